@@ -61,6 +61,7 @@ extern UINTN             BootMemMapKey;
 void BootInitialize(EFI_HANDLE        ImageHandle,
                     EFI_SYSTEM_TABLE *SystemTable);
 void BootPrintSplashMsg(void);
+void BootGetAcpi(void);
 void BootGetMemMap(void);
 void BootExitUEFI(void);
 
@@ -0,0 +1,117 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   boot/src/acpi.c
+ * @brief  Bootloader ACPI table lookup code.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* UEFI includes. */
+#include "efi.h"
+#include "efilib.h"
+
+/* Bootloader includes. */
+#include "boot/inc/interface.h"
+#include "boot/inc/internal.h"
+
+/* Other modules. */
+#include "kernel/inc/interface.h"
+
+/*****************************************************************************
+ *                               DEFINES
+ ****************************************************************************/
+
+/* RSDP: XSDT address (ACPI 2.0+). */
+#define RSDP_XSDT_OFFSET        24
+
+/* System description table header: length, then the XSDT entries. */
+#define SDT_LENGTH_OFFSET       4
+#define SDT_HEADER_SIZE         36
+
+/* FADT: ARM boot architecture flags (ACPI 5.1+). */
+#define FADT_ARM_BOOT_OFFSET    129
+#define FADT_ARM_BOOT_PSCI      0x0001
+#define FADT_ARM_BOOT_HVC       0x0002
+
+/*****************************************************************************
+ *                             BootGetAcpi()
+ ****************************************************************************/
+
+void BootGetAcpi(void)
+{
+  /* Local variables. */
+  EFI_STATUS result    = EFI_SUCCESS;
+  UINT8     *rsdp      = EFI_NULL;
+  UINT8     *xsdt      = EFI_NULL;
+  UINT8     *table     = EFI_NULL;
+  UINT32     xsdtSize  = 0;
+  UINT32     tableSize = 0;
+  UINT16     armBoot   = 0;
+  UINT32     i         = 0;
+
+  /* No ACPI 2.0 tables: leave the conduit to the kernel. */
+  result = LibGetSystemConfigurationTable(&Acpi20TableGuid, (VOID **) &rsdp);
+  if (result != EFI_SUCCESS || rsdp == EFI_NULL)
+  {
+    Print(L"   PSCI CONDUIT: unknown (no ACPI)\n");
+    return;
+  }
+
+  /* Table fields are not aligned, copy them out. */
+  CopyMem(&xsdt, rsdp + RSDP_XSDT_OFFSET, sizeof(xsdt));
+  CopyMem(&xsdtSize, xsdt + SDT_LENGTH_OFFSET, sizeof(xsdtSize));
+
+  /* Look for the FADT ("FACP") among the XSDT entries. */
+  for (i = SDT_HEADER_SIZE; i + sizeof(table) <= xsdtSize; i += sizeof(table))
+  {
+    /* Next table. */
+    CopyMem(&table, xsdt + i, sizeof(table));
+    if (CompareMem(table, "FACP", 4) != 0)
+    {
+      continue;
+    }
+
+    /* Too old to carry the ARM boot flags? */
+    CopyMem(&tableSize, table + SDT_LENGTH_OFFSET, sizeof(tableSize));
+    if (tableSize < FADT_ARM_BOOT_OFFSET + sizeof(armBoot))
+    {
+      break;
+    }
+
+    /* PSCI through HVC, SMC or not at all. */
+    CopyMem(&armBoot, table + FADT_ARM_BOOT_OFFSET, sizeof(armBoot));
+    PortPsciConduit = !(armBoot & FADT_ARM_BOOT_PSCI) ? PORT_CONDUIT_NONE :
+                      (armBoot & FADT_ARM_BOOT_HVC)   ? PORT_CONDUIT_HVC  :
+                                                        PORT_CONDUIT_SMC;
+    break;
+  }
+
+  /* Print the conduit. */
+  Print(L"   PSCI CONDUIT: %s\n",
+        PortPsciConduit == PORT_CONDUIT_HVC  ? L"HVC"  :
+        PortPsciConduit == PORT_CONDUIT_SMC  ? L"SMC"  :
+        PortPsciConduit == PORT_CONDUIT_NONE ? L"none" : L"unknown");
+}
@@ -64,6 +64,9 @@ void BootInitialize(EFI_HANDLE        ImageHandle,
   /* Print intro message. */
   BootPrintSplashMsg();
 
+  /* Find the PSCI conduit in the ACPI tables. */
+  BootGetAcpi();
+
   /* Get memory map. */
   BootGetMemMap();
 
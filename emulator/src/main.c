@@ -67,6 +67,7 @@ char qemu_cmd[1024] = "qemu\\qemu-system-aarch64.exe "
                       "-M virt "
                       "-cpu cortex-a57 "
                       "-m 1G "
+                      "-smp 4 "
                       "-display none "
                       "-serial stdio "
                       "-bios firmware\\uefi_code.fd "
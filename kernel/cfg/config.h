@@ -51,9 +51,78 @@
 /* Thread/process name maximum size. */
 #define KERNEL_CONFIG_NAME_MAX_SIZE       32
 
+/* Threads switched out fewer switches ago are not migrated (cache-hot). */
+#define KERNEL_CONFIG_CACHE_HOT_SWITCHES  4
+
+/* EDF admission limit: total deadline density of a CPU (percent). */
+#define KERNEL_CONFIG_EDF_MAX_UTIL_PCT    90
+
+/* Periodic tick frequency (stopped on idle CPUs). */
+#define KERNEL_CONFIG_TICK_HZ             100
+
+/* Ticks between two load balancing passes of a busy CPU. */
+#define KERNEL_CONFIG_BALANCE_TICKS       4
+
+/* Round-robin time slice of each priority band (microseconds, 0 = run
+ * until a higher priority preempts). The priorities are split into four
+ * equal bands, lowest first: background work gets long slices, latency
+ * sensitive work short ones. */
+#define KERNEL_CONFIG_SLICE_BAND0_US      20000
+#define KERNEL_CONFIG_SLICE_BAND1_US      10000
+#define KERNEL_CONFIG_SLICE_BAND2_US      5000
+#define KERNEL_CONFIG_SLICE_BAND3_US      2000
+
+/* Longest idle sleep before looking for work to steal (microseconds). */
+#define KERNEL_CONFIG_IDLE_POLL_US        10000
+
+/* Idle exit latency limit of every CPU (microseconds, 0 = WFI only). */
+#define KERNEL_CONFIG_IDLE_LATENCY_US     1000
+
+/* CPUs kept in shallow idle states for real-time work (mask), and their
+ * exit latency limit (microseconds). */
+#define KERNEL_CONFIG_IDLE_RT_CPUS        0x0
+#define KERNEL_CONFIG_IDLE_RT_LATENCY_US  10
+
+/* Timing wheel slots (one tick each) for timeouts far in the future. */
+#define KERNEL_CONFIG_TIMER_WHEEL_SLOTS   256
+
+/* Default timer slack, lets nearby timers expire in one interrupt (us). */
+#define KERNEL_CONFIG_TIMER_SLACK_US      50
+
+/* Futex hash table size (log2 of the bucket count). */
+#define KERNEL_CONFIG_FUTEX_HASH_BITS     8
+
+/* Priority of the per-CPU fiber executor threads. */
+#define KERNEL_CONFIG_FIBER_PRIORITY      8
+
+/* Fiber steps run back to back before the executor yields. */
+#define KERNEL_CONFIG_FIBER_BATCH         32
+
+/* Priority of the per-CPU deferred work threads (non-urgent work). */
+#define KERNEL_CONFIG_WORK_PRIORITY       2
+
+/* Work items run back to back before the worker yields. */
+#define KERNEL_CONFIG_WORK_BATCH          64
+
+/* Timer slack of delayed work (microseconds). */
+#define KERNEL_CONFIG_WORK_SLACK_US       1000
+
 /* Stack default size. */
 #define KERNEL_CONFIG_DEFAULT_STACK_SIZE  0x2000
 
+/* Mapped stacks kept by each CPU for reuse by new threads. */
+#define KERNEL_CONFIG_STACK_CACHE_SIZE    16
+
+/* Scheduler latency/run time/queue length histograms (0 = off, 1 = on). */
+#define KERNEL_CONFIG_SCHED_STATS         1
+
+/* Run the benchmarks before starting the scheduler (0 = off, 1 = on). */
+#define KERNEL_CONFIG_BENCHMARK           0
+
+/* User address space window (lower half, first 4MB left unmapped). */
+#define KERNEL_CONFIG_USER_START          0x0000000000400000UL
+#define KERNEL_CONFIG_USER_END            0x0001000000000000UL
+
 /*****************************************************************************
  *                            END OF HEADER
  ****************************************************************************/
@@ -50,6 +50,8 @@
 #define KERNEL_SUCCESS        (0)
 #define KERNEL_ERR_RESOURCE   (-1)
 #define KERNEL_ERR_PARAMETER  (-2)
+#define KERNEL_ERR_TIMEOUT    (-3)
+#define KERNEL_ERR_AGAIN      (-4)
 
 /*****************************************************************************
  *                             EXTERNS
@@ -67,6 +69,17 @@ extern uint64_t KernelMemoryRamEnd;
 void     KernelCoreInitialize   (void);
 void     KernelCoreStart        (void);
 
+/* Futex API (deadline in counter ticks, 0 = none). */
+error_t  KernelFutexWait        (uint32_t *futexAddr,
+                                 uint32_t  expected,
+                                 uint64_t  deadline);
+uint64_t KernelFutexWake        (uint32_t *futexAddr,
+                                 uint64_t  wakeCount);
+uint64_t KernelFutexRequeue     (uint32_t *futexAddr,
+                                 uint64_t  wakeCount,
+                                 uint32_t *targetAddr,
+                                 uint64_t  requeueCount);
+
 /* Print API. */
 void     KernelPrintInitialize  (void);
 void     KernelPrintChr         (char      chr);
@@ -76,16 +89,28 @@ void     KernelPrintHex         (uint64_t  hex);
 void     KernelPrintFmt         (char     *fmt, ...);
 
 /* Thread API. */
-void     KernelThreadCreate     (void);
+error_t  KernelThreadCreate     (void    (*threadEntry)(void *arg),
+                                 void     *threadArg,
+                                 uint64_t  threadPriority,
+                                 uint64_t *threadId);
 void     KernelThreadYield      (void);
 void     KernelThreadBlock      (void);
-void     KernelThreadUnblock    (void);
+void     KernelThreadUnblock    (uint64_t  threadId);
+void     KernelThreadSleep      (uint64_t  microseconds);
 void     KernelThreadTerminate  (void);
-void     KernelThreadJoin       (void);
-
-/* Power API. */
+void     KernelThreadJoin       (uint64_t  threadId);
+error_t  KernelThreadAffinity   (uint64_t  threadId,
+                                 uint64_t  cpuMask);
+error_t  KernelThreadPriority   (uint64_t  threadId,
+                                 uint64_t  priority);
+void     KernelThreadPreemptDisable (void);
+void     KernelThreadPreemptEnable  (void);
+
+/* Power API (idle exit latency limit of a set of CPUs). */
 void     KernelPowerInitialize  (void);
 void     KernelPowerOff         (void);
+error_t  KernelPowerLatency     (uint64_t  cpuMask,
+                                 uint64_t  latencyUs);
 
 /*****************************************************************************
  *                            END OF HEADER
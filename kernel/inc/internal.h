@@ -39,60 +39,484 @@
 /* Kernel interface header. */
 #include "kernel/inc/interface.h"
 
+/*****************************************************************************
+ *                              DEFINES
+ ****************************************************************************/
+
+/* Region permissions. */
+#define KERNEL_REGION_READ        (1UL<<0)
+#define KERNEL_REGION_WRITE       (1UL<<1)
+#define KERNEL_REGION_EXEC        (1UL<<2)
+
+/* Region flags. */
+#define KERNEL_REGION_SHARED      (1UL<<8)
+
+/* Region backing. */
+#define KERNEL_REGION_ANONYMOUS   (0)
+#define KERNEL_REGION_PHYSICAL    (1)
+
+/* Affinity mask allowing every CPU (one bit per CPU, at most 64). */
+#define KERNEL_CPU_MASK_ALL       (~0UL >> (64 - KERNEL_CONFIG_MAX_CPU_COUNT))
+
+/* Fiber step results (what the executor does with the fiber next). */
+#define KERNEL_FIBER_DONE         (0UL)
+#define KERNEL_FIBER_WAIT         (1UL)
+#define KERNEL_FIBER_YIELD        (2UL)
+
+/* Fiber body helpers: a fiber function is a switch on its resume point,
+ * so locals do not survive a wait (keep state in the enclosing object).
+ * One wait or yield per source line. */
+#define KERNEL_FIBER_BEGIN(F)     switch ((F)->fiberResume) { case 0:
+#define KERNEL_FIBER_AWAIT(F, E)  do { (F)->fiberResume = __LINE__;        \
+                                       if (KernelFiberEventWait((E), (F))) \
+                                       {                                   \
+                                         return KERNEL_FIBER_WAIT;         \
+                                       }                                   \
+                                       case __LINE__:;                     \
+                                  } while (0)
+#define KERNEL_FIBER_YIELD_NOW(F) do { (F)->fiberResume = __LINE__;        \
+                                       return KERNEL_FIBER_YIELD;          \
+                                       case __LINE__:;                     \
+                                  } while (0)
+#define KERNEL_FIBER_END(F)       } (F)->fiberResume = 0;                  \
+                                  return KERNEL_FIBER_DONE
+
+/* Histogram buckets (log2, the last one is open-ended). */
+#define KERNEL_HISTOGRAM_BUCKETS  (40)
+
+/* Structure embedding list node FIELD of type TYPE at NODE. */
+#define KERNEL_LIST_ENTRY(NODE, TYPE, FIELD)                             \
+        ((TYPE *) ((uint8_t *) (NODE) - __builtin_offsetof(TYPE, FIELD)))
+
 /*****************************************************************************
  *                              TYPEDEFS
  ****************************************************************************/
 
-/* Structure to hold process information. */
+/* Intrusive doubly-linked list: circular around a head that is never an
+ * entry, a node on no list points to itself (O(1) removal anywhere). */
+typedef struct list
+{
+  struct list        *listNext;
+  struct list        *listPrev;
+} list_t;
+
+/* Log2 histogram (bucket N counts values in [2^(N-1), 2^N)). */
+typedef struct histogram
+{
+  uint64_t            histCount;
+  uint64_t            histSum;
+  uint64_t            histMax;
+  uint64_t            histBuckets[KERNEL_HISTOGRAM_BUCKETS];
+} histogram_t;
+
+/* Deferred work item (not packed: its state is accessed atomically). */
+typedef struct work
+{
+  uint64_t            workState;
+  uint64_t            workCpu;
+  void              (*workCallback)(struct work *work);
+  void               *workArg;
+  struct work        *nextWork;
+} work_t;
+
+/* Deferred reclamation node, embedded in the object it frees. */
+typedef struct rcu
+{
+  uint64_t            rcuEpoch;
+  void              (*rcuCallback)(void *rcuArg);
+  void               *rcuArg;
+  struct rcu         *nextRcu;
+} rcu_t;
+
+/* Ticket spinlock (not packed: both words are accessed atomically). */
+typedef struct spinlock
+{
+  uint32_t            lockNext;
+  uint32_t            lockOwner;
+} spinlock_t;
+
+/* Structure to hold a virtual memory region (AVL tree node). */
+typedef struct region
+{
+  uint64_t             regionStart;
+  uint64_t             regionEnd;
+  uint64_t             regionFlags;
+  uint64_t             regionBacking;
+  uint64_t             regionOffset;
+  uint64_t             regionHeight;
+  uint64_t             regionLowest;
+  uint64_t             regionHighest;
+  uint64_t             regionMaxGap;
+  struct region       *leftRegion;
+  struct region       *rightRegion;
+  struct region       *nextFreeRegion;
+} __attribute__((packed)) region_t;
+
+/* Structure to hold process information (not packed: isUsed is accessed
+ * atomically by lock-free lookups). */
 typedef struct process
 {
   uint64_t             isUsed;
   uint8_t              processName[KERNEL_CONFIG_NAME_MAX_SIZE];
   uint64_t             processId;
+  region_t            *processRegionRoot;
+  uint64_t             processRegionCount;
+  void                *processTranslation;
+  spinlock_t           processMapLock;
+  uint64_t             processAffinity;
+  rcu_t                processRcu;
+  work_t               processWork;
   struct process      *nextFreeProcess;
-} __attribute__((packed)) process_t;
+} process_t;
 
-/* Structure to hold thread information. */
+/* Structure to hold thread information (not packed: isUsed, the wake state
+ * and the wake list link are accessed atomically). */
 typedef struct thread
 {
   uint64_t            isUsed;
   uint8_t             threadName[KERNEL_CONFIG_NAME_MAX_SIZE];
   uint64_t            threadId;
   uint64_t            threadCpu;
+  uint64_t            threadAffinity;
   uint64_t            threadPriority;
-  struct thread      *nextReadyThread;
+  uint64_t            threadBase;
+  process_t          *threadProcess;
+  uint64_t            threadLastRun;
+  uint64_t            threadState;
+  uint64_t            threadRuntime;
+  uint64_t            threadPeriod;
+  uint64_t            threadRelative;
+  uint64_t            threadDeadline;
+  uint64_t            threadBudget;
+  uint64_t            threadRelease;
+  uint64_t            threadStarted;
+  uint64_t            threadStack;
+  uint64_t            threadExited;
+  uint64_t            threadJoiner;
+  uint64_t            threadReadyAt;
+  uint64_t            threadRunStart;
+  uint64_t            threadWaitTotal;
+  uint64_t            threadWaitMax;
+  uint64_t            threadRunTotal;
+  uint64_t            threadSwitchVol;
+  uint64_t            threadSwitchInv;
+  void              (*threadEntry)(void *arg);
+  void               *threadArg;
+  struct mutex       *threadWaitingOn;
+  struct mutex       *threadMutexes;
+  list_t              threadWaitLink;
+  rcu_t               threadRcu;
+  struct thread      *nextWakeThread;
+  list_t              threadReadyLink;
   struct thread      *nextFreeThread;
-} __attribute__((packed)) thread_t;
+} thread_t;
+
+/* MCS queue node, one per waiting CPU (spins on its own cache line). */
+typedef struct mcs_node
+{
+  struct mcs_node    *nextNode;
+  uint64_t            isLocked;
+} __attribute__((aligned(64))) mcs_node_t;
+
+/* MCS queued spinlock (tail of the waiter queue, NULL = free). */
+typedef struct mcslock
+{
+  mcs_node_t         *lockTail;
+} mcslock_t;
+
+/* Stackless fiber: a resume point instead of a stack (32 bytes). */
+typedef struct fiber
+{
+  uint32_t            fiberResume;
+  uint32_t            fiberCpu;
+  uint64_t          (*fiberEntry)(struct fiber *fiber);
+  void               *fiberArg;
+  struct fiber       *nextFiber;
+} fiber_t;
+
+/* Event fibers wait for (counts signals nobody waited for yet). */
+typedef struct fiber_event
+{
+  spinlock_t          eventLock;
+  uint64_t            eventCount;
+  fiber_t            *eventHead;
+  fiber_t            *eventTail;
+} fiber_event_t;
+
+/* Structure to hold a mutex (not packed: its owner is accessed atomically).
+ * mutexOwner is the owner thread ID + 1 (0 = free), plus a waiters bit. */
+typedef struct mutex
+{
+  uint64_t            mutexOwner;
+  list_t              mutexWaiters;
+  struct mutex       *nextHeldMutex;
+} mutex_t;
+
+/* Structure to hold a timer (not packed: its state is accessed atomically). */
+typedef struct timer
+{
+  uint64_t            timerDeadline;
+  uint64_t            timerSlack;
+  uint64_t            timerCpu;
+  uint64_t            timerState;
+  void              (*timerCallback)(struct timer *timer);
+  void               *timerArg;
+  struct timer       *nextTimer;
+  struct timer       *prevTimer;
+  struct timer       *nextExpired;
+} timer_t;
+
+/* Work item queued once a timer expires (see KernelWorkDelaySetup). */
+typedef struct work_delayed
+{
+  work_t              delayedWork;
+  timer_t             delayedTimer;
+} work_delayed_t;
+
+/*****************************************************************************
+ *                             EXTERNS
+ ****************************************************************************/
+
+/* Fiber steps run by each CPU. */
+extern uint64_t KernelFiberSteps[KERNEL_CONFIG_MAX_CPU_COUNT];
+
+/* Shared zero page statistics (read faults served, first writes). */
+extern uint64_t KernelMemoryZeroPageHits;
+extern uint64_t KernelMemoryZeroPageFills;
+
+/* Idle states entered by each CPU, and counter ticks spent in them. */
+extern uint64_t KernelPowerEntries[KERNEL_CONFIG_MAX_CPU_COUNT]
+                                  [PORT_IDLE_STATE_COUNT];
+extern uint64_t KernelPowerTime[KERNEL_CONFIG_MAX_CPU_COUNT]
+                               [PORT_IDLE_STATE_COUNT];
+
+/* Objects reclaimed by each CPU after their grace period. */
+extern uint64_t KernelRcuReclaimed[KERNEL_CONFIG_MAX_CPU_COUNT];
+
+/* Threads pulled into each CPU by the load balancer. */
+extern uint64_t KernelThreadMigrations[KERNEL_CONFIG_MAX_CPU_COUNT];
+
+/* Idle statistics (sleeps, counter ticks asleep, wake-up reasons). */
+extern uint64_t KernelThreadIdleEntries[KERNEL_CONFIG_MAX_CPU_COUNT];
+extern uint64_t KernelThreadIdleTime[KERNEL_CONFIG_MAX_CPU_COUNT];
+extern uint64_t KernelThreadIdleWakeTimer[KERNEL_CONFIG_MAX_CPU_COUNT];
+extern uint64_t KernelThreadIdleWakeOther[KERNEL_CONFIG_MAX_CPU_COUNT];
+
+/* EDF statistics (deadline misses, exhausted budgets). */
+extern uint64_t KernelThreadEdfMisses[KERNEL_CONFIG_MAX_CPU_COUNT];
+extern uint64_t KernelThreadEdfOverruns[KERNEL_CONFIG_MAX_CPU_COUNT];
+
+/* Cross-CPU wake-ups (pushed to a remote wake list, IPIs sent/taken). */
+extern uint64_t KernelThreadRemoteWakes[KERNEL_CONFIG_MAX_CPU_COUNT];
+extern uint64_t KernelThreadIpiSent[KERNEL_CONFIG_MAX_CPU_COUNT];
+extern uint64_t KernelThreadIpiReceived[KERNEL_CONFIG_MAX_CPU_COUNT];
+
+/* Preemptions (time slice expired, higher priority woken up). */
+extern uint64_t KernelThreadPreemptSlice[KERNEL_CONFIG_MAX_CPU_COUNT];
+extern uint64_t KernelThreadPreemptWake[KERNEL_CONFIG_MAX_CPU_COUNT];
+
+/* Timer interrupts taken and timers expired by each CPU. */
+extern uint64_t KernelTimerInterrupts[KERNEL_CONFIG_MAX_CPU_COUNT];
+extern uint64_t KernelTimerExpired[KERNEL_CONFIG_MAX_CPU_COUNT];
+
+/* Work items run and batches taken by each CPU. */
+extern uint64_t KernelWorkExecuted[KERNEL_CONFIG_MAX_CPU_COUNT];
+extern uint64_t KernelWorkBatches[KERNEL_CONFIG_MAX_CPU_COUNT];
 
 /*****************************************************************************
  *                          FUNCTION PROTOTYPES
  ****************************************************************************/
 
+/* Benchmark module. */
+void        KernelBenchmarkRun         (void);
+void        KernelBenchmarkLocks       (uint64_t cpuCount);
+void        KernelBenchmarkLockWorker  (uint64_t cpuId);
+void        KernelBenchmarkWakeup      (uint64_t cpuCount);
+
+/* Fiber module. */
+void        KernelFiberInitialize      (uint64_t cpuId);
+error_t     KernelFiberStart           (fiber_t  *fiber,
+                                        uint64_t (*fiberEntry)(fiber_t *),
+                                        void     *fiberArg);
+void        KernelFiberEventInitialize (fiber_event_t *event);
+uint64_t    KernelFiberEventWait       (fiber_event_t *event,
+                                        fiber_t       *fiber);
+void        KernelFiberEventSignal     (fiber_event_t *event);
+
+/* Futex module. */
+void        KernelFutexInitialize      (void);
+
+/* Histogram module. */
+void        KernelHistogramReset       (histogram_t *hist);
+void        KernelHistogramAdd         (histogram_t *hist, uint64_t value);
+void        KernelHistogramPrint       (char        *histName,
+                                        histogram_t *hist,
+                                        uint64_t     unitMul,
+                                        uint64_t     unitDiv);
+
+/* List module. */
+void        KernelListInitialize       (list_t *list);
+uint64_t    KernelListEmpty            (list_t *list);
+void        KernelListInsert           (list_t *prevNode, list_t *node);
+void        KernelListAppend           (list_t *list, list_t *node);
+void        KernelListRemove           (list_t *node);
+
 /* Memory module. */
 void        KernelMemoryInitialize     (void);
 void       *KernelMemoryPageAllocate   (void);
 void        KernelMemoryPageDeallocate (void *pageBaseAddr);
+void        KernelMemoryPageReference  (void *pageBaseAddr);
+void        KernelMemoryPageRelease    (void *pageBaseAddr);
+uint64_t    KernelMemoryPageRefCount   (void *pageBaseAddr);
+void       *KernelMemoryPageZeroed     (void);
+void        KernelMemoryPageClear      (void *pageBaseAddr);
+void        KernelMemoryPageCopy       (void *dstPageAddr, void *srcPageAddr);
+
+/* Mutex module. */
+void        KernelMutexInitialize      (mutex_t *mutex);
+void        KernelMutexLock            (mutex_t *mutex);
+void        KernelMutexUnlock          (mutex_t *mutex);
+void        KernelMutexUpdatePriority  (thread_t *thread);
+
+/* Power module. */
+void        KernelPowerIdle            (uint64_t powerCpu, uint64_t wakeAt);
 
 /* Process module. */
 void        KernelProcessInitialize    (void);
 process_t  *KernelProcessAllocate      (void);
 void        KernelProcessDeallocate    (process_t *process);
 process_t  *KernelProcessGet           (uint64_t processId);
+process_t  *KernelProcessDuplicate     (process_t *parent);
+error_t     KernelProcessSetAffinity   (process_t *process,
+                                        uint64_t   cpuMask);
+error_t     KernelProcessFault         (void     *faultAddr,
+                                        uint64_t  faultAccess);
+
+/* RCU module. */
+void        KernelRcuInitialize        (void);
+void        KernelRcuRetire            (rcu_t  *rcu,
+                                        void  (*rcuCallback)(void *),
+                                        void   *rcuArg);
+void        KernelRcuQuiescent         (void);
+void        KernelRcuIdleEnter         (void);
+void        KernelRcuIdleExit          (void);
+
+/* Region module. */
+void        KernelRegionInitialize     (void);
+region_t   *KernelRegionFind           (process_t *process,
+                                        uint64_t   regionAddr);
+region_t   *KernelRegionFindNext       (process_t *process,
+                                        uint64_t   regionAddr);
+error_t     KernelRegionInsert         (process_t *process,
+                                        uint64_t   regionStart,
+                                        uint64_t   regionSize,
+                                        uint64_t   regionFlags,
+                                        uint64_t   regionBacking,
+                                        uint64_t   regionOffset);
+error_t     KernelRegionRemove         (process_t *process,
+                                        uint64_t   regionStart,
+                                        uint64_t   regionSize);
+error_t     KernelRegionSplit          (process_t *process,
+                                        uint64_t   regionAddr);
+error_t     KernelRegionFindFree       (process_t *process,
+                                        uint64_t   regionSize,
+                                        uint64_t  *regionStart);
+error_t     KernelRegionDuplicate      (process_t *dstProcess,
+                                        process_t *srcProcess);
+void        KernelRegionDestroy        (process_t *process);
+
+/* Spinlock module. */
+void        KernelSpinInitialize       (spinlock_t *lock);
+void        KernelSpinLock             (spinlock_t *lock);
+void        KernelSpinUnlock           (spinlock_t *lock);
+uint64_t    KernelSpinLockIrq          (spinlock_t *lock);
+void        KernelSpinUnlockIrq        (spinlock_t *lock, uint64_t irqState);
+void        KernelMcsInitialize        (mcslock_t  *lock);
+void        KernelMcsLock              (mcslock_t  *lock, mcs_node_t *node);
+void        KernelMcsUnlock            (mcslock_t  *lock, mcs_node_t *node);
+uint64_t    KernelMcsLockIrq           (mcslock_t  *lock, mcs_node_t *node);
+void        KernelMcsUnlockIrq         (mcslock_t  *lock,
+                                        mcs_node_t *node,
+                                        uint64_t    irqState);
 
 /* Thread module. */
 void        KernelThreadInitialize     (void);
+void        KernelThreadLock           (void);
+void        KernelThreadUnlock         (void);
 thread_t   *KernelThreadAllocate       (uint64_t threadCpu,
                                         uint64_t threadPriority);
 void        KernelThreadDeallocate     (thread_t *thread);
 thread_t   *KernelThreadGet            (uint64_t threadId);
+thread_t   *KernelThreadCurrent        (void);
+void        KernelThreadAdopt          (uint64_t threadCpu);
+void        KernelThreadPrepare        (thread_t  *thread,
+                                        void     (*threadEntry)(void *arg),
+                                        void      *threadArg,
+                                        void      *stackTop);
 void        KernelThreadAdmit          (thread_t *thread);
+uint64_t    KernelThreadDequeue        (thread_t *thread);
 thread_t   *KernelThreadDispatch       (uint64_t threadCpu,
                                         uint64_t threadPriority);
+thread_t   *KernelThreadDispatchNext   (uint64_t threadCpu);
+void        KernelThreadSetPriority    (thread_t *thread,
+                                        uint64_t  threadPriority);
+void        KernelThreadAttach         (thread_t  *thread,
+                                        process_t *process);
+void        KernelThreadBalance        (uint64_t threadCpu);
 void        KernelThreadRun            (uint64_t threadId);
 uint64_t    KernelThreadPause          (void);
+error_t     KernelThreadBlockUntil     (uint64_t deadline);
+void        KernelThreadBlockLocked    (void);
+void        KernelThreadWake           (thread_t *thread);
+void        KernelThreadWakeInterrupt  (void);
+void        KernelThreadInterruptEnter (void);
+void        KernelThreadInterruptExit  (void);
+void        KernelThreadPreemptCheck   (void);
+void        KernelThreadSliceEnd       (void);
+uint64_t    KernelThreadReschedSwap    (uint64_t needResched);
+void        KernelThreadTick           (void);
+error_t     KernelThreadSetDeadline    (thread_t *thread,
+                                        uint64_t  runtimeUs,
+                                        uint64_t  deadlineUs,
+                                        uint64_t  periodUs);
+void        KernelThreadEdfWait        (void);
+void        KernelThreadStatsDump      (void);
 void        KernelThreadIdle           (void *arg);
 void        KernelThreadScheduler      ();
 
+/* Timer module. */
+void        KernelTimerInitialize      (void);
+void        KernelTimerInterrupt       (void);
+uint64_t    KernelTimerNow             (void);
+uint64_t    KernelTimerTicks           (uint64_t microseconds);
+void        KernelTimerSetup           (timer_t  *timer,
+                                        void    (*timerCallback)(timer_t *),
+                                        void     *timerArg);
+void        KernelTimerStart           (timer_t  *timer,
+                                        uint64_t  deadline,
+                                        uint64_t  slack);
+uint64_t    KernelTimerCancel          (timer_t  *timer);
+void        KernelTimerWait            (timer_t  *timer);
+void        KernelTimerRun             (void);
+void        KernelTimerSlice           (uint64_t deadline);
+uint64_t    KernelTimerIdleEnter       (uint64_t wakeAt);
+void        KernelTimerIdleExit        (void);
+
+/* Work module. */
+void        KernelWorkInitialize       (uint64_t cpuId);
+void        KernelWorkSetup            (work_t  *work,
+                                        void   (*workCallback)(work_t *),
+                                        void    *workArg);
+uint64_t    KernelWorkQueue            (work_t  *work);
+uint64_t    KernelWorkQueueOn          (uint64_t workCpu, work_t *work);
+void        KernelWorkDelaySetup       (work_delayed_t *delayed,
+                                        void   (*workCallback)(work_t *),
+                                        void    *workArg);
+void        KernelWorkDelay            (work_delayed_t *delayed,
+                                        uint64_t        microseconds);
+uint64_t    KernelWorkCancelDelay      (work_delayed_t *delayed);
+void        KernelWorkFlush            (uint64_t workCpu);
+
 /*****************************************************************************
  *                            END OF HEADER
  ****************************************************************************/
@@ -0,0 +1,660 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   kernel/src/benchmark.c
+ * @brief  ARTOS kernel benchmark module.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Kernel includes. */
+#include "kernel/inc/interface.h"
+#include "kernel/inc/internal.h"
+
+/*****************************************************************************
+ *                               MACROS
+ ****************************************************************************/
+
+/* Number of measured round trips (two switches each). */
+#define SWITCH_ROUNDS    (10000U)
+
+/* Round trips to warm up caches and FP save areas. */
+#define SWITCH_WARMUP    (100U)
+
+/* Number of measured pick-next operations per configuration. */
+#define DISPATCH_ROUNDS  (10000U)
+
+/* Number of measured priority changes per configuration, and the most
+ * threads parked in each of the two priorities involved. */
+#define REQUEUE_ROUNDS   (10000U)
+#define REQUEUE_MAX      (4096U)
+
+/* Number of measured create-run-exit cycles. */
+#define CREATE_ROUNDS    (1000U)
+
+/* Lock acquisitions per CPU and per configuration. */
+#define LOCK_ROUNDS      (10000U)
+
+/* Lock kinds measured. */
+#define LOCK_TICKET      (0)
+#define LOCK_MCS         (1)
+
+/* Phase telling the secondary CPUs to leave the benchmark. */
+#define LOCK_PHASE_EXIT  (~0UL)
+
+/* Number of measured cross-CPU wake-ups. */
+#define WAKE_ROUNDS      (100U)
+
+/* Time left to the woken CPU to block and go to sleep (microseconds). */
+#define WAKE_SETTLE_US   (200U)
+
+/*****************************************************************************
+ *                           STATIC VARIABLES
+ ****************************************************************************/
+
+/* Ping-pong threads. */
+static thread_t *KernelBenchmarkPing  = NULL;
+static thread_t *KernelBenchmarkPong  = NULL;
+
+/* Whether both sides touch FP/SIMD registers in every round. */
+static uint64_t  KernelBenchmarkUseFp = 0;
+
+/* Lock benchmark: phase (bumped per run), CPUs taking part, lock kind,
+ * secondaries done and the counter protected by the lock. */
+static uint64_t   KernelBenchmarkLockPhase   = 0;
+static uint64_t   KernelBenchmarkLockCpus    = 0;
+static uint64_t   KernelBenchmarkLockKind    = 0;
+static uint64_t   KernelBenchmarkLockDone    = 0;
+static uint64_t   KernelBenchmarkLockCounter = 0;
+
+/* Wake-up benchmark: thread blocked on CPU 1, it is waiting (1) or not,
+ * the last wake-up time, completed rounds, latency sum/max and stop. */
+static uint64_t   KernelBenchmarkWakeId      = 0;
+static uint64_t   KernelBenchmarkWakeReady   = 0;
+static uint64_t   KernelBenchmarkWakeStamp   = 0;
+static uint64_t   KernelBenchmarkWakeDone    = 0;
+static uint64_t   KernelBenchmarkWakeSum     = 0;
+static uint64_t   KernelBenchmarkWakeMax     = 0;
+static uint64_t   KernelBenchmarkWakeStop    = 0;
+
+/* Requeue benchmark: threads parked in the ready queues. */
+static thread_t  *KernelBenchmarkQueued[2 * REQUEUE_MAX];
+
+/* Locks under test. */
+static spinlock_t KernelBenchmarkTicket;
+static mcslock_t  KernelBenchmarkMcs;
+static mcs_node_t KernelBenchmarkMcsNodes[KERNEL_CONFIG_MAX_CPU_COUNT];
+
+/* Stack of the pong thread. */
+static uint8_t   KernelBenchmarkStack[KERNEL_CONFIG_DEFAULT_STACK_SIZE]
+                 __attribute__((aligned(16)));
+
+/*****************************************************************************
+ *                         KernelBenchmarkFpTouch()
+ ****************************************************************************/
+
+static void KernelBenchmarkFpTouch (void)
+{
+  /* Dirty the FP/SIMD register file (traps on first use in a slice). */
+  if (KernelBenchmarkUseFp)
+  {
+    __asm__ volatile("FMOV D0, XZR");
+  }
+}
+
+/*****************************************************************************
+ *                        KernelBenchmarkPongEntry()
+ ****************************************************************************/
+
+static void KernelBenchmarkPongEntry (void *arg)
+{
+  /* Unused. */
+  (void) arg;
+
+  /* Bounce straight back to the ping thread, forever. */
+  while (1)
+  {
+    KernelBenchmarkFpTouch();
+    KernelThreadRun(KernelBenchmarkPing->threadId);
+  }
+}
+
+/*****************************************************************************
+ *                        KernelBenchmarkPingPong()
+ ****************************************************************************/
+
+static uint64_t KernelBenchmarkPingPong (uint64_t useFp)
+{
+  /* Loop counter and timestamps. */
+  uint64_t curRound = 0;
+  uint64_t start    = 0;
+  uint64_t end      = 0;
+
+  /* Select the variant. */
+  KernelBenchmarkUseFp = useFp;
+
+  /* Warm up. */
+  for (curRound = 0; curRound < SWITCH_WARMUP; curRound++)
+  {
+    KernelBenchmarkFpTouch();
+    KernelThreadRun(KernelBenchmarkPong->threadId);
+  }
+
+  /* Measure. */
+  start = PortCpuCycles();
+  for (curRound = 0; curRound < SWITCH_ROUNDS; curRound++)
+  {
+    KernelBenchmarkFpTouch();
+    KernelThreadRun(KernelBenchmarkPong->threadId);
+  }
+  end = PortCpuCycles();
+
+  /* Cycles per switch. */
+  return (end - start) / (2 * SWITCH_ROUNDS);
+}
+
+/*****************************************************************************
+ *                        KernelBenchmarkSwitch()
+ ****************************************************************************/
+
+static void KernelBenchmarkSwitch (void)
+{
+  /* Results. */
+  uint64_t  integerCycles = 0;
+  uint64_t  fpCycles      = 0;
+
+  /* Simplifying variables. */
+  thread_t *ping          = KernelThreadCurrent();
+
+  /* The calling thread pings, a fresh thread on the same CPU pongs. */
+  KernelBenchmarkPing = ping;
+  KernelBenchmarkPong = KernelThreadAllocate(ping->threadCpu,
+                                             ping->threadPriority);
+  if (KernelBenchmarkPong == NULL)
+  {
+    KernelPrintFmt("BENCHMARK SWITCH: no thread available\n");
+    return;
+  }
+  KernelThreadPrepare(KernelBenchmarkPong,
+                      KernelBenchmarkPongEntry, NULL,
+                      KernelBenchmarkStack + sizeof(KernelBenchmarkStack));
+
+  /* Without, then with FP/SIMD state. */
+  integerCycles = KernelBenchmarkPingPong(0);
+  fpCycles      = KernelBenchmarkPingPong(1);
+
+  /* Report. */
+  KernelPrintFmt("BENCHMARK SWITCH: %d cycles (integer), %d cycles (FP)\n",
+                 integerCycles, fpCycles);
+
+  /* The pong thread is parked inside KernelThreadRun(), drop it. */
+  KernelThreadDeallocate(KernelBenchmarkPong);
+}
+
+/*****************************************************************************
+ *                        KernelBenchmarkDispatch()
+ ****************************************************************************/
+
+static void KernelBenchmarkDispatch (void)
+{
+  /* Number of populated priorities per configuration. */
+  static const uint64_t populated[] = {1, 2, 8, 32, 63};
+
+  /* Threads parked in the ready queues (priorities 1..63). */
+  thread_t *threads[KERNEL_CONFIG_MAX_PRIOIRTY];
+
+  /* Loop counters and timestamps. */
+  uint64_t  curConfig   = 0;
+  uint64_t  curPriority = 0;
+  uint64_t  curRound    = 0;
+  uint64_t  count       = 0;
+  uint64_t  start       = 0;
+  uint64_t  end         = 0;
+
+  /* Simplifying variables. */
+  uint64_t  threadCpu   = 0;
+  uint64_t  needResched = 0;
+  thread_t *thread      = NULL;
+
+  /* Measure every configuration. */
+  for (curConfig = 0; curConfig < sizeof(populated)/sizeof(uint64_t);
+       curConfig++)
+  {
+    /* Allocate one never-run thread for each of priorities 1..count. */
+    count = populated[curConfig];
+    for (curPriority = 1; curPriority <= count; curPriority++)
+    {
+      threads[curPriority] = KernelThreadAllocate(0, curPriority);
+      if (threads[curPriority] == NULL)
+      {
+        KernelPrintFmt("BENCHMARK DISPATCH: no thread available\n");
+        count = curPriority - 1;
+        break;
+      }
+    }
+
+    /* Park them on our CPU under the scheduler lock, as the scheduler
+     * runs these calls: nobody may pull and run unprepared threads (the
+     * lock cost itself is measured by the lock benchmark). */
+    KernelThreadLock();
+    threadCpu   = KernelThreadCurrent()->threadCpu;
+    needResched = KernelThreadReschedSwap(0);
+    for (curPriority = 1; curPriority <= count; curPriority++)
+    {
+      threads[curPriority]->threadCpu = threadCpu;
+      KernelThreadAdmit(threads[curPriority]);
+    }
+
+    /* Pick the highest-priority thread and requeue it. */
+    start = PortCpuCycles();
+    for (curRound = 0; curRound < DISPATCH_ROUNDS; curRound++)
+    {
+      thread = KernelThreadDispatchNext(threadCpu);
+      KernelThreadAdmit(thread);
+    }
+    end = PortCpuCycles();
+
+    /* Unpark them (other ready threads stay), and drop the preemptions
+     * they requested: none of them may ever run. */
+    for (curPriority = 1; curPriority <= count; curPriority++)
+    {
+      KernelThreadDequeue(threads[curPriority]);
+    }
+    KernelThreadReschedSwap(needResched);
+    KernelThreadUnlock();
+
+    /* Report. */
+    KernelPrintFmt("BENCHMARK DISPATCH: %d priorities, %d cycles\n",
+                   count, (end - start) / DISPATCH_ROUNDS);
+
+    /* Free the threads. */
+    for (curPriority = 1; curPriority <= count; curPriority++)
+    {
+      KernelThreadDeallocate(threads[curPriority]);
+    }
+  }
+}
+
+/*****************************************************************************
+ *                        KernelBenchmarkRequeue()
+ ****************************************************************************/
+
+static void KernelBenchmarkRequeue (void)
+{
+  /* Number of threads per priority for each configuration. */
+  static const uint64_t populated[] = {16, 256, REQUEUE_MAX};
+
+  /* Loop counters and timestamps. */
+  uint64_t  curConfig   = 0;
+  uint64_t  curThread   = 0;
+  uint64_t  curRound    = 0;
+  uint64_t  count       = 0;
+  uint64_t  start       = 0;
+  uint64_t  end         = 0;
+
+  /* Simplifying variables. */
+  uint64_t  threadCpu   = 0;
+  uint64_t  needResched = 0;
+  thread_t *thread      = NULL;
+
+  /* Measure every configuration. */
+  for (curConfig = 0; curConfig < sizeof(populated)/sizeof(uint64_t);
+       curConfig++)
+  {
+    /* Allocate never-run threads for priorities 1 and 2, interleaved. */
+    count = 2 * populated[curConfig];
+    for (curThread = 0; curThread < count; curThread++)
+    {
+      thread = KernelThreadAllocate(0, 1 + curThread % 2);
+      if (thread == NULL)
+      {
+        KernelPrintFmt("BENCHMARK REQUEUE: no thread available\n");
+        count = curThread;
+        break;
+      }
+      KernelBenchmarkQueued[curThread] = thread;
+    }
+
+    /* Park them on our CPU under the scheduler lock (see the dispatch
+     * benchmark). */
+    KernelThreadLock();
+    threadCpu   = KernelThreadCurrent()->threadCpu;
+    needResched = KernelThreadReschedSwap(0);
+    for (curThread = 0; curThread < count; curThread++)
+    {
+      KernelBenchmarkQueued[curThread]->threadCpu = threadCpu;
+      KernelThreadAdmit(KernelBenchmarkQueued[curThread]);
+    }
+
+    /* Move threads from anywhere in one queue to the tail of the other
+     * (a dequeue from the middle, then an admit). */
+    start = PortCpuCycles();
+    for (curRound = 0; curRound < REQUEUE_ROUNDS && count != 0; curRound++)
+    {
+      thread = KernelBenchmarkQueued[curRound % count];
+      KernelThreadSetPriority(thread, 3 - thread->threadPriority);
+    }
+    end = PortCpuCycles();
+
+    /* Unpark them and drop the preemptions they requested. */
+    for (curThread = 0; curThread < count; curThread++)
+    {
+      KernelThreadDequeue(KernelBenchmarkQueued[curThread]);
+    }
+    KernelThreadReschedSwap(needResched);
+    KernelThreadUnlock();
+
+    /* Report. */
+    KernelPrintFmt("BENCHMARK REQUEUE: %d threads per priority, %d cycles\n",
+                   count / 2, (end - start) / REQUEUE_ROUNDS);
+
+    /* Free the threads. */
+    for (curThread = 0; curThread < count; curThread++)
+    {
+      KernelThreadDeallocate(KernelBenchmarkQueued[curThread]);
+    }
+  }
+}
+
+/*****************************************************************************
+ *                       KernelBenchmarkCreateEntry()
+ ****************************************************************************/
+
+static void KernelBenchmarkCreateEntry (void *arg)
+{
+  /* Count the run, then exit by returning. */
+  (*((uint64_t *) arg))++;
+}
+
+/*****************************************************************************
+ *                         KernelBenchmarkCreate()
+ ****************************************************************************/
+
+static void KernelBenchmarkCreate (void)
+{
+  /* Loop counter, timestamps and completed runs. */
+  uint64_t curRound = 0;
+  uint64_t start    = 0;
+  uint64_t end      = 0;
+  uint64_t runs     = 0;
+
+  /* Warm up: maps the first stack, later rounds reuse it. */
+  if (KernelThreadCreate(KernelBenchmarkCreateEntry, &runs, 1, NULL) !=
+      KERNEL_SUCCESS)
+  {
+    KernelPrintFmt("BENCHMARK CREATE: no thread available\n");
+    return;
+  }
+  KernelThreadYield();
+
+  /* Create a higher-priority thread and let it run to its exit. */
+  start = PortCpuCycles();
+  for (curRound = 0; curRound < CREATE_ROUNDS; curRound++)
+  {
+    KernelThreadCreate(KernelBenchmarkCreateEntry, &runs, 1, NULL);
+    KernelThreadYield();
+  }
+  end = PortCpuCycles();
+
+  /* Report. */
+  KernelPrintFmt("BENCHMARK CREATE: %d cycles (create, run, exit), %d runs\n",
+                 (end - start) / CREATE_ROUNDS, runs);
+}
+
+/*****************************************************************************
+ *                       KernelBenchmarkLockRounds()
+ ****************************************************************************/
+
+static void KernelBenchmarkLockRounds (uint64_t cpuId)
+{
+  /* Loop counter. */
+  uint64_t curRound = 0;
+
+  /* Hammer the lock with a minimal critical section. */
+  for (curRound = 0; curRound < LOCK_ROUNDS; curRound++)
+  {
+    if (KernelBenchmarkLockKind == LOCK_TICKET)
+    {
+      KernelSpinLock(&KernelBenchmarkTicket);
+      KernelBenchmarkLockCounter++;
+      KernelSpinUnlock(&KernelBenchmarkTicket);
+    }
+    else
+    {
+      KernelMcsLock(&KernelBenchmarkMcs, &KernelBenchmarkMcsNodes[cpuId]);
+      KernelBenchmarkLockCounter++;
+      KernelMcsUnlock(&KernelBenchmarkMcs, &KernelBenchmarkMcsNodes[cpuId]);
+    }
+  }
+}
+
+/*****************************************************************************
+ *                       KernelBenchmarkWakeEntry()
+ ****************************************************************************/
+
+static void KernelBenchmarkWakeEntry (void *arg)
+{
+  /* Latency of this round (counter ticks). */
+  uint64_t latency = 0;
+
+  /* Unused. */
+  (void) arg;
+
+  /* Block, measure how long the wake-up took to get us running. */
+  while (1)
+  {
+    __atomic_store_n(&KernelBenchmarkWakeReady, 1, __ATOMIC_RELEASE);
+    KernelThreadBlock();
+    if (__atomic_load_n(&KernelBenchmarkWakeStop, __ATOMIC_ACQUIRE))
+    {
+      break;
+    }
+    latency = PortTimerNow() -
+              __atomic_load_n(&KernelBenchmarkWakeStamp, __ATOMIC_ACQUIRE);
+    KernelBenchmarkWakeSum += latency;
+    if (latency > KernelBenchmarkWakeMax)
+    {
+      KernelBenchmarkWakeMax = latency;
+    }
+    PortAtomicFetchAdd64(&KernelBenchmarkWakeDone, 1);
+  }
+}
+
+/*****************************************************************************
+ *                       KernelBenchmarkLockWorker()
+ ****************************************************************************/
+
+void KernelBenchmarkLockWorker (uint64_t cpuId)
+{
+  /* Last phase seen. */
+  uint64_t phase = 0;
+
+  /* Take part in every run that includes this CPU. */
+  while (1)
+  {
+    /* Wait for the boot CPU to start a run. */
+    while (__atomic_load_n(&KernelBenchmarkLockPhase, __ATOMIC_ACQUIRE) ==
+           phase)
+    {
+      PortCpuRelax();
+    }
+    phase = __atomic_load_n(&KernelBenchmarkLockPhase, __ATOMIC_ACQUIRE);
+
+    /* Benchmark over? CPU 1 hosts the thread of the wake-up benchmark. */
+    if (phase == LOCK_PHASE_EXIT)
+    {
+      if (cpuId == 1)
+      {
+        KernelThreadCreate(KernelBenchmarkWakeEntry, NULL, 1,
+                           &KernelBenchmarkWakeId);
+      }
+      break;
+    }
+
+    /* Contend, then report. */
+    if (cpuId < KernelBenchmarkLockCpus)
+    {
+      KernelBenchmarkLockRounds(cpuId);
+      PortAtomicFetchAdd64(&KernelBenchmarkLockDone, 1);
+    }
+  }
+}
+
+/*****************************************************************************
+ *                         KernelBenchmarkLocks()
+ ****************************************************************************/
+
+void KernelBenchmarkLocks (uint64_t cpuCount)
+{
+  /* Lock names for the report. */
+  static char *kindNames[] = {"ticket", "MCS"};
+
+  /* Loop counters and timestamps. */
+  uint64_t curKind = 0;
+  uint64_t curCpus = 0;
+  uint64_t start   = 0;
+  uint64_t end     = 0;
+
+  /* Fresh locks. */
+  KernelSpinInitialize(&KernelBenchmarkTicket);
+  KernelMcsInitialize(&KernelBenchmarkMcs);
+  KernelPrintFmt("BENCHMARK LOCK: %s atomics\n",
+                 PortAtomicHasLse() ? "LSE" : "LDXR/STXR");
+
+  /* 1, 2, 4, ... CPUs (the boot CPU takes part in every run). */
+  for (curKind = LOCK_TICKET; curKind <= LOCK_MCS; curKind++)
+  {
+    for (curCpus = 1; curCpus <= cpuCount; curCpus *= 2)
+    {
+      /* Start the run. */
+      KernelBenchmarkLockKind    = curKind;
+      KernelBenchmarkLockCpus    = curCpus;
+      KernelBenchmarkLockCounter = 0;
+      KernelBenchmarkLockDone    = 0;
+      start = PortCpuCycles();
+      PortAtomicFetchAdd64(&KernelBenchmarkLockPhase, 1);
+
+      /* Contend too, then wait for the others. */
+      KernelBenchmarkLockRounds(0);
+      while (__atomic_load_n(&KernelBenchmarkLockDone, __ATOMIC_ACQUIRE) <
+             curCpus - 1)
+      {
+        PortCpuRelax();
+      }
+      end = PortCpuCycles();
+
+      /* Report (a lost update would show as a short counter). */
+      KernelPrintFmt("BENCHMARK LOCK: %s, %d cpus, %d cycles, counter %d\n",
+                     kindNames[curKind], curCpus,
+                     (end - start) / (LOCK_ROUNDS * curCpus),
+                     KernelBenchmarkLockCounter);
+    }
+  }
+
+  /* Release the secondary CPUs. */
+  __atomic_store_n(&KernelBenchmarkLockPhase, LOCK_PHASE_EXIT,
+                   __ATOMIC_RELEASE);
+}
+
+/*****************************************************************************
+ *                         KernelBenchmarkWakeup()
+ ****************************************************************************/
+
+void KernelBenchmarkWakeup (uint64_t cpuCount)
+{
+  /* Loop counter and timestamps. */
+  uint64_t curRound    = 0;
+  uint64_t settleUntil = 0;
+
+  /* Counter ticks per second, nanoseconds are reported. */
+  uint64_t frequency   = PortTimerFrequency();
+
+  /* The woken thread lives on CPU 1. */
+  if (cpuCount < 2)
+  {
+    KernelPrintFmt("BENCHMARK WAKEUP: needs two CPUs\n");
+    return;
+  }
+
+  /* Wake it up from here while CPU 1 sleeps. */
+  for (curRound = 0; curRound < WAKE_ROUNDS; curRound++)
+  {
+    /* Wait until it is about to block, then until its CPU went idle. */
+    while (!__atomic_load_n(&KernelBenchmarkWakeReady, __ATOMIC_ACQUIRE))
+    {
+      PortCpuRelax();
+    }
+    KernelBenchmarkWakeReady = 0;
+    settleUntil = PortTimerNow() + frequency / 1000000 * WAKE_SETTLE_US;
+    while (PortTimerNow() < settleUntil)
+    {
+      PortCpuRelax();
+    }
+
+    /* Wake it up and wait for it to report. */
+    __atomic_store_n(&KernelBenchmarkWakeStamp, PortTimerNow(),
+                     __ATOMIC_RELEASE);
+    KernelThreadUnblock(KernelBenchmarkWakeId);
+    while (__atomic_load_n(&KernelBenchmarkWakeDone, __ATOMIC_ACQUIRE) <=
+           curRound)
+    {
+      PortCpuRelax();
+    }
+  }
+
+  /* Report. */
+  KernelPrintFmt("BENCHMARK WAKEUP: %d ns average, %d ns max (cross-CPU)\n",
+                 KernelBenchmarkWakeSum * 1000000000 /
+                 (frequency * WAKE_ROUNDS),
+                 KernelBenchmarkWakeMax * 1000000000 / frequency);
+
+  /* Let the thread exit. */
+  while (!__atomic_load_n(&KernelBenchmarkWakeReady, __ATOMIC_ACQUIRE))
+  {
+    PortCpuRelax();
+  }
+  __atomic_store_n(&KernelBenchmarkWakeStop, 1, __ATOMIC_RELEASE);
+  KernelThreadUnblock(KernelBenchmarkWakeId);
+}
+
+/*****************************************************************************
+ *                          KernelBenchmarkRun()
+ ****************************************************************************/
+
+void KernelBenchmarkRun (void)
+{
+  /* Context switch latency. */
+  KernelBenchmarkSwitch();
+
+  /* Scheduler pick-next cost. */
+  KernelBenchmarkDispatch();
+
+  /* Ready queue removal cost with thousands of threads per priority. */
+  KernelBenchmarkRequeue();
+
+  /* Thread spawn cost with recycled stacks. */
+  KernelBenchmarkCreate();
+}
@@ -37,32 +37,218 @@
 #include "port/inc/interface.h"
 
 /*****************************************************************************
- *                       KernelCoreInitialize()
+ *                           STATIC VARIABLES
  ****************************************************************************/
 
-void KernelCoreInitialize(void)
+/* Kernel stacks of the secondary CPUs (the boot CPU keeps the UEFI one). */
+static uint8_t KernelCoreStacks[KERNEL_CONFIG_MAX_CPU_COUNT]
+                               [KERNEL_CONFIG_DEFAULT_STACK_SIZE]
+                               __attribute__((aligned(16)));
+
+/* Number of CPUs running the kernel. */
+static volatile uint64_t KernelCoreOnline = 1;
+
+/*****************************************************************************
+ *                        KernelCoreSecondary()
+ ****************************************************************************/
+
+static void KernelCoreSecondary(uint64_t cpuId)
 {
-  /* Initialize CPU-specific port. */
-  PortSerialInitialize();
-  PortTranslationInitialize();
+  /* Per-CPU port state (MMU is already on, running from the direct map). */
+  PortCpuInitialize(cpuId);
+  PortExceptionInitialize();
+  PortInterruptInitialize(cpuId);
+  PortInterruptEnable(PORT_INTERRUPT_WAKEUP);
+  KernelTimerInitialize();
+
+  /* This context becomes the idle thread of the CPU. */
+  KernelThreadAdopt(cpuId);
+  KernelFiberInitialize(cpuId);
+  KernelWorkInitialize(cpuId);
+
+  /* Report in. */
+  PortAtomicFetchAdd64((uint64_t *) &KernelCoreOnline, 1);
+
+#if KERNEL_CONFIG_BENCHMARK
+  /* Take part in the SMP benchmarks driven by the boot CPU. */
+  KernelBenchmarkLockWorker(cpuId);
+#endif
+
+  /* Idle until there is work. */
+  KernelThreadIdle(NULL);
+}
+
+/*****************************************************************************
+ *                        KernelCoreSecondaries()
+ ****************************************************************************/
+
+static void KernelCoreSecondaries(void)
+{
+  /* Loop counter. */
+  uint64_t curCpu  = 0;
+
+  /* CPUs expected online (including the boot one). */
+  uint64_t started = 1;
+
+  /* Start every other CPU the firmware knows about. */
+  for (curCpu = 1; curCpu < KERNEL_CONFIG_MAX_CPU_COUNT; curCpu++)
+  {
+    if (PortCpuStart(curCpu, KernelCoreSecondary,
+                     KernelCoreStacks[curCpu] +
+                     KERNEL_CONFIG_DEFAULT_STACK_SIZE) == PORT_SUCCESS)
+    {
+      started++;
+    }
+  }
+
+  /* Wait until all of them adopted their idle thread. */
+  while (__atomic_load_n(&KernelCoreOnline, __ATOMIC_ACQUIRE) < started);
+
+  /* Report. */
+  KernelPrintFmt("CPUS ONLINE: %d\n", started);
+}
+
+/*****************************************************************************
+ *                        KernelCoreIdleReport()
+ ****************************************************************************/
+
+static void KernelCoreIdleReport(void)
+{
+  /* Loop counters. */
+  uint64_t curCpu  = 0;
+  uint64_t stateNo = 0;
+
+  /* Counter ticks per microsecond (rounded up, never zero). */
+  uint64_t ticksPerUs = (PortTimerFrequency() + 999999) / 1000000;
+
+  /* One line per online CPU. */
+  for (curCpu = 0; curCpu < KernelCoreOnline; curCpu++)
+  {
+    KernelPrintFmt("CPU %d IDLE: %d sleeps, %d us, wakeups timer %d other %d\n",
+                   curCpu,
+                   KernelThreadIdleEntries[curCpu],
+                   KernelThreadIdleTime[curCpu] / ticksPerUs,
+                   KernelThreadIdleWakeTimer[curCpu],
+                   KernelThreadIdleWakeOther[curCpu]);
+    KernelPrintFmt("CPU %d EDF: %d deadline misses, %d budget overruns\n",
+                   curCpu,
+                   KernelThreadEdfMisses[curCpu],
+                   KernelThreadEdfOverruns[curCpu]);
+    KernelPrintFmt("CPU %d RCU: %d objects reclaimed\n",
+                   curCpu,
+                   KernelRcuReclaimed[curCpu]);
+    KernelPrintFmt("CPU %d FIBER: %d steps\n",
+                   curCpu,
+                   KernelFiberSteps[curCpu]);
+    KernelPrintFmt("CPU %d WORK: %d items in %d batches\n",
+                   curCpu,
+                   KernelWorkExecuted[curCpu],
+                   KernelWorkBatches[curCpu]);
+    KernelPrintFmt("CPU %d WAKE: %d remote wakeups, IPIs %d sent %d taken\n",
+                   curCpu,
+                   KernelThreadRemoteWakes[curCpu],
+                   KernelThreadIpiSent[curCpu],
+                   KernelThreadIpiReceived[curCpu]);
+    KernelPrintFmt("CPU %d PREEMPT: %d slice expiries, %d wakeups\n",
+                   curCpu,
+                   KernelThreadPreemptSlice[curCpu],
+                   KernelThreadPreemptWake[curCpu]);
+
+    /* Idle states picked by the governor. */
+    for (stateNo = 0; stateNo < PORT_IDLE_STATE_COUNT; stateNo++)
+    {
+      KernelPrintFmt("CPU %d POWER: state %d entered %d times, %d us\n",
+                     curCpu, stateNo,
+                     KernelPowerEntries[curCpu][stateNo],
+                     KernelPowerTime[curCpu][stateNo] / ticksPerUs);
+    }
+  }
+}
+
+/*****************************************************************************
+ *                          KernelCoreSetup()
+ ****************************************************************************/
+
+static void KernelCoreSetup(void)
+{
+  /* Vectors are installed at their direct map address. */
+  PortExceptionInitialize();
 
   /* Initialize kernel components. */
   KernelPrintInitialize();
   KernelMemoryInitialize();
+  KernelRegionInitialize();
+  KernelRcuInitialize();
   KernelProcessInitialize();
   KernelThreadInitialize();
+  KernelFutexInitialize();
+  KernelFiberInitialize(0);
+  KernelWorkInitialize(0);
   KernelPowerInitialize();
+
+  /* Interrupts and the tick of the boot CPU. */
+  PortInterruptInitialize(0);
+  PortInterruptEnable(PORT_INTERRUPT_WAKEUP);
+  KernelTimerInitialize();
 }
 
 /*****************************************************************************
- *                         KernelCoreStart()
+ *                           KernelCoreRun()
  ****************************************************************************/
 
-void KernelCoreStart(void)
+static void KernelCoreRun(void)
 {
+#if KERNEL_CONFIG_BENCHMARK
+  /* Measure the kernel primitives (on the boot CPU alone). */
+  KernelBenchmarkRun();
+#endif
+
+  /* Bring up the other CPUs. */
+  KernelCoreSecondaries();
+
+#if KERNEL_CONFIG_BENCHMARK
+  /* Lock contention on 1 to all CPUs. */
+  KernelBenchmarkLocks(KernelCoreOnline);
+
+  /* Cross-CPU wake-up latency. */
+  KernelBenchmarkWakeup(KernelCoreOnline);
+#endif
+
   /* Start scheduler. */
   KernelThreadScheduler();
 
+  /* Report idle statistics. */
+  KernelCoreIdleReport();
+
+  /* Scheduling latency, run time and queue length histograms. */
+  KernelThreadStatsDump();
+
   /* Just shutdown for now. */
   KernelPowerOff();
 }
+
+/*****************************************************************************
+ *                       KernelCoreInitialize()
+ ****************************************************************************/
+
+void KernelCoreInitialize(void)
+{
+  /* Initialize CPU-specific port (boot CPU is CPU 0). */
+  PortCpuInitialize(0);
+  PortAtomicInitialize();
+  PortSerialInitialize();
+  PortTranslationInitialize();
+
+  /* Continue from the direct map (kernel half). */
+  PortTranslationEnter(KernelCoreSetup);
+}
+
+/*****************************************************************************
+ *                         KernelCoreStart()
+ ****************************************************************************/
+
+void KernelCoreStart(void)
+{
+  /* Run the kernel from the direct map (kernel half). */
+  PortTranslationEnter(KernelCoreRun);
+}
@@ -0,0 +1,280 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   kernel/src/fiber.c
+ * @brief  ARTOS kernel stackless fiber module.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Kernel includes. */
+#include "kernel/inc/interface.h"
+#include "kernel/inc/internal.h"
+
+/*****************************************************************************
+ *                               MACROS
+ ****************************************************************************/
+
+/* Maximum CPU count. */
+#define MAX_CPU          (KERNEL_CONFIG_MAX_CPU_COUNT)
+
+/* Fibers run back to back before the executor lets other threads in. */
+#define FIBER_BATCH      (KERNEL_CONFIG_FIBER_BATCH)
+
+/* No executor thread on the CPU yet. */
+#define NO_EXECUTOR      (~0UL)
+
+/*****************************************************************************
+ *                           GLOBAL VARIABLES
+ ****************************************************************************/
+
+/* Fiber steps run by each CPU. */
+uint64_t KernelFiberSteps[MAX_CPU];
+
+/*****************************************************************************
+ *                           STATIC VARIABLES
+ ****************************************************************************/
+
+/* Ready fibers of each CPU (FIFO) and the lock protecting them (taken
+ * with IRQs masked, handlers signal events). */
+static fiber_t   *KernelFiberHead[MAX_CPU];
+static fiber_t   *KernelFiberTail[MAX_CPU];
+static spinlock_t KernelFiberLocks[MAX_CPU];
+
+/* Executor thread of each CPU, and whether it sleeps for lack of work. */
+static uint64_t   KernelFiberExecutor[MAX_CPU];
+static uint64_t   KernelFiberAsleep[MAX_CPU];
+
+/*****************************************************************************
+ *                         KernelFiberReady()
+ ****************************************************************************/
+
+static void KernelFiberReady (fiber_t *fiber)
+{
+  /* Simplifying variables. */
+  uint64_t fiberCpu = fiber->fiberCpu;
+  uint64_t irqState = 0;
+  uint64_t wakeup   = 0;
+
+  /* Append to the run queue of its CPU. */
+  fiber->nextFiber = NULL;
+  irqState = KernelSpinLockIrq(&KernelFiberLocks[fiberCpu]);
+  if (KernelFiberHead[fiberCpu] == NULL)
+  {
+    KernelFiberHead[fiberCpu] = fiber;
+  }
+  else
+  {
+    KernelFiberTail[fiberCpu]->nextFiber = fiber;
+  }
+  KernelFiberTail[fiberCpu] = fiber;
+
+  /* Executor asleep? Wake it up (once, lock-free, fine from a handler). */
+  wakeup = KernelFiberAsleep[fiberCpu];
+  KernelFiberAsleep[fiberCpu] = 0;
+  KernelSpinUnlockIrq(&KernelFiberLocks[fiberCpu], irqState);
+  if (wakeup)
+  {
+    KernelThreadUnblock(KernelFiberExecutor[fiberCpu]);
+  }
+}
+
+/*****************************************************************************
+ *                        KernelFiberExecute()
+ ****************************************************************************/
+
+static void KernelFiberExecute (void *arg)
+{
+  /* Simplifying variables. */
+  uint64_t fiberCpu = (uint64_t) arg;
+  uint64_t irqState = 0;
+  uint64_t curStep  = 0;
+  fiber_t *fiber    = NULL;
+
+  /* Run ready fibers one step each, sleep when there are none. */
+  while (1)
+  {
+    for (curStep = 0; curStep < FIBER_BATCH; curStep++)
+    {
+      /* Next ready fiber (or go to sleep). */
+      irqState = KernelSpinLockIrq(&KernelFiberLocks[fiberCpu]);
+      fiber    = KernelFiberHead[fiberCpu];
+      if (fiber == NULL)
+      {
+        KernelFiberAsleep[fiberCpu] = 1;
+        KernelSpinUnlockIrq(&KernelFiberLocks[fiberCpu], irqState);
+        KernelThreadBlock();
+        break;
+      }
+      KernelFiberHead[fiberCpu] = fiber->nextFiber;
+      KernelSpinUnlockIrq(&KernelFiberLocks[fiberCpu], irqState);
+
+      /* Resume it until it waits, yields or finishes. */
+      KernelFiberSteps[fiberCpu]++;
+      if (fiber->fiberEntry(fiber) == KERNEL_FIBER_YIELD)
+      {
+        KernelFiberReady(fiber);
+      }
+    }
+
+    /* Let other threads of this priority run between batches. */
+    KernelThreadYield();
+  }
+}
+
+/*****************************************************************************
+ *                       KernelFiberInitialize()
+ ****************************************************************************/
+
+void KernelFiberInitialize (uint64_t cpuId)
+{
+  /* Empty run queue. */
+  KernelSpinInitialize(&KernelFiberLocks[cpuId]);
+  KernelFiberHead[cpuId]     = NULL;
+  KernelFiberTail[cpuId]     = NULL;
+  KernelFiberAsleep[cpuId]   = 0;
+  KernelFiberSteps[cpuId]    = 0;
+  KernelFiberExecutor[cpuId] = NO_EXECUTOR;
+
+  /* Executor thread, pinned to this CPU (called on it). */
+  if (KernelThreadCreate(KernelFiberExecute, (void *) cpuId,
+                         KERNEL_CONFIG_FIBER_PRIORITY,
+                         &KernelFiberExecutor[cpuId]) != KERNEL_SUCCESS)
+  {
+    KernelFiberExecutor[cpuId] = NO_EXECUTOR;
+    return;
+  }
+  KernelThreadAffinity(KernelFiberExecutor[cpuId], 1UL << cpuId);
+}
+
+/*****************************************************************************
+ *                          KernelFiberStart()
+ ****************************************************************************/
+
+error_t KernelFiberStart (fiber_t  *fiber,
+                          uint64_t (*fiberEntry)(fiber_t *fiber),
+                          void     *fiberArg)
+{
+  /* Simplifying variables. */
+  uint64_t fiberCpu = PortCpuId();
+
+  /* Check parameters. */
+  if (fiberEntry == 0 || KernelFiberExecutor[fiberCpu] == NO_EXECUTOR)
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* First step runs from the top, on this CPU. */
+  fiber->fiberResume = 0;
+  fiber->fiberCpu    = (uint32_t) fiberCpu;
+  fiber->fiberEntry  = fiberEntry;
+  fiber->fiberArg    = fiberArg;
+  KernelFiberReady(fiber);
+
+  /* Done. */
+  return KERNEL_SUCCESS;
+}
+
+/*****************************************************************************
+ *                      KernelFiberEventInitialize()
+ ****************************************************************************/
+
+void KernelFiberEventInitialize (fiber_event_t *event)
+{
+  /* No pending signal, nobody waiting. */
+  KernelSpinInitialize(&event->eventLock);
+  event->eventCount = 0;
+  event->eventHead  = NULL;
+  event->eventTail  = NULL;
+}
+
+/*****************************************************************************
+ *                        KernelFiberEventWait()
+ ****************************************************************************/
+
+uint64_t KernelFiberEventWait (fiber_event_t *event, fiber_t *fiber)
+{
+  /* Local variables. */
+  uint64_t irqState = 0;
+
+  /* Signaled already? Consume it and go on without suspending (IRQs
+   * masked, a handler may signal the event). */
+  irqState = KernelSpinLockIrq(&event->eventLock);
+  if (event->eventCount > 0)
+  {
+    event->eventCount--;
+    KernelSpinUnlockIrq(&event->eventLock, irqState);
+    return 0;
+  }
+
+  /* Queue up, the fiber returns to its executor. */
+  fiber->nextFiber = NULL;
+  if (event->eventHead == NULL)
+  {
+    event->eventHead = fiber;
+  }
+  else
+  {
+    event->eventTail->nextFiber = fiber;
+  }
+  event->eventTail = fiber;
+  KernelSpinUnlockIrq(&event->eventLock, irqState);
+
+  /* Done. */
+  return 1;
+}
+
+/*****************************************************************************
+ *                       KernelFiberEventSignal()
+ ****************************************************************************/
+
+void KernelFiberEventSignal (fiber_event_t *event)
+{
+  /* Fiber to resume. */
+  fiber_t *fiber    = NULL;
+  uint64_t irqState = 0;
+
+  /* First waiter, else remember the signal for the next one (callable
+   * from interrupt handlers). */
+  irqState = KernelSpinLockIrq(&event->eventLock);
+  fiber = event->eventHead;
+  if (fiber == NULL)
+  {
+    event->eventCount++;
+  }
+  else
+  {
+    event->eventHead = fiber->nextFiber;
+  }
+  KernelSpinUnlockIrq(&event->eventLock, irqState);
+
+  /* Back to its CPU's run queue (it may already be returning there: only
+   * that CPU's executor runs it, so never twice at once). */
+  if (fiber != NULL)
+  {
+    KernelFiberReady(fiber);
+  }
+}
@@ -0,0 +1,510 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   kernel/src/futex.c
+ * @brief  ARTOS kernel futex (address-keyed wait queue) module.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Kernel includes. */
+#include "kernel/inc/interface.h"
+#include "kernel/inc/internal.h"
+
+/*****************************************************************************
+ *                               MACROS
+ ****************************************************************************/
+
+/* Hash table size (power of two). */
+#define BUCKET_COUNT     (1UL << KERNEL_CONFIG_FUTEX_HASH_BITS)
+
+/* Fibonacci hashing multiplier (2^64 / golden ratio). */
+#define HASH_MULTIPLIER  (0x9E3779B97F4A7C15UL)
+
+/*****************************************************************************
+ *                              TYPEDEFS
+ ****************************************************************************/
+
+/* Futex key: a private user word is (process, virtual address), a shared
+ * one its physical address (and the page pinned while waiting), a kernel
+ * word its address. */
+typedef struct futex_key
+{
+  uint64_t             keyAddr;
+  process_t           *keyProcess;
+  void                *keyPage;
+} futex_key_t;
+
+/* Waiter, lives on the stack of the blocked thread. */
+typedef struct futex_waiter
+{
+  futex_key_t          waiterKey;
+  uint64_t             waiterBucket;
+  uint64_t             isWoken;
+  thread_t            *waiterThread;
+  struct futex_waiter *nextWaiter;
+  struct futex_waiter *prevWaiter;
+} futex_waiter_t;
+
+/* Hash bucket: FIFO of waiters whose keys hash here. */
+typedef struct futex_bucket
+{
+  spinlock_t           bucketLock;
+  futex_waiter_t      *waiterHead;
+  futex_waiter_t      *waiterTail;
+} futex_bucket_t;
+
+/*****************************************************************************
+ *                           STATIC VARIABLES
+ ****************************************************************************/
+
+static futex_bucket_t KernelFutexBuckets[BUCKET_COUNT];
+
+/*****************************************************************************
+ *                          KernelFutexLock()
+ ****************************************************************************/
+
+static void KernelFutexLock (uint64_t bucketNo)
+{
+  /* Short sections: a ticket lock per bucket. */
+  KernelSpinLock(&KernelFutexBuckets[bucketNo].bucketLock);
+}
+
+/*****************************************************************************
+ *                         KernelFutexUnlock()
+ ****************************************************************************/
+
+static void KernelFutexUnlock (uint64_t bucketNo)
+{
+  /* Publish the updates and release. */
+  KernelSpinUnlock(&KernelFutexBuckets[bucketNo].bucketLock);
+}
+
+/*****************************************************************************
+ *                           KernelFutexKey()
+ ****************************************************************************/
+
+static error_t KernelFutexKey (uint32_t *futexAddr, futex_key_t *futexKey)
+{
+  /* Local variables. */
+  uint64_t   futexVirt = (uint64_t) futexAddr;
+  process_t *process   = KernelThreadCurrent()->threadProcess;
+  region_t  *region    = NULL;
+  void      *page      = NULL;
+
+  /* Kernel words are keyed by their (unique) kernel address. */
+  futexKey->keyAddr    = futexVirt;
+  futexKey->keyProcess = NULL;
+  futexKey->keyPage    = NULL;
+  if (futexVirt >= KERNEL_CONFIG_USER_END || process == NULL)
+  {
+    return KERNEL_SUCCESS;
+  }
+
+  /* User words must lie in a region, fault them in like a read would. */
+  region = KernelRegionFind(process, futexVirt);
+  if (region == NULL ||
+      KernelProcessFault(futexAddr, PORT_TRANSLATION_READ) != KERNEL_SUCCESS)
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* Private words by (process, virtual address): the zero page and
+   * copy-on-write move them to another frame at the first store. */
+  if (!(region->regionFlags & KERNEL_REGION_SHARED))
+  {
+    futexKey->keyProcess = process;
+    return KERNEL_SUCCESS;
+  }
+
+  /* Shared words by physical address, every mapping meets on one key
+   * (shared pages are never copied on write). */
+  page = PortTranslationGet(process->processTranslation,
+                            (void *) (futexVirt & ~(PAGE_SIZE - 1UL)), NULL);
+  if (page == NULL)
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+  futexKey->keyAddr = ((uint64_t) page) | (futexVirt & (PAGE_SIZE - 1UL));
+  futexKey->keyPage = page;
+
+  /* Done. */
+  return KERNEL_SUCCESS;
+}
+
+/*****************************************************************************
+ *                          KernelFutexMatch()
+ ****************************************************************************/
+
+static uint64_t KernelFutexMatch (futex_key_t *futexKey, futex_key_t *otherKey)
+{
+  /* Same word of the same address space. */
+  return futexKey->keyAddr    == otherKey->keyAddr &&
+         futexKey->keyProcess == otherKey->keyProcess;
+}
+
+/*****************************************************************************
+ *                          KernelFutexValue()
+ ****************************************************************************/
+
+static error_t KernelFutexValue (futex_key_t *futexKey, uint32_t *futexValue)
+{
+  /* Simplifying variables. */
+  uint64_t  futexAddr = futexKey->keyAddr;
+  void     *page      = NULL;
+
+  /* Private words: read the frame mapped now. Called under the bucket
+   * lock, a store that copies the page either comes after this read or
+   * its wake finds us queued. The mapping lock keeps a copy-on-write from
+   * releasing the frame while we read it. */
+  if (futexKey->keyProcess != NULL)
+  {
+    KernelSpinLock(&futexKey->keyProcess->processMapLock);
+    page = PortTranslationGet(futexKey->keyProcess->processTranslation,
+                              (void *) (futexAddr & ~(PAGE_SIZE - 1UL)),
+                              NULL);
+    if (page == NULL)
+    {
+      KernelSpinUnlock(&futexKey->keyProcess->processMapLock);
+      return KERNEL_ERR_PARAMETER;
+    }
+    futexAddr = ((uint64_t) page) | (futexAddr & (PAGE_SIZE - 1UL));
+    *futexValue = __atomic_load_n((uint32_t *) PORT_PHYS_TO_VIRT(futexAddr),
+                                  __ATOMIC_ACQUIRE);
+    KernelSpinUnlock(&futexKey->keyProcess->processMapLock);
+    return KERNEL_SUCCESS;
+  }
+
+  /* Physical addresses are read through the direct map (kernel keys are
+   * kernel-half addresses already, the conversion leaves them alone). */
+  *futexValue = __atomic_load_n((uint32_t *) PORT_PHYS_TO_VIRT(futexAddr),
+                                __ATOMIC_ACQUIRE);
+
+  /* Done. */
+  return KERNEL_SUCCESS;
+}
+
+/*****************************************************************************
+ *                          KernelFutexBucket()
+ ****************************************************************************/
+
+static uint64_t KernelFutexBucket (futex_key_t *futexKey)
+{
+  /* Simplifying variables (private words of two processes differ). */
+  uint64_t keyHash = (futexKey->keyAddr >> 2) +
+                     (uint64_t) futexKey->keyProcess;
+
+  /* Top bits of the product are the best mixed. */
+  return (keyHash * HASH_MULTIPLIER) >> (64 - KERNEL_CONFIG_FUTEX_HASH_BITS);
+}
+
+/*****************************************************************************
+ *                          KernelFutexLink()
+ ****************************************************************************/
+
+static void KernelFutexLink (uint64_t bucketNo, futex_waiter_t *waiter)
+{
+  /* Simplifying variables. */
+  futex_bucket_t *bucket = &KernelFutexBuckets[bucketNo];
+
+  /* Append (wake order is FIFO), a timed out waiter reads its bucket. */
+  __atomic_store_n(&waiter->waiterBucket, bucketNo, __ATOMIC_RELEASE);
+  waiter->nextWaiter   = NULL;
+  waiter->prevWaiter   = bucket->waiterTail;
+  if (bucket->waiterTail == NULL)
+  {
+    bucket->waiterHead = waiter;
+  }
+  else
+  {
+    bucket->waiterTail->nextWaiter = waiter;
+  }
+  bucket->waiterTail = waiter;
+}
+
+/*****************************************************************************
+ *                         KernelFutexUnlink()
+ ****************************************************************************/
+
+static void KernelFutexUnlink (futex_waiter_t *waiter)
+{
+  /* Simplifying variables. */
+  futex_bucket_t *bucket = &KernelFutexBuckets[waiter->waiterBucket];
+
+  /* Remove from the doubly-linked bucket list. */
+  if (waiter->prevWaiter == NULL)
+  {
+    bucket->waiterHead = waiter->nextWaiter;
+  }
+  else
+  {
+    waiter->prevWaiter->nextWaiter = waiter->nextWaiter;
+  }
+  if (waiter->nextWaiter == NULL)
+  {
+    bucket->waiterTail = waiter->prevWaiter;
+  }
+  else
+  {
+    waiter->nextWaiter->prevWaiter = waiter->prevWaiter;
+  }
+
+  /* Clean up. */
+  waiter->nextWaiter = NULL;
+  waiter->prevWaiter = NULL;
+}
+
+/*****************************************************************************
+ *                        KernelFutexInitialize()
+ ****************************************************************************/
+
+void KernelFutexInitialize (void)
+{
+  /* Loop counter. */
+  uint64_t curBucket = 0;
+
+  /* Empty, unlocked buckets. */
+  for (curBucket = 0; curBucket < BUCKET_COUNT; curBucket++)
+  {
+    KernelSpinInitialize(&KernelFutexBuckets[curBucket].bucketLock);
+    KernelFutexBuckets[curBucket].waiterHead = NULL;
+    KernelFutexBuckets[curBucket].waiterTail = NULL;
+  }
+}
+
+/*****************************************************************************
+ *                           KernelFutexWait()
+ ****************************************************************************/
+
+error_t KernelFutexWait (uint32_t *futexAddr,
+                         uint32_t  expected,
+                         uint64_t  deadline)
+{
+  /* Local variables. */
+  futex_waiter_t waiter;
+  uint64_t       bucketNo = 0;
+  uint32_t       value    = 0;
+  error_t        result   = KERNEL_SUCCESS;
+
+  /* Key the word (user words must lie in a region). */
+  waiter.isWoken      = 0;
+  waiter.waiterThread = KernelThreadCurrent();
+  if (KernelFutexKey(futexAddr, &waiter.waiterKey) != KERNEL_SUCCESS)
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* A shared frame keeps its key (it is not reused) while we wait. */
+  if (waiter.waiterKey.keyPage != NULL)
+  {
+    KernelMemoryPageReference(waiter.waiterKey.keyPage);
+  }
+
+  /* Queue only if the word still holds the expected value. */
+  bucketNo = KernelFutexBucket(&waiter.waiterKey);
+  KernelFutexLock(bucketNo);
+  result = KernelFutexValue(&waiter.waiterKey, &value);
+  if (result == KERNEL_SUCCESS && value != expected)
+  {
+    result = KERNEL_ERR_AGAIN;
+  }
+  if (result == KERNEL_SUCCESS)
+  {
+    KernelFutexLink(bucketNo, &waiter);
+  }
+  KernelFutexUnlock(bucketNo);
+
+  /* Block (a wake between unlock and block is kept by the thread). */
+  while (result == KERNEL_SUCCESS &&
+         !__atomic_load_n(&waiter.isWoken, __ATOMIC_ACQUIRE))
+  {
+    if (deadline == 0)
+    {
+      KernelThreadBlock();
+    }
+    else if (KernelThreadBlockUntil(deadline) == KERNEL_ERR_TIMEOUT)
+    {
+      result = KERNEL_ERR_TIMEOUT;
+      break;
+    }
+  }
+
+  /* Timed out: leave the bucket, unless a requeue or wake beat us. */
+  while (result == KERNEL_ERR_TIMEOUT)
+  {
+    bucketNo = __atomic_load_n(&waiter.waiterBucket, __ATOMIC_ACQUIRE);
+    KernelFutexLock(bucketNo);
+    if (waiter.waiterBucket != bucketNo)
+    {
+      KernelFutexUnlock(bucketNo);
+      continue;
+    }
+    if (waiter.isWoken)
+    {
+      result = KERNEL_SUCCESS;
+    }
+    else
+    {
+      KernelFutexUnlink(&waiter);
+    }
+    KernelFutexUnlock(bucketNo);
+    break;
+  }
+
+  /* Unpin (the frame of the word we were requeued to, if any). */
+  if (waiter.waiterKey.keyPage != NULL)
+  {
+    KernelMemoryPageRelease(waiter.waiterKey.keyPage);
+  }
+
+  /* Done. */
+  return result;
+}
+
+/*****************************************************************************
+ *                           KernelFutexWake()
+ ****************************************************************************/
+
+uint64_t KernelFutexWake (uint32_t *futexAddr, uint64_t wakeCount)
+{
+  /* Local variables. */
+  futex_key_t     futexKey;
+  uint64_t        bucketNo = 0;
+  uint64_t        woken    = 0;
+  futex_waiter_t *waiter   = NULL;
+  futex_waiter_t *next     = NULL;
+  thread_t       *thread   = NULL;
+
+  /* Not in a region: nobody can be waiting. */
+  if (KernelFutexKey(futexAddr, &futexKey) != KERNEL_SUCCESS)
+  {
+    return 0;
+  }
+
+  /* Wake the first wakeCount waiters of this word, not the whole bucket. */
+  bucketNo = KernelFutexBucket(&futexKey);
+  KernelFutexLock(bucketNo);
+  for (waiter = KernelFutexBuckets[bucketNo].waiterHead;
+       waiter != NULL && woken < wakeCount; waiter = next)
+  {
+    next = waiter->nextWaiter;
+    if (KernelFutexMatch(&waiter->waiterKey, &futexKey))
+    {
+      /* The waiter may return (and drop its stack) once isWoken is set. */
+      thread = waiter->waiterThread;
+      KernelFutexUnlink(waiter);
+      __atomic_store_n(&waiter->isWoken, 1, __ATOMIC_RELEASE);
+      KernelThreadUnblock(thread->threadId);
+      woken++;
+    }
+  }
+  KernelFutexUnlock(bucketNo);
+
+  /* Done. */
+  return woken;
+}
+
+/*****************************************************************************
+ *                          KernelFutexRequeue()
+ ****************************************************************************/
+
+uint64_t KernelFutexRequeue (uint32_t *futexAddr,
+                             uint64_t  wakeCount,
+                             uint32_t *targetAddr,
+                             uint64_t  requeueCount)
+{
+  /* Local variables. */
+  futex_key_t     futexKey;
+  futex_key_t     targetKey;
+  uint64_t        srcBucket = 0;
+  uint64_t        dstBucket = 0;
+  uint64_t        woken     = 0;
+  uint64_t        moved     = 0;
+  futex_waiter_t *waiter    = NULL;
+  futex_waiter_t *next      = NULL;
+  thread_t       *thread    = NULL;
+
+  /* Both words must lie in a region. */
+  if (KernelFutexKey(futexAddr, &futexKey)   != KERNEL_SUCCESS ||
+      KernelFutexKey(targetAddr, &targetKey) != KERNEL_SUCCESS)
+  {
+    return 0;
+  }
+
+  /* Lock both buckets in index order (no ABBA deadlock). */
+  srcBucket = KernelFutexBucket(&futexKey);
+  dstBucket = KernelFutexBucket(&targetKey);
+  KernelFutexLock(srcBucket < dstBucket ? srcBucket : dstBucket);
+  if (srcBucket != dstBucket)
+  {
+    KernelFutexLock(srcBucket < dstBucket ? dstBucket : srcBucket);
+  }
+
+  /* Wake a few, move the rest to the target word (no thundering herd). */
+  for (waiter = KernelFutexBuckets[srcBucket].waiterHead;
+       waiter != NULL && (woken < wakeCount || moved < requeueCount);
+       waiter = next)
+  {
+    next = waiter->nextWaiter;
+    if (!KernelFutexMatch(&waiter->waiterKey, &futexKey))
+    {
+      continue;
+    }
+    KernelFutexUnlink(waiter);
+    if (woken < wakeCount)
+    {
+      thread = waiter->waiterThread;
+      __atomic_store_n(&waiter->isWoken, 1, __ATOMIC_RELEASE);
+      KernelThreadUnblock(thread->threadId);
+      woken++;
+    }
+    else
+    {
+      /* Move the pin along with the key. */
+      if (targetKey.keyPage != NULL)
+      {
+        KernelMemoryPageReference(targetKey.keyPage);
+      }
+      if (waiter->waiterKey.keyPage != NULL)
+      {
+        KernelMemoryPageRelease(waiter->waiterKey.keyPage);
+      }
+      waiter->waiterKey = targetKey;
+      KernelFutexLink(dstBucket, waiter);
+      moved++;
+    }
+  }
+
+  /* Unlock. */
+  if (srcBucket != dstBucket)
+  {
+    KernelFutexUnlock(dstBucket);
+  }
+  KernelFutexUnlock(srcBucket);
+
+  /* Done. */
+  return woken;
+}
@@ -0,0 +1,124 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   kernel/src/histogram.c
+ * @brief  ARTOS kernel log2 histogram module.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Kernel includes. */
+#include "kernel/inc/interface.h"
+#include "kernel/inc/internal.h"
+
+/*****************************************************************************
+ *                               MACROS
+ ****************************************************************************/
+
+/* Bucket 0 holds zero, bucket N holds [2^(N-1), 2^N). */
+#define HIST_BUCKETS     (KERNEL_HISTOGRAM_BUCKETS)
+
+/*****************************************************************************
+ *                       KernelHistogramReset()
+ ****************************************************************************/
+
+void KernelHistogramReset (histogram_t *hist)
+{
+  /* Loop counter. */
+  uint64_t curBucket = 0;
+
+  /* Empty. */
+  hist->histCount = 0;
+  hist->histSum   = 0;
+  hist->histMax   = 0;
+  for (curBucket = 0; curBucket < HIST_BUCKETS; curBucket++)
+  {
+    hist->histBuckets[curBucket] = 0;
+  }
+}
+
+/*****************************************************************************
+ *                        KernelHistogramAdd()
+ ****************************************************************************/
+
+void KernelHistogramAdd (histogram_t *hist, uint64_t value)
+{
+  /* Bucket = number of significant bits (one CLZ). */
+  uint64_t bucket = value == 0 ? 0 : 64 - __builtin_clzl(value);
+
+  /* The last bucket is open-ended. */
+  if (bucket >= HIST_BUCKETS)
+  {
+    bucket = HIST_BUCKETS - 1;
+  }
+
+  /* Record. */
+  hist->histBuckets[bucket]++;
+  hist->histCount++;
+  hist->histSum += value;
+  if (value > hist->histMax)
+  {
+    hist->histMax = value;
+  }
+}
+
+/*****************************************************************************
+ *                       KernelHistogramPrint()
+ ****************************************************************************/
+
+void KernelHistogramPrint (char        *histName,
+                           histogram_t *hist,
+                           uint64_t     unitMul,
+                           uint64_t     unitDiv)
+{
+  /* Loop counter and bucket lower bound. */
+  uint64_t curBucket = 0;
+  uint64_t lowBound  = 0;
+
+  /* Nothing recorded? */
+  if (hist->histCount == 0)
+  {
+    return;
+  }
+
+  /* Summary, values scaled by unitMul / unitDiv. */
+  KernelPrintFmt("%s: %d samples, avg %d, max %d\n",
+                 histName, hist->histCount,
+                 hist->histSum / hist->histCount * unitMul / unitDiv,
+                 hist->histMax * unitMul / unitDiv);
+
+  /* One line per non-empty bucket. */
+  for (curBucket = 0; curBucket < HIST_BUCKETS; curBucket++)
+  {
+    if (hist->histBuckets[curBucket] != 0)
+    {
+      lowBound = curBucket == 0 ? 0 : 1UL << (curBucket - 1);
+      KernelPrintFmt("  >= %d: %d\n",
+                     lowBound * unitMul / unitDiv,
+                     hist->histBuckets[curBucket]);
+    }
+  }
+}
@@ -0,0 +1,96 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   kernel/src/list.c
+ * @brief  ARTOS kernel intrusive doubly-linked list module.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Kernel includes. */
+#include "kernel/inc/interface.h"
+#include "kernel/inc/internal.h"
+
+/*****************************************************************************
+ *                        KernelListInitialize()
+ ****************************************************************************/
+
+void KernelListInitialize (list_t *list)
+{
+  /* Empty list, or a node on no list. */
+  list->listNext = list;
+  list->listPrev = list;
+}
+
+/*****************************************************************************
+ *                          KernelListEmpty()
+ ****************************************************************************/
+
+uint64_t KernelListEmpty (list_t *list)
+{
+  /* A head without entries, or a node on no list. */
+  return list->listNext == list;
+}
+
+/*****************************************************************************
+ *                          KernelListInsert()
+ ****************************************************************************/
+
+void KernelListInsert (list_t *prevNode, list_t *node)
+{
+  /* Simplifying variables. */
+  list_t *nextNode = prevNode->listNext;
+
+  /* Link between prevNode and its successor. */
+  node->listPrev     = prevNode;
+  node->listNext     = nextNode;
+  nextNode->listPrev = node;
+  prevNode->listNext = node;
+}
+
+/*****************************************************************************
+ *                          KernelListAppend()
+ ****************************************************************************/
+
+void KernelListAppend (list_t *list, list_t *node)
+{
+  /* After the last entry (the head is its successor). */
+  KernelListInsert(list->listPrev, node);
+}
+
+/*****************************************************************************
+ *                          KernelListRemove()
+ ****************************************************************************/
+
+void KernelListRemove (list_t *node)
+{
+  /* Link the neighbours to each other. */
+  node->listPrev->listNext = node->listNext;
+  node->listNext->listPrev = node->listPrev;
+
+  /* On no list anymore. */
+  node->listNext = node;
+  node->listPrev = node;
+}
@@ -55,19 +55,83 @@ uint64_t KernelMemoryRamEnd     = KERNEL_CONFIG_RAM_END;
 node_t *KernelMemoryFreeHead = NULL;
 node_t *KernelMemoryFreeTail = NULL;
 
+/* Shared zero page statistics. */
+uint64_t KernelMemoryZeroPageHits  = 0;
+uint64_t KernelMemoryZeroPageFills = 0;
+
+/*****************************************************************************
+ *                           STATIC VARIABLES
+ ****************************************************************************/
+
+/* Per-page reference counters (stored at the beginning of RAM). */
+static uint32_t *KernelMemoryPageRefs  = NULL;
+static uint64_t  KernelMemoryPageCount = 0;
+
+/* Global read-only page of zeros (never freed). */
+static void     *KernelMemoryZeroPage  = NULL;
+
+/* Free list and reference counter lock. */
+static spinlock_t KernelMemoryLock;
+
+/*****************************************************************************
+ *                         KernelMemoryPageRef()
+ ****************************************************************************/
+
+static uint32_t *KernelMemoryPageRef (void *pageBaseAddr)
+{
+  /* Simplifying variables (counters are indexed by physical address). */
+  uint64_t pageAddr = (uint64_t) PORT_VIRT_TO_PHYS(pageBaseAddr);
+
+  /* Pages outside RAM (e.g. device memory) are not reference-counted. */
+  if (pageAddr < KernelMemoryRamStart || pageAddr >= KernelMemoryRamEnd)
+  {
+    return NULL;
+  }
+
+  /* Return the counter of the page. */
+  return &KernelMemoryPageRefs[(pageAddr - KernelMemoryRamStart) / PAGE_SIZE];
+}
+
 /*****************************************************************************
  *                       KernelMemoryInitialize()
  ****************************************************************************/
 
 void KernelMemoryInitialize(void)
 {
-  /* Create linkedlist of free RAM pages. */
-  KernelMemoryFreeHead = (node_t *) KernelMemoryRamStart;
-  KernelMemoryFreeTail = (node_t *) KernelMemoryRamStart;
+  /* Size of the reference counter array. */
+  uint64_t refsSize = 0;
+
+  /* Loop counter. */
+  uint64_t curPage  = 0;
+
+  /* Free list lock. */
+  KernelSpinInitialize(&KernelMemoryLock);
+
+  /* Reserve reference counters for all RAM pages. */
+  KernelMemoryPageCount = (KernelMemoryRamEnd - KernelMemoryRamStart) /
+                          PAGE_SIZE;
+  KernelMemoryPageRefs  = PORT_PHYS_TO_VIRT(KernelMemoryRamStart);
+  refsSize = KernelMemoryPageCount * sizeof(uint32_t);
+  refsSize = (refsSize + PAGE_SIZE - 1) & ~(((uint64_t) PAGE_SIZE) - 1);
+
+  /* No page is referenced yet. */
+  for (curPage = 0; curPage < KernelMemoryPageCount; curPage++)
+  {
+    KernelMemoryPageRefs[curPage] = 0;
+  }
+
+  /* Create linkedlist of free RAM pages (after the counters, direct map). */
+  KernelMemoryFreeHead = PORT_PHYS_TO_VIRT(KernelMemoryRamStart + refsSize);
+  KernelMemoryFreeTail = KernelMemoryFreeHead;
 
   /* Initialize linkedlist. */
   KernelMemoryFreeHead->next = NULL;
-  KernelMemoryFreeHead->size = KernelMemoryRamEnd - KernelMemoryRamStart;
+  KernelMemoryFreeHead->size = KernelMemoryRamEnd - KernelMemoryRamStart -
+                               refsSize;
+
+  /* Allocate the zero page, the kernel keeps its reference forever. */
+  KernelMemoryZeroPage = KernelMemoryPageAllocate();
+  KernelMemoryPageClear(KernelMemoryZeroPage);
 }
 
 /*****************************************************************************
@@ -81,6 +145,7 @@ void *KernelMemoryPageAllocate(void)
   node_t *newHead  = NULL;
 
   /* Linkedlist is not empty? */
+  KernelSpinLock(&KernelMemoryLock);
   if (KernelMemoryFreeHead != NULL)
   {
     /* Allocate the page at the head. */
@@ -109,7 +174,11 @@ void *KernelMemoryPageAllocate(void)
     {
       KernelMemoryFreeTail = KernelMemoryFreeHead;
     }
+
+    /* The caller holds the only reference. */
+    *KernelMemoryPageRef(freePage) = 1;
   }
+  KernelSpinUnlock(&KernelMemoryLock);
 
   /* Return allocated page. */
   return freePage;
@@ -124,10 +193,12 @@ void KernelMemoryPageDeallocate(void *pageBaseAddr)
   /* Local variables. */
   node_t *freePage = NULL;
 
-  /* Read parameter. */
+  /* Read parameter (physical addresses are moved into the direct map). */
   freePage = (node_t *)(((uint64_t)pageBaseAddr)&~(((uint64_t)PAGE_SIZE)-1));
+  freePage = PORT_PHYS_TO_VIRT(freePage);
 
   /* Insert page into linkedlist. */
+  KernelSpinLock(&KernelMemoryLock);
   if (KernelMemoryFreeHead == NULL)
   {
     KernelMemoryFreeHead  = freePage;
@@ -142,4 +213,116 @@ void KernelMemoryPageDeallocate(void *pageBaseAddr)
   /* Re-initialize page info. */
   freePage->next = NULL;
   freePage->size = PAGE_SIZE;
+
+  /* Nobody references the page anymore. */
+  *KernelMemoryPageRef(freePage) = 0;
+  KernelSpinUnlock(&KernelMemoryLock);
+}
+
+/*****************************************************************************
+ *                      KernelMemoryPageReference()
+ ****************************************************************************/
+
+void KernelMemoryPageReference(void *pageBaseAddr)
+{
+  /* Reference counter of the page. */
+  uint32_t *pageRef = KernelMemoryPageRef(pageBaseAddr);
+
+  /* Add a reference. */
+  if (pageRef != NULL)
+  {
+    KernelSpinLock(&KernelMemoryLock);
+    (*pageRef)++;
+    KernelSpinUnlock(&KernelMemoryLock);
+  }
+}
+
+/*****************************************************************************
+ *                       KernelMemoryPageRelease()
+ ****************************************************************************/
+
+void KernelMemoryPageRelease(void *pageBaseAddr)
+{
+  /* Reference counter of the page. */
+  uint32_t *pageRef = KernelMemoryPageRef(pageBaseAddr);
+  uint64_t  isLast  = 0;
+
+  /* Drop a reference. */
+  if (pageRef != NULL)
+  {
+    KernelSpinLock(&KernelMemoryLock);
+    if (*pageRef != 0)
+    {
+      isLast = (--(*pageRef) == 0);
+    }
+    KernelSpinUnlock(&KernelMemoryLock);
+  }
+
+  /* Free the page with the last one. */
+  if (isLast)
+  {
+    KernelMemoryPageDeallocate(pageBaseAddr);
+  }
+}
+
+/*****************************************************************************
+ *                       KernelMemoryPageRefCount()
+ ****************************************************************************/
+
+uint64_t KernelMemoryPageRefCount(void *pageBaseAddr)
+{
+  /* Reference counter of the page. */
+  uint32_t *pageRef = KernelMemoryPageRef(pageBaseAddr);
+
+  /* Untracked pages count as a single reference. */
+  return pageRef != NULL ? *pageRef : 1;
+}
+
+/*****************************************************************************
+ *                       KernelMemoryPageZeroed()
+ ****************************************************************************/
+
+void *KernelMemoryPageZeroed(void)
+{
+  /* Shared zero page for read faults on anonymous memory. */
+  return KernelMemoryZeroPage;
+}
+
+/*****************************************************************************
+ *                        KernelMemoryPageClear()
+ ****************************************************************************/
+
+void KernelMemoryPageClear(void *pageBaseAddr)
+{
+  /* Page as an array of 64-bit words. */
+  uint64_t *page = (uint64_t *) pageBaseAddr;
+
+  /* Loop counter. */
+  uint64_t  i    = 0;
+
+  /* Zero-fill the page. */
+  for (i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++)
+  {
+    page[i] = 0;
+  }
+}
+
+/*****************************************************************************
+ *                        KernelMemoryPageCopy()
+ ****************************************************************************/
+
+void KernelMemoryPageCopy(void *dstPageAddr, void *srcPageAddr)
+{
+  /* Pages as arrays of 64-bit words. */
+  uint64_t *dstPage = (uint64_t *) dstPageAddr;
+  uint64_t *srcPage = (uint64_t *) srcPageAddr;
+
+  /* Loop counter. */
+  uint64_t  i       = 0;
+
+  /* Copy the page. */
+  for (i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++)
+  {
+    dstPage[i] = srcPage[i];
+  }
 }
@@ -0,0 +1,348 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   kernel/src/mutex.c
+ * @brief  ARTOS kernel mutex module.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Kernel includes. */
+#include "kernel/inc/interface.h"
+#include "kernel/inc/internal.h"
+
+/*****************************************************************************
+ *                               MACROS
+ ****************************************************************************/
+
+/* Owner word bit: waiters are queued, unlock must take the slow path. */
+#define MUTEX_WAITERS    (1UL << 63)
+
+/*****************************************************************************
+ *                          KernelMutexOwner()
+ ****************************************************************************/
+
+static thread_t *KernelMutexOwner (mutex_t *mutex)
+{
+  /* Owner word without the waiters bit. */
+  uint64_t owner = __atomic_load_n(&mutex->mutexOwner, __ATOMIC_RELAXED) &
+                   ~MUTEX_WAITERS;
+
+  /* Free? */
+  if (owner == 0)
+  {
+    return NULL;
+  }
+
+  /* Done. */
+  return KernelThreadGet(owner - 1);
+}
+
+/*****************************************************************************
+ *                        KernelMutexWaitInsert()
+ ****************************************************************************/
+
+static void KernelMutexWaitInsert (mutex_t *mutex, thread_t *thread)
+{
+  /* Insertion point (from the tail, the lowest priority). */
+  list_t *prevLink = mutex->mutexWaiters.listPrev;
+
+  /* Highest priority first, FIFO among equals. */
+  while (prevLink != &mutex->mutexWaiters &&
+         KERNEL_LIST_ENTRY(prevLink, thread_t,
+                           threadWaitLink)->threadPriority <
+         thread->threadPriority)
+  {
+    prevLink = prevLink->listPrev;
+  }
+
+  /* Link. */
+  KernelListInsert(prevLink, &thread->threadWaitLink);
+}
+
+/*****************************************************************************
+ *                        KernelMutexWaitFirst()
+ ****************************************************************************/
+
+static thread_t *KernelMutexWaitFirst (mutex_t *mutex)
+{
+  /* Highest-priority waiter, if any. */
+  if (KernelListEmpty(&mutex->mutexWaiters))
+  {
+    return NULL;
+  }
+  return KERNEL_LIST_ENTRY(mutex->mutexWaiters.listNext, thread_t,
+                           threadWaitLink);
+}
+
+/*****************************************************************************
+ *                        KernelMutexHeldRemove()
+ ****************************************************************************/
+
+static void KernelMutexHeldRemove (thread_t *thread, mutex_t *mutex)
+{
+  /* Local variables. */
+  mutex_t *prevMutex = NULL;
+  mutex_t *curMutex  = thread->threadMutexes;
+
+  /* Find it. */
+  while (curMutex != NULL && curMutex != mutex)
+  {
+    prevMutex = curMutex;
+    curMutex  = curMutex->nextHeldMutex;
+  }
+
+  /* Not contended while we held it. */
+  if (curMutex == NULL)
+  {
+    return;
+  }
+
+  /* Unlink. */
+  if (prevMutex == NULL)
+  {
+    thread->threadMutexes = mutex->nextHeldMutex;
+  }
+  else
+  {
+    prevMutex->nextHeldMutex = mutex->nextHeldMutex;
+  }
+  mutex->nextHeldMutex = NULL;
+}
+
+/*****************************************************************************
+ *                         KernelMutexPriority()
+ ****************************************************************************/
+
+static uint64_t KernelMutexPriority (thread_t *thread)
+{
+  /* Local variables. */
+  uint64_t  threadPriority = thread->threadBase;
+  mutex_t  *mutex          = NULL;
+  thread_t *waiter         = NULL;
+
+  /* Inherit the top waiter of every contended mutex we hold. */
+  for (mutex = thread->threadMutexes; mutex != NULL;
+       mutex = mutex->nextHeldMutex)
+  {
+    waiter = KernelMutexWaitFirst(mutex);
+    if (waiter != NULL && waiter->threadPriority > threadPriority)
+    {
+      threadPriority = waiter->threadPriority;
+    }
+  }
+
+  /* Done. */
+  return threadPriority;
+}
+
+/*****************************************************************************
+ *                          KernelMutexBoost()
+ ****************************************************************************/
+
+static void KernelMutexBoost (thread_t *thread, uint64_t threadPriority)
+{
+  /* Local variables. */
+  mutex_t *mutex = NULL;
+
+  /* Walk the chain of owners until one already runs high enough. */
+  while (thread != NULL && thread->threadPriority < threadPriority)
+  {
+    /* Boost (requeues it if it is ready). */
+    KernelThreadSetPriority(thread, threadPriority);
+
+    /* Not waiting for another mutex? End of the chain. */
+    mutex = thread->threadWaitingOn;
+    if (mutex == NULL)
+    {
+      break;
+    }
+
+    /* Keep the waiter queue sorted, then boost that owner too. */
+    KernelListRemove(&thread->threadWaitLink);
+    KernelMutexWaitInsert(mutex, thread);
+    thread = KernelMutexOwner(mutex);
+  }
+}
+
+/*****************************************************************************
+ *                      KernelMutexUpdatePriority()
+ ****************************************************************************/
+
+void KernelMutexUpdatePriority (thread_t *thread)
+{
+  /* Local variables. */
+  uint64_t threadPriority = 0;
+  mutex_t *mutex          = NULL;
+
+  /* Base changed: recompute along the chain of owners, both ways. */
+  while (thread != NULL)
+  {
+    /* Effective priority unchanged? Nothing further down moves. */
+    threadPriority = KernelMutexPriority(thread);
+    if (threadPriority == thread->threadPriority)
+    {
+      break;
+    }
+    KernelThreadSetPriority(thread, threadPriority);
+
+    /* Waiting? Resort the waiter queue, the owner may inherit less/more. */
+    mutex = thread->threadWaitingOn;
+    if (mutex == NULL)
+    {
+      break;
+    }
+    KernelListRemove(&thread->threadWaitLink);
+    KernelMutexWaitInsert(mutex, thread);
+    thread = KernelMutexOwner(mutex);
+  }
+}
+
+/*****************************************************************************
+ *                        KernelMutexInitialize()
+ ****************************************************************************/
+
+void KernelMutexInitialize (mutex_t *mutex)
+{
+  /* Free and uncontended. */
+  mutex->mutexOwner    = 0;
+  mutex->nextHeldMutex = NULL;
+  KernelListInitialize(&mutex->mutexWaiters);
+}
+
+/*****************************************************************************
+ *                           KernelMutexLock()
+ ****************************************************************************/
+
+void KernelMutexLock (mutex_t *mutex)
+{
+  /* Local variables. */
+  thread_t *thread = KernelThreadCurrent();
+  uint64_t  self   = thread->threadId + 1;
+  uint64_t  owner  = 0;
+
+  /* Fast path: free, one compare-and-swap. */
+  if (PortAtomicCas64(&mutex->mutexOwner, 0, self) == 0)
+  {
+    return;
+  }
+
+  /* Slow path: the scheduler lock serializes waiters and the owner. */
+  KernelThreadLock();
+  while (1)
+  {
+    /* Released meanwhile? Take it. */
+    owner = __atomic_load_n(&mutex->mutexOwner, __ATOMIC_RELAXED);
+    if (owner == 0)
+    {
+      if (PortAtomicCas64(&mutex->mutexOwner, 0, self) == 0)
+      {
+        KernelThreadUnlock();
+        return;
+      }
+      continue;
+    }
+
+    /* Others already wait: the owner is accounting for the mutex. */
+    if (owner & MUTEX_WAITERS)
+    {
+      break;
+    }
+
+    /* First waiter: force the owner into the slow unlock. */
+    if (PortAtomicCas64(&mutex->mutexOwner, owner,
+                        owner | MUTEX_WAITERS) == owner)
+    {
+      /* Its priority now depends on this mutex. */
+      mutex->nextHeldMutex = KernelThreadGet(owner - 1)->threadMutexes;
+      KernelThreadGet(owner - 1)->threadMutexes = mutex;
+      break;
+    }
+  }
+
+  /* Queue up and lend our priority along the chain of owners. */
+  thread->threadWaitingOn = mutex;
+  KernelMutexWaitInsert(mutex, thread);
+  KernelMutexBoost(KernelMutexOwner(mutex), thread->threadPriority);
+
+  /* Sleep until the owner hands the mutex over (wake-ups may be stale). */
+  while ((__atomic_load_n(&mutex->mutexOwner, __ATOMIC_ACQUIRE) &
+          ~MUTEX_WAITERS) != self)
+  {
+    KernelThreadBlockLocked();
+    KernelThreadLock();
+  }
+  KernelThreadUnlock();
+}
+
+/*****************************************************************************
+ *                          KernelMutexUnlock()
+ ****************************************************************************/
+
+void KernelMutexUnlock (mutex_t *mutex)
+{
+  /* Local variables. */
+  thread_t *thread = KernelThreadCurrent();
+  uint64_t  owner  = thread->threadId + 1;
+  uint64_t  next   = 0;
+  thread_t *waiter = NULL;
+
+  /* Fast path: nobody waits, one compare-and-swap. */
+  if (PortAtomicCas64(&mutex->mutexOwner, owner, 0) == owner)
+  {
+    return;
+  }
+
+  /* Slow path: hand over to the highest-priority waiter. */
+  KernelThreadLock();
+  KernelMutexHeldRemove(thread, mutex);
+  waiter = KernelMutexWaitFirst(mutex);
+  if (waiter != NULL)
+  {
+    /* Dequeue it, it owns the mutex (and its other waiters) from now on. */
+    KernelListRemove(&waiter->threadWaitLink);
+    waiter->threadWaitingOn = NULL;
+    next                    = waiter->threadId + 1;
+    if (!KernelListEmpty(&mutex->mutexWaiters))
+    {
+      next                  |= MUTEX_WAITERS;
+      mutex->nextHeldMutex   = waiter->threadMutexes;
+      waiter->threadMutexes  = mutex;
+    }
+  }
+  __atomic_store_n(&mutex->mutexOwner, next, __ATOMIC_RELEASE);
+
+  /* Drop what we inherited through this mutex. */
+  KernelThreadSetPriority(thread, KernelMutexPriority(thread));
+
+  /* Wake up the new owner. */
+  if (waiter != NULL)
+  {
+    KernelThreadSetPriority(waiter, KernelMutexPriority(waiter));
+    KernelThreadWake(waiter);
+  }
+  KernelThreadUnlock();
+}
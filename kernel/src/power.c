@@ -33,13 +33,182 @@
 #include "kernel/inc/interface.h"
 #include "kernel/inc/internal.h"
 
+/*****************************************************************************
+ *                               MACROS
+ ****************************************************************************/
+
+/* Maximum CPU count. */
+#define MAX_CPU          (KERNEL_CONFIG_MAX_CPU_COUNT)
+
+/* Idle states of the port (state 0 is WFI). */
+#define STATE_COUNT      (PORT_IDLE_STATE_COUNT)
+
+/* No idle period seen yet, trust the next timer event. */
+#define NO_PREDICTION    (~0UL)
+
+/*****************************************************************************
+ *                           GLOBAL VARIABLES
+ ****************************************************************************/
+
+/* Idle states entered by each CPU, and counter ticks spent in them. */
+uint64_t KernelPowerEntries[MAX_CPU][STATE_COUNT];
+uint64_t KernelPowerTime[MAX_CPU][STATE_COUNT];
+
+/*****************************************************************************
+ *                           STATIC VARIABLES
+ ****************************************************************************/
+
+/* Exit latency and target residency of each state (counter ticks). */
+static uint64_t KernelPowerExit[STATE_COUNT];
+static uint64_t KernelPowerResidency[STATE_COUNT];
+
+/* Longest exit latency each CPU tolerates (counter ticks). */
+static uint64_t KernelPowerLimit[MAX_CPU];
+
+/* Running average of the idle periods of each CPU (counter ticks). */
+static uint64_t KernelPowerAverage[MAX_CPU];
+
+/*****************************************************************************
+ *                          KernelPowerSelect()
+ ****************************************************************************/
+
+static uint64_t KernelPowerSelect(uint64_t powerCpu, uint64_t predicted)
+{
+  /* Local variables. */
+  uint64_t limit   = __atomic_load_n(&KernelPowerLimit[powerCpu],
+                                     __ATOMIC_RELAXED);
+  uint64_t stateNo = 0;
+  uint64_t exitUs  = 0;
+  uint64_t resUs   = 0;
+
+  /* Deepest state that pays off and wakes up in time. */
+  for (stateNo = STATE_COUNT - 1; stateNo > 0; stateNo--)
+  {
+    /* Refused by the firmware (or never offered)? */
+    if (PortPsciState(stateNo, &exitUs, &resUs) != PORT_SUCCESS)
+    {
+      continue;
+    }
+
+    /* Long enough and fast enough? */
+    if (KernelPowerResidency[stateNo] <= predicted &&
+        KernelPowerExit[stateNo]      <= limit)
+    {
+      break;
+    }
+  }
+
+  /* Done (0 = WFI). */
+  return stateNo;
+}
+
 /*****************************************************************************
  *                        KernelPowerInitialize()
  ****************************************************************************/
 
 void KernelPowerInitialize(void)
 {
-  /* Do nothing. */
+  /* Local variables. */
+  uint64_t stateNo = 0;
+  uint64_t curCpu  = 0;
+  uint64_t exitUs  = 0;
+  uint64_t resUs   = 0;
+  uint64_t version = 0;
+  uint64_t smccc   = 0;
+
+  /* Find the firmware and the idle states it accepts. */
+  PortPsciInitialize();
+  version = PortPsciVersion();
+  smccc   = PortPsciSmccc();
+
+  /* Cache the state table in counter ticks. */
+  for (stateNo = 0; stateNo < STATE_COUNT; stateNo++)
+  {
+    /* Unusable states are skipped by PortPsciState() at selection time. */
+    if (PortPsciState(stateNo, &exitUs, &resUs) == PORT_SUCCESS)
+    {
+      KernelPowerExit[stateNo]      = KernelTimerTicks(exitUs);
+      KernelPowerResidency[stateNo] = KernelTimerTicks(resUs);
+    }
+  }
+
+  /* Latency limits from the config, nothing predicted yet. */
+  for (curCpu = 0; curCpu < MAX_CPU; curCpu++)
+  {
+    KernelPowerLimit[curCpu] =
+      ((KERNEL_CONFIG_IDLE_RT_CPUS >> curCpu) & 1) ?
+        KernelTimerTicks(KERNEL_CONFIG_IDLE_RT_LATENCY_US) :
+        KernelTimerTicks(KERNEL_CONFIG_IDLE_LATENCY_US);
+    KernelPowerAverage[curCpu] = NO_PREDICTION;
+  }
+
+  /* Print what was found. */
+  KernelPrintFmt("PSCI: version %d.%d, SMCCC %d.%d, conduit %s\n",
+                 version >> 16, version & 0xFFFF,
+                 smccc >> 16, smccc & 0xFFFF,
+                 PortPsciConduit == PORT_CONDUIT_SMC ? "SMC" :
+                 PortPsciConduit == PORT_CONDUIT_HVC ? "HVC" : "none");
+}
+
+/*****************************************************************************
+ *                            KernelPowerIdle()
+ ****************************************************************************/
+
+void KernelPowerIdle(uint64_t powerCpu, uint64_t wakeAt)
+{
+  /* Local variables. */
+  uint64_t start     = PortTimerNow();
+  uint64_t bound     = 0;
+  uint64_t predicted = 0;
+  uint64_t stateNo   = 0;
+  uint64_t slept     = 0;
+  uint64_t average   = KernelPowerAverage[powerCpu];
+
+  /* The next timer event bounds the sleep, other wakeups cut it short. */
+  bound     = wakeAt > start ? wakeAt - start : 0;
+  predicted = average < bound ? average : bound;
+
+  /* Sleep (IRQs masked, PortPsciIdle() lets the wakeup through). */
+  stateNo = KernelPowerSelect(powerCpu, predicted);
+  PortPsciIdle(stateNo);
+  slept = PortTimerNow() - start;
+
+  /* Account the state. */
+  KernelPowerEntries[powerCpu][stateNo]++;
+  KernelPowerTime[powerCpu][stateNo] += slept;
+
+  /* Move the prediction a quarter of the way to this period. */
+  KernelPowerAverage[powerCpu] = average == NO_PREDICTION ? slept :
+                                 average - average / 4 + slept / 4;
+}
+
+/*****************************************************************************
+ *                          KernelPowerLatency()
+ ****************************************************************************/
+
+error_t KernelPowerLatency(uint64_t cpuMask, uint64_t latencyUs)
+{
+  /* Local variables. */
+  uint64_t curCpu = 0;
+  uint64_t limit  = KernelTimerTicks(latencyUs);
+
+  /* Validate the parameters. */
+  if (cpuMask == 0)
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* Applies from the next idle entry of each CPU. */
+  for (curCpu = 0; curCpu < MAX_CPU; curCpu++)
+  {
+    if ((cpuMask >> curCpu) & 1)
+    {
+      __atomic_store_n(&KernelPowerLimit[curCpu], limit, __ATOMIC_RELAXED);
+    }
+  }
+
+  /* Done. */
+  return KERNEL_SUCCESS;
 }
 
 /*****************************************************************************
@@ -48,7 +217,6 @@ void KernelPowerInitialize(void)
 
 void KernelPowerOff(void)
 {
-  /* Power State Coordination Interface: SYSTEM SHUTDOWN */
-  __asm__("LDR W0, =0x84000008");
-  __asm__("HVC #0");
+  /* Power State Coordination Interface: SYSTEM_OFF. */
+  PortPsciSystemOff();
 }
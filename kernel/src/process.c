@@ -37,8 +37,9 @@
  *                               MACROS
  ****************************************************************************/
 
-/* Process count (from the port). */
-#define PROCESS_COUNT    (0x10000U)
+/* Process count (from the port: 16-bit ASIDs, process N runs under ASID
+ * N + 1, ASID 0 is reserved for the boot identity map). */
+#define PROCESS_COUNT    (0xFFFFU)
 
 /*****************************************************************************
  *                           STATIC VARIABLES
@@ -49,6 +50,9 @@ static process_t KernelProcessList[PROCESS_COUNT];
 static process_t *KernelProcessFreeHead;
 static process_t *KernelProcessFreeTail;
 
+/* Free process list lock. */
+static spinlock_t KernelProcessFreeLock;
+
 /*****************************************************************************
  *                       KernelProcessInitialize()
  ****************************************************************************/
@@ -62,6 +66,7 @@ void KernelProcessInitialize (void)
   uint64_t   curProcess      = 0;
 
   /* Initialize head and tail for process list. */
+  KernelSpinInitialize(&KernelProcessFreeLock);
   KernelProcessFreeHead = &KernelProcessList[0];
   KernelProcessFreeTail = &KernelProcessList[PROCESS_COUNT - 1];
 
@@ -79,9 +84,13 @@ void KernelProcessInitialize (void)
     }
 
     /* Initialize process structure. */
-    KernelProcessList[curProcess].isUsed          = 0;
-    KernelProcessList[curProcess].processId       = curProcess;
-    KernelProcessList[curProcess].nextFreeProcess = nextFreeProcess;
+    KernelProcessList[curProcess].isUsed             = 0;
+    KernelProcessList[curProcess].processId          = curProcess;
+    KernelProcessList[curProcess].processRegionRoot  = NULL;
+    KernelProcessList[curProcess].processRegionCount = 0;
+    KernelProcessList[curProcess].processTranslation = NULL;
+    KernelProcessList[curProcess].processAffinity    = KERNEL_CPU_MASK_ALL;
+    KernelProcessList[curProcess].nextFreeProcess    = nextFreeProcess;
   }
 }
 
@@ -95,36 +104,98 @@ process_t *KernelProcessAllocate (void)
   process_t *process = NULL;
 
   /* Check if there is no free process. */
+  KernelSpinLock(&KernelProcessFreeLock);
   if (KernelProcessFreeHead == NULL)
   {
+    KernelSpinUnlock(&KernelProcessFreeLock);
     return NULL;
   }
 
   /* Allocate new process from head. */
   process = KernelProcessFreeHead;
+
+  /* Create an empty address space for the process. */
+  process->processTranslation = PortTranslationCreate();
+  if (process->processTranslation == NULL)
+  {
+    KernelSpinUnlock(&KernelProcessFreeLock);
+    return NULL;
+  }
+
+  /* Remove the process from the free list. */
   KernelProcessFreeHead = process->nextFreeProcess;
+  KernelSpinUnlock(&KernelProcessFreeLock);
 
   /* Initialize the new process. */
-  process->isUsed          = 1;
-  process->nextFreeProcess = NULL;
+  KernelSpinInitialize(&process->processMapLock);
+  process->processRegionRoot  = NULL;
+  process->processRegionCount = 0;
+  process->processAffinity    = KERNEL_CPU_MASK_ALL;
+  process->nextFreeProcess    = NULL;
+
+  /* Publish it to lock-free lookups once it is fully set up. */
+  __atomic_store_n(&process->isUsed, 1, __ATOMIC_RELEASE);
 
   /* Done. */
   return process;
 }
 
+/*****************************************************************************
+ *                        KernelProcessTeardown()
+ ****************************************************************************/
+
+static void KernelProcessTeardown (work_t *work)
+{
+  /* Simplifying variables. */
+  process_t *process = (process_t *) work->workArg;
+
+  /* Release the address space and every page mapped into it. */
+  PortTranslationDestroy(process->processTranslation, KernelMemoryPageRelease);
+  process->processTranslation = NULL;
+  KernelRegionDestroy(process);
+
+  /* Insert into the free process list. */
+  process->nextFreeProcess = NULL;
+  KernelSpinLock(&KernelProcessFreeLock);
+  if (KernelProcessFreeHead == NULL)
+  {
+    KernelProcessFreeHead = process;
+  }
+  else
+  {
+    KernelProcessFreeTail->nextFreeProcess = process;
+  }
+  KernelProcessFreeTail = process;
+  KernelSpinUnlock(&KernelProcessFreeLock);
+}
+
+/*****************************************************************************
+ *                          KernelProcessFree()
+ ****************************************************************************/
+
+static void KernelProcessFree (void *arg)
+{
+  /* Simplifying variables. */
+  process_t *process = (process_t *) arg;
+
+  /* Freeing page tables is slow: leave it to the work queue instead of
+   * the schedule point that ended the grace period. */
+  KernelWorkSetup(&process->processWork, KernelProcessTeardown, process);
+  KernelWorkQueue(&process->processWork);
+}
+
 /*****************************************************************************
  *                       KernelProcessDeallocate()
  ****************************************************************************/
 
 void KernelProcessDeallocate (process_t *process)
 {
-  /* Free up the process. */
-  process->isUsed          = 0;
-  process->nextFreeProcess = NULL;
+  /* Unpublish it: lookups by ID fail from now on. */
+  __atomic_store_n(&process->isUsed, 0, __ATOMIC_SEQ_CST);
 
-  /* Update the tail of the process list. */
-  KernelProcessFreeTail->nextFreeProcess = process;
-  KernelProcessFreeTail                  = process;
+  /* Lock-free readers may still use it (and its address space), tear it
+   * down after a grace period. */
+  KernelRcuRetire(&process->processRcu, KernelProcessFree, process);
 }
 
 /*****************************************************************************
@@ -145,12 +216,319 @@ process_t *KernelProcessGet (uint64_t processId)
   /* Obtain process structure by id. */
   process = &KernelProcessList[processId];
 
-  /* Check whether the process is used or not. */
-  if (process->isUsed == 0)
+  /* Check whether the process is used or not (no lock needed, see
+   * KernelProcessDeallocate()). */
+  if (__atomic_load_n(&process->isUsed, __ATOMIC_ACQUIRE) == 0)
   {
     return NULL;
   }
 
   /* Done. */
   return process;
-}
\ No newline at end of file
+}
+
+/*****************************************************************************
+ *                        KernelProcessDuplicate()
+ ****************************************************************************/
+
+process_t *KernelProcessDuplicate (process_t *parent)
+{
+  /* The new process. */
+  process_t *child           = NULL;
+
+  /* Region being shared. */
+  region_t  *region          = NULL;
+
+  /* Attributes stripped from the shared mappings. */
+  uint64_t   clearAttributes = 0;
+
+  /* Loop counter. */
+  uint64_t   i               = 0;
+
+  /* Error code. */
+  error_t    err             = KERNEL_SUCCESS;
+
+  /* Allocate the child process. */
+  child = KernelProcessAllocate();
+  if (child == NULL)
+  {
+    return NULL;
+  }
+
+  /* Inherit the name and the default CPU mask. */
+  for (i = 0; i < KERNEL_CONFIG_NAME_MAX_SIZE; i++)
+  {
+    child->processName[i] = parent->processName[i];
+  }
+  child->processAffinity = parent->processAffinity;
+
+  /* Copy the region tree and share every mapped anonymous page instead of
+   * copying it. The parent mappings change too: no fault or region change
+   * of the parent may come in between. */
+  KernelSpinLock(&parent->processMapLock);
+  err    = KernelRegionDuplicate(child, parent);
+  region = KernelRegionFindNext(parent, KERNEL_CONFIG_USER_START);
+  while (err == KERNEL_SUCCESS && region != NULL)
+  {
+    /* Physical regions are simply re-faulted by the child. */
+    if (region->regionBacking == KERNEL_REGION_ANONYMOUS)
+    {
+      /* Private pages become read-only in both processes (copy-on-write). */
+      if (region->regionFlags & KERNEL_REGION_SHARED)
+      {
+        clearAttributes = 0;
+      }
+      else
+      {
+        clearAttributes = PORT_TRANSLATION_WRITE;
+      }
+
+      /* Map the same pages into the child, one more reference each. */
+      err = PortTranslationShare(child->processTranslation,
+                                 parent->processTranslation,
+                                 (void *) region->regionStart,
+                                 (void *) region->regionEnd,
+                                 clearAttributes,
+                                 KernelMemoryPageReference);
+    }
+
+    /* Next region. */
+    region = KernelRegionFindNext(parent, region->regionEnd);
+  }
+  KernelSpinUnlock(&parent->processMapLock);
+
+  /* Out of memory? Undo everything. */
+  if (err != KERNEL_SUCCESS)
+  {
+    KernelProcessDeallocate(child);
+    return NULL;
+  }
+
+  /* Done. */
+  return child;
+}
+
+/*****************************************************************************
+ *                      KernelProcessSetAffinity()
+ ****************************************************************************/
+
+error_t KernelProcessSetAffinity (process_t *process, uint64_t cpuMask)
+{
+  /* At least one existing CPU. */
+  cpuMask &= KERNEL_CPU_MASK_ALL;
+  if (cpuMask == 0)
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* Threads attached from now on start with it. */
+  process->processAffinity = cpuMask;
+
+  /* Done. */
+  return KERNEL_SUCCESS;
+}
+
+/*****************************************************************************
+ *                      KernelProcessAttributes()
+ ****************************************************************************/
+
+static uint64_t KernelProcessAttributes (uint64_t regionFlags)
+{
+  /* Process memory is always user memory. */
+  uint64_t attributes = PORT_TRANSLATION_USER;
+
+  /* Translate region permissions. */
+  if (regionFlags & KERNEL_REGION_READ)
+  {
+    attributes |= PORT_TRANSLATION_READ;
+  }
+  if (regionFlags & KERNEL_REGION_WRITE)
+  {
+    attributes |= PORT_TRANSLATION_WRITE;
+  }
+  if (regionFlags & KERNEL_REGION_EXEC)
+  {
+    attributes |= PORT_TRANSLATION_EXEC;
+  }
+
+  /* Done. */
+  return attributes;
+}
+
+/*****************************************************************************
+ *                      KernelProcessCopyOnWrite()
+ ****************************************************************************/
+
+static error_t KernelProcessCopyOnWrite (process_t *process,
+                                         void      *pageAddr,
+                                         void      *oldPage,
+                                         uint64_t   attributes)
+{
+  /* Private copy of the page. */
+  void *newPage = NULL;
+
+  /* Access the shared page through the direct map. */
+  oldPage = PORT_PHYS_TO_VIRT(oldPage);
+
+  /* Last reference? Just make the page writable again. */
+  if (oldPage != KernelMemoryPageZeroed() &&
+      KernelMemoryPageRefCount(oldPage) == 1)
+  {
+    PortTranslationProtect(process->processTranslation, pageAddr, attributes);
+    return KERNEL_SUCCESS;
+  }
+
+  /* Allocate the private copy. */
+  newPage = KernelMemoryPageAllocate();
+  if (newPage == NULL)
+  {
+    return KERNEL_ERR_RESOURCE;
+  }
+
+  /* Copy the content (the zero page only needs clearing). */
+  if (oldPage == KernelMemoryPageZeroed())
+  {
+    KernelMemoryPageClear(newPage);
+    KernelMemoryZeroPageFills++;
+  }
+  else
+  {
+    KernelMemoryPageCopy(newPage, oldPage);
+  }
+
+  /* Install the private copy first (flushed everywhere on return), only
+   * then drop our reference to the shared page. */
+  if (PortTranslationReplace(process->processTranslation, pageAddr,
+                             PORT_VIRT_TO_PHYS(newPage), attributes) == NULL)
+  {
+    KernelMemoryPageRelease(newPage);
+    return KERNEL_ERR_RESOURCE;
+  }
+  KernelMemoryPageRelease(oldPage);
+
+  /* Done. */
+  return KERNEL_SUCCESS;
+}
+
+/*****************************************************************************
+ *                         KernelProcessResolve()
+ ****************************************************************************/
+
+static error_t KernelProcessResolve (process_t *process,
+                                     uint64_t   faultAddr,
+                                     uint64_t   faultAccess)
+{
+  /* Region covering the fault. */
+  region_t *region       = NULL;
+
+  /* Current and wanted mapping information. */
+  void     *pageAddr     = NULL;
+  void     *physicalAddr = NULL;
+  uint64_t  mapped       = 0;
+  uint64_t  attributes   = 0;
+
+  /* Find the region in O(log n). */
+  pageAddr = (void *) (faultAddr & ~(((uint64_t) PAGE_SIZE) - 1));
+  region   = KernelRegionFind(process, (uint64_t) pageAddr);
+  if (region == NULL)
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* Check the access against region permissions. */
+  attributes = KernelProcessAttributes(region->regionFlags);
+  if ((faultAccess & ~attributes) & (PORT_TRANSLATION_READ  |
+                                     PORT_TRANSLATION_WRITE |
+                                     PORT_TRANSLATION_EXEC))
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* Look up the current mapping. */
+  physicalAddr = PortTranslationGet(process->processTranslation,
+                                    pageAddr, &mapped);
+
+  /* Page is not mapped yet: populate it. */
+  if (physicalAddr == NULL)
+  {
+    if (region->regionBacking == KERNEL_REGION_PHYSICAL)
+    {
+      /* Fixed physical backing. */
+      physicalAddr = (void *) (region->regionOffset +
+                               ((uint64_t) pageAddr - region->regionStart));
+      KernelMemoryPageReference(physicalAddr);
+    }
+    else if (!(faultAccess & PORT_TRANSLATION_WRITE) &&
+             !(region->regionFlags & KERNEL_REGION_SHARED))
+    {
+      /* Read of untouched private memory: map the shared zero page. */
+      physicalAddr = KernelMemoryPageZeroed();
+      attributes  &= ~PORT_TRANSLATION_WRITE;
+      KernelMemoryPageReference(physicalAddr);
+      KernelMemoryZeroPageHits++;
+    }
+    else
+    {
+      /* Fresh zero-filled anonymous page. */
+      physicalAddr = KernelMemoryPageAllocate();
+      if (physicalAddr == NULL)
+      {
+        return KERNEL_ERR_RESOURCE;
+      }
+      KernelMemoryPageClear(physicalAddr);
+    }
+
+    /* Map it (kernel pages are direct map addresses). */
+    if (PortTranslationSet(process->processTranslation, pageAddr,
+                           PORT_VIRT_TO_PHYS(physicalAddr),
+                           attributes) == NULL)
+    {
+      KernelMemoryPageRelease(physicalAddr);
+      return KERNEL_ERR_RESOURCE;
+    }
+
+    /* Done. */
+    return KERNEL_SUCCESS;
+  }
+
+  /* Write to a read-only mapping of a writable region: copy-on-write. */
+  if ((faultAccess & PORT_TRANSLATION_WRITE) &&
+      !(mapped & PORT_TRANSLATION_WRITE))
+  {
+    return KernelProcessCopyOnWrite(process, pageAddr,
+                                    physicalAddr, attributes);
+  }
+
+  /* Already resolved (e.g. by another CPU). */
+  return KERNEL_SUCCESS;
+}
+
+/*****************************************************************************
+ *                         KernelProcessFault()
+ ****************************************************************************/
+
+error_t KernelProcessFault (void *faultAddr, uint64_t faultAccess)
+{
+  /* Faulting thread. */
+  thread_t  *thread  = KernelThreadCurrent();
+
+  /* Its address space and the result. */
+  process_t *process = NULL;
+  error_t    err     = KERNEL_SUCCESS;
+
+  /* Only threads running inside a process can fault on process memory. */
+  if (thread == NULL || thread->threadProcess == NULL)
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* Resolve the fault in the process address space, one fault of the
+   * process at a time (look-up, copy and page release stay consistent). */
+  process = thread->threadProcess;
+  KernelSpinLock(&process->processMapLock);
+  err = KernelProcessResolve(process, (uint64_t) faultAddr, faultAccess);
+  KernelSpinUnlock(&process->processMapLock);
+
+  /* Done. */
+  return err;
+}
@@ -0,0 +1,208 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   kernel/src/rcu.c
+ * @brief  ARTOS kernel deferred reclamation (RCU) module.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Kernel includes. */
+#include "kernel/inc/interface.h"
+#include "kernel/inc/internal.h"
+
+/*****************************************************************************
+ *                               MACROS
+ ****************************************************************************/
+
+/* Maximum CPU count. */
+#define MAX_CPU          (KERNEL_CONFIG_MAX_CPU_COUNT)
+
+/* Epochs to wait after a retire: every CPU went through two schedule
+ * points, so none can still hold a reference taken before the retire.
+ * References live in lock sections or with preemption disabled only, so
+ * a preempted thread holds none either. */
+#define GRACE_EPOCHS     (2)
+
+/*****************************************************************************
+ *                           GLOBAL VARIABLES
+ ****************************************************************************/
+
+/* Objects reclaimed by each CPU. */
+uint64_t KernelRcuReclaimed[MAX_CPU];
+
+/*****************************************************************************
+ *                           STATIC VARIABLES
+ ****************************************************************************/
+
+/* Global epoch, advanced once every CPU went through a quiescent state. */
+static uint64_t  KernelRcuEpoch = 0;
+
+/* Last epoch each CPU saw at a quiescent state. */
+static uint64_t  KernelRcuSeen[MAX_CPU];
+
+/* CPUs asleep or offline hold no references (extended quiescent state). */
+static uint64_t  KernelRcuIdle[MAX_CPU];
+
+/* Objects retired by each CPU, oldest first. Only touched by that CPU. */
+static rcu_t    *KernelRcuHead[MAX_CPU];
+static rcu_t    *KernelRcuTail[MAX_CPU];
+
+/*****************************************************************************
+ *                        KernelRcuInitialize()
+ ****************************************************************************/
+
+void KernelRcuInitialize (void)
+{
+  /* Loop counter. */
+  uint64_t curCpu = 0;
+
+  /* Every CPU is offline until it enters the scheduler. */
+  for (curCpu = 0; curCpu < MAX_CPU; curCpu++)
+  {
+    KernelRcuSeen[curCpu]      = 0;
+    KernelRcuIdle[curCpu]      = 1;
+    KernelRcuHead[curCpu]      = NULL;
+    KernelRcuTail[curCpu]      = NULL;
+    KernelRcuReclaimed[curCpu] = 0;
+  }
+}
+
+/*****************************************************************************
+ *                          KernelRcuAdvance()
+ ****************************************************************************/
+
+static void KernelRcuAdvance (void)
+{
+  /* Simplifying variables. */
+  uint64_t epoch  = __atomic_load_n(&KernelRcuEpoch, __ATOMIC_SEQ_CST);
+  uint64_t curCpu = 0;
+
+  /* Some CPU running code may still be in the previous epoch? */
+  for (curCpu = 0; curCpu < MAX_CPU; curCpu++)
+  {
+    if (!__atomic_load_n(&KernelRcuIdle[curCpu], __ATOMIC_SEQ_CST) &&
+        __atomic_load_n(&KernelRcuSeen[curCpu], __ATOMIC_SEQ_CST) != epoch)
+    {
+      return;
+    }
+  }
+
+  /* Everyone caught up: next epoch (losing the race is fine). */
+  PortAtomicCas64(&KernelRcuEpoch, epoch, epoch + 1);
+}
+
+/*****************************************************************************
+ *                          KernelRcuRetire()
+ ****************************************************************************/
+
+void KernelRcuRetire (rcu_t *rcu, void (*rcuCallback)(void *), void *rcuArg)
+{
+  /* Simplifying variables (the list of the CPU we stay on). */
+  uint64_t irqState = PortCpuIrqSave();
+  uint64_t cpuId    = PortCpuId();
+
+  /* Readers finding the object unlinked later cannot be in this epoch. */
+  rcu->rcuEpoch    = __atomic_load_n(&KernelRcuEpoch, __ATOMIC_SEQ_CST);
+  rcu->rcuCallback = rcuCallback;
+  rcu->rcuArg      = rcuArg;
+  rcu->nextRcu     = NULL;
+
+  /* Append to this CPU's list (epochs only grow along it). */
+  if (KernelRcuHead[cpuId] == NULL)
+  {
+    KernelRcuHead[cpuId] = rcu;
+  }
+  else
+  {
+    KernelRcuTail[cpuId]->nextRcu = rcu;
+  }
+  KernelRcuTail[cpuId] = rcu;
+  PortCpuIrqRestore(irqState);
+}
+
+/*****************************************************************************
+ *                         KernelRcuQuiescent()
+ ****************************************************************************/
+
+void KernelRcuQuiescent (void)
+{
+  /* Simplifying variables (the CPU we stay on). */
+  uint64_t irqState = PortCpuIrqSave();
+  uint64_t cpuId    = PortCpuId();
+  uint64_t epoch    = __atomic_load_n(&KernelRcuEpoch, __ATOMIC_SEQ_CST);
+  rcu_t   *rcu      = NULL;
+
+  /* No reference taken before this point is held anymore. */
+  __atomic_store_n(&KernelRcuSeen[cpuId], epoch, __ATOMIC_SEQ_CST);
+
+  /* Nothing waiting here: leave grace periods to CPUs that need them. */
+  if (KernelRcuHead[cpuId] == NULL)
+  {
+    PortCpuIrqRestore(irqState);
+    return;
+  }
+  KernelRcuAdvance();
+  epoch = __atomic_load_n(&KernelRcuEpoch, __ATOMIC_SEQ_CST);
+
+  /* Reclaim everything whose grace period is over. */
+  while (KernelRcuHead[cpuId] != NULL &&
+         KernelRcuHead[cpuId]->rcuEpoch + GRACE_EPOCHS <= epoch)
+  {
+    rcu                  = KernelRcuHead[cpuId];
+    KernelRcuHead[cpuId] = rcu->nextRcu;
+    rcu->rcuCallback(rcu->rcuArg);
+    KernelRcuReclaimed[cpuId]++;
+  }
+  PortCpuIrqRestore(irqState);
+}
+
+/*****************************************************************************
+ *                         KernelRcuIdleEnter()
+ ****************************************************************************/
+
+void KernelRcuIdleEnter (void)
+{
+  /* Going to sleep: nothing is referenced until KernelRcuIdleExit(). */
+  KernelRcuQuiescent();
+  __atomic_store_n(&KernelRcuIdle[PortCpuId()], 1, __ATOMIC_SEQ_CST);
+}
+
+/*****************************************************************************
+ *                          KernelRcuIdleExit()
+ ****************************************************************************/
+
+void KernelRcuIdleExit (void)
+{
+  /* Simplifying variables. */
+  uint64_t cpuId = PortCpuId();
+
+  /* Join the current epoch before touching any shared object. */
+  __atomic_store_n(&KernelRcuIdle[cpuId], 0, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&KernelRcuSeen[cpuId],
+                   __atomic_load_n(&KernelRcuEpoch, __ATOMIC_SEQ_CST),
+                   __ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,987 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   kernel/src/region.c
+ * @brief  ARTOS kernel virtual memory region module.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Kernel includes. */
+#include "kernel/inc/interface.h"
+#include "kernel/inc/internal.h"
+
+/*****************************************************************************
+ *                               MACROS
+ ****************************************************************************/
+
+/* Number of region structures carved out of a single page. */
+#define REGIONS_PER_PAGE  (PAGE_SIZE / sizeof(region_t))
+
+/* Page alignment check. */
+#define IS_PAGE_ALIGNED(X)  ((((uint64_t) (X)) & (PAGE_SIZE - 1)) == 0)
+
+/*****************************************************************************
+ *                           STATIC VARIABLES
+ ****************************************************************************/
+
+/* Linkedlist of free region structures (shared by every process). */
+static region_t   *KernelRegionFreeHead;
+static spinlock_t  KernelRegionFreeLock;
+
+/*****************************************************************************
+ *                        KernelRegionAllocate()
+ ****************************************************************************/
+
+static region_t *KernelRegionAllocate (void)
+{
+  /* Region structure to be returned. */
+  region_t *region = NULL;
+
+  /* Fresh page to refill the free list. */
+  region_t *page   = NULL;
+
+  /* Loop counter. */
+  uint64_t  i      = 0;
+
+  /* Refill the free list from a new page if it is empty. */
+  KernelSpinLock(&KernelRegionFreeLock);
+  if (KernelRegionFreeHead == NULL)
+  {
+    /* Allocate a page for region structures (outside of the lock). */
+    KernelSpinUnlock(&KernelRegionFreeLock);
+    page = KernelMemoryPageAllocate();
+
+    /* Out of memory? */
+    if (page == NULL)
+    {
+      return NULL;
+    }
+
+    /* Chain all structures in the page into the free list. */
+    KernelSpinLock(&KernelRegionFreeLock);
+    for (i = 0; i < REGIONS_PER_PAGE; i++)
+    {
+      page[i].nextFreeRegion = KernelRegionFreeHead;
+      KernelRegionFreeHead   = &page[i];
+    }
+  }
+
+  /* Allocate new region from head. */
+  region = KernelRegionFreeHead;
+  KernelRegionFreeHead = region->nextFreeRegion;
+  KernelSpinUnlock(&KernelRegionFreeLock);
+
+  /* Initialize the new region. */
+  region->leftRegion     = NULL;
+  region->rightRegion    = NULL;
+  region->nextFreeRegion = NULL;
+  region->regionHeight   = 1;
+
+  /* Done. */
+  return region;
+}
+
+/*****************************************************************************
+ *                       KernelRegionDeallocate()
+ ****************************************************************************/
+
+static void KernelRegionDeallocate (region_t *region)
+{
+  /* Push the region back into the free list. */
+  KernelSpinLock(&KernelRegionFreeLock);
+  region->nextFreeRegion = KernelRegionFreeHead;
+  KernelRegionFreeHead   = region;
+  KernelSpinUnlock(&KernelRegionFreeLock);
+}
+
+/*****************************************************************************
+ *                         KernelRegionHeight()
+ ****************************************************************************/
+
+static uint64_t KernelRegionHeight (region_t *region)
+{
+  /* Empty subtrees have zero height. */
+  return region == NULL ? 0 : region->regionHeight;
+}
+
+/*****************************************************************************
+ *                         KernelRegionUpdate()
+ ****************************************************************************/
+
+static void KernelRegionUpdate (region_t *region)
+{
+  /* Simplifying variables. */
+  region_t *left     = region->leftRegion;
+  region_t *right    = region->rightRegion;
+  uint64_t  leftHgt  = KernelRegionHeight(left);
+  uint64_t  rightHgt = KernelRegionHeight(right);
+
+  /* Update subtree height. */
+  region->regionHeight = 1 + (leftHgt > rightHgt ? leftHgt : rightHgt);
+
+  /* Update subtree address span. */
+  region->regionLowest  = left  != NULL ? left->regionLowest   :
+                                          region->regionStart;
+  region->regionHighest = right != NULL ? right->regionHighest :
+                                          region->regionEnd;
+
+  /* Update the largest free gap between regions of the subtree. */
+  region->regionMaxGap = 0;
+  if (left != NULL)
+  {
+    if (left->regionMaxGap > region->regionMaxGap)
+    {
+      region->regionMaxGap = left->regionMaxGap;
+    }
+    if (region->regionStart - left->regionHighest > region->regionMaxGap)
+    {
+      region->regionMaxGap = region->regionStart - left->regionHighest;
+    }
+  }
+  if (right != NULL)
+  {
+    if (right->regionMaxGap > region->regionMaxGap)
+    {
+      region->regionMaxGap = right->regionMaxGap;
+    }
+    if (right->regionLowest - region->regionEnd > region->regionMaxGap)
+    {
+      region->regionMaxGap = right->regionLowest - region->regionEnd;
+    }
+  }
+}
+
+/*****************************************************************************
+ *                       KernelRegionRotateLeft()
+ ****************************************************************************/
+
+static region_t *KernelRegionRotateLeft (region_t *region)
+{
+  /* The right child becomes the new subtree root. */
+  region_t *newRoot = region->rightRegion;
+
+  /* Rotate. */
+  region->rightRegion = newRoot->leftRegion;
+  newRoot->leftRegion = region;
+
+  /* Update the lowered node first, then the new root. */
+  KernelRegionUpdate(region);
+  KernelRegionUpdate(newRoot);
+
+  /* Done. */
+  return newRoot;
+}
+
+/*****************************************************************************
+ *                       KernelRegionRotateRight()
+ ****************************************************************************/
+
+static region_t *KernelRegionRotateRight (region_t *region)
+{
+  /* The left child becomes the new subtree root. */
+  region_t *newRoot = region->leftRegion;
+
+  /* Rotate. */
+  region->leftRegion   = newRoot->rightRegion;
+  newRoot->rightRegion = region;
+
+  /* Update the lowered node first, then the new root. */
+  KernelRegionUpdate(region);
+  KernelRegionUpdate(newRoot);
+
+  /* Done. */
+  return newRoot;
+}
+
+/*****************************************************************************
+ *                        KernelRegionBalance()
+ ****************************************************************************/
+
+static region_t *KernelRegionBalance (region_t *region)
+{
+  /* Simplifying variables. */
+  region_t *left  = NULL;
+  region_t *right = NULL;
+
+  /* Refresh height and gap information. */
+  KernelRegionUpdate(region);
+
+  /* Obtain children. */
+  left  = region->leftRegion;
+  right = region->rightRegion;
+
+  /* Left-heavy? */
+  if (KernelRegionHeight(left) > KernelRegionHeight(right) + 1)
+  {
+    /* Left-right case needs a double rotation. */
+    if (KernelRegionHeight(left->leftRegion) <
+        KernelRegionHeight(left->rightRegion))
+    {
+      region->leftRegion = KernelRegionRotateLeft(left);
+    }
+    region = KernelRegionRotateRight(region);
+  }
+  /* Right-heavy? */
+  else if (KernelRegionHeight(right) > KernelRegionHeight(left) + 1)
+  {
+    /* Right-left case needs a double rotation. */
+    if (KernelRegionHeight(right->rightRegion) <
+        KernelRegionHeight(right->leftRegion))
+    {
+      region->rightRegion = KernelRegionRotateRight(right);
+    }
+    region = KernelRegionRotateLeft(region);
+  }
+
+  /* Done. */
+  return region;
+}
+
+/*****************************************************************************
+ *                         KernelRegionAttach()
+ ****************************************************************************/
+
+static region_t *KernelRegionAttach (region_t *root, region_t *region)
+{
+  /* Empty subtree? The region becomes a leaf. */
+  if (root == NULL)
+  {
+    region->leftRegion  = NULL;
+    region->rightRegion = NULL;
+    KernelRegionUpdate(region);
+    return region;
+  }
+
+  /* Descend by start address. */
+  if (region->regionStart < root->regionStart)
+  {
+    root->leftRegion  = KernelRegionAttach(root->leftRegion, region);
+  }
+  else
+  {
+    root->rightRegion = KernelRegionAttach(root->rightRegion, region);
+  }
+
+  /* Rebalance on the way up. */
+  return KernelRegionBalance(root);
+}
+
+/*****************************************************************************
+ *                        KernelRegionDetachMin()
+ ****************************************************************************/
+
+static region_t *KernelRegionDetachMin (region_t *root, region_t **minRegion)
+{
+  /* Leftmost node found? */
+  if (root->leftRegion == NULL)
+  {
+    *minRegion = root;
+    return root->rightRegion;
+  }
+
+  /* Keep descending to the left. */
+  root->leftRegion = KernelRegionDetachMin(root->leftRegion, minRegion);
+
+  /* Rebalance on the way up. */
+  return KernelRegionBalance(root);
+}
+
+/*****************************************************************************
+ *                         KernelRegionDetach()
+ ****************************************************************************/
+
+static region_t *KernelRegionDetach (region_t *root, uint64_t regionStart)
+{
+  /* Successor that replaces a node with two children. */
+  region_t *minRegion = NULL;
+
+  /* Not found? */
+  if (root == NULL)
+  {
+    return NULL;
+  }
+
+  /* Descend by start address. */
+  if (regionStart < root->regionStart)
+  {
+    root->leftRegion  = KernelRegionDetach(root->leftRegion,  regionStart);
+  }
+  else if (regionStart > root->regionStart)
+  {
+    root->rightRegion = KernelRegionDetach(root->rightRegion, regionStart);
+  }
+  else if (root->leftRegion == NULL)
+  {
+    /* Replace the node by its only (or no) child. */
+    return root->rightRegion;
+  }
+  else if (root->rightRegion == NULL)
+  {
+    /* Replace the node by its only child. */
+    return root->leftRegion;
+  }
+  else
+  {
+    /* Replace the node by its in-order successor. */
+    root->rightRegion = KernelRegionDetachMin(root->rightRegion, &minRegion);
+    minRegion->leftRegion  = root->leftRegion;
+    minRegion->rightRegion = root->rightRegion;
+    root = minRegion;
+  }
+
+  /* Rebalance on the way up. */
+  return KernelRegionBalance(root);
+}
+
+/*****************************************************************************
+ *                         KernelRegionLookup()
+ ****************************************************************************/
+
+static region_t *KernelRegionLookup (region_t *root, uint64_t regionAddr)
+{
+  /* Standard binary search over non-overlapping ranges. */
+  while (root != NULL)
+  {
+    if (regionAddr < root->regionStart)
+    {
+      root = root->leftRegion;
+    }
+    else if (regionAddr >= root->regionEnd)
+    {
+      root = root->rightRegion;
+    }
+    else
+    {
+      return root;
+    }
+  }
+
+  /* Address is not covered by any region. */
+  return NULL;
+}
+
+/*****************************************************************************
+ *                        KernelRegionFirstAbove()
+ ****************************************************************************/
+
+static region_t *KernelRegionFirstAbove (region_t *root, uint64_t regionAddr)
+{
+  /* Lowest region that ends after regionAddr. */
+  region_t *region = NULL;
+
+  /* Regions don't overlap, so end addresses are ordered like starts. */
+  while (root != NULL)
+  {
+    if (root->regionEnd > regionAddr)
+    {
+      region = root;
+      root   = root->leftRegion;
+    }
+    else
+    {
+      root   = root->rightRegion;
+    }
+  }
+
+  /* Done. */
+  return region;
+}
+
+/*****************************************************************************
+ *                        KernelRegionMergeable()
+ ****************************************************************************/
+
+static uint64_t KernelRegionMergeable (uint64_t lowerFlags,
+                                       uint64_t lowerBacking,
+                                       uint64_t lowerOffsetEnd,
+                                       uint64_t upperFlags,
+                                       uint64_t upperBacking,
+                                       uint64_t upperOffset)
+{
+  /* Permissions and backing must be identical. */
+  if (lowerFlags != upperFlags || lowerBacking != upperBacking)
+  {
+    return 0;
+  }
+
+  /* Physically-backed regions must also be physically contiguous. */
+  if (lowerBacking == KERNEL_REGION_PHYSICAL && lowerOffsetEnd != upperOffset)
+  {
+    return 0;
+  }
+
+  /* Done. */
+  return 1;
+}
+
+/*****************************************************************************
+ *                         KernelRegionSearch()
+ ****************************************************************************/
+
+static uint64_t KernelRegionSearch (region_t *root,
+                                    uint64_t  regionSize,
+                                    uint64_t  regionLimit,
+                                    uint64_t *regionCursor)
+{
+  /* Gap in front of the subtree (zero if the cursor is already inside). */
+  uint64_t frontGap = 0;
+
+  /* Empty subtree or search already past the limit? */
+  if (root == NULL || *regionCursor >= regionLimit)
+  {
+    return 0;
+  }
+
+  /* Whole subtree lies below the cursor? */
+  if (root->regionHighest <= *regionCursor)
+  {
+    return 0;
+  }
+
+  /* Skip the subtree if neither its front gap nor inner gaps fit. */
+  if (root->regionLowest > *regionCursor)
+  {
+    frontGap = root->regionLowest - *regionCursor;
+  }
+  if (frontGap < regionSize && root->regionMaxGap < regionSize)
+  {
+    *regionCursor = root->regionHighest;
+    return 0;
+  }
+
+  /* Search the lower half first (first-fit). */
+  if (KernelRegionSearch(root->leftRegion, regionSize,
+                         regionLimit, regionCursor))
+  {
+    return 1;
+  }
+
+  /* Does the gap right before this region fit? */
+  if (root->regionStart > *regionCursor &&
+      root->regionStart - *regionCursor >= regionSize &&
+      regionLimit - *regionCursor >= regionSize)
+  {
+    return 1;
+  }
+
+  /* Move the cursor past this region. */
+  if (root->regionEnd > *regionCursor)
+  {
+    *regionCursor = root->regionEnd;
+  }
+
+  /* Search the upper half. */
+  return KernelRegionSearch(root->rightRegion, regionSize,
+                            regionLimit, regionCursor);
+}
+
+/*****************************************************************************
+ *                          KernelRegionCopy()
+ ****************************************************************************/
+
+static error_t KernelRegionCopy (region_t *root, region_t **copy)
+{
+  /* Copy of the root and of its children. */
+  region_t *region = NULL;
+  region_t *child  = NULL;
+
+  /* Error code. */
+  error_t   err    = KERNEL_SUCCESS;
+
+  /* Nothing copied yet. */
+  *copy = NULL;
+
+  /* Empty subtree? */
+  if (root == NULL)
+  {
+    return KERNEL_SUCCESS;
+  }
+
+  /* Allocate the copy. */
+  region = KernelRegionAllocate();
+  if (region == NULL)
+  {
+    return KERNEL_ERR_RESOURCE;
+  }
+
+  /* Copy the node including its cached subtree information. */
+  region->regionStart   = root->regionStart;
+  region->regionEnd     = root->regionEnd;
+  region->regionFlags   = root->regionFlags;
+  region->regionBacking = root->regionBacking;
+  region->regionOffset  = root->regionOffset;
+  region->regionHeight  = root->regionHeight;
+  region->regionLowest  = root->regionLowest;
+  region->regionHighest = root->regionHighest;
+  region->regionMaxGap  = root->regionMaxGap;
+  *copy = region;
+
+  /* Copy children with the same shape (no rebalancing needed). */
+  err = KernelRegionCopy(root->leftRegion, &child);
+  region->leftRegion = child;
+  if (err != KERNEL_SUCCESS)
+  {
+    return err;
+  }
+  err = KernelRegionCopy(root->rightRegion, &child);
+  region->rightRegion = child;
+
+  /* Done. */
+  return err;
+}
+
+/*****************************************************************************
+ *                        KernelRegionFreeTree()
+ ****************************************************************************/
+
+static void KernelRegionFreeTree (region_t *root)
+{
+  /* Empty subtree? */
+  if (root == NULL)
+  {
+    return;
+  }
+
+  /* Free children, then the node itself. */
+  KernelRegionFreeTree(root->leftRegion);
+  KernelRegionFreeTree(root->rightRegion);
+  KernelRegionDeallocate(root);
+}
+
+/*****************************************************************************
+ *                       KernelRegionInitialize()
+ ****************************************************************************/
+
+void KernelRegionInitialize (void)
+{
+  /* Free list is filled lazily, one page at a time. */
+  KernelRegionFreeHead = NULL;
+  KernelSpinInitialize(&KernelRegionFreeLock);
+}
+
+/*****************************************************************************
+ *                          KernelRegionFind()
+ ****************************************************************************/
+
+region_t *KernelRegionFind (process_t *process, uint64_t regionAddr)
+{
+  /* O(log n) lookup of the region covering regionAddr (valid while the
+   * caller holds the mapping lock of the process). */
+  return KernelRegionLookup(process->processRegionRoot, regionAddr);
+}
+
+/*****************************************************************************
+ *                        KernelRegionFindNext()
+ ****************************************************************************/
+
+region_t *KernelRegionFindNext (process_t *process, uint64_t regionAddr)
+{
+  /* Lowest region ending after regionAddr (in-order iteration, under the
+   * mapping lock of the process). */
+  return KernelRegionFirstAbove(process->processRegionRoot, regionAddr);
+}
+
+/*****************************************************************************
+ *                      KernelRegionInsertLocked()
+ ****************************************************************************/
+
+static error_t KernelRegionInsertLocked (process_t *process,
+                                         uint64_t   regionStart,
+                                         uint64_t   regionSize,
+                                         uint64_t   regionFlags,
+                                         uint64_t   regionBacking,
+                                         uint64_t   regionOffset)
+{
+  /* Region to be inserted and its neighbours. */
+  region_t *region     = NULL;
+  region_t *prevRegion = NULL;
+  region_t *nextRegion = NULL;
+
+  /* Simplifying variables. */
+  uint64_t  regionEnd  = regionStart + regionSize;
+
+  /* Validate parameters. */
+  if (regionSize == 0                        ||
+      !IS_PAGE_ALIGNED(regionStart)          ||
+      !IS_PAGE_ALIGNED(regionSize)           ||
+      regionStart < KERNEL_CONFIG_USER_START ||
+      regionEnd   > KERNEL_CONFIG_USER_END   ||
+      regionEnd   < regionStart)
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* Make sure the new region doesn't overlap existing ones. */
+  nextRegion = KernelRegionFirstAbove(process->processRegionRoot, regionStart);
+  if (nextRegion != NULL && nextRegion->regionStart < regionEnd)
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* Find a compatible region ending exactly where the new one starts. */
+  prevRegion = KernelRegionLookup(process->processRegionRoot, regionStart-1);
+  if (prevRegion != NULL &&
+      !KernelRegionMergeable(prevRegion->regionFlags,
+                             prevRegion->regionBacking,
+                             prevRegion->regionOffset +
+                             (prevRegion->regionEnd - prevRegion->regionStart),
+                             regionFlags, regionBacking, regionOffset))
+  {
+    prevRegion = NULL;
+  }
+
+  /* Find a compatible region starting exactly where the new one ends. */
+  if (nextRegion != NULL &&
+      (nextRegion->regionStart != regionEnd ||
+       !KernelRegionMergeable(regionFlags, regionBacking,
+                              regionOffset + regionSize,
+                              nextRegion->regionFlags,
+                              nextRegion->regionBacking,
+                              nextRegion->regionOffset)))
+  {
+    nextRegion = NULL;
+  }
+
+  /* Merge with the next region? */
+  if (nextRegion != NULL)
+  {
+    /* Take the next region out of the tree. */
+    process->processRegionRoot = KernelRegionDetach(process->processRegionRoot,
+                                                    nextRegion->regionStart);
+    process->processRegionCount--;
+
+    /* The merged region covers up to its end. */
+    regionEnd = nextRegion->regionEnd;
+  }
+
+  /* Merge with the previous region? */
+  if (prevRegion != NULL)
+  {
+    /* Take the previous region out of the tree. */
+    process->processRegionRoot = KernelRegionDetach(process->processRegionRoot,
+                                                    prevRegion->regionStart);
+    process->processRegionCount--;
+
+    /* The merged region starts where it starts. */
+    regionStart  = prevRegion->regionStart;
+    regionOffset = prevRegion->regionOffset;
+
+    /* Reuse its structure. */
+    region = prevRegion;
+    if (nextRegion != NULL)
+    {
+      KernelRegionDeallocate(nextRegion);
+    }
+  }
+  else if (nextRegion != NULL)
+  {
+    /* Reuse the next region's structure. */
+    region = nextRegion;
+  }
+  else
+  {
+    /* No merge possible, allocate a new structure. */
+    region = KernelRegionAllocate();
+    if (region == NULL)
+    {
+      return KERNEL_ERR_RESOURCE;
+    }
+  }
+
+  /* Initialize the region. */
+  region->regionStart   = regionStart;
+  region->regionEnd     = regionEnd;
+  region->regionFlags   = regionFlags;
+  region->regionBacking = regionBacking;
+  region->regionOffset  = regionOffset;
+
+  /* Insert into the tree. */
+  process->processRegionRoot = KernelRegionAttach(process->processRegionRoot,
+                                                  region);
+  process->processRegionCount++;
+
+  /* Done. */
+  return KERNEL_SUCCESS;
+}
+
+/*****************************************************************************
+ *                         KernelRegionInsert()
+ ****************************************************************************/
+
+error_t KernelRegionInsert (process_t *process,
+                            uint64_t   regionStart,
+                            uint64_t   regionSize,
+                            uint64_t   regionFlags,
+                            uint64_t   regionBacking,
+                            uint64_t   regionOffset)
+{
+  /* Error code. */
+  error_t err = KERNEL_SUCCESS;
+
+  /* Faults look the tree up under the mapping lock. */
+  KernelSpinLock(&process->processMapLock);
+  err = KernelRegionInsertLocked(process, regionStart, regionSize,
+                                 regionFlags, regionBacking, regionOffset);
+  KernelSpinUnlock(&process->processMapLock);
+
+  /* Done. */
+  return err;
+}
+
+/*****************************************************************************
+ *                       KernelRegionSplitLocked()
+ ****************************************************************************/
+
+static error_t KernelRegionSplitLocked (process_t *process,
+                                        uint64_t   regionAddr)
+{
+  /* Region to split and the new upper part. */
+  region_t *region      = NULL;
+  region_t *upperRegion = NULL;
+
+  /* Validate parameters. */
+  if (!IS_PAGE_ALIGNED(regionAddr))
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* Nothing to split if no region straddles regionAddr. */
+  region = KernelRegionLookup(process->processRegionRoot, regionAddr);
+  if (region == NULL || region->regionStart == regionAddr)
+  {
+    return KERNEL_SUCCESS;
+  }
+
+  /* Allocate the upper part. */
+  upperRegion = KernelRegionAllocate();
+  if (upperRegion == NULL)
+  {
+    return KERNEL_ERR_RESOURCE;
+  }
+
+  /* Initialize the upper part. */
+  upperRegion->regionStart   = regionAddr;
+  upperRegion->regionEnd     = region->regionEnd;
+  upperRegion->regionFlags   = region->regionFlags;
+  upperRegion->regionBacking = region->regionBacking;
+  upperRegion->regionOffset  = region->regionOffset +
+                               (regionAddr - region->regionStart);
+
+  /* Shrink the lower part (re-attach to refresh gap information). */
+  process->processRegionRoot = KernelRegionDetach(process->processRegionRoot,
+                                                  region->regionStart);
+  region->regionEnd = regionAddr;
+  process->processRegionRoot = KernelRegionAttach(process->processRegionRoot,
+                                                  region);
+
+  /* Insert the upper part. */
+  process->processRegionRoot = KernelRegionAttach(process->processRegionRoot,
+                                                  upperRegion);
+  process->processRegionCount++;
+
+  /* Done. */
+  return KERNEL_SUCCESS;
+}
+
+/*****************************************************************************
+ *                          KernelRegionSplit()
+ ****************************************************************************/
+
+error_t KernelRegionSplit (process_t *process, uint64_t regionAddr)
+{
+  /* Error code. */
+  error_t err = KERNEL_SUCCESS;
+
+  /* Faults look the tree up under the mapping lock. */
+  KernelSpinLock(&process->processMapLock);
+  err = KernelRegionSplitLocked(process, regionAddr);
+  KernelSpinUnlock(&process->processMapLock);
+
+  /* Done. */
+  return err;
+}
+
+/*****************************************************************************
+ *                         KernelRegionUnmap()
+ ****************************************************************************/
+
+static void KernelRegionUnmap (process_t *process, region_t *region)
+{
+  /* Page being unmapped. */
+  uint64_t  pageAddr = 0;
+  void     *page     = NULL;
+
+  /* Unmap (and flush) every page the region has faulted in, drop the
+   * reference each mapping holds (the zero page and physical backings
+   * included, they were referenced when mapped). */
+  for (pageAddr = region->regionStart; pageAddr < region->regionEnd;
+       pageAddr += PAGE_SIZE)
+  {
+    page = PortTranslationDel(process->processTranslation, (void *) pageAddr);
+    if (page != NULL)
+    {
+      KernelMemoryPageRelease(PORT_PHYS_TO_VIRT(page));
+    }
+  }
+}
+
+/*****************************************************************************
+ *                         KernelRegionRemove()
+ ****************************************************************************/
+
+error_t KernelRegionRemove (process_t *process,
+                            uint64_t   regionStart,
+                            uint64_t   regionSize)
+{
+  /* Region being removed. */
+  region_t *region    = NULL;
+
+  /* Simplifying variables. */
+  uint64_t  regionEnd = regionStart + regionSize;
+
+  /* Error code. */
+  error_t   err       = KERNEL_SUCCESS;
+
+  /* Validate parameters. */
+  if (regionSize == 0               ||
+      !IS_PAGE_ALIGNED(regionStart) ||
+      !IS_PAGE_ALIGNED(regionSize)  ||
+      regionEnd < regionStart)
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* Split regions straddling the boundaries. The whole removal holds the
+   * mapping lock, so no fault maps the range again half way through. */
+  KernelSpinLock(&process->processMapLock);
+  err = KernelRegionSplitLocked(process, regionStart);
+  if (err == KERNEL_SUCCESS)
+  {
+    err = KernelRegionSplitLocked(process, regionEnd);
+  }
+  if (err != KERNEL_SUCCESS)
+  {
+    KernelSpinUnlock(&process->processMapLock);
+    return err;
+  }
+
+  /* Remove every region fully inside [regionStart, regionEnd). */
+  region = KernelRegionFirstAbove(process->processRegionRoot, regionStart);
+  while (region != NULL && region->regionStart < regionEnd)
+  {
+    /* Detach the region, release its pages and free it. */
+    process->processRegionRoot = KernelRegionDetach(process->processRegionRoot,
+                                                    region->regionStart);
+    process->processRegionCount--;
+    KernelRegionUnmap(process, region);
+    KernelRegionDeallocate(region);
+
+    /* Next overlapping region. */
+    region = KernelRegionFirstAbove(process->processRegionRoot, regionStart);
+  }
+  KernelSpinUnlock(&process->processMapLock);
+
+  /* Done. */
+  return KERNEL_SUCCESS;
+}
+
+/*****************************************************************************
+ *                        KernelRegionFindFree()
+ ****************************************************************************/
+
+error_t KernelRegionFindFree (process_t *process,
+                              uint64_t   regionSize,
+                              uint64_t  *regionStart)
+{
+  /* Lowest free address considered so far. */
+  uint64_t regionCursor = KERNEL_CONFIG_USER_START;
+
+  /* Validate parameters. */
+  if (regionSize == 0 || !IS_PAGE_ALIGNED(regionSize))
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* First fit among the gaps between regions. */
+  if (KernelRegionSearch(process->processRegionRoot, regionSize,
+                         KERNEL_CONFIG_USER_END, &regionCursor) == 0)
+  {
+    /* Otherwise try the space after the last region. */
+    if (regionCursor >= KERNEL_CONFIG_USER_END ||
+        KERNEL_CONFIG_USER_END - regionCursor < regionSize)
+    {
+      return KERNEL_ERR_RESOURCE;
+    }
+  }
+
+  /* Done. */
+  *regionStart = regionCursor;
+  return KERNEL_SUCCESS;
+}
+
+/*****************************************************************************
+ *                       KernelRegionDuplicate()
+ ****************************************************************************/
+
+error_t KernelRegionDuplicate (process_t *dstProcess, process_t *srcProcess)
+{
+  /* Root of the copied tree. */
+  region_t *root = NULL;
+
+  /* Error code. */
+  error_t   err  = KERNEL_SUCCESS;
+
+  /* Copy the whole tree in O(n). */
+  err = KernelRegionCopy(srcProcess->processRegionRoot, &root);
+  if (err != KERNEL_SUCCESS)
+  {
+    KernelRegionFreeTree(root);
+    return err;
+  }
+
+  /* Replace the destination tree. */
+  KernelRegionDestroy(dstProcess);
+  dstProcess->processRegionRoot  = root;
+  dstProcess->processRegionCount = srcProcess->processRegionCount;
+
+  /* Done. */
+  return KERNEL_SUCCESS;
+}
+
+/*****************************************************************************
+ *                        KernelRegionDestroy()
+ ****************************************************************************/
+
+void KernelRegionDestroy (process_t *process)
+{
+  /* Free the whole tree. */
+  KernelRegionFreeTree(process->processRegionRoot);
+
+  /* The process has no regions anymore. */
+  process->processRegionRoot  = NULL;
+  process->processRegionCount = 0;
+}
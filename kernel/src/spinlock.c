@@ -0,0 +1,213 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   kernel/src/spinlock.c
+ * @brief  ARTOS kernel spinlock module.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Kernel includes. */
+#include "kernel/inc/interface.h"
+#include "kernel/inc/internal.h"
+
+/*****************************************************************************
+ *                        KernelSpinInitialize()
+ ****************************************************************************/
+
+void KernelSpinInitialize (spinlock_t *lock)
+{
+  /* No ticket handed out, none served. */
+  lock->lockNext  = 0;
+  lock->lockOwner = 0;
+}
+
+/*****************************************************************************
+ *                           KernelSpinLock()
+ ****************************************************************************/
+
+void KernelSpinLock (spinlock_t *lock)
+{
+  /* Ticket to wait for. */
+  uint32_t ticket = 0;
+
+  /* The holder must not be preempted while others spin on it. */
+  KernelThreadPreemptDisable();
+
+  /* Take a ticket (one atomic add, FIFO fairness). */
+  ticket = PortAtomicFetchAdd32(&lock->lockNext, 1);
+
+  /* Wait for our turn. */
+  while (__atomic_load_n(&lock->lockOwner, __ATOMIC_ACQUIRE) != ticket)
+  {
+    PortCpuRelax();
+  }
+}
+
+/*****************************************************************************
+ *                          KernelSpinUnlock()
+ ****************************************************************************/
+
+void KernelSpinUnlock (spinlock_t *lock)
+{
+  /* Serve the next ticket (only the holder writes lockOwner). */
+  __atomic_store_n(&lock->lockOwner, lock->lockOwner + 1, __ATOMIC_RELEASE);
+
+  /* Preemptible again (a preemption requested meanwhile happens now). */
+  KernelThreadPreemptEnable();
+}
+
+/*****************************************************************************
+ *                          KernelSpinLockIrq()
+ ****************************************************************************/
+
+uint64_t KernelSpinLockIrq (spinlock_t *lock)
+{
+  /* Mask IRQs first: a handler must not spin on a lock we hold. */
+  uint64_t irqState = PortCpuIrqSave();
+
+  /* Lock. */
+  KernelSpinLock(lock);
+
+  /* Done. */
+  return irqState;
+}
+
+/*****************************************************************************
+ *                         KernelSpinUnlockIrq()
+ ****************************************************************************/
+
+void KernelSpinUnlockIrq (spinlock_t *lock, uint64_t irqState)
+{
+  /* Unlock, then restore the saved IRQ mask. */
+  KernelSpinUnlock(lock);
+  PortCpuIrqRestore(irqState);
+
+  /* The lock section may have made a more urgent thread ready. */
+  KernelThreadPreemptCheck();
+}
+
+/*****************************************************************************
+ *                         KernelMcsInitialize()
+ ****************************************************************************/
+
+void KernelMcsInitialize (mcslock_t *lock)
+{
+  /* Empty queue. */
+  lock->lockTail = NULL;
+}
+
+/*****************************************************************************
+ *                            KernelMcsLock()
+ ****************************************************************************/
+
+void KernelMcsLock (mcslock_t *lock, mcs_node_t *node)
+{
+  /* Local variables. */
+  mcs_node_t *prevNode = NULL;
+
+  /* Prepare our queue node (one per CPU: callers are pinned already by
+   * masked IRQs or disabled preemption). */
+  node->nextNode = NULL;
+  node->isLocked = 1;
+
+  /* Join the queue (one atomic swap). */
+  prevNode = (mcs_node_t *) PortAtomicSwap64((uint64_t *) &lock->lockTail,
+                                             (uint64_t) node);
+
+  /* Free? We own it. */
+  if (prevNode == NULL)
+  {
+    return;
+  }
+
+  /* Link behind prev, then spin on our own cache line only. */
+  __atomic_store_n(&prevNode->nextNode, node, __ATOMIC_RELEASE);
+  while (__atomic_load_n(&node->isLocked, __ATOMIC_ACQUIRE))
+  {
+    PortCpuRelax();
+  }
+}
+
+/*****************************************************************************
+ *                           KernelMcsUnlock()
+ ****************************************************************************/
+
+void KernelMcsUnlock (mcslock_t *lock, mcs_node_t *node)
+{
+  /* Successor in the queue. */
+  mcs_node_t *nextNode = __atomic_load_n(&node->nextNode, __ATOMIC_ACQUIRE);
+
+  /* Nobody behind us? Empty the queue, unless someone is joining. */
+  if (nextNode == NULL)
+  {
+    if (PortAtomicCas64((uint64_t *) &lock->lockTail, (uint64_t) node,
+                        (uint64_t) NULL) == (uint64_t) node)
+    {
+      return;
+    }
+
+    /* A newcomer swapped the tail, wait until it links itself. */
+    while ((nextNode = __atomic_load_n(&node->nextNode,
+                                       __ATOMIC_ACQUIRE)) == NULL)
+    {
+      PortCpuRelax();
+    }
+  }
+
+  /* Hand the lock over. */
+  __atomic_store_n(&nextNode->isLocked, 0, __ATOMIC_RELEASE);
+}
+
+/*****************************************************************************
+ *                           KernelMcsLockIrq()
+ ****************************************************************************/
+
+uint64_t KernelMcsLockIrq (mcslock_t *lock, mcs_node_t *node)
+{
+  /* Mask IRQs first: a handler must not spin on a lock we hold. */
+  uint64_t irqState = PortCpuIrqSave();
+
+  /* Lock. */
+  KernelMcsLock(lock, node);
+
+  /* Done. */
+  return irqState;
+}
+
+/*****************************************************************************
+ *                          KernelMcsUnlockIrq()
+ ****************************************************************************/
+
+void KernelMcsUnlockIrq (mcslock_t *lock, mcs_node_t *node, uint64_t irqState)
+{
+  /* Unlock, then restore the saved IRQ mask. */
+  KernelMcsUnlock(lock, node);
+  PortCpuIrqRestore(irqState);
+
+  /* A preemption may have been asked for while IRQs were masked. */
+  KernelThreadPreemptCheck();
+}
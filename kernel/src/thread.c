@@ -44,6 +44,66 @@
 #define MAX_CPU          (KERNEL_CONFIG_MAX_CPU_COUNT)
 #define MAX_PRIORITY     (KERNEL_CONFIG_MAX_PRIOIRTY )
 
+/* Idle threads live in this priority and are never migrated. */
+#define IDLE_PRIORITY    (0)
+
+/* Affinity mask of every CPU. */
+#define ALL_CPUS         (KERNEL_CPU_MASK_ALL)
+
+/* Threads descheduled less than this many switches ago are cache-hot. */
+#define CACHE_HOT        (KERNEL_CONFIG_CACHE_HOT_SWITCHES)
+
+/* Ticks between two balancing passes of a busy CPU. */
+#define BALANCE_TICKS    (KERNEL_CONFIG_BALANCE_TICKS)
+
+/* Thread stacks: mapped pages above an unmapped guard page in a slot. */
+#define STACK_SIZE       (KERNEL_CONFIG_DEFAULT_STACK_SIZE)
+#define STACK_CACHE      (KERNEL_CONFIG_STACK_CACHE_SIZE)
+#define NO_STACK         (~0UL)
+
+/* Fixed-point scale of the EDF utilization (1.0 = 1 << EDF_SHIFT). */
+#define EDF_SHIFT        (20)
+#define EDF_MAX_UTIL     ((KERNEL_CONFIG_EDF_MAX_UTIL_PCT << EDF_SHIFT) / 100)
+
+/* Wake state: runnable (ready or running), woken before it blocked, or
+ * blocked. Changed with compare-and-swap, wakers take no lock. */
+#define THREAD_RUNNABLE  (0UL)
+#define THREAD_WAKEUP    (1UL)
+#define THREAD_BLOCKED   (2UL)
+
+/* Why the running thread should be preempted (bits, see NeedResched). */
+#define PREEMPT_SLICE    (1UL)
+#define PREEMPT_WAKE     (2UL)
+
+/* Time slice bands (priorities split into equal ranges, lowest first). */
+#define SLICE_BANDS      (4)
+
+/*****************************************************************************
+ *                           GLOBAL VARIABLES
+ ****************************************************************************/
+
+/* Threads pulled into each CPU by the balancer. */
+uint64_t KernelThreadMigrations[MAX_CPU];
+
+/* Idle statistics. */
+uint64_t KernelThreadIdleEntries[MAX_CPU];
+uint64_t KernelThreadIdleTime[MAX_CPU];
+uint64_t KernelThreadIdleWakeTimer[MAX_CPU];
+uint64_t KernelThreadIdleWakeOther[MAX_CPU];
+
+/* EDF statistics (jobs finished late, budgets exhausted). */
+uint64_t KernelThreadEdfMisses[MAX_CPU];
+uint64_t KernelThreadEdfOverruns[MAX_CPU];
+
+/* Cross-CPU wake-ups (by target CPU), IPIs sent and taken (by CPU). */
+uint64_t KernelThreadRemoteWakes[MAX_CPU];
+uint64_t KernelThreadIpiSent[MAX_CPU];
+uint64_t KernelThreadIpiReceived[MAX_CPU];
+
+/* Preemptions by reason (time slice expired, more urgent thread woken). */
+uint64_t KernelThreadPreemptSlice[MAX_CPU];
+uint64_t KernelThreadPreemptWake[MAX_CPU];
+
 /*****************************************************************************
  *                           STATIC VARIABLES
  ****************************************************************************/
@@ -53,11 +113,125 @@ static thread_t  KernelThreadList[THREAD_COUNT];
 static thread_t *KernelThreadFreeHead;
 static thread_t *KernelThreadFreeTail;
 
-static thread_t *KernelThreadReadyQuHead[MAX_CPU][MAX_PRIORITY];
-static thread_t *KernelThreadReadyQuTail[MAX_CPU][MAX_PRIORITY];
+/* Ready queue of each CPU and priority (FIFO, threads linked through
+ * threadReadyLink). */
+static list_t    KernelThreadReadyQu[MAX_CPU][MAX_PRIORITY];
+
+/* Bit N set = ready queue N of the CPU is not empty (MAX_PRIORITY <= 64). */
+static uint64_t  KernelThreadReadyMask[MAX_CPU];
+
+/* Number of queued non-idle threads (with the running one, the load used
+ * by the balancer). */
+static uint64_t  KernelThreadReadyCount[MAX_CPU];
+
+/* Periodic ticks taken by each CPU (paces the balancer), and whether its
+ * last balancing pass found only cache-hot threads to pull. */
+static uint64_t  KernelThreadTicks[MAX_CPU];
+static uint64_t  KernelThreadBalanceHot[MAX_CPU];
+
+/* Number of context switches (clock for the cache-hot heuristic). */
+static uint64_t  KernelThreadSwitchCount[MAX_CPU];
 
 static thread_t *KernelThreadRunning[MAX_CPU];
 
+/* Ready EDF threads sorted by absolute deadline (served before priorities). */
+static list_t    KernelThreadEdfQu[MAX_CPU];
+
+/* EDF threads out of budget, throttled until their deadline (sorted by
+ * it, replenished at the schedule points of the CPU). */
+static list_t    KernelThreadEdfThrottled[MAX_CPU];
+
+/* Admitted EDF utilization of each CPU (fixed point, see EDF_SHIFT). */
+static uint64_t  KernelThreadEdfUtil[MAX_CPU];
+
+/* Mapped stack slots recycled by each CPU (LIFO, the hottest on top). */
+static uint64_t  KernelThreadStackCache[MAX_CPU][STACK_CACHE];
+static uint64_t  KernelThreadStackCached[MAX_CPU];
+
+/* Unmapped stack slots given back, and the first never-used slot. */
+static uint64_t  KernelThreadStackFree[THREAD_COUNT];
+static uint64_t  KernelThreadStackFreeCount = 0;
+static uint64_t  KernelThreadStackNext      = 0;
+
+/* Thread that exited on each CPU, reaped by the next one to run there. */
+static thread_t *KernelThreadDead[MAX_CPU];
+
+#if KERNEL_CONFIG_SCHED_STATS
+/* Per-CPU scheduling histograms (counter ticks ready before running and
+ * running before switched out, ready queue length at each switch). */
+static histogram_t KernelThreadWaitHist[MAX_CPU];
+static histogram_t KernelThreadRunHist[MAX_CPU];
+static histogram_t KernelThreadQueueHist[MAX_CPU];
+
+/* Switches away from a thread that gave up the CPU or was preempted. */
+static uint64_t    KernelThreadVoluntary[MAX_CPU];
+static uint64_t    KernelThreadInvoluntary[MAX_CPU];
+#endif
+
+/* Time slice of each priority (counter ticks, 0 = not sliced). */
+static uint64_t  KernelThreadSliceTicks[MAX_PRIORITY];
+
+/* Preemption: disable depth (sections, handlers), pending reasons, and
+ * whether the switch in progress is a preemption. */
+static uint64_t  KernelThreadPreemptCount[MAX_CPU];
+static uint64_t  KernelThreadNeedResched[MAX_CPU];
+static uint64_t  KernelThreadForcing[MAX_CPU];
+
+/* Woken threads pushed by any CPU (LIFO, lock-free), drained by the owner
+ * CPU at its next schedule point. */
+static thread_t *KernelThreadWakeList[MAX_CPU];
+
+/* Scheduler lock (ready queues, running threads, balancer), contended by
+ * every CPU: MCS queue lock, one node per CPU (released on the same CPU by
+ * whichever thread runs after the switch). */
+static mcslock_t  KernelThreadSchedLock;
+static mcs_node_t KernelThreadSchedNodes[MAX_CPU];
+
+/* IRQ mask of the lock holder on each CPU (restored by the unlock). */
+static uint64_t   KernelThreadIrqState[MAX_CPU];
+
+/* Free thread list lock (taken inside the scheduler lock when nested). */
+static spinlock_t KernelThreadFreeLock;
+
+/* Kernel translation table lock (stack slot mappings of every CPU). */
+static spinlock_t KernelThreadStackLock;
+
+/*****************************************************************************
+ *                          KernelThreadLock()
+ ****************************************************************************/
+
+void KernelThreadLock (void)
+{
+  /* Mask IRQs first: pins us to this CPU, no preemption while queued. */
+  uint64_t irqState  = PortCpuIrqSave();
+  uint64_t threadCpu = PortCpuId();
+
+  /* Queue up on the node of this CPU. */
+  KernelMcsLock(&KernelThreadSchedLock, &KernelThreadSchedNodes[threadCpu]);
+
+  /* Only the holder reads it back (a switch carries it along). */
+  KernelThreadIrqState[threadCpu] = irqState;
+}
+
+/*****************************************************************************
+ *                         KernelThreadUnlock()
+ ****************************************************************************/
+
+void KernelThreadUnlock (void)
+{
+  /* Simplifying variables. */
+  uint64_t threadCpu = PortCpuId();
+  uint64_t irqState  = KernelThreadIrqState[threadCpu];
+
+  /* Publish the updates and hand over to the next CPU in the queue. */
+  KernelMcsUnlock(&KernelThreadSchedLock,
+                  &KernelThreadSchedNodes[threadCpu]);
+
+  /* Back to the IRQ mask of the locker, then preempt if we were asked. */
+  PortCpuIrqRestore(irqState);
+  KernelThreadPreemptCheck();
+}
+
 /*****************************************************************************
  *                       KernelThreadInitialize()
  ****************************************************************************/
@@ -73,6 +247,17 @@ void KernelThreadInitialize (void)
   thread_t *idleThread     = NULL;
   thread_t *nextFreeThread = NULL;
 
+  /* Time slice of each band (microseconds). */
+  static const uint64_t sliceUs[SLICE_BANDS] = {
+    KERNEL_CONFIG_SLICE_BAND0_US, KERNEL_CONFIG_SLICE_BAND1_US,
+    KERNEL_CONFIG_SLICE_BAND2_US, KERNEL_CONFIG_SLICE_BAND3_US
+  };
+
+  /* Locks. */
+  KernelMcsInitialize(&KernelThreadSchedLock);
+  KernelSpinInitialize(&KernelThreadFreeLock);
+  KernelSpinInitialize(&KernelThreadStackLock);
+
   /* Initialize head and tail for thread list. */
   KernelThreadFreeHead = &KernelThreadList[0];
   KernelThreadFreeTail = &KernelThreadList[THREAD_COUNT - 1];
@@ -94,9 +279,37 @@ void KernelThreadInitialize (void)
     KernelThreadList[curThread].isUsed          = 0;
     KernelThreadList[curThread].threadId        = curThread;
     KernelThreadList[curThread].threadCpu       = 0;
+    KernelThreadList[curThread].threadAffinity  = ALL_CPUS;
     KernelThreadList[curThread].threadPriority  = 0;
-    KernelThreadList[curThread].nextReadyThread = NULL;
+    KernelThreadList[curThread].threadBase      = 0;
+    KernelThreadList[curThread].threadWaitingOn = NULL;
+    KernelThreadList[curThread].threadMutexes   = NULL;
+    KernelThreadList[curThread].threadProcess   = NULL;
+    KernelThreadList[curThread].threadLastRun   = 0;
+    KernelThreadList[curThread].threadState     = THREAD_RUNNABLE;
+    KernelThreadList[curThread].threadRuntime   = 0;
+    KernelThreadList[curThread].threadPeriod    = 0;
+    KernelThreadList[curThread].threadRelative  = 0;
+    KernelThreadList[curThread].threadDeadline  = 0;
+    KernelThreadList[curThread].threadBudget    = 0;
+    KernelThreadList[curThread].threadRelease   = 0;
+    KernelThreadList[curThread].threadStarted   = 0;
+    KernelThreadList[curThread].threadStack     = NO_STACK;
+    KernelThreadList[curThread].threadExited    = 0;
+    KernelThreadList[curThread].threadJoiner    = 0;
+    KernelThreadList[curThread].threadReadyAt   = 0;
+    KernelThreadList[curThread].threadRunStart  = 0;
+    KernelThreadList[curThread].threadWaitTotal = 0;
+    KernelThreadList[curThread].threadWaitMax   = 0;
+    KernelThreadList[curThread].threadRunTotal  = 0;
+    KernelThreadList[curThread].threadSwitchVol = 0;
+    KernelThreadList[curThread].threadSwitchInv = 0;
+    KernelThreadList[curThread].threadEntry     = 0;
+    KernelThreadList[curThread].threadArg       = NULL;
+    KernelThreadList[curThread].nextWakeThread  = NULL;
     KernelThreadList[curThread].nextFreeThread  = nextFreeThread;
+    KernelListInitialize(&KernelThreadList[curThread].threadWaitLink);
+    KernelListInitialize(&KernelThreadList[curThread].threadReadyLink);
   }
 
   /* Initialize Ready Queue. */
@@ -104,22 +317,81 @@ void KernelThreadInitialize (void)
   {
     for (curPriority = 0; curPriority < MAX_PRIORITY; curPriority++)
     {
-      KernelThreadReadyQuHead[curCpu][curPriority] = NULL;
-      KernelThreadReadyQuTail[curCpu][curPriority] = NULL;
+      KernelListInitialize(&KernelThreadReadyQu[curCpu][curPriority]);
     }
-    KernelThreadRunning[curCpu] = NULL;
+    KernelThreadReadyMask[curCpu]     = 0;
+    KernelThreadReadyCount[curCpu]    = 0;
+    KernelThreadTicks[curCpu]         = 0;
+    KernelThreadBalanceHot[curCpu]    = 0;
+    KernelThreadSwitchCount[curCpu]   = 0;
+    KernelThreadMigrations[curCpu]    = 0;
+    KernelThreadIdleEntries[curCpu]   = 0;
+    KernelThreadIdleTime[curCpu]      = 0;
+    KernelThreadIdleWakeTimer[curCpu] = 0;
+    KernelThreadIdleWakeOther[curCpu] = 0;
+    KernelThreadEdfMisses[curCpu]     = 0;
+    KernelThreadEdfOverruns[curCpu]   = 0;
+    KernelThreadEdfUtil[curCpu]       = 0;
+    KernelListInitialize(&KernelThreadEdfQu[curCpu]);
+    KernelListInitialize(&KernelThreadEdfThrottled[curCpu]);
+    KernelThreadStackCached[curCpu]   = 0;
+#if KERNEL_CONFIG_SCHED_STATS
+    KernelHistogramReset(&KernelThreadWaitHist[curCpu]);
+    KernelHistogramReset(&KernelThreadRunHist[curCpu]);
+    KernelHistogramReset(&KernelThreadQueueHist[curCpu]);
+    KernelThreadVoluntary[curCpu]     = 0;
+    KernelThreadInvoluntary[curCpu]   = 0;
+#endif
+    KernelThreadRemoteWakes[curCpu]   = 0;
+    KernelThreadIpiSent[curCpu]       = 0;
+    KernelThreadIpiReceived[curCpu]   = 0;
+    KernelThreadPreemptSlice[curCpu]  = 0;
+    KernelThreadPreemptWake[curCpu]   = 0;
+    KernelThreadPreemptCount[curCpu]  = 0;
+    KernelThreadNeedResched[curCpu]   = 0;
+    KernelThreadForcing[curCpu]       = 0;
+    KernelThreadDead[curCpu]          = NULL;
+    KernelThreadWakeList[curCpu]      = NULL;
+    KernelThreadRunning[curCpu]       = NULL;
+  }
+
+  /* Time slice of each priority, by band. */
+  for (curPriority = 0; curPriority < MAX_PRIORITY; curPriority++)
+  {
+    KernelThreadSliceTicks[curPriority] =
+      KernelTimerTicks(sliceUs[curPriority * SLICE_BANDS / MAX_PRIORITY]);
   }
 
   /* CREATE IDLE THREAD FOR EVERY PROCESSOR. PRIORITY = 0 */
   for(curCpu = 0; curCpu < MAX_CPU; curCpu ++)
   {
-    /* Allocate new thread. */
+    /* Allocate new thread, it never leaves its CPU. */
     idleThread = KernelThreadAllocate(curCpu, 0);
+    idleThread->threadAffinity = 1UL << curCpu;
 
     /* Admit the idle thread into the ready queue. */
-    KernelThreadReadyQuHead[curCpu][0] = idleThread;
-    KernelThreadReadyQuTail[curCpu][0] = idleThread;
+    KernelThreadAdmit(idleThread);
   }
+
+  /* The boot context becomes the idle thread of the boot CPU. */
+  KernelThreadAdopt(PortCpuId());
+}
+
+/*****************************************************************************
+ *                          KernelThreadAdopt()
+ ****************************************************************************/
+
+void KernelThreadAdopt (uint64_t threadCpu)
+{
+  /* The CPU takes part in grace periods from now on. */
+  KernelRcuIdleExit();
+
+  /* The calling context becomes the idle thread of the CPU. */
+  KernelThreadLock();
+  KernelThreadRunning[threadCpu] = KernelThreadDispatch(threadCpu,
+                                                        IDLE_PRIORITY);
+  PortThreadAdopt(KernelThreadRunning[threadCpu]->threadId);
+  KernelThreadUnlock();
 }
 
 /*****************************************************************************
@@ -133,45 +405,100 @@ thread_t *KernelThreadAllocate (uint64_t threadCpu,
   thread_t *thread = NULL;
 
   /* Check if there is no free thread. */
+  KernelSpinLock(&KernelThreadFreeLock);
   if (KernelThreadFreeHead == NULL)
   {
+    KernelSpinUnlock(&KernelThreadFreeLock);
     return NULL;
   }
 
   /* Allocate new thread from head. */
   thread = KernelThreadFreeHead;
   KernelThreadFreeHead = thread->nextFreeThread;
+  KernelSpinUnlock(&KernelThreadFreeLock);
 
   /* Initialize the new thread. */
-  thread->isUsed          = 1;
   thread->threadCpu       = threadCpu;
+  thread->threadAffinity  = ALL_CPUS;
   thread->threadPriority  = threadPriority;
+  thread->threadBase      = threadPriority;
+  thread->threadWaitingOn = NULL;
+  thread->threadMutexes   = NULL;
+  thread->threadProcess   = NULL;
+  thread->threadLastRun   = 0;
+  thread->threadState     = THREAD_RUNNABLE;
+  thread->threadRuntime   = 0;
+  thread->threadPeriod    = 0;
+  thread->threadRelative  = 0;
+  thread->threadDeadline  = 0;
+  thread->threadBudget    = 0;
+  thread->threadRelease   = 0;
+  thread->threadStarted   = 0;
+  thread->threadStack     = NO_STACK;
+  thread->threadExited    = 0;
+  thread->threadJoiner    = 0;
+  thread->threadReadyAt   = 0;
+  thread->threadRunStart  = 0;
+  thread->threadWaitTotal = 0;
+  thread->threadWaitMax   = 0;
+  thread->threadRunTotal  = 0;
+  thread->threadSwitchVol = 0;
+  thread->threadSwitchInv = 0;
+  thread->threadEntry     = 0;
+  thread->threadArg       = NULL;
   thread->nextFreeThread  = NULL;
-  thread->nextReadyThread = NULL;
+  thread->nextWakeThread  = NULL;
+  KernelListInitialize(&thread->threadWaitLink);
+  KernelListInitialize(&thread->threadReadyLink);
 
   /* Finalize the allocation process at the port. */
   PortThreadAllocate(thread->threadId);
 
+  /* Publish it to lock-free lookups once it is fully set up. */
+  __atomic_store_n(&thread->isUsed, 1, __ATOMIC_RELEASE);
+
   /* Done. */
   return thread;
 }
 
 /*****************************************************************************
- *                        KernelThreadDeallocate()
+ *                          KernelThreadFree()
  ****************************************************************************/
 
-void KernelThreadDeallocate (thread_t *thread)
+static void KernelThreadFree (void *arg)
 {
-  /* Free up the thread. */
-  thread->isUsed         = 0;
-  thread->nextFreeThread = NULL;
+  /* Simplifying variables. */
+  thread_t *thread = (thread_t *) arg;
 
   /* Finalize the deallocation process at the port. */
+  thread->nextFreeThread = NULL;
   PortThreadDeallocate(thread->threadId);
 
   /* Insert into the free thread list. */
-  KernelThreadFreeTail->nextFreeThread = thread;
-  KernelThreadFreeTail                 = thread;
+  KernelSpinLock(&KernelThreadFreeLock);
+  if (KernelThreadFreeHead == NULL)
+  {
+    KernelThreadFreeHead = thread;
+  }
+  else
+  {
+    KernelThreadFreeTail->nextFreeThread = thread;
+  }
+  KernelThreadFreeTail = thread;
+  KernelSpinUnlock(&KernelThreadFreeLock);
+}
+
+/*****************************************************************************
+ *                        KernelThreadDeallocate()
+ ****************************************************************************/
+
+void KernelThreadDeallocate (thread_t *thread)
+{
+  /* Unpublish it: lookups by ID fail from now on. */
+  __atomic_store_n(&thread->isUsed, 0, __ATOMIC_SEQ_CST);
+
+  /* Lock-free readers may still use it, reuse it after a grace period. */
+  KernelRcuRetire(&thread->threadRcu, KernelThreadFree, thread);
 }
 
 /*****************************************************************************
@@ -192,8 +519,9 @@ thread_t *KernelThreadGet (uint64_t threadId)
   /* Obtain the thread structure by Id. */
   thread = &KernelThreadList[threadId];
 
-  /* Check whether the thread is already allocated or not. */
-  if (thread->isUsed == 0)
+  /* Check whether the thread is already allocated or not (no lock needed,
+   * a deallocated thread stays intact until every CPU moved on). */
+  if (__atomic_load_n(&thread->isUsed, __ATOMIC_ACQUIRE) == 0)
   {
     return NULL;
   }
@@ -203,173 +531,2010 @@ thread_t *KernelThreadGet (uint64_t threadId)
 }
 
 /*****************************************************************************
- *                        KernelThreadAdmit()
+ *                          KernelThreadCurrent()
  ****************************************************************************/
 
-void KernelThreadAdmit (thread_t *thread)
+thread_t *KernelThreadCurrent (void)
+{
+  /* Pinned between reading the CPU and its running thread. */
+  uint64_t  irqState = PortCpuIrqSave();
+  thread_t *thread   = KernelThreadRunning[PortCpuId()];
+
+  /* Thread running on the calling CPU. */
+  PortCpuIrqRestore(irqState);
+  return thread;
+}
+
+/*****************************************************************************
+ *                        KernelThreadEdfInsert()
+ ****************************************************************************/
+
+static void KernelThreadEdfInsert (list_t *edfQueue, thread_t *thread)
 {
   /* Simplifying variables. */
-  uint64_t threadCpu      = 0;
-  uint64_t threadPriority = 0;
-  thread_t *threadHead    = NULL;
-  thread_t *threadTail    = NULL;
+  list_t *prevLink = edfQueue->listPrev;
+
+  /* Insert by absolute deadline, FIFO among equal deadlines (from the
+   * tail: fresh deadlines are usually the latest). */
+  while (prevLink != edfQueue &&
+         KERNEL_LIST_ENTRY(prevLink, thread_t,
+                           threadReadyLink)->threadDeadline >
+         thread->threadDeadline)
+  {
+    prevLink = prevLink->listPrev;
+  }
+  KernelListInsert(prevLink, &thread->threadReadyLink);
+}
 
-  /* Obtain thread CPU and priority. */
-  threadCpu = thread->threadCpu;
-  threadPriority = thread->threadPriority;
+/*****************************************************************************
+ *                        KernelThreadEdfAdmit()
+ ****************************************************************************/
 
-  /* Obtain ready queue head and tail. */
-  threadHead = KernelThreadReadyQuHead[threadCpu][threadPriority];
-  threadTail = KernelThreadReadyQuTail[threadCpu][threadPriority];
+static void KernelThreadEdfAdmit (thread_t *thread)
+{
+  /* Simplifying variables. */
+  uint64_t threadCpu = thread->threadCpu;
+  uint64_t now       = PortTimerNow();
 
-  /* Enqueue */
-  if(threadTail == NULL)
+  /* Out of budget before its deadline: throttled until then (hard CBS,
+   * the reserved bandwidth is all it gets). */
+  if (thread->threadBudget == 0 && thread->threadDeadline > now)
   {
-    threadHead = thread;
-    threadTail = thread;
+    KernelThreadEdfInsert(&KernelThreadEdfThrottled[threadCpu], thread);
+    return;
   }
-  else
+
+  /* CBS wake-up rule: a stale deadline or a budget that would exceed the
+   * reserved bandwidth until it gets a fresh deadline and a full budget. */
+  if (thread->threadDeadline <= now ||
+      thread->threadBudget * thread->threadPeriod >
+      (thread->threadDeadline - now) * thread->threadRuntime)
   {
-    threadTail->nextReadyThread = thread;
-    threadTail = thread;
+    thread->threadDeadline = now + thread->threadRelative;
+    thread->threadBudget   = thread->threadRuntime;
   }
 
-  /* Store the new values of ready queue head and tail. */
-  KernelThreadReadyQuTail[threadCpu][threadPriority] = threadTail;
-  KernelThreadReadyQuHead[threadCpu][threadPriority] = threadHead;
+  /* Ready, by deadline. */
+  KernelThreadEdfInsert(&KernelThreadEdfQu[threadCpu], thread);
 }
 
 /*****************************************************************************
- *                       KernelThreadDispatch()
+ *                       KernelThreadEdfCharge()
  ****************************************************************************/
 
-thread_t *KernelThreadDispatch (uint64_t threadCpu,
-                                uint64_t threadPriority)
+static void KernelThreadEdfCharge (thread_t *thread)
 {
-  /* Thread to be returned. */
-  thread_t *thread     = NULL;
-
   /* Simplifying variables. */
-  thread_t *threadHead = NULL;
-  thread_t *threadTail = NULL;
-
-  /* Obtain ready queue head and tail. */
-  threadHead = KernelThreadReadyQuHead[threadCpu][threadPriority];
-  threadTail = KernelThreadReadyQuTail[threadCpu][threadPriority];
+  uint64_t now  = PortTimerNow();
+  uint64_t used = now - thread->threadStarted;
 
-  /* Check whether the ready queue is empty or not. */
-  if (threadHead == NULL)
+  /* Fixed-priority threads have no budget. */
+  thread->threadStarted = now;
+  if (thread->threadRuntime == 0)
   {
-    return NULL;
+    return;
   }
 
-  /* Dequeue */
-  threadHead = threadHead->nextReadyThread;
-  if (threadHead == NULL)
+  /* Consume the budget, an exhausted one is refilled at the deadline. */
+  if (used >= thread->threadBudget)
   {
-    threadTail = NULL;
+    if (thread->threadBudget != 0)
+    {
+      KernelThreadEdfOverruns[thread->threadCpu]++;
+    }
+    thread->threadBudget = 0;
+    return;
   }
+  thread->threadBudget -= used;
+}
 
-  /* Clean up nextReadyThread pointer. */
-  thread->nextReadyThread = NULL;
+/*****************************************************************************
+ *                        KernelThreadHasWork()
+ ****************************************************************************/
 
-  /* Store the new values of ready queue head and tail. */
-  KernelThreadReadyQuHead[threadCpu][threadPriority] = threadHead;
-  KernelThreadReadyQuTail[threadCpu][threadPriority] = threadTail;
+static uint64_t KernelThreadHasWork (uint64_t threadCpu)
+{
+  /* Any ready thread other than idle, or a pending wake-up (read without
+   * the lock by idle). */
+  return (__atomic_load_n(&KernelThreadReadyMask[threadCpu],
+                          __ATOMIC_RELAXED) & ~(1UL << IDLE_PRIORITY)) != 0 ||
+         __atomic_load_n(&KernelThreadEdfQu[threadCpu].listNext,
+                         __ATOMIC_RELAXED) != &KernelThreadEdfQu[threadCpu] ||
+         __atomic_load_n(&KernelThreadWakeList[threadCpu],
+                         __ATOMIC_RELAXED) != NULL;
+}
 
-  /* Done. */
-  return thread;
+/*****************************************************************************
+ *                        KernelThreadOutranks()
+ ****************************************************************************/
+
+static uint64_t KernelThreadOutranks (thread_t *thread, thread_t *running)
+{
+  /* Nothing or idle running: any thread does. */
+  if (running == NULL || running->threadPriority == IDLE_PRIORITY)
+  {
+    return 1;
+  }
+
+  /* Deadline threads only yield to an earlier deadline (a woken one gets
+   * its new deadline at admission, the CPU that admits it decides). */
+  if (running->threadRuntime != 0)
+  {
+    return thread->threadRuntime != 0 &&
+           thread->threadDeadline < running->threadDeadline;
+  }
+
+  /* EDF goes before priorities, otherwise a strictly higher priority. */
+  return thread->threadRuntime != 0 ||
+         thread->threadPriority > running->threadPriority;
 }
 
 /*****************************************************************************
- *                         KernelThreadRun()
+ *                          KernelThreadKick()
  ****************************************************************************/
 
-void KernelThreadRun (uint64_t threadId)
+static void KernelThreadKick (thread_t *thread, uint64_t threadCpu)
 {
-  /* Put thread on the CPU and RESTORE its context. */
+  /* Simplifying variables (callers are pinned). */
+  uint64_t  selfCpu = PortCpuId();
+  thread_t *running = NULL;
+
+  /* Interrupt only idle CPUs or ones running less urgent work, the others
+   * find the thread when they schedule next (racy read, a stale value
+   * costs one spurious IPI or one schedule point of latency). */
+  running = __atomic_load_n(&KernelThreadRunning[threadCpu], __ATOMIC_RELAXED);
+  if (!KernelThreadOutranks(thread, running))
+  {
+    return;
+  }
+
+  /* Our own CPU: preempt at the next preemption point, which drains the
+   * list first. */
+  if (threadCpu == selfCpu)
+  {
+    KernelThreadNeedResched[selfCpu] |= PREEMPT_WAKE;
+    return;
+  }
 
-  /* Update KernelThreadRunning */
+  /* Not started yet? It looks at its queues when it comes up. */
+  if (running == NULL)
+  {
+    return;
+  }
 
-  (void) threadId;
+  /* Software-generated interrupt to the target CPU. */
+  KernelThreadIpiSent[selfCpu]++;
+  PortInterruptSend(threadCpu, PORT_INTERRUPT_WAKEUP);
 }
 
 /*****************************************************************************
- *                        KernelThreadPause()
+ *                        KernelThreadAdmit()
  ****************************************************************************/
 
-uint64_t KernelThreadPause (void)
+void KernelThreadAdmit (thread_t *thread)
 {
-  /* Read KernelThreadRunning */
+  /* Simplifying variables. */
+  uint64_t threadCpu      = 0;
+  uint64_t threadPriority = 0;
+
+#if KERNEL_CONFIG_SCHED_STATS
+  /* Ready since now (a migration or requeue keeps the first stamp). */
+  if (thread->threadReadyAt == 0)
+  {
+    thread->threadReadyAt = PortTimerNow();
+  }
+#endif
+
+  /* More urgent than the thread running on its CPU? Preempt it as soon
+   * as it is preemptible, here or through an IPI (the scheduler lock is
+   * held, we are pinned). */
+  threadCpu = thread->threadCpu;
+  KernelThreadKick(thread, threadCpu);
+
+  /* Deadline threads go to the EDF queue instead. */
+  if (thread->threadRuntime != 0)
+  {
+    KernelThreadEdfAdmit(thread);
+    return;
+  }
+
+  /* Obtain thread priority. */
+  threadPriority = thread->threadPriority;
 
-  /* Remove thread from the CPU and STORE its context. */
+  /* Enqueue at the tail. */
+  KernelListAppend(&KernelThreadReadyQu[threadCpu][threadPriority],
+                   &thread->threadReadyLink);
 
-  return 0;
+  /* The queue is not empty anymore. */
+  KernelThreadReadyMask[threadCpu] |= 1UL << threadPriority;
+
+  /* Account the load. */
+  if (threadPriority != IDLE_PRIORITY)
+  {
+    KernelThreadReadyCount[threadCpu]++;
+  }
 }
 
 /*****************************************************************************
- *                           KernelThreadIdle()
+ *                         KernelThreadDequeue()
  ****************************************************************************/
 
-void KernelThreadIdle(void *arg)
+uint64_t KernelThreadDequeue (thread_t *thread)
 {
-  KernelPrintFmt("Hello from idle thread! %p\n", arg);
-  while (1);
+  /* Simplifying variables. */
+  uint64_t  threadCpu      = thread->threadCpu;
+  uint64_t  threadPriority = thread->threadPriority;
+
+  /* Not queued (an unlinked node points to itself). */
+  if (KernelListEmpty(&thread->threadReadyLink))
+  {
+    return 0;
+  }
+
+  /* Unlink, wherever it sits in its queue. */
+  KernelListRemove(&thread->threadReadyLink);
+
+  /* Deadline threads leave the EDF (or throttled) queue, no mask or load
+   * to update. */
+  if (thread->threadRuntime != 0)
+  {
+    return 1;
+  }
+
+  /* Was it the last one? */
+  if (KernelListEmpty(&KernelThreadReadyQu[threadCpu][threadPriority]))
+  {
+    KernelThreadReadyMask[threadCpu] &= ~(1UL << threadPriority);
+  }
+
+  /* Account the load. */
+  if (threadPriority != IDLE_PRIORITY)
+  {
+    KernelThreadReadyCount[threadCpu]--;
+  }
+
+  /* Done. */
+  return 1;
 }
 
 /*****************************************************************************
- *                        KernelThreadScheduler()
+ *                       KernelThreadDispatch()
  ****************************************************************************/
 
-void KernelThreadScheduler()
+thread_t *KernelThreadDispatch (uint64_t threadCpu,
+                                uint64_t threadPriority)
 {
-  /* Dispatch highest-priority job and run it on all processors. */
+  /* Thread to be returned. */
+  thread_t *thread     = NULL;
+
+  /* Simplifying variables. */
+  list_t   *readyQueue = &KernelThreadReadyQu[threadCpu][threadPriority];
+
+  /* Check whether the ready queue is empty or not. */
+  if (KernelListEmpty(readyQueue))
+  {
+    return NULL;
+  }
+
+  /* Dequeue the head. */
+  thread = KERNEL_LIST_ENTRY(readyQueue->listNext, thread_t,
+                             threadReadyLink);
+  KernelThreadDequeue(thread);
+
+  /* Done. */
+  return thread;
 }
 
 /*****************************************************************************
- *                         KernelThreadCreate()
+ *                       KernelThreadSetPriority()
  ****************************************************************************/
 
-void KernelThreadCreate (void)
+void KernelThreadSetPriority (thread_t *thread, uint64_t threadPriority)
 {
+  /* Nothing to do? */
+  if (thread->threadPriority == threadPriority)
+  {
+    return;
+  }
+
+  /* Lowered while running here? A ready thread may outrank it now. */
+  if (KernelThreadRunning[thread->threadCpu] == thread &&
+      thread->threadCpu == PortCpuId() &&
+      threadPriority < thread->threadPriority)
+  {
+    KernelThreadNeedResched[thread->threadCpu] |= PREEMPT_WAKE;
+  }
+
+  /* Running, blocked or EDF: the priority is only read at the next admit. */
+  if (KernelThreadRunning[thread->threadCpu] == thread ||
+      thread->threadState == THREAD_BLOCKED || thread->threadRuntime != 0)
+  {
+    thread->threadPriority = threadPriority;
+    return;
+  }
+
+  /* Ready: move it to the queue of the new priority. */
+  if (KernelThreadDequeue(thread))
+  {
+    thread->threadPriority = threadPriority;
+    KernelThreadAdmit(thread);
+  }
+  else
+  {
+    thread->threadPriority = threadPriority;
+  }
 }
 
 /*****************************************************************************
- *                        KernelThreadYield()
+ *                          KernelThreadSteal()
  ****************************************************************************/
 
-void KernelThreadYield (void)
+static thread_t *KernelThreadSteal (uint64_t victimCpu,
+                                    uint64_t threadCpu,
+                                    uint64_t force)
 {
+  /* Local variables. */
+  uint64_t  readyMask   = 0;
+  uint64_t  curPriority = 0;
+  uint64_t  cpuBit      = 1UL << threadCpu;
+  list_t   *readyQueue  = NULL;
+  list_t   *curLink     = NULL;
+  thread_t *curThread   = NULL;
+  thread_t *thread      = NULL;
+  thread_t *firstThread = NULL;
+
+  /* Highest priorities first, idle threads are never stolen. */
+  readyMask = KernelThreadReadyMask[victimCpu] & ~(1UL << IDLE_PRIORITY);
+  while (readyMask != 0)
+  {
+    /* Next non-empty priority. */
+    curPriority = 63 - __builtin_clzl(readyMask);
+    readyMask  &= ~(1UL << curPriority);
+
+    /* Look for a thread allowed here whose cache footprint is gone. */
+    firstThread = NULL;
+    readyQueue  = &KernelThreadReadyQu[victimCpu][curPriority];
+    for (curLink = readyQueue->listNext; curLink != readyQueue;
+         curLink = curLink->listNext)
+    {
+      curThread = KERNEL_LIST_ENTRY(curLink, thread_t, threadReadyLink);
+      if (curThread->threadAffinity & cpuBit)
+      {
+        if (KernelThreadSwitchCount[victimCpu] - curThread->threadLastRun >=
+            CACHE_HOT)
+        {
+          thread = curThread;
+          break;
+        }
+        if (firstThread == NULL)
+        {
+          firstThread = curThread;
+        }
+      }
+    }
+
+    /* First allowed one is the closest to the head. */
+    if (thread == NULL && force)
+    {
+      thread = firstThread;
+    }
+
+    /* Found? Leave the loop. */
+    if (thread != NULL)
+    {
+      break;
+    }
+  }
+
+  /* Nothing suitable. */
+  if (thread == NULL)
+  {
+    return NULL;
+  }
+
+  /* Unlink it, wherever it sits in the queue. */
+  KernelThreadDequeue(thread);
+
+  /* Done. */
+  return thread;
 }
 
 /*****************************************************************************
- *                        KernelThreadBlock()
+ *                         KernelThreadMigrate()
  ****************************************************************************/
 
-void KernelThreadBlock (void)
+static void KernelThreadMigrate (thread_t *thread, uint64_t threadCpu)
 {
+  /* Move the thread to the ready queue of its new CPU. */
+  thread->threadCpu = threadCpu;
+  KernelThreadAdmit(thread);
+
+  /* Statistics. */
+  KernelThreadMigrations[threadCpu]++;
 }
 
 /*****************************************************************************
- *                       KernelThreadUnblock()
+ *                          KernelThreadLoad()
  ****************************************************************************/
 
-void KernelThreadUnblock (void)
+static uint64_t KernelThreadLoad (uint64_t threadCpu)
 {
+  /* Simplifying variables. */
+  thread_t *running = KernelThreadRunning[threadCpu];
+
+  /* Queued threads plus the running one, unless it is idle. */
+  return KernelThreadReadyCount[threadCpu] +
+         (running != NULL && running->threadPriority != IDLE_PRIORITY);
 }
 
 /*****************************************************************************
- *                      KernelThreadTerminate()
+ *                         KernelThreadBusiest()
  ****************************************************************************/
 
-void KernelThreadTerminate (void)
+static uint64_t KernelThreadBusiest (uint64_t threadCpu)
 {
+  /* Loop counter and result. */
+  uint64_t curCpu     = 0;
+  uint64_t busiestCpu = threadCpu;
+
+  /* CPU with the highest load (ties keep the first). */
+  for (curCpu = 0; curCpu < MAX_CPU; curCpu++)
+  {
+    if (KernelThreadLoad(curCpu) > KernelThreadLoad(busiestCpu))
+    {
+      busiestCpu = curCpu;
+    }
+  }
+
+  /* Done. */
+  return busiestCpu;
 }
 
 /*****************************************************************************
- *                       KernelThreadJoin()
+ *                        KernelThreadBalanceIdle()
  ****************************************************************************/
 
-void KernelThreadJoin (void)
+static void KernelThreadBalanceIdle (uint64_t threadCpu)
 {
+  /* Local variables. */
+  uint64_t  busiestCpu = 0;
+  thread_t *thread     = NULL;
+
+  /* Anyone with waiting threads? */
+  busiestCpu = KernelThreadBusiest(threadCpu);
+  if (busiestCpu == threadCpu)
+  {
+    return;
+  }
+
+  /* An idle CPU is worse than a cold cache: always take one. */
+  thread = KernelThreadSteal(busiestCpu, threadCpu, 1);
+  if (thread != NULL)
+  {
+    KernelThreadMigrate(thread, threadCpu);
+  }
+}
+
+/*****************************************************************************
+ *                         KernelThreadBalance()
+ ****************************************************************************/
+
+void KernelThreadBalance (uint64_t threadCpu)
+{
+  /* Local variables. */
+  uint64_t  busiestCpu = 0;
+  uint64_t  imbalance  = 0;
+  thread_t *thread     = NULL;
+
+  /* Find the busiest CPU. */
+  KernelThreadLock();
+  busiestCpu = KernelThreadBusiest(threadCpu);
+  if (busiestCpu == threadCpu)
+  {
+    KernelThreadUnlock();
+    return;
+  }
+
+  /* Pull half of the difference, cache-hot threads stay unless the last
+   * pass already left the imbalance in place because of them. */
+  imbalance = (KernelThreadLoad(busiestCpu) -
+               KernelThreadLoad(threadCpu)) / 2;
+  while (imbalance > 0)
+  {
+    thread = KernelThreadSteal(busiestCpu, threadCpu,
+                               KernelThreadBalanceHot[threadCpu]);
+    if (thread == NULL)
+    {
+      break;
+    }
+    KernelThreadMigrate(thread, threadCpu);
+    imbalance--;
+  }
+  KernelThreadBalanceHot[threadCpu] = imbalance > 0;
+  KernelThreadUnlock();
+}
+
+/*****************************************************************************
+ *                        KernelThreadDrain()
+ ****************************************************************************/
+
+static void KernelThreadDrain (uint64_t threadCpu)
+{
+  /* Local variables. */
+  thread_t *thread   = NULL;
+  thread_t *ordered  = NULL;
+  thread_t *nextWake = NULL;
+
+  /* Take the whole list at once, pushers never wait for us. */
+  if (__atomic_load_n(&KernelThreadWakeList[threadCpu],
+                      __ATOMIC_RELAXED) == NULL)
+  {
+    return;
+  }
+  thread = (thread_t *) PortAtomicSwap64(
+             (uint64_t *) &KernelThreadWakeList[threadCpu], (uint64_t) NULL);
+
+  /* Newest first: reverse it to admit in wake-up order. */
+  while (thread != NULL)
+  {
+    nextWake               = thread->nextWakeThread;
+    thread->nextWakeThread = ordered;
+    ordered                = thread;
+    thread                 = nextWake;
+  }
+
+  /* Make them ready (the scheduler lock is held). Moved to another CPU
+   * since they were pushed? Admission notifies that one. */
+  while (ordered != NULL)
+  {
+    nextWake                = ordered->nextWakeThread;
+    ordered->nextWakeThread = NULL;
+    KernelThreadAdmit(ordered);
+    ordered                 = nextWake;
+  }
+}
+
+/*****************************************************************************
+ *                      KernelThreadEdfReplenish()
+ ****************************************************************************/
+
+static void KernelThreadEdfReplenish (uint64_t threadCpu)
+{
+  /* Simplifying variables. */
+  uint64_t  now       = PortTimerNow();
+  list_t   *throttled = &KernelThreadEdfThrottled[threadCpu];
+  thread_t *thread    = NULL;
+
+  /* Deadline reached: ready again, admission gives it a fresh deadline
+   * and a full budget (the scheduler lock is held). */
+  while (!KernelListEmpty(throttled))
+  {
+    thread = KERNEL_LIST_ENTRY(throttled->listNext, thread_t,
+                               threadReadyLink);
+    if (thread->threadDeadline > now)
+    {
+      break;
+    }
+    KernelListRemove(&thread->threadReadyLink);
+    KernelThreadAdmit(thread);
+  }
+}
+
+/*****************************************************************************
+ *                      KernelThreadDispatchNext()
+ ****************************************************************************/
+
+thread_t *KernelThreadDispatchNext (uint64_t threadCpu)
+{
+  /* Simplifying variables. */
+  uint64_t  readyMask = 0;
+  list_t   *edfQueue  = NULL;
+  thread_t *thread    = NULL;
+
+  /* Threads woken up by other CPUs or replenished join the ready queues
+   * first. */
+  KernelThreadDrain(threadCpu);
+  KernelThreadEdfReplenish(threadCpu);
+  readyMask = KernelThreadReadyMask[threadCpu];
+  edfQueue  = &KernelThreadEdfQu[threadCpu];
+
+  /* Earliest deadline first, before every fixed priority. */
+  if (!KernelListEmpty(edfQueue))
+  {
+    thread = KERNEL_LIST_ENTRY(edfQueue->listNext, thread_t,
+                               threadReadyLink);
+    KernelThreadDequeue(thread);
+    return thread;
+  }
+
+  /* Nothing ready? */
+  if (readyMask == 0)
+  {
+    return NULL;
+  }
+
+  /* Highest non-empty priority is the most significant set bit (CLZ). */
+  return KernelThreadDispatch(threadCpu, 63 - __builtin_clzl(readyMask));
+}
+
+/*****************************************************************************
+ *                         KernelThreadStackTop()
+ ****************************************************************************/
+
+static void *KernelThreadStackTop (uint64_t stackSlot)
+{
+  /* Guard page first, the stack grows down towards it. */
+  return ((uint8_t *) PortThreadStackSlot(stackSlot)) + PAGE_SIZE + STACK_SIZE;
+}
+
+/*****************************************************************************
+ *                        KernelThreadStackUnmap()
+ ****************************************************************************/
+
+static void KernelThreadStackUnmap (uint64_t stackSlot, uint64_t pageCount)
+{
+  /* Local variables. */
+  uint8_t *stackBase = ((uint8_t *) PortThreadStackSlot(stackSlot)) + PAGE_SIZE;
+  void    *page      = NULL;
+  uint64_t curPage   = 0;
+
+  /* Unmap (and flush) every page, give the memory back. */
+  for (curPage = 0; curPage < pageCount; curPage++)
+  {
+    KernelSpinLock(&KernelThreadStackLock);
+    page = PortTranslationDel(NULL, stackBase + curPage * PAGE_SIZE);
+    KernelSpinUnlock(&KernelThreadStackLock);
+    if (page != NULL)
+    {
+      KernelMemoryPageDeallocate(PORT_PHYS_TO_VIRT(page));
+    }
+  }
+}
+
+/*****************************************************************************
+ *                         KernelThreadStackMap()
+ ****************************************************************************/
+
+static error_t KernelThreadStackMap (uint64_t stackSlot)
+{
+  /* Local variables. */
+  uint8_t *stackBase = ((uint8_t *) PortThreadStackSlot(stackSlot)) + PAGE_SIZE;
+  void    *page      = NULL;
+  void    *mapped    = NULL;
+  uint64_t curPage   = 0;
+
+  /* Back the stack with fresh pages, the guard page stays unmapped. */
+  for (curPage = 0; curPage < STACK_SIZE / PAGE_SIZE; curPage++)
+  {
+    page = KernelMemoryPageAllocate();
+    if (page == NULL)
+    {
+      KernelThreadStackUnmap(stackSlot, curPage);
+      return KERNEL_ERR_RESOURCE;
+    }
+
+    /* The kernel table is shared by every CPU: serialize the update. */
+    KernelSpinLock(&KernelThreadStackLock);
+    mapped = PortTranslationSet(NULL, stackBase + curPage * PAGE_SIZE,
+                                PORT_VIRT_TO_PHYS(page),
+                                PORT_TRANSLATION_READ |
+                                PORT_TRANSLATION_WRITE);
+    KernelSpinUnlock(&KernelThreadStackLock);
+
+    /* Out of table memory (or a stale mapping)? Undo what was mapped. */
+    if (mapped != PORT_VIRT_TO_PHYS(page))
+    {
+      KernelMemoryPageDeallocate(page);
+      KernelThreadStackUnmap(stackSlot, curPage);
+      return KERNEL_ERR_RESOURCE;
+    }
+  }
+
+  /* Done. */
+  return KERNEL_SUCCESS;
+}
+
+/*****************************************************************************
+ *                       KernelThreadStackRelease()
+ ****************************************************************************/
+
+static void KernelThreadStackRelease (uint64_t threadCpu, uint64_t stackSlot)
+{
+  /* Keep it mapped for the next thread created on this CPU. */
+  if (KernelThreadStackCached[threadCpu] < STACK_CACHE)
+  {
+    KernelThreadStackCache[threadCpu][KernelThreadStackCached[threadCpu]++] =
+      stackSlot;
+    return;
+  }
+
+  /* Cache full: unmap it and give the slot back. */
+  KernelThreadStackUnmap(stackSlot, STACK_SIZE / PAGE_SIZE);
+  KernelThreadStackFree[KernelThreadStackFreeCount++] = stackSlot;
+}
+
+/*****************************************************************************
+ *                          KernelThreadReap()
+ ****************************************************************************/
+
+static void KernelThreadReap (void)
+{
+  /* Simplifying variables. */
+  uint64_t  threadCpu = PortCpuId();
+  thread_t *thread    = KernelThreadDead[threadCpu];
+
+  /* Nobody exited on this CPU? */
+  if (thread == NULL)
+  {
+    return;
+  }
+
+  /* We are off its stack now: recycle the stack and the thread. */
+  KernelThreadDead[threadCpu] = NULL;
+  if (thread->threadStack != NO_STACK)
+  {
+    KernelThreadStackRelease(threadCpu, thread->threadStack);
+  }
+  KernelThreadDeallocate(thread);
+}
+
+#if KERNEL_CONFIG_SCHED_STATS
+/*****************************************************************************
+ *                         KernelThreadAccount()
+ ****************************************************************************/
+
+static void KernelThreadAccount (uint64_t  threadCpu,
+                                 thread_t *prevThread,
+                                 thread_t *nextThread,
+                                 uint64_t  isForced)
+{
+  /* Switch time, already read by KernelThreadEdfCharge(). */
+  uint64_t now  = prevThread->threadStarted;
+  uint64_t span = 0;
+
+  /* Queue length seen by this dispatch. */
+  KernelHistogramAdd(&KernelThreadQueueHist[threadCpu],
+                     KernelThreadReadyCount[threadCpu]);
+
+  /* Prev: run time, and whether it gave up the CPU or was preempted. */
+  if (prevThread->threadPriority != IDLE_PRIORITY &&
+      prevThread->threadRunStart != 0)
+  {
+    span = now - prevThread->threadRunStart;
+    prevThread->threadRunTotal += span;
+    KernelHistogramAdd(&KernelThreadRunHist[threadCpu], span);
+  }
+  if (isForced)
+  {
+    prevThread->threadSwitchInv++;
+    KernelThreadInvoluntary[threadCpu]++;
+  }
+  else
+  {
+    prevThread->threadSwitchVol++;
+    KernelThreadVoluntary[threadCpu]++;
+  }
+
+  /* Next: how long it waited in a ready queue. */
+  if (nextThread->threadPriority != IDLE_PRIORITY &&
+      nextThread->threadReadyAt != 0)
+  {
+    span = now - nextThread->threadReadyAt;
+    nextThread->threadWaitTotal += span;
+    if (span > nextThread->threadWaitMax)
+    {
+      nextThread->threadWaitMax = span;
+    }
+    KernelHistogramAdd(&KernelThreadWaitHist[threadCpu], span);
+  }
+  nextThread->threadReadyAt  = 0;
+  nextThread->threadRunStart = now;
+}
+#endif
+
+/*****************************************************************************
+ *                         KernelThreadSlice()
+ ****************************************************************************/
+
+static void KernelThreadSlice (thread_t *thread, uint64_t sliceStart)
+{
+  /* Simplifying variables. */
+  uint64_t  sliceTicks  = KernelThreadSliceTicks[thread->threadPriority];
+  uint64_t  sliceEnd    = 0;
+  uint64_t  throttleEnd = 0;
+  list_t   *throttled   = &KernelThreadEdfThrottled[PortCpuId()];
+
+  /* Deadline threads run until their budget is out, idle and priorities
+   * without a slice until they give up the CPU, the others round robin
+   * within the priority once the slice is over. */
+  if (thread->threadRuntime != 0)
+  {
+    sliceEnd = sliceStart + thread->threadBudget;
+  }
+  else if (thread->threadPriority != IDLE_PRIORITY && sliceTicks != 0)
+  {
+    sliceEnd = sliceStart + sliceTicks;
+  }
+
+  /* Be back when the first throttled deadline thread is replenished. */
+  if (!KernelListEmpty(throttled))
+  {
+    throttleEnd = KERNEL_LIST_ENTRY(throttled->listNext, thread_t,
+                                    threadReadyLink)->threadDeadline;
+    if (sliceEnd == 0 || throttleEnd < sliceEnd)
+    {
+      sliceEnd = throttleEnd;
+    }
+  }
+
+  /* Program it (0 = no slice end). */
+  KernelTimerSlice(sliceEnd);
+}
+
+/*****************************************************************************
+ *                         KernelThreadSwitch()
+ ****************************************************************************/
+
+static void KernelThreadSwitch (thread_t *nextThread)
+{
+  /* Simplifying variables. */
+  uint64_t   threadCpu   = PortCpuId();
+  uint64_t   isForced    = KernelThreadForcing[threadCpu];
+  uint64_t   irqState    = 0;
+  thread_t  *prevThread  = NULL;
+  process_t *nextProcess = NULL;
+
+  /* Obtain outgoing thread. */
+  KernelThreadForcing[threadCpu] = 0;
+  prevThread = KernelThreadRunning[threadCpu];
+  if (nextThread == prevThread)
+  {
+    KernelThreadUnlock();
+    return;
+  }
+
+  /* Charge the budget of prev, next runs from now on. */
+  KernelThreadEdfCharge(prevThread);
+  nextThread->threadStarted = prevThread->threadStarted;
+#if KERNEL_CONFIG_SCHED_STATS
+  KernelThreadAccount(threadCpu, prevThread, nextThread, isForced);
+#else
+  (void) isForced;
+#endif
+
+  /* Put thread on the CPU, prev starts cooling down. */
+  KernelThreadRunning[threadCpu] = nextThread;
+  prevThread->threadLastRun      = KernelThreadSwitchCount[threadCpu]++;
+
+  /* Requests to preempt prev are void, next gets a fresh slice. */
+  KernelThreadNeedResched[threadCpu] = 0;
+  KernelThreadSlice(nextThread, nextThread->threadStarted);
+
+  /* Switch address space if the thread belongs to another process. */
+  nextProcess = nextThread->threadProcess;
+  if (nextProcess != prevThread->threadProcess)
+  {
+    if (nextProcess == NULL)
+    {
+      PortTranslationSwitch(NULL, 0);
+    }
+    else
+    {
+      PortTranslationSwitch(nextProcess->processTranslation,
+                            nextProcess->processId + 1);
+    }
+  }
+
+  /* STORE the context of prev and RESTORE the one of next. */
+  irqState = KernelThreadIrqState[threadCpu];
+  PortThreadSwitch(prevThread->threadId, nextThread->threadId);
+
+  /* Back in prev: the lock was taken by whoever switched to us, maybe on
+   * another CPU. Unlock restores our own IRQ mask. */
+  KernelThreadIrqState[PortCpuId()] = irqState;
+  KernelThreadReap();
+  KernelThreadUnlock();
+}
+
+/*****************************************************************************
+ *                          KernelThreadStart()
+ ****************************************************************************/
+
+static void KernelThreadStart (void *arg)
+{
+  /* Simplifying variables. */
+  thread_t *thread = (thread_t *) arg;
+
+  /* First activation: finish the switch that brought us here. */
+  KernelThreadReap();
+  KernelThreadUnlock();
+
+  /* Threads run with IRQs unmasked: preemptible from here on. */
+  PortCpuIrqEnable();
+  KernelThreadPreemptCheck();
+
+  /* Run the thread body. */
+  thread->threadEntry(thread->threadArg);
+
+  /* Returning from the body ends the thread. */
+  KernelThreadTerminate();
+}
+
+/*****************************************************************************
+ *                         KernelThreadPrepare()
+ ****************************************************************************/
+
+void KernelThreadPrepare (thread_t  *thread,
+                          void     (*threadEntry)(void *arg),
+                          void      *threadArg,
+                          void      *stackTop)
+{
+  /* Remember the body, the port starts every thread in KernelThreadStart. */
+  thread->threadEntry = threadEntry;
+  thread->threadArg   = threadArg;
+  PortThreadPrepare(thread->threadId, KernelThreadStart, thread, stackTop);
+}
+
+/*****************************************************************************
+ *                         KernelThreadRun()
+ ****************************************************************************/
+
+void KernelThreadRun (uint64_t threadId)
+{
+  /* Thread to run (looked up under the lock, it cannot go away). */
+  thread_t *thread = NULL;
+
+  /* Check parameters. */
+  KernelThreadLock();
+  thread = KernelThreadGet(threadId);
+  if (thread == NULL)
+  {
+    KernelThreadUnlock();
+    return;
+  }
+
+  /* Switch to it (the lock is released on the other side). */
+  KernelThreadSwitch(thread);
+}
+
+/*****************************************************************************
+ *                        KernelThreadPause()
+ ****************************************************************************/
+
+uint64_t KernelThreadPause (void)
+{
+  /* Read KernelThreadRunning */
+  thread_t *thread = KernelThreadRunning[PortCpuId()];
+
+  /* Back to the ready queue, its context is stored by KernelThreadRun(). */
+  KernelThreadEdfCharge(thread);
+  KernelThreadAdmit(thread);
+
+  /* Done. */
+  return thread->threadId;
+}
+
+/*****************************************************************************
+ *                        KernelThreadIdleSleep()
+ ****************************************************************************/
+
+static void KernelThreadIdleSleep (uint64_t threadCpu)
+{
+  /* Timestamps and interrupt count before sleeping. */
+  uint64_t start      = 0;
+  uint64_t interrupts = KernelTimerInterrupts[threadCpu];
+  uint64_t pollTicks  = 0;
+  uint64_t wakeAt     = 0;
+
+  /* Interrupts in the sleep window must not switch away from it. */
+  KernelThreadPreemptDisable();
+
+  /* No tick while asleep, wake up in time to look for work again. */
+  pollTicks = PortTimerFrequency() / 1000000 * KERNEL_CONFIG_IDLE_POLL_US;
+  start     = PortTimerNow();
+  wakeAt    = KernelTimerIdleEnter(start + pollTicks);
+  KernelRcuIdleEnter();
+
+  /* Wait for an interrupt, as deep as the governor allows. */
+  KernelPowerIdle(threadCpu, wakeAt);
+  KernelRcuIdleExit();
+
+  /* Residency and wake-up reason. */
+  KernelThreadIdleEntries[threadCpu]++;
+  KernelThreadIdleTime[threadCpu] += PortTimerNow() - start;
+  if (KernelTimerInterrupts[threadCpu] != interrupts)
+  {
+    KernelThreadIdleWakeTimer[threadCpu]++;
+  }
+  else
+  {
+    KernelThreadIdleWakeOther[threadCpu]++;
+  }
+
+  /* Back to work: restart the tick. */
+  KernelTimerIdleExit();
+  KernelThreadPreemptEnable();
+}
+
+/*****************************************************************************
+ *                           KernelThreadIdle()
+ ****************************************************************************/
+
+void KernelThreadIdle(void *arg)
+{
+  /* Simplifying variables. */
+  uint64_t threadCpu = PortCpuId();
+
+  /* Unused. */
+  (void) arg;
+
+  /* Pull work from busier CPUs and run it, sleep when there is none. */
+  while (1)
+  {
+    KernelThreadBalance(threadCpu);
+    if (!KernelThreadHasWork(threadCpu))
+    {
+      KernelThreadIdleSleep(threadCpu);
+    }
+    KernelThreadYield();
+  }
+}
+
+/*****************************************************************************
+ *                        KernelThreadScheduler()
+ ****************************************************************************/
+
+void KernelThreadScheduler()
+{
+  /* Dispatch highest-priority job and run it on this processor. */
+  KernelThreadYield();
+}
+
+/*****************************************************************************
+ *                         KernelThreadCreate()
+ ****************************************************************************/
+
+error_t KernelThreadCreate (void    (*threadEntry)(void *arg),
+                            void     *threadArg,
+                            uint64_t  threadPriority,
+                            uint64_t *threadId)
+{
+  /* Simplifying variables. */
+  uint64_t  threadCpu = PortCpuId();
+  uint64_t  stackSlot = NO_STACK;
+  uint64_t  isFresh   = 0;
+  thread_t *thread    = NULL;
+
+  /* Check parameters (the idle priority is reserved). */
+  if (threadEntry == 0 || threadPriority == IDLE_PRIORITY ||
+      threadPriority >= MAX_PRIORITY)
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* Stack: a recycled one (no mapping work), else a fresh slot. */
+  KernelThreadLock();
+  if (KernelThreadStackCached[threadCpu] > 0)
+  {
+    stackSlot = KernelThreadStackCache[threadCpu]
+                                      [--KernelThreadStackCached[threadCpu]];
+  }
+  else if (KernelThreadStackFreeCount > 0)
+  {
+    stackSlot = KernelThreadStackFree[--KernelThreadStackFreeCount];
+    isFresh   = 1;
+  }
+  else if (KernelThreadStackNext < THREAD_COUNT)
+  {
+    stackSlot = KernelThreadStackNext++;
+    isFresh   = 1;
+  }
+
+  /* Thread structure. */
+  if (stackSlot != NO_STACK)
+  {
+    thread = KernelThreadAllocate(threadCpu, threadPriority);
+  }
+  KernelThreadUnlock();
+
+  /* Map a fresh stack (outside of the lock, this walks the tables). */
+  if (thread != NULL && isFresh &&
+      KernelThreadStackMap(stackSlot) != KERNEL_SUCCESS)
+  {
+    KernelThreadLock();
+    KernelThreadDeallocate(thread);
+    KernelThreadUnlock();
+    thread = NULL;
+  }
+
+  /* Out of threads or memory? Give the stack slot back. */
+  if (thread == NULL)
+  {
+    if (stackSlot != NO_STACK)
+    {
+      KernelThreadLock();
+      if (isFresh)
+      {
+        KernelThreadStackFree[KernelThreadStackFreeCount++] = stackSlot;
+      }
+      else
+      {
+        KernelThreadStackRelease(threadCpu, stackSlot);
+      }
+      KernelThreadUnlock();
+    }
+    return KERNEL_ERR_RESOURCE;
+  }
+
+  /* Build the first frame at the top of the stack. */
+  thread->threadStack = stackSlot;
+  KernelThreadPrepare(thread, threadEntry, threadArg,
+                      KernelThreadStackTop(stackSlot));
+  if (threadId != NULL)
+  {
+    *threadId = thread->threadId;
+  }
+
+  /* Ready to run (the balancer spreads it if this CPU is busy). */
+  KernelThreadLock();
+  KernelThreadAdmit(thread);
+  KernelThreadUnlock();
+
+  /* Done. */
+  return KERNEL_SUCCESS;
+}
+
+/*****************************************************************************
+ *                        KernelThreadYield()
+ ****************************************************************************/
+
+void KernelThreadYield (void)
+{
+  /* Simplifying variables. */
+  uint64_t  threadCpu = 0;
+  thread_t *thread    = NULL;
+
+  /* Expire due timers first, their wake-ups compete for this dispatch. */
+  KernelTimerRun();
+
+  /* No object reference is held across a schedule point. */
+  KernelRcuQuiescent();
+
+  /* Give up the CPU (the one we hold the lock on). */
+  KernelThreadLock();
+  threadCpu = PortCpuId();
+  KernelThreadPause();
+
+  /* Only idle left? Steal work first (new-idle balancing). */
+  if (!KernelThreadHasWork(threadCpu))
+  {
+    KernelThreadBalanceIdle(threadCpu);
+  }
+
+  /* Dispatch the highest-priority ready thread (idle is always ready). */
+  thread = KernelThreadDispatchNext(threadCpu);
+
+  /* Run it (the lock is released on the other side). */
+  KernelThreadSwitch(thread);
+}
+
+/*****************************************************************************
+ *                        KernelThreadBlock()
+ ****************************************************************************/
+
+void KernelThreadBlock (void)
+{
+  /* No object reference is held across a schedule point. */
+  KernelRcuQuiescent();
+
+  /* Block with the scheduler lock held (released on the way out). */
+  KernelThreadLock();
+  KernelThreadBlockLocked();
+}
+
+/*****************************************************************************
+ *                       KernelThreadBlockLocked()
+ ****************************************************************************/
+
+void KernelThreadBlockLocked (void)
+{
+  /* Simplifying variables. */
+  uint64_t  threadCpu = PortCpuId();
+  thread_t *thread    = NULL;
+
+  /* Woken up before we got here? Consume the wake-up and go on. */
+  thread = KernelThreadRunning[threadCpu];
+  if (PortAtomicCas64(&thread->threadState, THREAD_RUNNABLE,
+                      THREAD_BLOCKED) != THREAD_RUNNABLE)
+  {
+    __atomic_store_n(&thread->threadState, THREAD_RUNNABLE,
+                     __ATOMIC_RELAXED);
+    KernelThreadUnlock();
+    return;
+  }
+
+  /* Leave the CPU without going back to the ready queue. A waker can only
+   * hand us to this CPU, which drains its list after the switch is done. */
+  KernelThreadEdfCharge(thread);
+
+  /* Only idle left? Steal work first (new-idle balancing). */
+  if (!KernelThreadHasWork(threadCpu))
+  {
+    KernelThreadBalanceIdle(threadCpu);
+  }
+
+  /* Run the next thread (the lock is released on the other side). */
+  KernelThreadSwitch(KernelThreadDispatchNext(threadCpu));
+}
+
+/*****************************************************************************
+ *                       KernelThreadUnblock()
+ ****************************************************************************/
+
+void KernelThreadUnblock (uint64_t threadId)
+{
+  /* Thread to wake up. */
+  thread_t *thread = NULL;
+
+  /* Not preemptible while we hold the reference (see rcu.c). */
+  KernelThreadPreemptDisable();
+  thread = KernelThreadGet(threadId);
+
+  /* Wake it up (no lock needed). */
+  if (thread != NULL)
+  {
+    KernelThreadWake(thread);
+  }
+  KernelThreadPreemptEnable();
+}
+
+/*****************************************************************************
+ *                         KernelThreadWake()
+ ****************************************************************************/
+
+void KernelThreadWake (thread_t *thread)
+{
+  /* Local variables. */
+  uint64_t  state     = 0;
+  uint64_t  threadCpu = 0;
+  uint64_t  irqState  = 0;
+  thread_t *listHead  = NULL;
+
+  /* Not blocked yet: its next block returns. Blocked: we own the wake-up. */
+  while (1)
+  {
+    state = __atomic_load_n(&thread->threadState, __ATOMIC_ACQUIRE);
+    if (state == THREAD_WAKEUP)
+    {
+      return;
+    }
+    if (state == THREAD_RUNNABLE)
+    {
+      if (PortAtomicCas64(&thread->threadState, THREAD_RUNNABLE,
+                          THREAD_WAKEUP) == THREAD_RUNNABLE)
+      {
+        return;
+      }
+      continue;
+    }
+    if (PortAtomicCas64(&thread->threadState, THREAD_BLOCKED,
+                        THREAD_RUNNABLE) == THREAD_BLOCKED)
+    {
+      break;
+    }
+  }
+
+  /* Pinned: the statistics and the kick look at the CPU we run on. */
+  irqState = PortCpuIrqSave();
+
+  /* Push it to the wake list of its CPU (blocked threads do not migrate). */
+  threadCpu = thread->threadCpu;
+  do
+  {
+    listHead = __atomic_load_n(&KernelThreadWakeList[threadCpu],
+                               __ATOMIC_RELAXED);
+    thread->nextWakeThread = listHead;
+  } while (PortAtomicCas64((uint64_t *) &KernelThreadWakeList[threadCpu],
+                           (uint64_t) listHead, (uint64_t) thread) !=
+           (uint64_t) listHead);
+
+  /* Statistics (many CPUs may wake into the same one). */
+  if (threadCpu != PortCpuId())
+  {
+    PortAtomicFetchAdd64(&KernelThreadRemoteWakes[threadCpu], 1);
+  }
+
+  /* The first push notifies the CPU, later ones ride on that. */
+  if (listHead == NULL)
+  {
+    KernelThreadKick(thread, threadCpu);
+  }
+  PortCpuIrqRestore(irqState);
+
+  /* Woke up something more urgent than us? */
+  KernelThreadPreemptCheck();
+}
+
+/*****************************************************************************
+ *                      KernelThreadWakeInterrupt()
+ ****************************************************************************/
+
+void KernelThreadWakeInterrupt (void)
+{
+  /* Simplifying variables. */
+  uint64_t threadCpu = PortCpuId();
+
+  /* The interrupt exit drains the wake list and preempts if needed (an
+   * interrupted idle loop drains it itself). */
+  KernelThreadIpiReceived[threadCpu]++;
+  KernelThreadNeedResched[threadCpu] |= PREEMPT_WAKE;
+}
+
+/*****************************************************************************
+ *                        KernelThreadSliceEnd()
+ ****************************************************************************/
+
+void KernelThreadSliceEnd (void)
+{
+  /* Called by the timer interrupt, the interrupt exit preempts. */
+  KernelThreadNeedResched[PortCpuId()] |= PREEMPT_SLICE;
+}
+
+/*****************************************************************************
+ *                        KernelThreadReschedSwap()
+ ****************************************************************************/
+
+uint64_t KernelThreadReschedSwap (uint64_t needResched)
+{
+  /* Simplifying variables (scheduler lock held, IRQs masked). */
+  uint64_t threadCpu  = PortCpuId();
+  uint64_t oldResched = KernelThreadNeedResched[threadCpu];
+
+  /* Replace the preemption requests of this CPU, return the old ones. */
+  KernelThreadNeedResched[threadCpu] = needResched;
+  return oldResched;
+}
+
+/*****************************************************************************
+ *                          KernelThreadTick()
+ ****************************************************************************/
+
+void KernelThreadTick (void)
+{
+  /* Simplifying variables. */
+  uint64_t threadCpu = PortCpuId();
+  uint64_t readyNow  = 0;
+
+  /* Called by the periodic tick (busy CPUs only), balance every few. */
+  if (++KernelThreadTicks[threadCpu] % BALANCE_TICKS != 0)
+  {
+    return;
+  }
+
+  /* Busy CPUs never reach the idle balancer: even the load out here. */
+  readyNow = KernelThreadReadyCount[threadCpu];
+  KernelThreadBalance(threadCpu);
+
+  /* Pulled threads may outrank the running one (interrupt exit checks). */
+  if (KernelThreadReadyCount[threadCpu] != readyNow)
+  {
+    KernelThreadNeedResched[threadCpu] |= PREEMPT_WAKE;
+  }
+}
+
+/*****************************************************************************
+ *                        KernelThreadOutranked()
+ ****************************************************************************/
+
+static uint64_t KernelThreadOutranked (uint64_t  threadCpu,
+                                       thread_t *running,
+                                       uint64_t  reason)
+{
+  /* Simplifying variables. */
+  uint64_t  readyMask  = KernelThreadReadyMask[threadCpu];
+  uint64_t  topPrio    = 0;
+  list_t   *edfQueue   = &KernelThreadEdfQu[threadCpu];
+  thread_t *edfThread  = NULL;
+
+  /* Earliest ready deadline thread, if any. */
+  if (!KernelListEmpty(edfQueue))
+  {
+    edfThread = KERNEL_LIST_ENTRY(edfQueue->listNext, thread_t,
+                                  threadReadyLink);
+  }
+
+  /* Deadline thread running: out of budget (throttled) it always goes,
+   * otherwise only an earlier deadline preempts it. */
+  if (running->threadRuntime != 0)
+  {
+    return running->threadBudget == 0 ||
+           (edfThread != NULL &&
+            edfThread->threadDeadline < running->threadDeadline);
+  }
+
+  /* Ready deadline threads go before every fixed priority. */
+  if (edfThread != NULL)
+  {
+    return 1;
+  }
+
+  /* Nothing ready (idle threads are never queued while another runs)? */
+  if (readyMask == 0)
+  {
+    return 0;
+  }
+
+  /* A higher priority always, the same one once the slice is over. */
+  topPrio = 63 - __builtin_clzl(readyMask);
+  return topPrio > running->threadPriority ||
+         (topPrio == running->threadPriority && (reason & PREEMPT_SLICE));
+}
+
+/*****************************************************************************
+ *                         KernelThreadPreempt()
+ ****************************************************************************/
+
+static void KernelThreadPreempt (void)
+{
+  /* Simplifying variables. */
+  uint64_t  threadCpu = 0;
+  uint64_t  reason    = 0;
+  thread_t *running   = NULL;
+
+  /* Preemptible code holds no object reference (see rcu.c). */
+  KernelRcuQuiescent();
+
+  /* Take the request, and make threads woken from elsewhere visible. */
+  KernelThreadLock();
+  threadCpu = PortCpuId();
+  running   = KernelThreadRunning[threadCpu];
+  reason    = KernelThreadNeedResched[threadCpu];
+  KernelThreadNeedResched[threadCpu] = 0;
+  KernelThreadDrain(threadCpu);
+  KernelThreadEdfReplenish(threadCpu);
+
+  /* Budget of a deadline thread over? Charging it empties it, the thread
+   * is throttled until its deadline (CBS) when it goes back. */
+  if ((reason & PREEMPT_SLICE) && running->threadRuntime != 0)
+  {
+    KernelThreadEdfCharge(running);
+  }
+
+  /* Nobody more urgent? Go on, with a new slice if this one is over. */
+  if (!KernelThreadOutranked(threadCpu, running, reason))
+  {
+    if (reason & PREEMPT_SLICE)
+    {
+      KernelThreadSlice(running, PortTimerNow());
+    }
+    KernelThreadUnlock();
+    return;
+  }
+
+  /* Statistics. */
+  if (reason & PREEMPT_SLICE)
+  {
+    KernelThreadPreemptSlice[threadCpu]++;
+  }
+  else
+  {
+    KernelThreadPreemptWake[threadCpu]++;
+  }
+
+  /* Back to the tail of its queue, the most urgent thread runs instead
+   * (the lock is released on the other side). */
+  KernelThreadForcing[threadCpu] = 1;
+  KernelThreadPause();
+  KernelThreadSwitch(KernelThreadDispatchNext(threadCpu));
+}
+
+/*****************************************************************************
+ *                      KernelThreadPreemptDisable()
+ ****************************************************************************/
+
+void KernelThreadPreemptDisable (void)
+{
+  /* Pinned while counting (the count belongs to the CPU). */
+  uint64_t irqState = PortCpuIrqSave();
+
+  /* Nests: preemptible again at the outermost enable. */
+  KernelThreadPreemptCount[PortCpuId()]++;
+  PortCpuIrqRestore(irqState);
+}
+
+/*****************************************************************************
+ *                      KernelThreadPreemptEnable()
+ ****************************************************************************/
+
+void KernelThreadPreemptEnable (void)
+{
+  /* Pinned while counting (the count belongs to the CPU). */
+  uint64_t irqState = PortCpuIrqSave();
+
+  /* One level less. */
+  KernelThreadPreemptCount[PortCpuId()]--;
+  PortCpuIrqRestore(irqState);
+
+  /* A preemption requested inside the section happens now. */
+  KernelThreadPreemptCheck();
+}
+
+/*****************************************************************************
+ *                       KernelThreadPreemptCheck()
+ ****************************************************************************/
+
+void KernelThreadPreemptCheck (void)
+{
+  /* Local variables. */
+  uint64_t irqState  = 0;
+  uint64_t threadCpu = 0;
+  uint64_t isPending = 0;
+
+  /* IRQs masked: a handler, idle or a lock section, they check later. */
+  if (!PortCpuIrqEnabled())
+  {
+    return;
+  }
+
+  /* Preemptible and asked to? */
+  irqState  = PortCpuIrqSave();
+  threadCpu = PortCpuId();
+  isPending = KernelThreadPreemptCount[threadCpu] == 0 &&
+              KernelThreadNeedResched[threadCpu] != 0;
+  PortCpuIrqRestore(irqState);
+
+  /* Give the CPU to the more urgent thread. */
+  if (isPending)
+  {
+    KernelThreadPreempt();
+  }
+}
+
+/*****************************************************************************
+ *                      KernelThreadInterruptEnter()
+ ****************************************************************************/
+
+void KernelThreadInterruptEnter (void)
+{
+  /* Handlers run with IRQs masked and never switch threads. */
+  KernelThreadPreemptCount[PortCpuId()]++;
+}
+
+/*****************************************************************************
+ *                      KernelThreadInterruptExit()
+ ****************************************************************************/
+
+void KernelThreadInterruptExit (void)
+{
+  /* Simplifying variables. */
+  uint64_t threadCpu = PortCpuId();
+
+  /* Interrupted a preemptible thread, and a handler asked for it? The
+   * thread returns from the interrupt when it gets the CPU back. */
+  if (--KernelThreadPreemptCount[threadCpu] == 0 &&
+      KernelThreadNeedResched[threadCpu] != 0)
+  {
+    KernelThreadPreempt();
+  }
+}
+
+/*****************************************************************************
+ *                        KernelThreadTimeout()
+ ****************************************************************************/
+
+static void KernelThreadTimeout (timer_t *timer)
+{
+  /* Wake up the thread that armed the timer. */
+  KernelThreadUnblock(((thread_t *) timer->timerArg)->threadId);
+}
+
+/*****************************************************************************
+ *                       KernelThreadBlockUntil()
+ ****************************************************************************/
+
+error_t KernelThreadBlockUntil (uint64_t deadline)
+{
+  /* Simplifying variables. */
+  timer_t  timer;
+  uint64_t pending = 0;
+
+  /* Arm a timeout that unblocks us. */
+  KernelTimerSetup(&timer, KernelThreadTimeout, KernelThreadCurrent());
+  KernelTimerStart(&timer, deadline,
+                   KernelTimerTicks(KERNEL_CONFIG_TIMER_SLACK_US));
+
+  /* Wait for Unblock() or the timeout. */
+  KernelThreadBlock();
+
+  /* The timer lives on our stack: make sure nobody touches it anymore. */
+  pending = KernelTimerCancel(&timer);
+  KernelTimerWait(&timer);
+
+  /* Done (woken up by someone else if the timer had not fired yet). */
+  return pending ? KERNEL_SUCCESS : KERNEL_ERR_TIMEOUT;
+}
+
+/*****************************************************************************
+ *                        KernelThreadSleep()
+ ****************************************************************************/
+
+void KernelThreadSleep (uint64_t microseconds)
+{
+  /* Simplifying variables. */
+  uint64_t deadline = KernelTimerNow() + KernelTimerTicks(microseconds);
+
+  /* Unblocking is allowed to be spurious, sleep until the deadline. */
+  while (KernelThreadBlockUntil(deadline) != KERNEL_ERR_TIMEOUT);
+}
+
+/*****************************************************************************
+ *                       KernelThreadSetDeadline()
+ ****************************************************************************/
+
+error_t KernelThreadSetDeadline (thread_t *thread,
+                                 uint64_t  runtimeUs,
+                                 uint64_t  deadlineUs,
+                                 uint64_t  periodUs)
+{
+  /* Local variables. */
+  uint64_t threadCpu = 0;
+  uint64_t oldUtil   = 0;
+  uint64_t newUtil   = 0;
+  uint64_t isQueued  = 0;
+
+  /* Check parameters (runtime <= deadline <= period, 0 = fixed priority). */
+  if (runtimeUs != 0 && (deadlineUs < runtimeUs || periodUs < deadlineUs))
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* Density of the new reservation. */
+  if (runtimeUs != 0)
+  {
+    newUtil = (KernelTimerTicks(runtimeUs) << EDF_SHIFT) /
+              KernelTimerTicks(deadlineUs);
+  }
+
+  /* Running on another CPU? Its class cannot change under its feet. */
+  KernelThreadLock();
+  threadCpu = thread->threadCpu;
+  if (thread != KernelThreadCurrent() &&
+      KernelThreadRunning[threadCpu] == thread)
+  {
+    KernelThreadUnlock();
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* Queued? Take it out of its (ready, EDF or throttled) queue. */
+  isQueued = KernelThreadDequeue(thread);
+
+  /* Density of the old reservation, stable under the lock. */
+  if (thread->threadRuntime != 0)
+  {
+    oldUtil = (thread->threadRuntime << EDF_SHIFT) / thread->threadRelative;
+  }
+
+  /* Admission test: the densities of the CPU must stay schedulable. */
+  if (KernelThreadEdfUtil[threadCpu] - oldUtil + newUtil > EDF_MAX_UTIL)
+  {
+    if (isQueued)
+    {
+      KernelThreadAdmit(thread);
+    }
+    KernelThreadUnlock();
+    return KERNEL_ERR_RESOURCE;
+  }
+  KernelThreadEdfUtil[threadCpu] += newUtil - oldUtil;
+
+  /* Store the reservation in counter ticks, the first job starts now. */
+  thread->threadRuntime  = KernelTimerTicks(runtimeUs);
+  thread->threadRelative = KernelTimerTicks(deadlineUs);
+  thread->threadPeriod   = KernelTimerTicks(periodUs);
+  thread->threadRelease  = PortTimerNow();
+  thread->threadDeadline = thread->threadRelease + thread->threadRelative;
+  thread->threadBudget   = thread->threadRuntime;
+
+  /* Back into the queue of its new class. */
+  if (isQueued)
+  {
+    KernelThreadAdmit(thread);
+  }
+  KernelThreadUnlock();
+
+  /* Done. */
+  return KERNEL_SUCCESS;
+}
+
+/*****************************************************************************
+ *                        KernelThreadEdfWait()
+ ****************************************************************************/
+
+void KernelThreadEdfWait (void)
+{
+  /* Simplifying variables. */
+  uint64_t  now    = PortTimerNow();
+  thread_t *thread = KernelThreadCurrent();
+
+  /* Not a deadline thread? */
+  if (thread->threadRuntime == 0)
+  {
+    return;
+  }
+
+  /* Job done: late? */
+  KernelThreadLock();
+  if (now > thread->threadDeadline)
+  {
+    KernelThreadEdfMisses[thread->threadCpu]++;
+  }
+
+  /* Next release, skipping the periods we overran entirely. */
+  thread->threadRelease += thread->threadPeriod;
+  if (thread->threadRelease < now)
+  {
+    thread->threadRelease = now;
+  }
+  KernelThreadUnlock();
+
+  /* Sleep until the release, the CBS rule gives the job a new deadline. */
+  while (KernelThreadBlockUntil(thread->threadRelease) != KERNEL_ERR_TIMEOUT);
+}
+
+/*****************************************************************************
+ *                      KernelThreadTerminate()
+ ****************************************************************************/
+
+void KernelThreadTerminate (void)
+{
+  /* Simplifying variables. */
+  uint64_t  threadCpu = 0;
+  thread_t *thread    = KernelThreadCurrent();
+  thread_t *joiner    = NULL;
+
+  /* Give the EDF reservation back. */
+  KernelThreadSetDeadline(thread, 0, 0, 0);
+
+  /* Exited: wake up the thread joining us. */
+  KernelThreadLock();
+  threadCpu = PortCpuId();
+  thread->threadExited = 1;
+  if (thread->threadJoiner != 0)
+  {
+    joiner = KernelThreadGet(thread->threadJoiner - 1);
+    if (joiner != NULL)
+    {
+      KernelThreadWake(joiner);
+    }
+  }
+
+  /* Our stack is still in use: the next thread on this CPU reaps us. */
+  KernelThreadDead[threadCpu] = thread;
+
+  /* Only idle left? Steal work first (new-idle balancing). */
+  if (!KernelThreadHasWork(threadCpu))
+  {
+    KernelThreadBalanceIdle(threadCpu);
+  }
+
+  /* Leave for good (the lock is released on the other side). */
+  KernelThreadSwitch(KernelThreadDispatchNext(threadCpu));
+}
+
+/*****************************************************************************
+ *                       KernelThreadJoin()
+ ****************************************************************************/
+
+void KernelThreadJoin (uint64_t threadId)
+{
+  /* Simplifying variables. */
+  thread_t *self   = KernelThreadCurrent();
+  thread_t *thread = NULL;
+
+  /* Sleep until the thread has exited (one joiner per thread). */
+  KernelThreadLock();
+  thread = KernelThreadGet(threadId);
+  while (thread != NULL && thread != self && !thread->threadExited)
+  {
+    thread->threadJoiner = self->threadId + 1;
+    KernelThreadBlockLocked();
+    KernelThreadLock();
+    thread = KernelThreadGet(threadId);
+  }
+  KernelThreadUnlock();
+}
+
+/*****************************************************************************
+ *                          KernelThreadMove()
+ ****************************************************************************/
+
+static error_t KernelThreadMove (thread_t *thread, uint64_t cpuMask)
+{
+  /* Local variables. */
+  uint64_t curCpu    = 0;
+  uint64_t threadCpu = MAX_CPU;
+
+  /* Keep only existing CPUs, at least one is needed. */
+  cpuMask &= ALL_CPUS;
+  if (cpuMask == 0 || thread->threadPriority == IDLE_PRIORITY)
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* Its CPU is still allowed? Nothing moves. */
+  if (cpuMask & (1UL << thread->threadCpu))
+  {
+    thread->threadAffinity = cpuMask;
+    return KERNEL_SUCCESS;
+  }
+
+  /* EDF reservations are admitted per CPU: drop it before moving. */
+  if (thread->threadRuntime != 0)
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* Least loaded allowed CPU among the online ones. */
+  for (curCpu = 0; curCpu < MAX_CPU; curCpu++)
+  {
+    if ((cpuMask & (1UL << curCpu)) && KernelThreadRunning[curCpu] != NULL &&
+        (threadCpu == MAX_CPU ||
+         KernelThreadReadyCount[curCpu] < KernelThreadReadyCount[threadCpu]))
+    {
+      threadCpu = curCpu;
+    }
+  }
+  if (threadCpu == MAX_CPU)
+  {
+    return KERNEL_ERR_PARAMETER;
+  }
+  thread->threadAffinity = cpuMask;
+
+  /* Ready: requeue it there now. Running, blocked or being woken up: it
+   * is admitted there next time (wake lists follow threadCpu). */
+  if (KernelThreadRunning[thread->threadCpu] != thread &&
+      KernelThreadDequeue(thread))
+  {
+    KernelThreadMigrate(thread, threadCpu);
+  }
+  else
+  {
+    thread->threadCpu = threadCpu;
+  }
+
+  /* Done. */
+  return KERNEL_SUCCESS;
+}
+
+/*****************************************************************************
+ *                        KernelThreadAffinity()
+ ****************************************************************************/
+
+error_t KernelThreadAffinity (uint64_t threadId, uint64_t cpuMask)
+{
+  /* Local variables. */
+  thread_t *thread = NULL;
+  error_t   err    = KERNEL_ERR_PARAMETER;
+
+  /* Restrict it (the scheduler lock keeps queues and threadCpu in sync,
+   * and the thread from going away). */
+  KernelThreadLock();
+  thread = KernelThreadGet(threadId);
+  if (thread != NULL)
+  {
+    err = KernelThreadMove(thread, cpuMask);
+  }
+  KernelThreadUnlock();
+
+  /* Not allowed here anymore? Leave for the new CPU right away. */
+  if (err == KERNEL_SUCCESS && thread == KernelThreadCurrent() &&
+      thread->threadCpu != PortCpuId())
+  {
+    KernelThreadYield();
+  }
+
+  /* Done. */
+  return err;
+}
+
+/*****************************************************************************
+ *                        KernelThreadPriority()
+ ****************************************************************************/
+
+error_t KernelThreadPriority (uint64_t threadId, uint64_t priority)
+{
+  /* Thread to change (looked up under the lock, it cannot go away). */
+  thread_t *thread = NULL;
+
+  /* Check parameters (the idle priority is reserved). */
+  KernelThreadLock();
+  thread = KernelThreadGet(threadId);
+  if (thread == NULL || thread->threadPriority == IDLE_PRIORITY ||
+      priority == IDLE_PRIORITY || priority >= MAX_PRIORITY)
+  {
+    KernelThreadUnlock();
+    return KERNEL_ERR_PARAMETER;
+  }
+
+  /* New base, inherited priorities still apply (requeues if ready). */
+  thread->threadBase = priority;
+  KernelMutexUpdatePriority(thread);
+  KernelThreadUnlock();
+
+  /* Done. */
+  return KERNEL_SUCCESS;
+}
+
+/*****************************************************************************
+ *                         KernelThreadAttach()
+ ****************************************************************************/
+
+void KernelThreadAttach (thread_t *thread, process_t *process)
+{
+  /* Join the address space and take the default mask of the process
+   * (before the thread first runs). */
+  KernelThreadLock();
+  thread->threadProcess = process;
+  if (KernelThreadMove(thread, process->processAffinity) != KERNEL_SUCCESS)
+  {
+    thread->threadAffinity = ALL_CPUS;
+  }
+  KernelThreadUnlock();
+}
+
+/*****************************************************************************
+ *                       KernelThreadStatsDump()
+ ****************************************************************************/
+
+void KernelThreadStatsDump (void)
+{
+#if KERNEL_CONFIG_SCHED_STATS
+  /* Loop counters. */
+  uint64_t  curCpu    = 0;
+  uint64_t  curThread = 0;
+  thread_t *thread    = NULL;
+
+  /* Counter ticks to nanoseconds: ticks * 1000000 / (ticks per ms). */
+  uint64_t  ticksPerMs = PortTimerFrequency() / 1000;
+
+  /* Per-CPU histograms (CPUs that never switched are skipped). */
+  for (curCpu = 0; curCpu < MAX_CPU; curCpu++)
+  {
+    if (KernelThreadQueueHist[curCpu].histCount == 0)
+    {
+      continue;
+    }
+    KernelPrintFmt("CPU %d SCHED: %d voluntary, %d forced switches\n",
+                   curCpu,
+                   KernelThreadVoluntary[curCpu],
+                   KernelThreadInvoluntary[curCpu]);
+    KernelHistogramPrint("  wake-to-run (ns)",
+                         &KernelThreadWaitHist[curCpu], 1000000, ticksPerMs);
+    KernelHistogramPrint("  run time (ns)",
+                         &KernelThreadRunHist[curCpu], 1000000, ticksPerMs);
+    KernelHistogramPrint("  ready queue length",
+                         &KernelThreadQueueHist[curCpu], 1, 1);
+  }
+
+  /* Live threads that ran at least once (idle threads excluded, not
+   * preemptible while we hold references, see rcu.c). */
+  KernelThreadPreemptDisable();
+  for (curThread = 0; curThread < THREAD_COUNT; curThread++)
+  {
+    thread = KernelThreadGet(curThread);
+    if (thread == NULL || thread->threadPriority == IDLE_PRIORITY ||
+        thread->threadRunStart == 0)
+    {
+      continue;
+    }
+    KernelPrintFmt("THREAD %d: wait %d us (max %d ns), run %d us, "
+                   "%d voluntary, %d forced\n",
+                   curThread,
+                   thread->threadWaitTotal * 1000 / ticksPerMs,
+                   thread->threadWaitMax * 1000000 / ticksPerMs,
+                   thread->threadRunTotal * 1000 / ticksPerMs,
+                   thread->threadSwitchVol,
+                   thread->threadSwitchInv);
+  }
+  KernelThreadPreemptEnable();
+#endif
 }
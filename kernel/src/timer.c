@@ -0,0 +1,646 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   kernel/src/timer.c
+ * @brief  ARTOS kernel timer module.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Kernel includes. */
+#include "kernel/inc/interface.h"
+#include "kernel/inc/internal.h"
+
+/*****************************************************************************
+ *                               MACROS
+ ****************************************************************************/
+
+/* Maximum CPU count. */
+#define MAX_CPU          (KERNEL_CONFIG_MAX_CPU_COUNT)
+
+/* Timing wheel size (slots of one tick each). */
+#define WHEEL_SLOTS      (KERNEL_CONFIG_TIMER_WHEEL_SLOTS)
+
+/* Timers due within this many ticks go to the sorted list directly. */
+#define NEAR_TICKS       (2)
+
+/* No event pending. */
+#define NO_DEADLINE      (~0UL)
+
+/* Timer states. */
+#define TIMER_IDLE       (0)
+#define TIMER_WHEEL      (1)
+#define TIMER_SORTED     (2)
+#define TIMER_FIRING     (3)
+
+/*****************************************************************************
+ *                           GLOBAL VARIABLES
+ ****************************************************************************/
+
+/* Timer interrupts taken by each CPU. */
+uint64_t KernelTimerInterrupts[MAX_CPU];
+
+/* Timers expired by each CPU (several per interrupt when coalesced). */
+uint64_t KernelTimerExpired[MAX_CPU];
+
+/*****************************************************************************
+ *                           STATIC VARIABLES
+ ****************************************************************************/
+
+/* Counter ticks per periodic tick. */
+static uint64_t KernelTimerPeriod = 0;
+
+/* Periodic tick state of each CPU. */
+static uint64_t KernelTimerTickOn[MAX_CPU];
+static uint64_t KernelTimerTickNext[MAX_CPU];
+
+/* One-shot wake-up of each CPU (NO_DEADLINE = none). */
+static uint64_t KernelTimerWakeAt[MAX_CPU];
+
+/* End of the time slice of the running thread (NO_DEADLINE = none). */
+static uint64_t KernelTimerSliceAt[MAX_CPU];
+
+/* Deadline the hardware timer is armed for (NO_DEADLINE = off). */
+static uint64_t KernelTimerArmed[MAX_CPU];
+
+/* Coarse timers: one list per tick, wrapping around. */
+static timer_t *KernelTimerWheel[MAX_CPU][WHEEL_SLOTS];
+
+/* Next wheel tick (deadline / period) not processed yet. */
+static uint64_t KernelTimerWheelTick[MAX_CPU];
+
+/* Near timers sorted by deadline. */
+static timer_t *KernelTimerSorted[MAX_CPU];
+
+/* Per-CPU lock of the timer lists, and the IRQ mask of its holder. */
+static spinlock_t KernelTimerLocks[MAX_CPU];
+static uint64_t   KernelTimerIrqState[MAX_CPU];
+
+/*****************************************************************************
+ *                          KernelTimerLock()
+ ****************************************************************************/
+
+static void KernelTimerLock (uint64_t timerCpu)
+{
+  /* Short sections: a ticket lock per CPU, the interrupt takes it too. */
+  uint64_t irqState = KernelSpinLockIrq(&KernelTimerLocks[timerCpu]);
+
+  /* Only the holder reads it back. */
+  KernelTimerIrqState[timerCpu] = irqState;
+}
+
+/*****************************************************************************
+ *                         KernelTimerUnlock()
+ ****************************************************************************/
+
+static void KernelTimerUnlock (uint64_t timerCpu)
+{
+  /* Publish the updates and release. */
+  KernelSpinUnlockIrq(&KernelTimerLocks[timerCpu],
+                      KernelTimerIrqState[timerCpu]);
+}
+
+/*****************************************************************************
+ *                          KernelTimerLink()
+ ****************************************************************************/
+
+static void KernelTimerLink (timer_t **head, timer_t *prev, timer_t *timer)
+{
+  /* Insert after prev (NULL = at the head). */
+  timer->prevTimer = prev;
+  if (prev == NULL)
+  {
+    timer->nextTimer = *head;
+    *head            = timer;
+  }
+  else
+  {
+    timer->nextTimer = prev->nextTimer;
+    prev->nextTimer  = timer;
+  }
+  if (timer->nextTimer != NULL)
+  {
+    timer->nextTimer->prevTimer = timer;
+  }
+}
+
+/*****************************************************************************
+ *                         KernelTimerUnlink()
+ ****************************************************************************/
+
+static void KernelTimerUnlink (timer_t **head, timer_t *timer)
+{
+  /* Remove from a doubly-linked list. */
+  if (timer->prevTimer == NULL)
+  {
+    *head = timer->nextTimer;
+  }
+  else
+  {
+    timer->prevTimer->nextTimer = timer->nextTimer;
+  }
+  if (timer->nextTimer != NULL)
+  {
+    timer->nextTimer->prevTimer = timer->prevTimer;
+  }
+
+  /* Clean up. */
+  timer->nextTimer  = NULL;
+  timer->prevTimer  = NULL;
+  timer->timerState = TIMER_IDLE;
+}
+
+/*****************************************************************************
+ *                          KernelTimerSort()
+ ****************************************************************************/
+
+static void KernelTimerSort (uint64_t timerCpu, timer_t *timer)
+{
+  /* Insertion point. */
+  timer_t *prev = NULL;
+  timer_t *next = KernelTimerSorted[timerCpu];
+
+  /* Keep FIFO order among equal deadlines. */
+  while (next != NULL && next->timerDeadline <= timer->timerDeadline)
+  {
+    prev = next;
+    next = next->nextTimer;
+  }
+
+  /* Link. */
+  KernelTimerLink(&KernelTimerSorted[timerCpu], prev, timer);
+  timer->timerState = TIMER_SORTED;
+}
+
+/*****************************************************************************
+ *                          KernelTimerQueue()
+ ****************************************************************************/
+
+static void KernelTimerQueue (uint64_t timerCpu, timer_t *timer, uint64_t now)
+{
+  /* Simplifying variables. */
+  uint64_t tick = timer->timerDeadline / KernelTimerPeriod;
+
+  /* Near or already processed tick? Needs tick resolution or better. */
+  if (tick < KernelTimerWheelTick[timerCpu] ||
+      timer->timerDeadline < now + NEAR_TICKS * KernelTimerPeriod)
+  {
+    KernelTimerSort(timerCpu, timer);
+  }
+  else
+  {
+    /* Far: O(1) insertion into the slot of its tick. */
+    KernelTimerLink(&KernelTimerWheel[timerCpu][tick % WHEEL_SLOTS],
+                    NULL, timer);
+    timer->timerState = TIMER_WHEEL;
+  }
+}
+
+/*****************************************************************************
+ *                         KernelTimerCascade()
+ ****************************************************************************/
+
+static void KernelTimerCascade (uint64_t timerCpu, uint64_t now)
+{
+  /* Local variables. */
+  uint64_t  nowTick = now / KernelTimerPeriod;
+  uint64_t  curTick = KernelTimerWheelTick[timerCpu];
+  timer_t **slot    = NULL;
+  timer_t  *timer   = NULL;
+  timer_t  *next    = NULL;
+
+  /* Do not walk the same slot twice in a long sleep. */
+  if (nowTick >= curTick + WHEEL_SLOTS)
+  {
+    curTick = nowTick + 1 - WHEEL_SLOTS;
+  }
+
+  /* Move every timer of the elapsed ticks (and the next one) to the list. */
+  for (; curTick <= nowTick + NEAR_TICKS - 1; curTick++)
+  {
+    slot = &KernelTimerWheel[timerCpu][curTick % WHEEL_SLOTS];
+    for (timer = *slot; timer != NULL; timer = next)
+    {
+      next = timer->nextTimer;
+      if (timer->timerDeadline / KernelTimerPeriod <= nowTick + NEAR_TICKS - 1)
+      {
+        KernelTimerUnlink(slot, timer);
+        KernelTimerSort(timerCpu, timer);
+      }
+    }
+  }
+
+  /* Remember where we stopped. */
+  if (curTick > KernelTimerWheelTick[timerCpu])
+  {
+    KernelTimerWheelTick[timerCpu] = curTick;
+  }
+}
+
+/*****************************************************************************
+ *                         KernelTimerNextEvent()
+ ****************************************************************************/
+
+static uint64_t KernelTimerNextEvent (uint64_t timerCpu)
+{
+  /* Local variables. */
+  uint64_t  deadline = KernelTimerWakeAt[timerCpu];
+  uint64_t  curTick  = 0;
+  timer_t  *timer    = NULL;
+
+  /* The tick only counts while it runs. */
+  if (KernelTimerTickOn[timerCpu] && KernelTimerTickNext[timerCpu] < deadline)
+  {
+    deadline = KernelTimerTickNext[timerCpu];
+  }
+
+  /* End of the running time slice. */
+  if (KernelTimerSliceAt[timerCpu] < deadline)
+  {
+    deadline = KernelTimerSliceAt[timerCpu];
+  }
+
+  /* Latest point that still honours every slack (coalescing). */
+  for (timer = KernelTimerSorted[timerCpu];
+       timer != NULL && timer->timerDeadline < deadline;
+       timer = timer->nextTimer)
+  {
+    if (timer->timerDeadline + timer->timerSlack < deadline)
+    {
+      deadline = timer->timerDeadline + timer->timerSlack;
+    }
+  }
+
+  /* Without the tick, wake up to cascade the first non-empty slot. */
+  if (!KernelTimerTickOn[timerCpu])
+  {
+    for (curTick  = KernelTimerWheelTick[timerCpu];
+         curTick  < KernelTimerWheelTick[timerCpu] + WHEEL_SLOTS &&
+         curTick * KernelTimerPeriod < deadline;
+         curTick++)
+    {
+      if (KernelTimerWheel[timerCpu][curTick % WHEEL_SLOTS] != NULL)
+      {
+        deadline = (curTick + 1 - NEAR_TICKS) * KernelTimerPeriod;
+        break;
+      }
+    }
+  }
+
+  /* Done. */
+  return deadline;
+}
+
+/*****************************************************************************
+ *                          KernelTimerProgram()
+ ****************************************************************************/
+
+static void KernelTimerProgram (uint64_t timerCpu)
+{
+  /* Earliest pending event. */
+  uint64_t deadline = KernelTimerNextEvent(timerCpu);
+
+  /* Arm the hardware timer or leave it off. */
+  KernelTimerArmed[timerCpu] = deadline;
+  if (deadline == NO_DEADLINE)
+  {
+    PortTimerCancel();
+  }
+  else
+  {
+    PortTimerSet(deadline);
+  }
+}
+
+/*****************************************************************************
+ *                        KernelTimerInitialize()
+ ****************************************************************************/
+
+void KernelTimerInitialize (void)
+{
+  /* Simplifying variables. */
+  uint64_t timerCpu = PortCpuId();
+  uint64_t curSlot  = 0;
+
+  /* Tick length in counter ticks (same on every CPU). */
+  KernelTimerPeriod = PortTimerFrequency() / KERNEL_CONFIG_TICK_HZ;
+
+  /* Empty timer lists. */
+  for (curSlot = 0; curSlot < WHEEL_SLOTS; curSlot++)
+  {
+    KernelTimerWheel[timerCpu][curSlot] = NULL;
+  }
+  KernelTimerSorted[timerCpu]    = NULL;
+  KernelSpinInitialize(&KernelTimerLocks[timerCpu]);
+  KernelTimerExpired[timerCpu]   = 0;
+
+  /* Start the periodic tick of this CPU. */
+  PortTimerInitialize();
+  KernelTimerInterrupts[timerCpu] = 0;
+  KernelTimerWakeAt[timerCpu]     = NO_DEADLINE;
+  KernelTimerSliceAt[timerCpu]    = NO_DEADLINE;
+  KernelTimerTickOn[timerCpu]     = 1;
+  KernelTimerTickNext[timerCpu]   = PortTimerNow() + KernelTimerPeriod;
+  KernelTimerWheelTick[timerCpu]  = PortTimerNow() / KernelTimerPeriod;
+  KernelTimerProgram(timerCpu);
+}
+
+/*****************************************************************************
+ *                           KernelTimerNow()
+ ****************************************************************************/
+
+uint64_t KernelTimerNow (void)
+{
+  /* Timer deadlines are in counter ticks. */
+  return PortTimerNow();
+}
+
+/*****************************************************************************
+ *                          KernelTimerTicks()
+ ****************************************************************************/
+
+uint64_t KernelTimerTicks (uint64_t microseconds)
+{
+  /* Convert without overflowing for delays up to hours. */
+  return (PortTimerFrequency() / 1000) * microseconds / 1000;
+}
+
+/*****************************************************************************
+ *                          KernelTimerSetup()
+ ****************************************************************************/
+
+void KernelTimerSetup (timer_t  *timer,
+                       void    (*timerCallback)(timer_t *timer),
+                       void     *timerArg)
+{
+  /* Initialize the timer structure. */
+  timer->timerDeadline = 0;
+  timer->timerSlack    = 0;
+  timer->timerCpu      = 0;
+  timer->timerState    = TIMER_IDLE;
+  timer->timerCallback = timerCallback;
+  timer->timerArg      = timerArg;
+  timer->nextTimer     = NULL;
+  timer->prevTimer     = NULL;
+  timer->nextExpired   = NULL;
+}
+
+/*****************************************************************************
+ *                          KernelTimerStart()
+ ****************************************************************************/
+
+void KernelTimerStart (timer_t  *timer,
+                       uint64_t  deadline,
+                       uint64_t  slack)
+{
+  /* Simplifying variables. */
+  uint64_t timerCpu = 0;
+
+  /* Timers run on the CPU that armed them (stay on it meanwhile). */
+  KernelThreadPreemptDisable();
+  timerCpu = PortCpuId();
+
+  /* Re-arming? Drop the old deadline first (a firing timer is unlinked). */
+  if (timer->timerState != TIMER_FIRING)
+  {
+    KernelTimerCancel(timer);
+  }
+
+  /* Queue. */
+  KernelTimerLock(timerCpu);
+  timer->timerDeadline = deadline;
+  timer->timerSlack    = slack;
+  __atomic_store_n(&timer->timerCpu, timerCpu, __ATOMIC_RELAXED);
+  KernelTimerQueue(timerCpu, timer, PortTimerNow());
+  KernelTimerProgram(timerCpu);
+  KernelTimerUnlock(timerCpu);
+  KernelThreadPreemptEnable();
+}
+
+/*****************************************************************************
+ *                          KernelTimerCancel()
+ ****************************************************************************/
+
+uint64_t KernelTimerCancel (timer_t *timer)
+{
+  /* Local variables. */
+  uint64_t timerCpu = 0;
+  uint64_t pending  = 0;
+
+  /* Lock the CPU that holds it: a re-arm elsewhere moves it (and changes
+   * timerCpu under the lock of its new CPU), look again until it stays. */
+  while (1)
+  {
+    timerCpu = __atomic_load_n(&timer->timerCpu, __ATOMIC_RELAXED);
+    KernelTimerLock(timerCpu);
+    if (timer->timerCpu == timerCpu)
+    {
+      break;
+    }
+    KernelTimerUnlock(timerCpu);
+  }
+
+  /* Unlink from whatever list holds it. */
+  if (timer->timerState == TIMER_WHEEL)
+  {
+    KernelTimerUnlink(&KernelTimerWheel[timerCpu][(timer->timerDeadline /
+                                                   KernelTimerPeriod) %
+                                                  WHEEL_SLOTS], timer);
+    pending = 1;
+  }
+  else if (timer->timerState == TIMER_SORTED)
+  {
+    KernelTimerUnlink(&KernelTimerSorted[timerCpu], timer);
+    pending = 1;
+  }
+  KernelTimerUnlock(timerCpu);
+
+  /* Whether the callback will not run anymore because of us. */
+  return pending;
+}
+
+/*****************************************************************************
+ *                           KernelTimerWait()
+ ****************************************************************************/
+
+void KernelTimerWait (timer_t *timer)
+{
+  /* A cancelled timer may still be in its callback on another CPU. */
+  while (__atomic_load_n(&timer->timerState, __ATOMIC_ACQUIRE) ==
+         TIMER_FIRING);
+}
+
+/*****************************************************************************
+ *                           KernelTimerRun()
+ ****************************************************************************/
+
+void KernelTimerRun (void)
+{
+  /* Simplifying variables. */
+  uint64_t  timerCpu = 0;
+  uint64_t  now      = PortTimerNow();
+  timer_t  *expired  = NULL;
+  timer_t  *timer    = NULL;
+
+  /* The lists and callbacks of this CPU (stay on it meanwhile). */
+  KernelThreadPreemptDisable();
+  timerCpu = PortCpuId();
+
+  /* Pull due timers out of the lists. */
+  KernelTimerLock(timerCpu);
+  KernelTimerCascade(timerCpu, now);
+  while (KernelTimerSorted[timerCpu] != NULL &&
+         KernelTimerSorted[timerCpu]->timerDeadline <= now)
+  {
+    timer = KernelTimerSorted[timerCpu];
+    KernelTimerUnlink(&KernelTimerSorted[timerCpu], timer);
+    timer->timerState  = TIMER_FIRING;
+    timer->nextExpired = expired;
+    expired            = timer;
+    KernelTimerExpired[timerCpu]++;
+  }
+  KernelTimerUnlock(timerCpu);
+
+  /* Run the callbacks without the lock (they may re-arm, and so may any
+   * other CPU: the expired chain has its own link, which only we use). */
+  while (expired != NULL)
+  {
+    timer   = expired;
+    expired = timer->nextExpired;
+    timer->nextExpired = NULL;
+    timer->timerCallback(timer);
+
+    /* Last access: the owner may free the timer once it stops firing. */
+    PortAtomicCas64(&timer->timerState, TIMER_FIRING, TIMER_IDLE);
+  }
+  KernelThreadPreemptEnable();
+}
+
+/*****************************************************************************
+ *                          KernelTimerSlice()
+ ****************************************************************************/
+
+void KernelTimerSlice (uint64_t deadline)
+{
+  /* Simplifying variables (called on every switch, IRQs masked). */
+  uint64_t timerCpu = PortCpuId();
+
+  /* New slice end (0 = the next thread is not sliced). */
+  KernelTimerLock(timerCpu);
+  KernelTimerSliceAt[timerCpu] = deadline == 0 ? NO_DEADLINE : deadline;
+
+  /* Reprogram only to fire earlier, a stale later interrupt re-arms. */
+  if (KernelTimerSliceAt[timerCpu] < KernelTimerArmed[timerCpu])
+  {
+    KernelTimerProgram(timerCpu);
+  }
+  KernelTimerUnlock(timerCpu);
+}
+
+/*****************************************************************************
+ *                        KernelTimerInterrupt()
+ ****************************************************************************/
+
+void KernelTimerInterrupt (void)
+{
+  /* Simplifying variables. */
+  uint64_t timerCpu = PortCpuId();
+  uint64_t now      = PortTimerNow();
+
+  /* Statistics. */
+  KernelTimerInterrupts[timerCpu]++;
+
+  /* Periodic tick due? Skip the ticks we missed, balance the load. */
+  if (KernelTimerTickOn[timerCpu] && KernelTimerTickNext[timerCpu] <= now)
+  {
+    while (KernelTimerTickNext[timerCpu] <= now)
+    {
+      KernelTimerTickNext[timerCpu] += KernelTimerPeriod;
+    }
+    KernelThreadTick();
+  }
+
+  /* One-shot wake-up due? */
+  if (KernelTimerWakeAt[timerCpu] <= now)
+  {
+    KernelTimerWakeAt[timerCpu] = NO_DEADLINE;
+  }
+
+  /* Time slice over? The interrupt exit preempts the thread. */
+  if (KernelTimerSliceAt[timerCpu] <= now)
+  {
+    KernelTimerSliceAt[timerCpu] = NO_DEADLINE;
+    KernelThreadSliceEnd();
+  }
+
+  /* Expire timers, every one inside its slack window fires now. */
+  KernelTimerRun();
+
+  /* Re-arm for the next event. */
+  KernelTimerLock(timerCpu);
+  KernelTimerProgram(timerCpu);
+  KernelTimerUnlock(timerCpu);
+}
+
+/*****************************************************************************
+ *                        KernelTimerIdleEnter()
+ ****************************************************************************/
+
+uint64_t KernelTimerIdleEnter (uint64_t wakeAt)
+{
+  /* Simplifying variables. */
+  uint64_t timerCpu = PortCpuId();
+  uint64_t deadline = 0;
+
+  /* Stop the periodic tick, only wake for real events. */
+  KernelTimerLock(timerCpu);
+  KernelTimerTickOn[timerCpu] = 0;
+  KernelTimerWakeAt[timerCpu] = wakeAt;
+  deadline = KernelTimerNextEvent(timerCpu);
+  KernelTimerProgram(timerCpu);
+  KernelTimerUnlock(timerCpu);
+
+  /* When the timer wakes this CPU up (for the idle governor). */
+  return deadline;
+}
+
+/*****************************************************************************
+ *                        KernelTimerIdleExit()
+ ****************************************************************************/
+
+void KernelTimerIdleExit (void)
+{
+  /* Simplifying variables. */
+  uint64_t timerCpu = PortCpuId();
+
+  /* Restart the periodic tick from now. */
+  KernelTimerLock(timerCpu);
+  KernelTimerWakeAt[timerCpu]   = NO_DEADLINE;
+  KernelTimerTickOn[timerCpu]   = 1;
+  KernelTimerTickNext[timerCpu] = PortTimerNow() + KernelTimerPeriod;
+  KernelTimerProgram(timerCpu);
+  KernelTimerUnlock(timerCpu);
+}
@@ -0,0 +1,330 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   kernel/src/work.c
+ * @brief  ARTOS kernel deferred work queue module.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Kernel includes. */
+#include "kernel/inc/interface.h"
+#include "kernel/inc/internal.h"
+
+/*****************************************************************************
+ *                               MACROS
+ ****************************************************************************/
+
+/* Maximum CPU count. */
+#define MAX_CPU          (KERNEL_CONFIG_MAX_CPU_COUNT)
+
+/* Items run back to back before the worker lets other threads in. */
+#define WORK_BATCH       (KERNEL_CONFIG_WORK_BATCH)
+
+/* No worker thread on the CPU yet. */
+#define NO_WORKER        (~0UL)
+
+/* Work item states. */
+#define WORK_IDLE        (0UL)
+#define WORK_PENDING     (1UL)
+
+/*****************************************************************************
+ *                              TYPEDEFS
+ ****************************************************************************/
+
+/* Flush barrier, lives on the stack of the flushing thread. */
+typedef struct work_flush
+{
+  uint64_t            flushThread;
+  uint64_t            flushDone;
+} work_flush_t;
+
+/*****************************************************************************
+ *                           GLOBAL VARIABLES
+ ****************************************************************************/
+
+/* Items run and batches taken by each CPU. */
+uint64_t KernelWorkExecuted[MAX_CPU];
+uint64_t KernelWorkBatches[MAX_CPU];
+
+/*****************************************************************************
+ *                           STATIC VARIABLES
+ ****************************************************************************/
+
+/* Pending items of each CPU (FIFO) and the lock protecting them (taken
+ * with IRQs masked, handlers queue work too). */
+static work_t    *KernelWorkHead[MAX_CPU];
+static work_t    *KernelWorkTail[MAX_CPU];
+static spinlock_t KernelWorkLocks[MAX_CPU];
+
+/* Worker thread of each CPU, and whether it sleeps for lack of work. */
+static uint64_t   KernelWorkWorker[MAX_CPU];
+static uint64_t   KernelWorkAsleep[MAX_CPU];
+
+/*****************************************************************************
+ *                          KernelWorkThread()
+ ****************************************************************************/
+
+static void KernelWorkThread (void *arg)
+{
+  /* Simplifying variables. */
+  uint64_t workCpu  = (uint64_t) arg;
+  uint64_t irqState = 0;
+  uint64_t curItem  = 0;
+  work_t  *work     = NULL;
+  work_t  *nextWork = NULL;
+
+  /* Take everything queued at once, run it, sleep when there is none. */
+  while (1)
+  {
+    irqState = KernelSpinLockIrq(&KernelWorkLocks[workCpu]);
+    work = KernelWorkHead[workCpu];
+    if (work == NULL)
+    {
+      KernelWorkAsleep[workCpu] = 1;
+      KernelSpinUnlockIrq(&KernelWorkLocks[workCpu], irqState);
+      KernelThreadBlock();
+      continue;
+    }
+    KernelWorkHead[workCpu] = NULL;
+    KernelWorkTail[workCpu] = NULL;
+    KernelSpinUnlockIrq(&KernelWorkLocks[workCpu], irqState);
+    KernelWorkBatches[workCpu]++;
+
+    /* Run the batch in queue order (an item may queue itself again). */
+    for (curItem = 0; work != NULL; curItem++)
+    {
+      nextWork = work->nextWork;
+      __atomic_store_n(&work->workState, WORK_IDLE, __ATOMIC_RELEASE);
+      work->workCallback(work);
+      KernelWorkExecuted[workCpu]++;
+      work = nextWork;
+
+      /* Long batch: let other threads of this priority run. */
+      if (curItem % WORK_BATCH == WORK_BATCH - 1)
+      {
+        KernelThreadYield();
+      }
+    }
+  }
+}
+
+/*****************************************************************************
+ *                        KernelWorkInitialize()
+ ****************************************************************************/
+
+void KernelWorkInitialize (uint64_t cpuId)
+{
+  /* Empty queue. */
+  KernelSpinInitialize(&KernelWorkLocks[cpuId]);
+  KernelWorkHead[cpuId]     = NULL;
+  KernelWorkTail[cpuId]     = NULL;
+  KernelWorkAsleep[cpuId]   = 0;
+  KernelWorkExecuted[cpuId] = 0;
+  KernelWorkBatches[cpuId]  = 0;
+  KernelWorkWorker[cpuId]   = NO_WORKER;
+
+  /* Worker thread, pinned to this CPU (called on it). */
+  if (KernelThreadCreate(KernelWorkThread, (void *) cpuId,
+                         KERNEL_CONFIG_WORK_PRIORITY,
+                         &KernelWorkWorker[cpuId]) != KERNEL_SUCCESS)
+  {
+    KernelWorkWorker[cpuId] = NO_WORKER;
+    return;
+  }
+  KernelThreadAffinity(KernelWorkWorker[cpuId], 1UL << cpuId);
+}
+
+/*****************************************************************************
+ *                          KernelWorkSetup()
+ ****************************************************************************/
+
+void KernelWorkSetup (work_t  *work,
+                      void   (*workCallback)(work_t *work),
+                      void    *workArg)
+{
+  /* Initialize the work structure. */
+  work->workState    = WORK_IDLE;
+  work->workCpu      = 0;
+  work->workCallback = workCallback;
+  work->workArg      = workArg;
+  work->nextWork     = NULL;
+}
+
+/*****************************************************************************
+ *                          KernelWorkQueueOn()
+ ****************************************************************************/
+
+uint64_t KernelWorkQueueOn (uint64_t workCpu, work_t *work)
+{
+  /* Local variables. */
+  uint64_t irqState = 0;
+  uint64_t wakeup   = 0;
+
+  /* No worker there? Fall back to the boot CPU. */
+  if (workCpu >= MAX_CPU || KernelWorkWorker[workCpu] == NO_WORKER)
+  {
+    workCpu = 0;
+  }
+
+  /* Already pending? It runs once for both requests. */
+  if (PortAtomicCas64(&work->workState, WORK_IDLE, WORK_PENDING) !=
+      WORK_IDLE)
+  {
+    return 0;
+  }
+
+  /* Append to the queue of the CPU. */
+  work->workCpu  = workCpu;
+  work->nextWork = NULL;
+  irqState = KernelSpinLockIrq(&KernelWorkLocks[workCpu]);
+  if (KernelWorkHead[workCpu] == NULL)
+  {
+    KernelWorkHead[workCpu] = work;
+  }
+  else
+  {
+    KernelWorkTail[workCpu]->nextWork = work;
+  }
+  KernelWorkTail[workCpu] = work;
+
+  /* Worker asleep? Wake it up (lock-free, fine from a handler). */
+  wakeup = KernelWorkAsleep[workCpu];
+  KernelWorkAsleep[workCpu] = 0;
+  KernelSpinUnlockIrq(&KernelWorkLocks[workCpu], irqState);
+  if (wakeup)
+  {
+    KernelThreadUnblock(KernelWorkWorker[workCpu]);
+  }
+
+  /* Done. */
+  return 1;
+}
+
+/*****************************************************************************
+ *                           KernelWorkQueue()
+ ****************************************************************************/
+
+uint64_t KernelWorkQueue (work_t *work)
+{
+  /* Run it on this CPU (its data is likely still in the cache). */
+  return KernelWorkQueueOn(PortCpuId(), work);
+}
+
+/*****************************************************************************
+ *                          KernelWorkTimeout()
+ ****************************************************************************/
+
+static void KernelWorkTimeout (timer_t *timer)
+{
+  /* Delay over: queue it on the CPU that armed the timer. */
+  KernelWorkQueueOn(timer->timerCpu, (work_t *) timer->timerArg);
+}
+
+/*****************************************************************************
+ *                        KernelWorkDelaySetup()
+ ****************************************************************************/
+
+void KernelWorkDelaySetup (work_delayed_t *delayed,
+                           void          (*workCallback)(work_t *work),
+                           void           *workArg)
+{
+  /* The work and its timer, once: a re-delay only re-arms the timer. */
+  KernelWorkSetup(&delayed->delayedWork, workCallback, workArg);
+  KernelTimerSetup(&delayed->delayedTimer, KernelWorkTimeout,
+                   &delayed->delayedWork);
+}
+
+/*****************************************************************************
+ *                          KernelWorkDelay()
+ ****************************************************************************/
+
+void KernelWorkDelay (work_delayed_t *delayed, uint64_t microseconds)
+{
+  /* Queue it from a timer, with slack: delayed work is never urgent
+   * (set up by KernelWorkDelaySetup, a pending delay is moved). */
+  KernelTimerStart(&delayed->delayedTimer,
+                   KernelTimerNow() + KernelTimerTicks(microseconds),
+                   KernelTimerTicks(KERNEL_CONFIG_WORK_SLACK_US));
+}
+
+/*****************************************************************************
+ *                        KernelWorkCancelDelay()
+ ****************************************************************************/
+
+uint64_t KernelWorkCancelDelay (work_delayed_t *delayed)
+{
+  /* Stop the timer and make sure its callback is not running. */
+  uint64_t pending = KernelTimerCancel(&delayed->delayedTimer);
+  KernelTimerWait(&delayed->delayedTimer);
+
+  /* Done (1 = the work was not queued). */
+  return pending;
+}
+
+/*****************************************************************************
+ *                         KernelWorkBarrier()
+ ****************************************************************************/
+
+static void KernelWorkBarrier (work_t *work)
+{
+  /* Simplifying variables. */
+  work_flush_t *flush       = (work_flush_t *) work->workArg;
+  uint64_t      flushThread = flush->flushThread;
+
+  /* Everything queued before us ran: release the flusher (its stack, and
+   * so the barrier, may be gone as soon as flushDone is set). */
+  __atomic_store_n(&flush->flushDone, 1, __ATOMIC_RELEASE);
+  KernelThreadUnblock(flushThread);
+}
+
+/*****************************************************************************
+ *                           KernelWorkFlush()
+ ****************************************************************************/
+
+void KernelWorkFlush (uint64_t workCpu)
+{
+  /* Barrier item and its state (both on our stack). */
+  work_t       work;
+  work_flush_t flush;
+
+  /* The worker flushing its own queue would wait for itself. */
+  if (workCpu >= MAX_CPU || KernelWorkWorker[workCpu] == NO_WORKER ||
+      KernelThreadCurrent()->threadId == KernelWorkWorker[workCpu])
+  {
+    return;
+  }
+
+  /* Queue a barrier behind everything pending and wait for it. */
+  flush.flushThread = KernelThreadCurrent()->threadId;
+  flush.flushDone   = 0;
+  KernelWorkSetup(&work, KernelWorkBarrier, &flush);
+  KernelWorkQueueOn(workCpu, &work);
+  while (!__atomic_load_n(&flush.flushDone, __ATOMIC_ACQUIRE))
+  {
+    KernelThreadBlock();
+  }
+}
@@ -52,9 +52,42 @@
 /* Address translation unit size. */
 #define PAGE_SIZE             (4096u)
 
-/* Process/thread count. */
+/* Start of the direct map of all physical memory (kernel half). */
+#define PORT_DIRECT_MAP_START (0xFFFF800000000000UL)
+
+/* Convert between physical and direct map addresses. */
+#define PORT_PHYS_TO_VIRT(ADDR) \
+  ((void *) (((uint64_t) (ADDR)) | PORT_DIRECT_MAP_START))
+#define PORT_VIRT_TO_PHYS(ADDR) \
+  ((void *) (((uint64_t) (ADDR)) & ~PORT_DIRECT_MAP_START))
+
+/* Process/thread/CPU count. */
 #define PORT_PROCESS_COUNT    (0x10000U)
 #define PORT_THREAD_COUNT     (0x10000U)
+#define PORT_CPU_COUNT        (16U)
+
+/* Error codes. */
+#define PORT_SUCCESS          (0)
+#define PORT_ERR_RESOURCE     (-1)
+
+/* Interrupt identifiers (GIC INTID, SGIs are 0 to 15). */
+#define PORT_INTERRUPT_WAKEUP   (0U)
+#define PORT_INTERRUPT_TIMER    (27U)
+
+/* SMCCC conduit of the PSCI firmware. */
+#define PORT_CONDUIT_UNKNOWN    (0U)
+#define PORT_CONDUIT_HVC        (1U)
+#define PORT_CONDUIT_SMC        (2U)
+#define PORT_CONDUIT_NONE       (3U)
+
+/* CPU idle states (0 is WFI, deeper ones go through PSCI CPU_SUSPEND). */
+#define PORT_IDLE_STATE_COUNT   (3U)
+
+/* Address translation attributes. */
+#define PORT_TRANSLATION_READ   (1UL<<0)
+#define PORT_TRANSLATION_WRITE  (1UL<<1)
+#define PORT_TRANSLATION_EXEC   (1UL<<2)
+#define PORT_TRANSLATION_USER   (1UL<<3)
 
 /*****************************************************************************
  *                              TYPEDEFS
@@ -75,6 +108,13 @@ typedef unsigned long      uint64_t;
 /* Error type. */
 typedef int64_t            error_t;
 
+/*****************************************************************************
+ *                             EXTERNS
+ ****************************************************************************/
+
+/* PSCI conduit (PORT_CONDUIT_*, set by the boot loader when it knows). */
+extern uint64_t PortPsciConduit;
+
 /*****************************************************************************
  *                          FUNCTION PROTOTYPES
  ****************************************************************************/
@@ -84,17 +124,99 @@ void PortSerialInitialize (void);
 void PortSerialPut        (char c);
 char PortSerialGet        (void);
 
+/* CPU-Specific Identification. */
+void     PortCpuInitialize (uint64_t cpuId);
+uint64_t PortCpuId         (void);
+uint64_t PortCpuCycles     (void);
+error_t  PortCpuStart      (uint64_t   cpuId,
+                            void     (*entry)(uint64_t cpuId),
+                            void      *stackTop);
+void     PortCpuIdle       (void);
+void     PortCpuRelax      (void);
+uint64_t PortCpuIrqSave    (void);
+void     PortCpuIrqRestore (uint64_t irqState);
+void     PortCpuIrqEnable  (void);
+uint64_t PortCpuIrqEnabled (void);
+
+/* CPU-Specific Atomic Operations (LSE when present, else LDXR/STXR). */
+void     PortAtomicInitialize (void);
+uint64_t PortAtomicHasLse     (void);
+uint32_t PortAtomicFetchAdd32 (uint32_t *atomicAddr, uint32_t value);
+uint64_t PortAtomicFetchAdd64 (uint64_t *atomicAddr, uint64_t value);
+uint64_t PortAtomicSwap64     (uint64_t *atomicAddr, uint64_t value);
+uint64_t PortAtomicCas64      (uint64_t *atomicAddr,
+                               uint64_t  expected,
+                               uint64_t  desired);
+
+/* CPU-Specific Exception Handling. */
+void PortExceptionInitialize (void);
+
+/* CPU-Specific Interrupt Controller. */
+void PortInterruptInitialize (uint64_t cpuId);
+void PortInterruptEnable     (uint64_t interruptId);
+void PortInterruptSend       (uint64_t cpuId, uint64_t interruptId);
+
+/* CPU-Specific Timer (virtual counter of the generic timer). */
+void     PortTimerInitialize (void);
+uint64_t PortTimerNow        (void);
+uint64_t PortTimerFrequency  (void);
+void     PortTimerSet        (uint64_t deadline);
+void     PortTimerCancel     (void);
+
+/* CPU-Specific Power Management (PSCI, versions are major << 16 | minor). */
+void     PortPsciInitialize (void);
+uint64_t PortPsciVersion    (void);
+uint64_t PortPsciSmccc      (void);
+error_t  PortPsciState      (uint64_t  stateNo,
+                             uint64_t *exitLatencyUs,
+                             uint64_t *residencyUs);
+void     PortPsciIdle       (uint64_t  stateNo);
+error_t  PortPsciCpuOn      (uint64_t  mpidr,
+                             void     *entryPhys,
+                             void     *contextPhys);
+void     PortPsciSystemOff  (void);
+
 /* CPU-Specific Address Translation. */
-void  PortTranslationInitialize (void);
-void *PortTranslationSet        (void *virtualAddr, void *physicalAddr);
-void *PortTranslationGet        (void *virtualAddr);
-void *PortTranslationDel        (void *virtualAddr);
+void    PortTranslationInitialize (void);
+void    PortTranslationEnter      (void    (*function)(void));
+void    PortTranslationSwitch     (void     *translationTable,
+                                   uint64_t  asid);
+void   *PortTranslationCreate     (void);
+void    PortTranslationDestroy    (void     *translationTable,
+                                   void    (*pageVisit)(void *physicalAddr));
+void   *PortTranslationSet        (void     *translationTable,
+                                   void     *virtualAddr,
+                                   void     *physicalAddr,
+                                   uint64_t  attributes);
+void   *PortTranslationGet        (void     *translationTable,
+                                   void     *virtualAddr,
+                                   uint64_t *attributes);
+void   *PortTranslationDel        (void     *translationTable,
+                                   void     *virtualAddr);
+void    PortTranslationProtect    (void     *translationTable,
+                                   void     *virtualAddr,
+                                   uint64_t  attributes);
+void   *PortTranslationReplace    (void     *translationTable,
+                                   void     *virtualAddr,
+                                   void     *physicalAddr,
+                                   uint64_t  attributes);
+error_t PortTranslationShare      (void     *dstTable,
+                                   void     *srcTable,
+                                   void     *startAddr,
+                                   void     *endAddr,
+                                   uint64_t  clearAttributes,
+                                   void    (*pageVisit)(void *physicalAddr));
 
 /* CPU-Specific Thread Routines. */
-void PortThreadAllocate   (uint64_t threadId);
-void PortThreadDeallocate (uint64_t threadId);
-void PortThreadRun        (uint64_t threadId);
-void PortThreadStop       (uint64_t threadId);
+void  PortThreadAllocate   (uint64_t threadId);
+void  PortThreadDeallocate (uint64_t threadId);
+void *PortThreadStackSlot  (uint64_t slotNo);
+void  PortThreadPrepare    (uint64_t   threadId,
+                            void     (*entry)(void *arg),
+                            void      *arg,
+                            void      *stackTop);
+void  PortThreadAdopt      (uint64_t threadId);
+void  PortThreadSwitch     (uint64_t prevThreadId, uint64_t nextThreadId);
 
 /*****************************************************************************
  *                            END OF HEADER
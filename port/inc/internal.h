@@ -39,6 +39,67 @@
 /* Port interface header. */
 #include "port/inc/interface.h"
 
+/*****************************************************************************
+ *                          MEMORY ZONES MACROS
+ ****************************************************************************/
+
+/* Private memory zone. */
+#define PRIMEM_ZONE_START       (0xFFFF000000000000UL)
+#define PRIMEM_ZONE_END         (0xFFFF3FFFFFFFFFFFUL)
+#define PRIMEM_ZONE_SLOTS       (64*1024)
+#define PRIMEM_ZONE_SLOT_SIZE   (0x40000000UL)
+
+/* Shared memory zone. */
+#define SHMEM_ZONE_START        (0xFFFF400000000000UL)
+#define SHMEM_ZONE_END          (0xFFFF7FFFFFFFFFFFUL)
+#define SHMEM_ZONE_SLOTS        (64*1024)
+#define SHMEM_ZONE_SLOT_SIZE    (0x40000000UL)
+
+/* Direct map zone (all physical memory, see PORT_PHYS_TO_VIRT). */
+#define DIRECT_ZONE_START       (PORT_DIRECT_MAP_START)
+#define DIRECT_ZONE_END         (0xFFFFBFFFFFFFFFFFUL)
+
+/* Stack zone. */
+#define STACK_ZONE_START        (0xFFFFC00000000000UL)
+#define STACK_ZONE_END          (0xFFFFFFFFFFFFFFFFUL)
+#define STACK_ZONE_SLOTS        (64*1024)
+#define STACK_ZONE_SLOT_SIZE    (0x40000000UL)
+
+/*****************************************************************************
+ *                              TYPEDEFS
+ ****************************************************************************/
+
+/* Register frame pushed by the exception vectors. */
+typedef struct port_frame_t
+{
+  uint64_t  x[31];
+  uint64_t  elr;
+  uint64_t  spsr;
+  uint64_t  sp0;
+} __attribute__((packed)) port_frame_t;
+
+/*****************************************************************************
+ *                          FUNCTION PROTOTYPES
+ ****************************************************************************/
+
+/* Exception entry (called from the vector table). */
+void PortExceptionHandler (uint64_t vectorNo, port_frame_t *frame);
+
+/* Kernel stack overflow entry (on the exception stack of the CPU). */
+void PortExceptionOverflow (uint64_t vectorNo);
+
+/* Move the UART to its direct map address. */
+void PortSerialRemap      (void);
+
+/* IRQ entry (called from the exception handler). */
+void PortInterruptHandler (void);
+
+/* Per-CPU thread state setup (called by PortCpuInitialize). */
+void PortThreadInitialize (uint64_t cpuId);
+
+/* FP/SIMD access trap (lazy FP state restore). */
+error_t PortThreadFpTrap  (void);
+
 /*****************************************************************************
  *                            END OF HEADER
  ****************************************************************************/
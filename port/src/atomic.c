@@ -0,0 +1,234 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   port/src/atomic.c
+ * @brief  ARTOS port module: atomic operations.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Port includes. */
+#include "port/inc/interface.h"
+#include "port/inc/internal.h"
+
+/*****************************************************************************
+ *                           ASSEMBLY MACROS
+ ****************************************************************************/
+
+#define MRS(var, sys_reg) __asm__ volatile("MRS %0, " #sys_reg : "=r"(var))
+
+/*****************************************************************************
+ *                            ATOMIC MACROS
+ ****************************************************************************/
+
+/* ID_AA64ISAR0_EL1.Atomic field (2 = ARMv8.1 LSE instructions). */
+#define ISAR0_ATOMIC_SHIFT      20
+#define ISAR0_ATOMIC_MASK       0xFUL
+#define ISAR0_ATOMIC_LSE        2
+
+/*****************************************************************************
+ *                           STATIC VARIABLES
+ ****************************************************************************/
+
+/* Whether the CPUs implement LSE (CAS/SWP/LDADD), else LDXR/STXR loops. */
+static uint64_t PortAtomicLse = 0;
+
+/*****************************************************************************
+ *                        PortAtomicInitialize()
+ ****************************************************************************/
+
+void PortAtomicInitialize (void)
+{
+  /* Feature register. */
+  uint64_t isar0 = 0;
+
+  /* Single-instruction atomics scale better under contention. */
+  MRS(isar0, ID_AA64ISAR0_EL1);
+  PortAtomicLse = ((isar0 >> ISAR0_ATOMIC_SHIFT) & ISAR0_ATOMIC_MASK) >=
+                  ISAR0_ATOMIC_LSE;
+}
+
+/*****************************************************************************
+ *                          PortAtomicHasLse()
+ ****************************************************************************/
+
+uint64_t PortAtomicHasLse (void)
+{
+  /* Selected implementation. */
+  return PortAtomicLse;
+}
+
+/*****************************************************************************
+ *                        PortAtomicFetchAdd32()
+ ****************************************************************************/
+
+uint32_t PortAtomicFetchAdd32 (uint32_t *atomicAddr, uint32_t value)
+{
+  /* Local variables. */
+  uint32_t oldValue = 0;
+  uint32_t newValue = 0;
+  uint32_t status   = 0;
+
+  /* Add, acquire semantics, return the previous value. */
+  if (PortAtomicLse)
+  {
+    __asm__ volatile(".arch_extension lse                            \n"
+                     "  ldadda %w[val], %w[old], [%[addr]]           \n"
+                     : [old] "=r" (oldValue)
+                     : [val] "r" (value), [addr] "r" (atomicAddr)
+                     : "memory");
+  }
+  else
+  {
+    __asm__ volatile("1:                                             \n"
+                     "  ldaxr  %w[old], [%[addr]]                    \n"
+                     "  add    %w[new], %w[old], %w[val]             \n"
+                     "  stxr   %w[sts], %w[new], [%[addr]]           \n"
+                     "  cbnz   %w[sts], 1b                           \n"
+                     : [old] "=&r" (oldValue), [new] "=&r" (newValue),
+                       [sts] "=&r" (status)
+                     : [val] "r" (value), [addr] "r" (atomicAddr)
+                     : "memory");
+  }
+
+  /* Done. */
+  return oldValue;
+}
+
+/*****************************************************************************
+ *                        PortAtomicFetchAdd64()
+ ****************************************************************************/
+
+uint64_t PortAtomicFetchAdd64 (uint64_t *atomicAddr, uint64_t value)
+{
+  /* Local variables. */
+  uint64_t oldValue = 0;
+  uint64_t newValue = 0;
+  uint32_t status   = 0;
+
+  /* Add, acquire and release semantics, return the previous value. */
+  if (PortAtomicLse)
+  {
+    __asm__ volatile(".arch_extension lse                            \n"
+                     "  ldaddal %[val], %[old], [%[addr]]            \n"
+                     : [old] "=r" (oldValue)
+                     : [val] "r" (value), [addr] "r" (atomicAddr)
+                     : "memory");
+  }
+  else
+  {
+    __asm__ volatile("1:                                             \n"
+                     "  ldaxr  %[old], [%[addr]]                     \n"
+                     "  add    %[new], %[old], %[val]                \n"
+                     "  stlxr  %w[sts], %[new], [%[addr]]            \n"
+                     "  cbnz   %w[sts], 1b                           \n"
+                     : [old] "=&r" (oldValue), [new] "=&r" (newValue),
+                       [sts] "=&r" (status)
+                     : [val] "r" (value), [addr] "r" (atomicAddr)
+                     : "memory");
+  }
+
+  /* Done. */
+  return oldValue;
+}
+
+/*****************************************************************************
+ *                          PortAtomicSwap64()
+ ****************************************************************************/
+
+uint64_t PortAtomicSwap64 (uint64_t *atomicAddr, uint64_t value)
+{
+  /* Local variables. */
+  uint64_t oldValue = 0;
+  uint32_t status   = 0;
+
+  /* Exchange, acquire and release semantics. */
+  if (PortAtomicLse)
+  {
+    __asm__ volatile(".arch_extension lse                            \n"
+                     "  swpal  %[val], %[old], [%[addr]]             \n"
+                     : [old] "=r" (oldValue)
+                     : [val] "r" (value), [addr] "r" (atomicAddr)
+                     : "memory");
+  }
+  else
+  {
+    __asm__ volatile("1:                                             \n"
+                     "  ldaxr  %[old], [%[addr]]                     \n"
+                     "  stlxr  %w[sts], %[val], [%[addr]]            \n"
+                     "  cbnz   %w[sts], 1b                           \n"
+                     : [old] "=&r" (oldValue), [sts] "=&r" (status)
+                     : [val] "r" (value), [addr] "r" (atomicAddr)
+                     : "memory");
+  }
+
+  /* Done. */
+  return oldValue;
+}
+
+/*****************************************************************************
+ *                          PortAtomicCas64()
+ ****************************************************************************/
+
+uint64_t PortAtomicCas64 (uint64_t *atomicAddr,
+                          uint64_t  expected,
+                          uint64_t  desired)
+{
+  /* Local variables. */
+  uint64_t oldValue = expected;
+  uint32_t status   = 0;
+
+  /* Compare and swap, acquire and release semantics, return the old (a
+   * mismatch drops the exclusive monitor it left armed). */
+  if (PortAtomicLse)
+  {
+    __asm__ volatile(".arch_extension lse                            \n"
+                     "  casal  %[old], %[new], [%[addr]]             \n"
+                     : [old] "+r" (oldValue)
+                     : [new] "r" (desired), [addr] "r" (atomicAddr)
+                     : "memory");
+  }
+  else
+  {
+    __asm__ volatile("1:                                             \n"
+                     "  ldaxr  %[old], [%[addr]]                     \n"
+                     "  cmp    %[old], %[exp]                        \n"
+                     "  b.ne   2f                                    \n"
+                     "  stlxr  %w[sts], %[new], [%[addr]]            \n"
+                     "  cbnz   %w[sts], 1b                           \n"
+                     "  b      3f                                    \n"
+                     "2:                                             \n"
+                     "  clrex                                        \n"
+                     "3:                                             \n"
+                     : [old] "=&r" (oldValue), [sts] "=&r" (status)
+                     : [exp] "r" (expected), [new] "r" (desired),
+                       [addr] "r" (atomicAddr)
+                     : "cc", "memory");
+  }
+
+  /* Done. */
+  return oldValue;
+}
@@ -0,0 +1,295 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   port/src/cpu.c
+ * @brief  ARTOS port module: CPU identification.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Port includes. */
+#include "port/inc/interface.h"
+#include "port/inc/internal.h"
+
+/*****************************************************************************
+ *                           ASSEMBLY MACROS
+ ****************************************************************************/
+
+#define MSR(sys_reg, var) __asm__ volatile("MSR " #sys_reg " , %0"::"r"(var))
+#define MRS(var, sys_reg) __asm__ volatile("MRS %0, " #sys_reg : "=r"(var))
+#define ISB()             __asm__ volatile("ISB")
+
+/*****************************************************************************
+ *                              CPU MACROS
+ ****************************************************************************/
+
+/* CPACR_EL1.FPEN field specification. */
+#define CPACR_FPEN_TRAP         (0UL<<20)
+
+/* PMCR_EL0 and PMCNTENSET_EL0 field specification. */
+#define PMCR_ENABLE             (1UL<<0)
+#define PMCNTEN_CYCLES          (1UL<<31)
+
+/* DAIF.I field specification. */
+#define DAIF_IRQ                (1UL<<7)
+
+/* QEMU virt numbers the cores linearly in MPIDR.Aff0. */
+#define CPU_MPIDR(CPU_ID)       ((uint64_t) (CPU_ID))
+
+/*****************************************************************************
+ *                              TYPEDEFS
+ ****************************************************************************/
+
+/* Boot block of a secondary CPU (read with the MMU off, one cache line). */
+typedef struct port_boot_t
+{
+  uint64_t  mair;
+  uint64_t  tcr;
+  uint64_t  ttbr0;
+  uint64_t  ttbr1;
+  uint64_t  sctlr;
+  uint64_t  stackTop;
+  uint64_t  entry;
+  uint64_t  cpuId;
+} __attribute__((packed)) port_boot_t;
+
+/*****************************************************************************
+ *                          FUNCTION PROTOTYPES
+ ****************************************************************************/
+
+/* Assembly entry of secondary CPUs (see below). */
+void PortCpuSecondaryEntry (void);
+
+/*****************************************************************************
+ *                           STATIC VARIABLES
+ ****************************************************************************/
+
+/* Boot blocks of secondary CPUs. */
+static port_boot_t PortCpuBoot[PORT_CPU_COUNT] __attribute__((aligned(64)));
+
+/*****************************************************************************
+ *                         SECONDARY ENTRY CODE
+ ****************************************************************************/
+
+__asm__(
+  /* MMU off, x0: physical address of the boot block (see port_boot_t). */
+  ".text                                                             \n"
+  ".global PortCpuSecondaryEntry                                     \n"
+  "PortCpuSecondaryEntry:                                            \n"
+  "  ldp   x1,  x2,  [x0, #0]                                        \n"
+  "  msr   mair_el1,  x1                                             \n"
+  "  msr   tcr_el1,   x2                                             \n"
+  "  ldp   x1,  x2,  [x0, #16]                                       \n"
+  "  msr   ttbr0_el1, x1                                             \n"
+  "  msr   ttbr1_el1, x2                                             \n"
+  "  isb                                                             \n"
+  "  tlbi  vmalle1                                                   \n"
+  "  dsb   nsh                                                       \n"
+  "  isb                                                             \n"
+  /* Same tables as the boot CPU: identity map keeps the PC valid. */
+  "  ldr   x1,  [x0, #32]                                            \n"
+  "  msr   sctlr_el1, x1                                             \n"
+  "  isb                                                             \n"
+  /* Switch to the kernel stack and the direct map alias of entry. */
+  "  ldp   x1,  x2,  [x0, #40]                                       \n"
+  "  ldr   x3,  [x0, #56]                                            \n"
+  "  mov   sp,  x1                                                   \n"
+  "  mov   x0,  x3                                                   \n"
+  "  blr   x2                                                        \n"
+  "1:                                                                \n"
+  "  wfe                                                             \n"
+  "  b     1b                                                        \n"
+);
+
+/*****************************************************************************
+ *                         PortCpuInitialize()
+ ****************************************************************************/
+
+void PortCpuInitialize (uint64_t cpuId)
+{
+  /* Keep the logical CPU number in TPIDR_EL1 for cheap lookups. */
+  MSR(TPIDR_EL1, cpuId);
+
+  /* Boot and idle code run with IRQs masked, threads unmask them. */
+  __asm__ volatile("MSR DAIFSet, #2" ::: "memory");
+
+  /* Trap FP/SIMD accesses, the state is loaded lazily per thread. */
+  MSR(CPACR_EL1, CPACR_FPEN_TRAP);
+  PortThreadInitialize(cpuId);
+
+  /* Enable the cycle counter (PMCR_EL0.E, PMCNTENSET_EL0.C). */
+  MSR(PMCR_EL0, PMCR_ENABLE);
+  MSR(PMCNTENSET_EL0, PMCNTEN_CYCLES);
+  ISB();
+}
+
+/*****************************************************************************
+ *                             PortCpuId()
+ ****************************************************************************/
+
+uint64_t PortCpuId (void)
+{
+  /* Logical CPU number. */
+  uint64_t cpuId = 0;
+
+  /* Read it back from TPIDR_EL1. */
+  MRS(cpuId, TPIDR_EL1);
+
+  /* Done. */
+  return cpuId;
+}
+
+/*****************************************************************************
+ *                            PortCpuCycles()
+ ****************************************************************************/
+
+uint64_t PortCpuCycles (void)
+{
+  /* Cycle counter value. */
+  uint64_t cycles = 0;
+
+  /* Do not let the read float around the measured code. */
+  ISB();
+  MRS(cycles, PMCCNTR_EL0);
+
+  /* Done. */
+  return cycles;
+}
+
+/*****************************************************************************
+ *                            PortCpuStart()
+ ****************************************************************************/
+
+error_t PortCpuStart (uint64_t   cpuId,
+                      void     (*entry)(uint64_t cpuId),
+                      void      *stackTop)
+{
+  /* Local variables. */
+  port_boot_t *boot = NULL;
+
+  /* Check parameters. */
+  if (cpuId >= PORT_CPU_COUNT)
+  {
+    return PORT_ERR_RESOURCE;
+  }
+
+  /* The secondary reuses the translation setup of this CPU. */
+  boot = &PortCpuBoot[cpuId];
+  MRS(boot->mair,  MAIR_EL1);
+  MRS(boot->tcr,   TCR_EL1);
+  MRS(boot->ttbr0, TTBR0_EL1);
+  MRS(boot->ttbr1, TTBR1_EL1);
+  MRS(boot->sctlr, SCTLR_EL1);
+  boot->stackTop = (uint64_t) stackTop;
+  boot->entry    = (uint64_t) entry;
+  boot->cpuId    = cpuId;
+
+  /* It reads the block with caches off: push it to memory. */
+  __asm__ volatile("DC CIVAC, %0" :: "r"(boot) : "memory");
+  __asm__ volatile("DSB SY" ::: "memory");
+
+  /* PSCI CPU_ON (physical entry point, context id = boot block). */
+  return PortPsciCpuOn(CPU_MPIDR(cpuId),
+                       PORT_VIRT_TO_PHYS(PortCpuSecondaryEntry),
+                       PORT_VIRT_TO_PHYS(boot));
+}
+
+/*****************************************************************************
+ *                            PortCpuRelax()
+ ****************************************************************************/
+
+void PortCpuRelax (void)
+{
+  /* Spin-wait hint (gives the pipeline to the other hardware thread). */
+  __asm__ volatile("YIELD" ::: "memory");
+}
+
+/*****************************************************************************
+ *                           PortCpuIrqSave()
+ ****************************************************************************/
+
+uint64_t PortCpuIrqSave (void)
+{
+  /* Previous interrupt mask. */
+  uint64_t daif = 0;
+
+  /* Save the mask, then mask IRQs. */
+  MRS(daif, DAIF);
+  __asm__ volatile("MSR DAIFSet, #2" ::: "memory");
+
+  /* Done. */
+  return daif;
+}
+
+/*****************************************************************************
+ *                          PortCpuIrqRestore()
+ ****************************************************************************/
+
+void PortCpuIrqRestore (uint64_t irqState)
+{
+  /* Back to the mask saved by PortCpuIrqSave(). */
+  __asm__ volatile("MSR DAIF, %0" :: "r"(irqState) : "memory");
+}
+
+/*****************************************************************************
+ *                          PortCpuIrqEnable()
+ ****************************************************************************/
+
+void PortCpuIrqEnable (void)
+{
+  /* Unmask IRQs (threads run preemptible). */
+  __asm__ volatile("MSR DAIFClr, #2" ::: "memory");
+}
+
+/*****************************************************************************
+ *                          PortCpuIrqEnabled()
+ ****************************************************************************/
+
+uint64_t PortCpuIrqEnabled (void)
+{
+  /* Current interrupt mask. */
+  uint64_t daif = 0;
+
+  /* PSTATE.I clear? */
+  MRS(daif, DAIF);
+  return (daif & DAIF_IRQ) == 0;
+}
+
+/*****************************************************************************
+ *                             PortCpuIdle()
+ ****************************************************************************/
+
+void PortCpuIdle (void)
+{
+  /* Sleep, a pending interrupt wakes the CPU even while masked. */
+  __asm__ volatile("DSB SY" ::: "memory");
+  __asm__ volatile("WFI" ::: "memory");
+
+  /* Let the interrupt be taken, then mask again. */
+  __asm__ volatile("MSR DAIFClr, #2" ::: "memory");
+  ISB();
+  __asm__ volatile("MSR DAIFSet, #2" ::: "memory");
+}
@@ -0,0 +1,324 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   port/src/exception.c
+ * @brief  ARTOS port module: exception handling.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Port includes. */
+#include "port/inc/interface.h"
+#include "port/inc/internal.h"
+
+/*****************************************************************************
+ *                          FUNCTION PROTOTYPES
+ ****************************************************************************/
+
+/* FIXME: THIS SHOULD BE ABSTRACTED IN A BETTER WAY. */
+error_t KernelProcessFault (void *faultAddr, uint64_t faultAccess);
+void    KernelPrintFmt     (char *fmt, ...);
+
+/*****************************************************************************
+ *                           ASSEMBLY MACROS
+ ****************************************************************************/
+
+#define MSR(sys_reg, var) __asm__ volatile("MSR " #sys_reg " , %0"::"r"(var))
+#define MRS(var, sys_reg) __asm__ volatile("MRS %0, " #sys_reg : "=r"(var))
+#define ISB()             __asm__ volatile("ISB")
+
+/*****************************************************************************
+ *                           EXCEPTION MACROS
+ ****************************************************************************/
+
+/* Exception type (vector number modulo 4). */
+#define VECTOR_SYNC             0
+#define VECTOR_IRQ              1
+#define VECTOR_FIQ              2
+#define VECTOR_SERROR           3
+
+/* ESR_EL1.EC field specification. */
+#define EC_FP_ACCESS            0x07
+#define EC_IABT_LOWER           0x20
+#define EC_IABT_SAME            0x21
+#define EC_DABT_LOWER           0x24
+#define EC_DABT_SAME            0x25
+
+/* ESR_EL1.ISS fields for aborts. */
+#define ISS_WNR                 (1UL<<6)
+#define ISS_FSC_TYPE_MASK       0x3C
+#define ISS_FSC_TRANSLATION     0x04
+#define ISS_FSC_PERMISSION      0x0C
+
+/* Per-CPU exception stack size (the vector code shifts by 13). */
+#define EXCEPTION_STACK_SHIFT   13
+#define EXCEPTION_STACK_SIZE    (1UL<<EXCEPTION_STACK_SHIFT)
+
+/*****************************************************************************
+ *                           VECTOR TABLE
+ ****************************************************************************/
+
+__asm__(
+  /* Every vector saves x0/x1, loads its number and joins the common path.
+   * Before touching memory it checks whether the frame would land in the
+   * guard page of a stack slot (offset below one page in the 1GB slot of
+   * the stack zone): storing there would fault again on the same SP and
+   * recurse forever, so an overflow moves to the exception stack instead.
+   * x0 is borrowed through SP (SP += x0, x0 = SP - x0) to keep all
+   * general purpose registers intact on the regular path. */
+  ".macro PORT_VECTOR vectorNo                                       \n"
+  "  .balign 0x80                                                    \n"
+  "  sub   sp, sp, #272                                              \n"
+  "  add   sp, sp, x0                                                \n"
+  "  sub   x0, sp, x0                                                \n"
+  "  tst   x0, #0x3FFFF000                                           \n"
+  "  sub   x0, sp, x0                                                \n"
+  "  sub   sp, sp, x0                                                \n"
+  "  b.eq  2f                                                        \n"
+  "1:                                                                \n"
+  "  stp   x0, x1, [sp, #0]                                          \n"
+  "  mov   x0, #\\vectorNo                                           \n"
+  "  b     PortExceptionEntry                                        \n"
+  "2:                                                                \n"
+  "  add   sp, sp, x0                                                \n"
+  "  sub   x0, sp, x0                                                \n"
+  "  mvn   x0, x0                                                    \n"
+  "  tst   x0, #0xFFFFC00000000000                                   \n"
+  "  mvn   x0, x0                                                    \n"
+  "  sub   x0, sp, x0                                                \n"
+  "  sub   sp, sp, x0                                                \n"
+  "  b.ne  1b                                                        \n"
+  "  mov   x1, #\\vectorNo                                           \n"
+  "  b     PortExceptionOverflowEntry                                \n"
+  ".endm                                                             \n"
+  "                                                                  \n"
+  ".text                                                             \n"
+  ".balign 0x800                                                     \n"
+  ".global PortExceptionVectors                                      \n"
+  "PortExceptionVectors:                                             \n"
+  "  PORT_VECTOR 0                                                   \n"
+  "  PORT_VECTOR 1                                                   \n"
+  "  PORT_VECTOR 2                                                   \n"
+  "  PORT_VECTOR 3                                                   \n"
+  "  PORT_VECTOR 4                                                   \n"
+  "  PORT_VECTOR 5                                                   \n"
+  "  PORT_VECTOR 6                                                   \n"
+  "  PORT_VECTOR 7                                                   \n"
+  "  PORT_VECTOR 8                                                   \n"
+  "  PORT_VECTOR 9                                                   \n"
+  "  PORT_VECTOR 10                                                  \n"
+  "  PORT_VECTOR 11                                                  \n"
+  "  PORT_VECTOR 12                                                  \n"
+  "  PORT_VECTOR 13                                                  \n"
+  "  PORT_VECTOR 14                                                  \n"
+  "  PORT_VECTOR 15                                                  \n"
+  "                                                                  \n"
+  /* Save the rest of the frame (see port_frame_t). */
+  "PortExceptionEntry:                                               \n"
+  "  stp   x2,  x3,  [sp, #16]                                       \n"
+  "  stp   x4,  x5,  [sp, #32]                                       \n"
+  "  stp   x6,  x7,  [sp, #48]                                       \n"
+  "  stp   x8,  x9,  [sp, #64]                                       \n"
+  "  stp   x10, x11, [sp, #80]                                       \n"
+  "  stp   x12, x13, [sp, #96]                                       \n"
+  "  stp   x14, x15, [sp, #112]                                      \n"
+  "  stp   x16, x17, [sp, #128]                                      \n"
+  "  stp   x18, x19, [sp, #144]                                      \n"
+  "  stp   x20, x21, [sp, #160]                                      \n"
+  "  stp   x22, x23, [sp, #176]                                      \n"
+  "  stp   x24, x25, [sp, #192]                                      \n"
+  "  stp   x26, x27, [sp, #208]                                      \n"
+  "  stp   x28, x29, [sp, #224]                                      \n"
+  "  mrs   x2,  elr_el1                                              \n"
+  "  stp   x30, x2,  [sp, #240]                                      \n"
+  "  mrs   x2,  spsr_el1                                             \n"
+  "  mrs   x3,  sp_el0                                               \n"
+  "  stp   x2,  x3,  [sp, #256]                                      \n"
+  "                                                                  \n"
+  /* PortExceptionHandler(vectorNo, frame). */
+  "  mov   x1,  sp                                                   \n"
+  "  bl    PortExceptionHandler                                      \n"
+  "                                                                  \n"
+  /* Restore the frame and return. */
+  "  ldp   x2,  x3,  [sp, #256]                                      \n"
+  "  msr   spsr_el1, x2                                              \n"
+  "  msr   sp_el0,   x3                                              \n"
+  "  ldp   x30, x2,  [sp, #240]                                      \n"
+  "  msr   elr_el1,  x2                                              \n"
+  "  ldp   x28, x29, [sp, #224]                                      \n"
+  "  ldp   x26, x27, [sp, #208]                                      \n"
+  "  ldp   x24, x25, [sp, #192]                                      \n"
+  "  ldp   x22, x23, [sp, #176]                                      \n"
+  "  ldp   x20, x21, [sp, #160]                                      \n"
+  "  ldp   x18, x19, [sp, #144]                                      \n"
+  "  ldp   x16, x17, [sp, #128]                                      \n"
+  "  ldp   x14, x15, [sp, #112]                                      \n"
+  "  ldp   x12, x13, [sp, #96]                                       \n"
+  "  ldp   x10, x11, [sp, #80]                                       \n"
+  "  ldp   x8,  x9,  [sp, #64]                                       \n"
+  "  ldp   x6,  x7,  [sp, #48]                                       \n"
+  "  ldp   x4,  x5,  [sp, #32]                                       \n"
+  "  ldp   x2,  x3,  [sp, #16]                                       \n"
+  "  ldp   x0,  x1,  [sp, #0]                                        \n"
+  "  add   sp,  sp,  #272                                            \n"
+  "  eret                                                            \n"
+  "                                                                  \n"
+  /* Stack overflow: continue on the exception stack of this CPU. */
+  "PortExceptionOverflowEntry:                                       \n"
+  "  mrs   x0,  tpidr_el1                                            \n"
+  "  add   x0,  x0,  #1                                              \n"
+  "  lsl   x0,  x0,  #13                                             \n"
+  "  adrp  x2,  PortExceptionStacks                                  \n"
+  "  add   x2,  x2,  :lo12:PortExceptionStacks                       \n"
+  "  add   sp,  x2,  x0                                              \n"
+  "  mov   x0,  x1                                                   \n"
+  "  bl    PortExceptionOverflow                                     \n"
+);
+
+/* Vector table base (defined above). */
+extern uint8_t PortExceptionVectors[];
+
+/*****************************************************************************
+ *                          STATIC VARIABLES
+ ****************************************************************************/
+
+/* Per-CPU exception stacks, used once a kernel stack has overflowed. */
+static uint8_t PortExceptionStacks[PORT_CPU_COUNT][EXCEPTION_STACK_SIZE]
+  __attribute__((used, aligned(16)));
+
+/*****************************************************************************
+ *                       PortExceptionInitialize()
+ ****************************************************************************/
+
+void PortExceptionInitialize (void)
+{
+  /* Install the vector table. */
+  MSR(VBAR_EL1, PortExceptionVectors);
+
+  /* Halt pipeline until MSR is completed. */
+  ISB();
+}
+
+/*****************************************************************************
+ *                        PortExceptionAbort()
+ ****************************************************************************/
+
+static error_t PortExceptionAbort (uint64_t esr, uint64_t far, uint64_t access)
+{
+  /* Simplifying variables. */
+  uint64_t faultType = esr & ISS_FSC_TYPE_MASK;
+
+  /* Only translation and permission faults can be resolved. */
+  if (faultType != ISS_FSC_TRANSLATION && faultType != ISS_FSC_PERMISSION)
+  {
+    return PORT_ERR_RESOURCE;
+  }
+
+  /* Let the kernel resolve the fault (demand paging, copy-on-write). */
+  return KernelProcessFault((void *) far, access);
+}
+
+/*****************************************************************************
+ *                        PortExceptionHandler()
+ ****************************************************************************/
+
+void PortExceptionHandler (uint64_t vectorNo, port_frame_t *frame)
+{
+  /* Syndrome information. */
+  uint64_t esr = 0;
+  uint64_t far = 0;
+  uint64_t ec  = 0;
+
+  /* Error code. */
+  error_t  err = PORT_ERR_RESOURCE;
+
+  /* Read syndrome and fault address. */
+  MRS(esr, ESR_EL1);
+  MRS(far, FAR_EL1);
+
+  /* Synchronous exception? */
+  if ((vectorNo & 3) == VECTOR_SYNC)
+  {
+    /* Decode exception class. */
+    ec = (esr >> 26) & 0x3F;
+
+    /* FP/SIMD access trap, data or instruction abort? */
+    if (ec == EC_FP_ACCESS)
+    {
+      err = PortThreadFpTrap();
+    }
+    else if (ec == EC_DABT_LOWER || ec == EC_DABT_SAME)
+    {
+      err = PortExceptionAbort(esr, far, (esr & ISS_WNR) ?
+                                         PORT_TRANSLATION_WRITE :
+                                         PORT_TRANSLATION_READ);
+    }
+    else if (ec == EC_IABT_LOWER || ec == EC_IABT_SAME)
+    {
+      err = PortExceptionAbort(esr, far, PORT_TRANSLATION_EXEC);
+    }
+  }
+
+  /* Interrupt? Let the controller dispatch it. */
+  if ((vectorNo & 3) == VECTOR_IRQ)
+  {
+    PortInterruptHandler();
+    err = PORT_SUCCESS;
+  }
+
+  /* Handled? Return to the interrupted context. */
+  if (err == PORT_SUCCESS)
+  {
+    return;
+  }
+
+  /* Unhandled exception: report and halt. */
+  KernelPrintFmt("UNHANDLED EXCEPTION: VEC=%x ESR=%x FAR=%x ELR=%x\n",
+                 vectorNo, esr, far, frame->elr);
+  while (1);
+}
+
+/*****************************************************************************
+ *                        PortExceptionOverflow()
+ ****************************************************************************/
+
+void PortExceptionOverflow (uint64_t vectorNo)
+{
+  /* Syndrome information. */
+  uint64_t esr = 0;
+  uint64_t far = 0;
+  uint64_t elr = 0;
+
+  /* Read syndrome, fault address and faulting instruction. */
+  MRS(esr, ESR_EL1);
+  MRS(far, FAR_EL1);
+  MRS(elr, ELR_EL1);
+
+  /* The interrupted stack is unusable: report and halt. */
+  KernelPrintFmt("KERNEL STACK OVERFLOW: VEC=%x ESR=%x FAR=%x ELR=%x\n",
+                 vectorNo, esr, far, elr);
+  while (1);
+}
@@ -0,0 +1,195 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   port/src/interrupt.c
+ * @brief  ARTOS port module: interrupt controller (GICv2).
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Port includes. */
+#include "port/inc/interface.h"
+#include "port/inc/internal.h"
+
+/*****************************************************************************
+ *                          FUNCTION PROTOTYPES
+ ****************************************************************************/
+
+/* FIXME: THIS SHOULD BE ABSTRACTED IN A BETTER WAY. */
+void KernelTimerInterrupt        (void);
+void KernelThreadWakeInterrupt   (void);
+void KernelThreadInterruptEnter  (void);
+void KernelThreadInterruptExit   (void);
+
+/*****************************************************************************
+ *                              GIC MACROS
+ ****************************************************************************/
+
+/* GICv2 physical base addresses (QEMU virt). */
+#define GICD_BASE               0x08000000UL
+#define GICC_BASE               0x08010000UL
+
+/* Register access through the direct map. */
+#define GICD_REG(OFFSET)        (*((volatile uint32_t *) \
+                                   PORT_PHYS_TO_VIRT(GICD_BASE + (OFFSET))))
+#define GICC_REG(OFFSET)        (*((volatile uint32_t *) \
+                                   PORT_PHYS_TO_VIRT(GICC_BASE + (OFFSET))))
+
+/* Distributor registers. */
+#define GICD_CTLR               0x000
+#define GICD_TYPER              0x004
+#define GICD_ISENABLER(N)       (0x100 + 4 * (N))
+#define GICD_ICENABLER(N)       (0x180 + 4 * (N))
+#define GICD_IPRIORITYR(N)      (0x400 + 4 * (N))
+#define GICD_SGIR               0xF00
+
+/* CPU interface registers. */
+#define GICC_CTLR               0x000
+#define GICC_PMR                0x004
+#define GICC_BPR                0x008
+#define GICC_IAR                0x00C
+#define GICC_EOIR               0x010
+
+/* Field specification. */
+#define GIC_ENABLE              1U
+#define GIC_PRIORITY_DEFAULT    0xA0A0A0A0U
+#define GIC_PRIORITY_MASK_ALL   0xF0U
+#define GIC_INTID_MASK          0x3FFU
+#define GIC_INTID_SPURIOUS      1023U
+#define GIC_SGI_TARGET_SHIFT    16
+
+/*****************************************************************************
+ *                       PortInterruptInitialize()
+ ****************************************************************************/
+
+void PortInterruptInitialize (uint64_t cpuId)
+{
+  /* Loop counter and limits. */
+  uint32_t curReg   = 0;
+  uint32_t regCount = 0;
+
+  /* The boot CPU sets up the (shared) distributor. */
+  if (cpuId == 0)
+  {
+    /* Disable while programming. */
+    GICD_REG(GICD_CTLR) = 0;
+
+    /* Disable every SPI and give it a default priority. */
+    regCount = ((GICD_REG(GICD_TYPER) & 0x1F) + 1) * 32;
+    for (curReg = 1; curReg < regCount / 32; curReg++)
+    {
+      GICD_REG(GICD_ICENABLER(curReg)) = 0xFFFFFFFFU;
+    }
+    for (curReg = 8; curReg < regCount / 4; curReg++)
+    {
+      GICD_REG(GICD_IPRIORITYR(curReg)) = GIC_PRIORITY_DEFAULT;
+    }
+
+    /* Enable forwarding. */
+    GICD_REG(GICD_CTLR) = GIC_ENABLE;
+  }
+
+  /* Banked SGI/PPI state: all disabled, default priority. */
+  GICD_REG(GICD_ICENABLER(0)) = 0xFFFFFFFFU;
+  for (curReg = 0; curReg < 8; curReg++)
+  {
+    GICD_REG(GICD_IPRIORITYR(curReg)) = GIC_PRIORITY_DEFAULT;
+  }
+
+  /* CPU interface: accept every priority, no preemption groups. */
+  GICC_REG(GICC_PMR)  = GIC_PRIORITY_MASK_ALL;
+  GICC_REG(GICC_BPR)  = 0;
+  GICC_REG(GICC_CTLR) = GIC_ENABLE;
+}
+
+/*****************************************************************************
+ *                        PortInterruptEnable()
+ ****************************************************************************/
+
+void PortInterruptEnable (uint64_t interruptId)
+{
+  /* One bit per interrupt (SGI/PPI bits are banked per CPU). */
+  GICD_REG(GICD_ISENABLER(interruptId / 32)) = 1U << (interruptId % 32);
+}
+
+/*****************************************************************************
+ *                         PortInterruptSend()
+ ****************************************************************************/
+
+void PortInterruptSend (uint64_t cpuId, uint64_t interruptId)
+{
+  /* Make our stores visible before the target takes the interrupt. */
+  __asm__ volatile("DSB ISHST" ::: "memory");
+
+  /* SGI to one CPU interface (numbered like the CPUs on QEMU virt). */
+  GICD_REG(GICD_SGIR) = (1U << (GIC_SGI_TARGET_SHIFT + cpuId)) |
+                        (uint32_t) interruptId;
+}
+
+/*****************************************************************************
+ *                        PortInterruptHandler()
+ ****************************************************************************/
+
+void PortInterruptHandler (void)
+{
+  /* Acknowledged interrupt. */
+  uint32_t iar = 0;
+  uint32_t interruptId = 0;
+
+  /* No thread switch while handlers run. */
+  KernelThreadInterruptEnter();
+
+  /* Drain every pending interrupt. */
+  while (1)
+  {
+    /* Acknowledge. */
+    iar         = GICC_REG(GICC_IAR);
+    interruptId = iar & GIC_INTID_MASK;
+    if (interruptId == GIC_INTID_SPURIOUS)
+    {
+      break;
+    }
+
+    /* Dispatch. */
+    if (interruptId == PORT_INTERRUPT_TIMER)
+    {
+      /* Silence the level-triggered source, the kernel re-arms it. */
+      PortTimerCancel();
+      KernelTimerInterrupt();
+    }
+    else if (interruptId == PORT_INTERRUPT_WAKEUP)
+    {
+      /* Another CPU made a thread ready for us. */
+      KernelThreadWakeInterrupt();
+    }
+
+    /* Done with this one. */
+    GICC_REG(GICC_EOIR) = iar;
+  }
+
+  /* Everything acknowledged: preempt the interrupted thread if needed. */
+  KernelThreadInterruptExit();
+}
@@ -0,0 +1,315 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   port/src/psci.c
+ * @brief  ARTOS port module: PSCI firmware calls and idle states.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Port includes. */
+#include "port/inc/interface.h"
+#include "port/inc/internal.h"
+
+/*****************************************************************************
+ *                             PSCI MACROS
+ ****************************************************************************/
+
+/* Function identifiers (SMC64 where the call takes addresses). */
+#define SMCCC_VERSION           0x80000000UL
+#define PSCI_VERSION            0x84000000UL
+#define PSCI_CPU_SUSPEND        0xC4000001UL
+#define PSCI_CPU_ON             0xC4000003UL
+#define PSCI_SYSTEM_OFF         0x84000008UL
+#define PSCI_FEATURES           0x8400000AUL
+
+/* Return codes. */
+#define PSCI_SUCCESS            (0)
+#define PSCI_NOT_SUPPORTED      (-1)
+
+/* Versions are major << 16 | minor. */
+#define PSCI_VERSION_0_2        0x00000002UL
+#define PSCI_VERSION_1_0        0x00010000UL
+#define SMCCC_VERSION_1_0       0x00010000UL
+
+/* PSCI_FEATURES(CPU_SUSPEND): power_state uses the extended format. */
+#define PSCI_FEATURE_EXTENDED   (1UL<<1)
+
+/*****************************************************************************
+ *                              TYPEDEFS
+ ****************************************************************************/
+
+/* Idle state (power_state in both formats, times in microseconds). */
+typedef struct port_psci_state_t
+{
+  uint64_t paramOriginal;
+  uint64_t paramExtended;
+  uint64_t exitLatency;
+  uint64_t residency;
+} port_psci_state_t;
+
+/*****************************************************************************
+ *                           GLOBAL VARIABLES
+ ****************************************************************************/
+
+/* Conduit of the firmware (the boot loader reads it from the ACPI FADT). */
+uint64_t PortPsciConduit = PORT_CONDUIT_UNKNOWN;
+
+/*****************************************************************************
+ *                           STATIC VARIABLES
+ ****************************************************************************/
+
+/* Idle states of the QEMU virt board, shallowest first. Retention keeps
+ * the core context and the generic timer, so no state needs a broadcast
+ * timer or a resume path. StateIDs follow the recommended encoding of the
+ * extended format (4 bits per power level, 1 = retention). */
+static const port_psci_state_t PortPsciStates[PORT_IDLE_STATE_COUNT] =
+{
+  /* WFI (no firmware call). */
+  { 0x00000000UL, 0x00000000UL, 1,   1    },
+  /* Core retention: standby at power level 0. */
+  { 0x00000000UL, 0x00000001UL, 20,  100  },
+  /* Cluster retention: standby at power level 1. */
+  { 0x01000000UL, 0x00000011UL, 100, 1000 },
+};
+
+/* States the firmware accepts (cleared when CPU_SUSPEND refuses one). */
+static uint64_t PortPsciUsable[PORT_IDLE_STATE_COUNT];
+
+/* Discovered versions (0 = no PSCI). */
+static uint64_t PortPsciVersionNo = 0;
+static uint64_t PortPsciSmcccNo   = 0;
+
+/* power_state format of CPU_SUSPEND. */
+static uint64_t PortPsciExtended  = 0;
+
+/*****************************************************************************
+ *                            PortPsciCall()
+ ****************************************************************************/
+
+static int64_t PortPsciCall (uint64_t function,
+                             uint64_t arg0,
+                             uint64_t arg1,
+                             uint64_t arg2)
+{
+  /* SMCCC arguments and result live in x0-x3. */
+  register uint64_t x0 __asm__("x0") = function;
+  register uint64_t x1 __asm__("x1") = arg0;
+  register uint64_t x2 __asm__("x2") = arg1;
+  register uint64_t x3 __asm__("x3") = arg2;
+
+  /* Call the firmware through its conduit (SMCCC 1.0 may use x4-x17). */
+  switch (PortPsciConduit)
+  {
+    case PORT_CONDUIT_SMC:
+      __asm__ volatile("SMC #0"
+                       : "+r"(x0), "+r"(x1), "+r"(x2), "+r"(x3)
+                       :
+                       : "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11",
+                         "x12", "x13", "x14", "x15", "x16", "x17", "memory");
+      break;
+    case PORT_CONDUIT_HVC:
+      __asm__ volatile("HVC #0"
+                       : "+r"(x0), "+r"(x1), "+r"(x2), "+r"(x3)
+                       :
+                       : "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11",
+                         "x12", "x13", "x14", "x15", "x16", "x17", "memory");
+      break;
+    default:
+      return PSCI_NOT_SUPPORTED;
+  }
+
+  /* Done (results are 32-bit for SMC32 calls). */
+  return (function & (1UL<<30)) ? (int64_t) x0 : (int64_t) (int32_t) x0;
+}
+
+/*****************************************************************************
+ *                         PortPsciInitialize()
+ ****************************************************************************/
+
+void PortPsciInitialize (void)
+{
+  /* Loop counter. */
+  uint64_t curState = 0;
+
+  /* Local variables. */
+  int64_t  ret      = 0;
+  uint64_t suspend  = 0;
+
+  /* No ACPI: the QEMU virt default. */
+  if (PortPsciConduit == PORT_CONDUIT_UNKNOWN)
+  {
+    PortPsciConduit = PORT_CONDUIT_HVC;
+  }
+
+  /* Version (PSCI 0.1 has no standard function IDs: treat as none). */
+  ret = PortPsciCall(PSCI_VERSION, 0, 0, 0);
+  if (ret >= (int64_t) PSCI_VERSION_0_2)
+  {
+    PortPsciVersionNo = (uint64_t) ret;
+    PortPsciSmcccNo   = SMCCC_VERSION_1_0;
+    suspend           = 1;
+  }
+
+  /* PSCI 1.0: discoverable SMCCC version and CPU_SUSPEND format. */
+  if (PortPsciVersionNo >= PSCI_VERSION_1_0)
+  {
+    if (PortPsciCall(PSCI_FEATURES, SMCCC_VERSION, 0, 0) >= PSCI_SUCCESS)
+    {
+      ret = PortPsciCall(SMCCC_VERSION, 0, 0, 0);
+      if (ret > 0)
+      {
+        PortPsciSmcccNo = (uint64_t) ret;
+      }
+    }
+    ret = PortPsciCall(PSCI_FEATURES, PSCI_CPU_SUSPEND, 0, 0);
+    if (ret < PSCI_SUCCESS)
+    {
+      suspend = 0;
+    }
+    else
+    {
+      PortPsciExtended = ((uint64_t) ret & PSCI_FEATURE_EXTENDED) != 0;
+    }
+  }
+
+  /* WFI always works, the others need CPU_SUSPEND. */
+  PortPsciUsable[0] = 1;
+  for (curState = 1; curState < PORT_IDLE_STATE_COUNT; curState++)
+  {
+    PortPsciUsable[curState] = suspend;
+  }
+}
+
+/*****************************************************************************
+ *                           PortPsciVersion()
+ ****************************************************************************/
+
+uint64_t PortPsciVersion (void)
+{
+  /* Major << 16 | minor, 0 without PSCI. */
+  return PortPsciVersionNo;
+}
+
+/*****************************************************************************
+ *                            PortPsciSmccc()
+ ****************************************************************************/
+
+uint64_t PortPsciSmccc (void)
+{
+  /* Major << 16 | minor, 0 without PSCI. */
+  return PortPsciSmcccNo;
+}
+
+/*****************************************************************************
+ *                            PortPsciState()
+ ****************************************************************************/
+
+error_t PortPsciState (uint64_t  stateNo,
+                       uint64_t *exitLatencyUs,
+                       uint64_t *residencyUs)
+{
+  /* Unknown or refused by the firmware? */
+  if (stateNo >= PORT_IDLE_STATE_COUNT ||
+      !__atomic_load_n(&PortPsciUsable[stateNo], __ATOMIC_RELAXED))
+  {
+    return PORT_ERR_RESOURCE;
+  }
+
+  /* Worst-case wake-up time, and the sleep that pays off entering it. */
+  *exitLatencyUs = PortPsciStates[stateNo].exitLatency;
+  *residencyUs   = PortPsciStates[stateNo].residency;
+
+  /* Done. */
+  return PORT_SUCCESS;
+}
+
+/*****************************************************************************
+ *                            PortPsciIdle()
+ ****************************************************************************/
+
+void PortPsciIdle (uint64_t stateNo)
+{
+  /* Local variables. */
+  uint64_t param = 0;
+  int64_t  ret   = 0;
+
+  /* Plain WFI? */
+  if (stateNo == 0 || stateNo >= PORT_IDLE_STATE_COUNT ||
+      !__atomic_load_n(&PortPsciUsable[stateNo], __ATOMIC_RELAXED))
+  {
+    PortCpuIdle();
+    return;
+  }
+
+  /* Standby returns like WFI once an interrupt is pending (even masked). */
+  param = PortPsciExtended ? PortPsciStates[stateNo].paramExtended
+                           : PortPsciStates[stateNo].paramOriginal;
+  __asm__ volatile("DSB SY" ::: "memory");
+  ret = PortPsciCall(PSCI_CPU_SUSPEND, param, 0, 0);
+
+  /* Refused: never ask again, sleep in WFI this time. */
+  if (ret != PSCI_SUCCESS)
+  {
+    __atomic_store_n(&PortPsciUsable[stateNo], 0, __ATOMIC_RELAXED);
+    PortCpuIdle();
+    return;
+  }
+
+  /* Let the interrupt be taken, then mask again. */
+  __asm__ volatile("MSR DAIFClr, #2" ::: "memory");
+  __asm__ volatile("ISB" ::: "memory");
+  __asm__ volatile("MSR DAIFSet, #2" ::: "memory");
+}
+
+/*****************************************************************************
+ *                            PortPsciCpuOn()
+ ****************************************************************************/
+
+error_t PortPsciCpuOn (uint64_t  mpidr,
+                       void     *entryPhys,
+                       void     *contextPhys)
+{
+  /* Local variables. */
+  int64_t ret = 0;
+
+  /* Start the core at entryPhys (MMU off), x0 = contextPhys. */
+  ret = PortPsciCall(PSCI_CPU_ON, mpidr, (uint64_t) entryPhys,
+                     (uint64_t) contextPhys);
+
+  /* Done. */
+  return ret == PSCI_SUCCESS ? PORT_SUCCESS : PORT_ERR_RESOURCE;
+}
+
+/*****************************************************************************
+ *                          PortPsciSystemOff()
+ ****************************************************************************/
+
+void PortPsciSystemOff (void)
+{
+  /* Does not return when PSCI is there. */
+  PortPsciCall(PSCI_SYSTEM_OFF, 0, 0, 0);
+}
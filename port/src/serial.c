@@ -37,16 +37,21 @@
  *                             UART MACROS
  ****************************************************************************/
 
+/* PL011 physical base address. */
+#define UART_BASE         (0x09000000UL)
+
 /* PL011 registers */
-#define UARTDR            (*((volatile unsigned short *) 0x09000000))
-#define UARTRSR           (*((volatile unsigned short *) 0x09000004))
-#define UARTECR           (*((volatile unsigned short *) 0x09000004))
-#define UARTFR            (*((volatile unsigned short *) 0x09000018))
-#define UARTILPR          (*((volatile unsigned short *) 0x09000020))
-#define UARTIBRD          (*((volatile unsigned short *) 0x09000024))
-#define UARTFBRD          (*((volatile unsigned short *) 0x09000028))
-#define UARTFLCR_H        (*((volatile unsigned short *) 0x0900002C))
-#define UARTCR            (*((volatile unsigned short *) 0x09000030))
+#define UART_REG(OFFSET)  (*((volatile unsigned short *) \
+                             (PortSerialBase + (OFFSET))))
+#define UARTDR            UART_REG(0x00)
+#define UARTRSR           UART_REG(0x04)
+#define UARTECR           UART_REG(0x04)
+#define UARTFR            UART_REG(0x18)
+#define UARTILPR          UART_REG(0x20)
+#define UARTIBRD          UART_REG(0x24)
+#define UARTFBRD          UART_REG(0x28)
+#define UARTFLCR_H        UART_REG(0x2C)
+#define UARTCR            UART_REG(0x30)
 
 /* UARTFR flags */
 #define CTS               (0x0001)
@@ -73,13 +78,31 @@
 #define RTSEn             (0x4000)
 #define CTSEn             (0x8000)
 
+/*****************************************************************************
+ *                           STATIC VARIABLES
+ ****************************************************************************/
+
+/* Current UART base address (physical until the direct map is up). */
+static uint64_t PortSerialBase = UART_BASE;
+
 /*****************************************************************************
  *                       PortSerialInitialize()
  ****************************************************************************/
 
 void PortSerialInitialize (void)
 {
-  /* Do nothing. */
+  /* Use the physical address while the MMU is being set up. */
+  PortSerialBase = UART_BASE;
+}
+
+/*****************************************************************************
+ *                          PortSerialRemap()
+ ****************************************************************************/
+
+void PortSerialRemap (void)
+{
+  /* Reach the UART through the direct map from now on. */
+  PortSerialBase = (uint64_t) PORT_PHYS_TO_VIRT(UART_BASE);
 }
 
 /*****************************************************************************
@@ -25,6 +25,7 @@
  *
  ****************************************************************************/
 
+
 /*****************************************************************************
  *                              INCLUDES
  ****************************************************************************/
@@ -34,44 +35,66 @@
 #include "port/inc/internal.h"
 
 /*****************************************************************************
- *                          MEMORY ZONES MACROS
+ *                          FUNCTION PROTOTYPES
  ****************************************************************************/
 
-/* Private memory zone. */
-#define PRIMEM_ZONE_START       (0xFFFF000000000000UL)
-#define PRIMEM_ZONE_END         (0xFFFF3FFFFFFFFFFFUL)
-#define PRIMEM_ZONE_SLOTS       (64*1024)
-#define PRIMEM_ZONE_SLOT_SIZE   (0x40000000UL)
+/* FIXME: THIS SHOULD BE ABSTRACTED IN A BETTER WAY. */
+void *KernelMemoryPageAllocate   (void);
+void  KernelMemoryPageDeallocate (void *pageBaseAddr);
+
+/* Assembly helpers (see below). */
+void  PortThreadContextSwitch    (uint64_t *prevStack, uint64_t nextStack);
+void  PortThreadBootstrap        (void);
+void  PortThreadFpSave           (void *fpState);
+void  PortThreadFpRestore        (void *fpState);
+void  PortThreadFpZero           (void);
+
+/*****************************************************************************
+ *                           ASSEMBLY MACROS
+ ****************************************************************************/
+
+#define MSR(sys_reg, var) __asm__ volatile("MSR " #sys_reg " , %0"::"r"(var))
+#define MRS(var, sys_reg) __asm__ volatile("MRS %0, " #sys_reg : "=r"(var))
+#define ISB()             __asm__ volatile("ISB")
+
+/*****************************************************************************
+ *                             THREAD MACROS
+ ****************************************************************************/
 
-/* Shared memory zone. */
-#define SHMEM_ZONE_START        (0xFFFF400000000000UL)
-#define SHMEM_ZONE_END          (0xFFFF7FFFFFFFFFFFUL)
-#define SHMEM_ZONE_SLOTS        (64*1024)
-#define SHMEM_ZONE_SLOT_SIZE    (0x40000000UL)
+/* CPACR_EL1.FPEN field specification. */
+#define CPACR_FPEN_MASK         (3UL<<20)
+#define CPACR_FPEN_TRAP         (0UL<<20)
+#define CPACR_FPEN_ENABLE       (3UL<<20)
 
-/* Reserved zone. */
-#define RESERVED_ZONE_START     (0xFFFF80000000000UL)
-#define RESERVED_ZONE_END       (0xFFFFBFFFFFFFFFFUL)
-#define RESERVED_ZONE_SLOTS     (64*1024)
-#define RESERVED_ZONE_SLOT_SIZE (0x40000000UL)
+/* Callee-saved registers pushed by PortThreadContextSwitch (x19-x30). */
+#define CONTEXT_REG_COUNT       12
 
-/* Stack zone. */
-#define STACK_ZONE_START        (0xFFFFC0000000000UL)
-#define STACK_ZONE_END          (0xFFFFFFFFFFFFFFFUL)
-#define STACK_ZONE_SLOTS        (64*1024)
-#define STACK_ZONE_SLOT_SIZE    (0x40000000UL)
+/* Stack alignment required by AAPCS64. */
+#define STACK_ALIGN             16
 
 /*****************************************************************************
  *                              TYPEDEFS
  ****************************************************************************/
 
-/* Invalid entry descriptor. */
+/* FP/SIMD register file (q0-q31, FPCR, FPSR). */
+typedef struct port_fpstate_t
+{
+  uint64_t               q[64];
+  uint64_t               fpcr;
+  uint64_t               fpsr;
+  struct port_fpstate_t *nextFreeState;
+} __attribute__((packed)) port_fpstate_t;
+
+/* Port thread data (not packed: the switch code stores stackPointer). */
 typedef struct port_thread_t
 {
-  void     *kernelStack;
-  void     *userStack;
-  uint64_t  isUserMode;
-} __attribute__((packed)) port_thread_t;
+  void           *kernelStack;
+  void           *userStack;
+  uint64_t        isUserMode;
+  uint64_t        stackPointer;
+  port_fpstate_t *fpState;
+  uint64_t        fpValid;
+} port_thread_t;
 
 /*****************************************************************************
  *                           STATIC VARIABLES
@@ -80,6 +103,191 @@ typedef struct port_thread_t
 /* Port-specific thread data. */
 static port_thread_t PortThreadList[PORT_THREAD_COUNT];
 
+/* Thread currently owning each CPU, plus one (0 means none yet). */
+static uint64_t PortThreadCurrent[PORT_CPU_COUNT];
+
+/* Free lists of FP/SIMD save areas (carved from pages on demand), one per
+ * CPU: only touched by their CPU with IRQs masked. */
+static port_fpstate_t *PortThreadFpFreeHead[PORT_CPU_COUNT];
+
+/*****************************************************************************
+ *                         CONTEXT SWITCH CODE
+ ****************************************************************************/
+
+__asm__(
+  /* x0: where to store the old sp, x1: new sp. */
+  ".text                                                             \n"
+  ".global PortThreadContextSwitch                                   \n"
+  "PortThreadContextSwitch:                                          \n"
+  "  sub   sp,  sp,  #96                                             \n"
+  "  stp   x19, x20, [sp, #0]                                        \n"
+  "  stp   x21, x22, [sp, #16]                                       \n"
+  "  stp   x23, x24, [sp, #32]                                       \n"
+  "  stp   x25, x26, [sp, #48]                                       \n"
+  "  stp   x27, x28, [sp, #64]                                       \n"
+  "  stp   x29, x30, [sp, #80]                                       \n"
+  "  mov   x2,  sp                                                   \n"
+  "  str   x2,  [x0]                                                 \n"
+  "  mov   sp,  x1                                                   \n"
+  "  ldp   x19, x20, [sp, #0]                                        \n"
+  "  ldp   x21, x22, [sp, #16]                                       \n"
+  "  ldp   x23, x24, [sp, #32]                                       \n"
+  "  ldp   x25, x26, [sp, #48]                                       \n"
+  "  ldp   x27, x28, [sp, #64]                                       \n"
+  "  ldp   x29, x30, [sp, #80]                                       \n"
+  "  add   sp,  sp,  #96                                             \n"
+  "  ret                                                             \n"
+  "                                                                  \n"
+  /* First activation of a thread: x19 = entry, x20 = argument. */
+  ".global PortThreadBootstrap                                       \n"
+  "PortThreadBootstrap:                                              \n"
+  "  mov   x0,  x20                                                  \n"
+  "  blr   x19                                                       \n"
+  "1:                                                                \n"
+  "  wfe                                                             \n"
+  "  b     1b                                                        \n"
+  "                                                                  \n"
+  /* x0: FP/SIMD save area (see port_fpstate_t). */
+  ".global PortThreadFpSave                                          \n"
+  "PortThreadFpSave:                                                 \n"
+  "  stp   q0,  q1,  [x0, #0]                                        \n"
+  "  stp   q2,  q3,  [x0, #32]                                       \n"
+  "  stp   q4,  q5,  [x0, #64]                                       \n"
+  "  stp   q6,  q7,  [x0, #96]                                       \n"
+  "  stp   q8,  q9,  [x0, #128]                                      \n"
+  "  stp   q10, q11, [x0, #160]                                      \n"
+  "  stp   q12, q13, [x0, #192]                                      \n"
+  "  stp   q14, q15, [x0, #224]                                      \n"
+  "  stp   q16, q17, [x0, #256]                                      \n"
+  "  stp   q18, q19, [x0, #288]                                      \n"
+  "  stp   q20, q21, [x0, #320]                                      \n"
+  "  stp   q22, q23, [x0, #352]                                      \n"
+  "  stp   q24, q25, [x0, #384]                                      \n"
+  "  stp   q26, q27, [x0, #416]                                      \n"
+  "  stp   q28, q29, [x0, #448]                                      \n"
+  "  stp   q30, q31, [x0, #480]                                      \n"
+  "  mrs   x1,  fpcr                                                 \n"
+  "  mrs   x2,  fpsr                                                 \n"
+  "  stp   x1,  x2,  [x0, #512]                                      \n"
+  "  ret                                                             \n"
+  "                                                                  \n"
+  ".global PortThreadFpRestore                                       \n"
+  "PortThreadFpRestore:                                              \n"
+  "  ldp   q0,  q1,  [x0, #0]                                        \n"
+  "  ldp   q2,  q3,  [x0, #32]                                       \n"
+  "  ldp   q4,  q5,  [x0, #64]                                       \n"
+  "  ldp   q6,  q7,  [x0, #96]                                       \n"
+  "  ldp   q8,  q9,  [x0, #128]                                      \n"
+  "  ldp   q10, q11, [x0, #160]                                      \n"
+  "  ldp   q12, q13, [x0, #192]                                      \n"
+  "  ldp   q14, q15, [x0, #224]                                      \n"
+  "  ldp   q16, q17, [x0, #256]                                      \n"
+  "  ldp   q18, q19, [x0, #288]                                      \n"
+  "  ldp   q20, q21, [x0, #320]                                      \n"
+  "  ldp   q22, q23, [x0, #352]                                      \n"
+  "  ldp   q24, q25, [x0, #384]                                      \n"
+  "  ldp   q26, q27, [x0, #416]                                      \n"
+  "  ldp   q28, q29, [x0, #448]                                      \n"
+  "  ldp   q30, q31, [x0, #480]                                      \n"
+  "  ldp   x1,  x2,  [x0, #512]                                      \n"
+  "  msr   fpcr, x1                                                  \n"
+  "  msr   fpsr, x2                                                  \n"
+  "  ret                                                             \n"
+  "                                                                  \n"
+  /* No saved state: clear q0-q31, FPCR and FPSR. */
+  ".global PortThreadFpZero                                          \n"
+  "PortThreadFpZero:                                                 \n"
+  "  movi  v0.2d, #0                                                 \n"
+  "  movi  v1.2d, #0                                                 \n"
+  "  movi  v2.2d, #0                                                 \n"
+  "  movi  v3.2d, #0                                                 \n"
+  "  movi  v4.2d, #0                                                 \n"
+  "  movi  v5.2d, #0                                                 \n"
+  "  movi  v6.2d, #0                                                 \n"
+  "  movi  v7.2d, #0                                                 \n"
+  "  movi  v8.2d, #0                                                 \n"
+  "  movi  v9.2d, #0                                                 \n"
+  "  movi  v10.2d, #0                                                \n"
+  "  movi  v11.2d, #0                                                \n"
+  "  movi  v12.2d, #0                                                \n"
+  "  movi  v13.2d, #0                                                \n"
+  "  movi  v14.2d, #0                                                \n"
+  "  movi  v15.2d, #0                                                \n"
+  "  movi  v16.2d, #0                                                \n"
+  "  movi  v17.2d, #0                                                \n"
+  "  movi  v18.2d, #0                                                \n"
+  "  movi  v19.2d, #0                                                \n"
+  "  movi  v20.2d, #0                                                \n"
+  "  movi  v21.2d, #0                                                \n"
+  "  movi  v22.2d, #0                                                \n"
+  "  movi  v23.2d, #0                                                \n"
+  "  movi  v24.2d, #0                                                \n"
+  "  movi  v25.2d, #0                                                \n"
+  "  movi  v26.2d, #0                                                \n"
+  "  movi  v27.2d, #0                                                \n"
+  "  movi  v28.2d, #0                                                \n"
+  "  movi  v29.2d, #0                                                \n"
+  "  movi  v30.2d, #0                                                \n"
+  "  movi  v31.2d, #0                                                \n"
+  "  msr   fpcr, xzr                                                 \n"
+  "  msr   fpsr, xzr                                                 \n"
+  "  ret                                                             \n"
+);
+
+/*****************************************************************************
+ *                        PortThreadFpAllocate()
+ ****************************************************************************/
+
+static port_fpstate_t *PortThreadFpAllocate (void)
+{
+  /* Local variables. */
+  port_fpstate_t *fpState  = NULL;
+  uint8_t        *page     = NULL;
+  uint64_t        offset   = 0;
+  uint64_t        irqState = PortCpuIrqSave();
+  uint64_t        cpuId    = PortCpuId();
+
+  /* Free list empty? Carve a new page into save areas. */
+  if (PortThreadFpFreeHead[cpuId] == NULL)
+  {
+    /* Allocate a page. */
+    page = KernelMemoryPageAllocate();
+    if (page == NULL)
+    {
+      PortCpuIrqRestore(irqState);
+      return NULL;
+    }
+
+    /* Add every save area of the page to the free list. */
+    for (offset = 0;
+         offset + sizeof(port_fpstate_t) <= PAGE_SIZE;
+         offset += sizeof(port_fpstate_t))
+    {
+      fpState = (port_fpstate_t *) (page + offset);
+      fpState->nextFreeState      = PortThreadFpFreeHead[cpuId];
+      PortThreadFpFreeHead[cpuId] = fpState;
+    }
+  }
+
+  /* Pop a save area. */
+  fpState = PortThreadFpFreeHead[cpuId];
+  PortThreadFpFreeHead[cpuId] = fpState->nextFreeState;
+  PortCpuIrqRestore(irqState);
+
+  /* Done. */
+  return fpState;
+}
+
+/*****************************************************************************
+ *                        PortThreadInitialize()
+ ****************************************************************************/
+
+void PortThreadInitialize (uint64_t cpuId)
+{
+  /* No FP/SIMD save area cached by this CPU yet. */
+  PortThreadFpFreeHead[cpuId] = NULL;
+}
+
 /*****************************************************************************
  *                         PortThreadAllocate()
  ****************************************************************************/
@@ -90,9 +298,12 @@ void PortThreadAllocate (uint64_t threadId)
 
   portThread = &PortThreadList[threadId];
 
-  portThread->kernelStack = NULL;
-  portThread->userStack   = NULL;
-  portThread->isUserMode  = 0;
+  portThread->kernelStack  = NULL;
+  portThread->userStack    = NULL;
+  portThread->isUserMode   = 0;
+  portThread->stackPointer = 0;
+  portThread->fpState      = NULL;
+  portThread->fpValid      = 0;
 }
 
 /*****************************************************************************
@@ -102,28 +313,179 @@ void PortThreadAllocate (uint64_t threadId)
 void PortThreadDeallocate (uint64_t threadId)
 {
   port_thread_t *portThread = NULL;
+  uint64_t       irqState   = 0;
+  uint64_t       cpuId      = 0;
+
+  portThread = &PortThreadList[threadId];
+
+  /* Give the FP/SIMD save area back to the list of this CPU (may run on
+   * any CPU, e.g. from RCU reclaim). */
+  if (portThread->fpState != NULL)
+  {
+    irqState = PortCpuIrqSave();
+    cpuId    = PortCpuId();
+    portThread->fpState->nextFreeState = PortThreadFpFreeHead[cpuId];
+    PortThreadFpFreeHead[cpuId]        = portThread->fpState;
+    PortCpuIrqRestore(irqState);
+  }
+
+  portThread->kernelStack  = NULL;
+  portThread->userStack    = NULL;
+  portThread->isUserMode   = 0;
+  portThread->stackPointer = 0;
+  portThread->fpState      = NULL;
+  portThread->fpValid      = 0;
+}
+
+/*****************************************************************************
+ *                         PortThreadStackSlot()
+ ****************************************************************************/
+
+void *PortThreadStackSlot (uint64_t slotNo)
+{
+  /* Out of the stack zone? */
+  if (slotNo >= STACK_ZONE_SLOTS)
+  {
+    return NULL;
+  }
+
+  /* Lowest address of the slot (kernel half, mapped through TTB1). */
+  return (void *) (STACK_ZONE_START + slotNo * STACK_ZONE_SLOT_SIZE);
+}
+
+/*****************************************************************************
+ *                          PortThreadPrepare()
+ ****************************************************************************/
+
+void PortThreadPrepare (uint64_t   threadId,
+                        void     (*entry)(void *arg),
+                        void      *arg,
+                        void      *stackTop)
+{
+  /* Local variables. */
+  port_thread_t *portThread = NULL;
+  uint64_t      *frame      = NULL;
+  uint64_t       curReg     = 0;
 
+  /* Obtain port thread. */
   portThread = &PortThreadList[threadId];
 
-  portThread->kernelStack = NULL;
-  portThread->userStack   = NULL;
-  portThread->isUserMode  = 0;
+  /* Build the frame PortThreadContextSwitch() pops on first activation. */
+  frame  = (uint64_t *) (((uint64_t) stackTop) & ~(STACK_ALIGN - 1UL));
+  frame -= CONTEXT_REG_COUNT;
+  for (curReg = 0; curReg < CONTEXT_REG_COUNT; curReg++)
+  {
+    frame[curReg] = 0;
+  }
+
+  /* x19 = entry, x20 = argument, x30 = bootstrap code. */
+  frame[0]  = (uint64_t) entry;
+  frame[1]  = (uint64_t) arg;
+  frame[11] = (uint64_t) PortThreadBootstrap;
+
+  /* Start from a clean FP/SIMD state. */
+  portThread->stackPointer = (uint64_t) frame;
+  portThread->fpValid      = 0;
 }
 
 /*****************************************************************************
- *                          PortThreadRun()
+ *                          PortThreadAdopt()
  ****************************************************************************/
 
-void PortThreadRun (uint64_t threadId)
+void PortThreadAdopt (uint64_t threadId)
 {
-  (void) threadId;
+  /* The calling context already runs: it only becomes the owner of the
+   * CPU, so its first FP/SIMD use gets a save area like any thread. */
+  PortThreadList[threadId].fpValid = 0;
+  PortThreadCurrent[PortCpuId()]   = threadId + 1;
 }
 
 /*****************************************************************************
- *                          PortThreadStop()
+ *                          PortThreadSwitch()
  ****************************************************************************/
 
-void PortThreadStop (uint64_t threadId)
+void PortThreadSwitch (uint64_t prevThreadId, uint64_t nextThreadId)
 {
-  (void) threadId;
-}
\ No newline at end of file
+  /* Local variables. */
+  port_thread_t *prevThread = NULL;
+  port_thread_t *nextThread = NULL;
+  uint64_t       cpacr      = 0;
+
+  /* Obtain port threads. */
+  prevThread = &PortThreadList[prevThreadId];
+  nextThread = &PortThreadList[nextThreadId];
+
+  /* FP/SIMD enabled means prev touched it in this slice: save it. */
+  MRS(cpacr, CPACR_EL1);
+  if ((cpacr & CPACR_FPEN_MASK) != CPACR_FPEN_TRAP)
+  {
+    /* The save area is allocated on the first trap. */
+    if (prevThread->fpState != NULL)
+    {
+      PortThreadFpSave(prevThread->fpState);
+      prevThread->fpValid = 1;
+    }
+
+    /* Trap again so next thread pays only if it uses FP/SIMD. */
+    cpacr = (cpacr & ~CPACR_FPEN_MASK) | CPACR_FPEN_TRAP;
+    MSR(CPACR_EL1, cpacr);
+    ISB();
+  }
+
+  /* Record the new owner of the CPU. */
+  PortThreadCurrent[PortCpuId()] = nextThreadId + 1;
+
+  /* Swap callee-saved registers and stacks. */
+  PortThreadContextSwitch(&prevThread->stackPointer, nextThread->stackPointer);
+}
+
+/*****************************************************************************
+ *                          PortThreadFpTrap()
+ ****************************************************************************/
+
+error_t PortThreadFpTrap (void)
+{
+  /* Local variables. */
+  port_thread_t *portThread = NULL;
+  uint64_t       threadId   = 0;
+  uint64_t       cpacr      = 0;
+
+  /* First use by a thread? Get a save area before enabling FP/SIMD: a
+   * thread without one could never be switched out safely. */
+  threadId = PortThreadCurrent[PortCpuId()];
+  if (threadId != 0)
+  {
+    portThread = &PortThreadList[threadId - 1];
+    if (portThread->fpState == NULL)
+    {
+      portThread->fpState = PortThreadFpAllocate();
+      portThread->fpValid = 0;
+    }
+    if (portThread->fpState == NULL)
+    {
+      return PORT_ERR_RESOURCE;
+    }
+  }
+
+  /* Enable FP/SIMD for the rest of the slice. */
+  MRS(cpacr, CPACR_EL1);
+  cpacr = (cpacr & ~CPACR_FPEN_MASK) | CPACR_FPEN_ENABLE;
+  MSR(CPACR_EL1, cpacr);
+  ISB();
+
+  /* Restore the registers saved at the last switch-out, or start from
+   * scratch (the last owner's values must not leak). Only the boot
+   * context before its adoption has no thread: nothing ran before it and
+   * the kernel never uses FP/SIMD itself (-mgeneral-regs-only). */
+  if (portThread != NULL && portThread->fpValid)
+  {
+    PortThreadFpRestore(portThread->fpState);
+  }
+  else if (portThread != NULL)
+  {
+    PortThreadFpZero();
+  }
+
+  /* Done. */
+  return PORT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   port/src/timer.c
+ * @brief  ARTOS port module: generic timer.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Port includes. */
+#include "port/inc/interface.h"
+#include "port/inc/internal.h"
+
+/*****************************************************************************
+ *                           ASSEMBLY MACROS
+ ****************************************************************************/
+
+#define MSR(sys_reg, var) __asm__ volatile("MSR " #sys_reg " , %0"::"r"(var))
+#define MRS(var, sys_reg) __asm__ volatile("MRS %0, " #sys_reg : "=r"(var))
+#define ISB()             __asm__ volatile("ISB")
+
+/*****************************************************************************
+ *                             TIMER MACROS
+ ****************************************************************************/
+
+/* CNTV_CTL_EL0 field specification. */
+#define CNTV_CTL_ENABLE         (1UL<<0)
+#define CNTV_CTL_IMASK          (1UL<<1)
+
+/*****************************************************************************
+ *                         PortTimerInitialize()
+ ****************************************************************************/
+
+void PortTimerInitialize (void)
+{
+  /* Start with the virtual timer of this CPU disabled. */
+  MSR(CNTV_CTL_EL0, 0UL);
+  ISB();
+
+  /* Route its interrupt to this CPU. */
+  PortInterruptEnable(PORT_INTERRUPT_TIMER);
+}
+
+/*****************************************************************************
+ *                            PortTimerNow()
+ ****************************************************************************/
+
+uint64_t PortTimerNow (void)
+{
+  /* Counter value. */
+  uint64_t now = 0;
+
+  /* Do not let the read float around the surrounding code. */
+  ISB();
+  MRS(now, CNTVCT_EL0);
+
+  /* Done. */
+  return now;
+}
+
+/*****************************************************************************
+ *                         PortTimerFrequency()
+ ****************************************************************************/
+
+uint64_t PortTimerFrequency (void)
+{
+  /* Counter frequency in Hz (set by firmware). */
+  uint64_t frequency = 0;
+
+  /* Read it. */
+  MRS(frequency, CNTFRQ_EL0);
+
+  /* Done. */
+  return frequency;
+}
+
+/*****************************************************************************
+ *                            PortTimerSet()
+ ****************************************************************************/
+
+void PortTimerSet (uint64_t deadline)
+{
+  /* Fire once the counter reaches the deadline. */
+  MSR(CNTV_CVAL_EL0, deadline);
+  MSR(CNTV_CTL_EL0, CNTV_CTL_ENABLE);
+  ISB();
+}
+
+/*****************************************************************************
+ *                           PortTimerCancel()
+ ****************************************************************************/
+
+void PortTimerCancel (void)
+{
+  /* Disabling also drops the (level-triggered) interrupt. */
+  MSR(CNTV_CTL_EL0, CNTV_CTL_IMASK);
+  ISB();
+}
@@ -42,11 +42,20 @@ void *KernelMemoryPageAllocate   (void);
 void  KernelMemoryPageDeallocate (void *pageBaseAddr);
 void  KernelPrintFmt             (char *fmt, ...);
 
+/* gnu-efi self relocation (used to move the image into the direct map). */
+extern char ImageBase[];
+extern char _DYNAMIC[];
+uint64_t _relocate (long ldbase, void *dyn, void *image, void *systab);
+
+/* Assembly helper of PortTranslationEnter(). */
+void PortTranslationTrampoline (uint64_t function, uint64_t stackOffset);
+
 /*****************************************************************************
  *                           ASSEMBLY MACROS
  ****************************************************************************/
 
 #define TLBI(variant)     __asm__("TLBI " #variant)
+#define TLBI_VA(variant, va) __asm__("TLBI " #variant ", %0"::"r"(va))
 #define DSB(variant)      __asm__("DSB " #variant)
 #define ISB()             __asm__("ISB")
 #define MSR(sys_reg, var) __asm__("MSR " #sys_reg " , %0"::"r"(var))
@@ -138,15 +147,17 @@ void  KernelPrintFmt             (char *fmt, ...);
 /* Alignment of L0/L1 tables. */
 #define TBL_ALIGN             __attribute__((aligned(PAGE_SIZE)))
 
-/* Convert 64-bit VA into address bits. */
+/* Convert 64-bit VA into address bits (tables are reached by direct map). */
 #define TO_BLK_ADDR(PTR)     ((((uint64_t)PTR)>>30)&((1UL<<18)-1))
-#define TO_TBL_ADDR(PTR)     ((((uint64_t)PTR)>>12)&((1UL<<36)-1))
+#define TO_TBL_ADDR(PTR)     ((((uint64_t)PORT_VIRT_TO_PHYS(PTR))>>12)&\
+                              ((1UL<<36)-1))
 #define TO_PAG_ADDR(PTR)     ((((uint64_t)PTR)>>12)&((1UL<<36)-1))
-#define TO_TTB_ADDR(PTR)     ((((uint64_t)PTR)>> 1)&((1UL<<47)-1))
+#define TO_TTB_ADDR(PTR)     ((((uint64_t)PORT_VIRT_TO_PHYS(PTR))>> 1)&\
+                              ((1UL<<47)-1))
 
 /* Convert address bites into 64-bit VA. */
 #define FROM_BLK_ADDR(ADDR)  ((void *) ((uint64_t) ADDR<<30))
-#define FROM_TBL_ADDR(ADDR)  ((void *) ((uint64_t) ADDR<<12))
+#define FROM_TBL_ADDR(ADDR)  PORT_PHYS_TO_VIRT((uint64_t) ADDR<<12)
 #define FROM_PAG_ADDR(ADDR)  ((void *) ((uint64_t) ADDR<<12))
 #define FROM_TTB_ADDR(ADDR)  ((void *) ((uint64_t) ADDR<< 1))
 
@@ -185,6 +196,13 @@ void  KernelPrintFmt             (char *fmt, ...);
 #define PXN_PERMIT_EXEC         0
 #define PXN_NOT_PERMIT_EXEC     1
 
+/* .UXN field specification.*/
+#define UXN_PERMIT_EXEC         0
+#define UXN_NOT_PERMIT_EXEC     1
+
+/* First L0 entry of the direct map in TTB1. */
+#define DIRECT_L0_FIRST      ((DIRECT_ZONE_START >> 39) & 0x1FF)
+
 /*****************************************************************************
  *                              TYPEDEFS
  ****************************************************************************/
@@ -298,9 +316,12 @@ typedef struct SCTLR
 static uint64_t PortTTB0[ENTRY_COUNT] TBL_ALIGN;
 static uint64_t PortTTB1[ENTRY_COUNT] TBL_ALIGN;
 
-/* TTB0 L1 page tables */
+/* TTB0 L1 page tables (boot identity map). */
 static uint64_t PortTTB0L1[TTB0_L1_COUNT][ENTRY_COUNT] TBL_ALIGN;
 
+/* TTB1 L1 page tables (direct map). */
+static uint64_t PortTTB1L1[TTB0_L1_COUNT][ENTRY_COUNT] TBL_ALIGN;
+
 /*****************************************************************************
  *                         PortSetupTTB0()
  ****************************************************************************/
@@ -347,7 +368,8 @@ static void PortSetupTTB0 (void)
   tableEntry->AP        = AP_RW_NONE;
   tableEntry->NS        = NS_SECURE;
 
-  /* Setup block entry. */
+  /* Setup block entry (non-global: tagged with the reserved ASID 0, so the
+   * user window of a process never resolves through it). */
   blockEntry->VALID     = IS_VALID;
   blockEntry->TYPE      = TYPE_BLOCK;
   blockEntry->ATTRIDX   = 0;
@@ -355,7 +377,7 @@ static void PortSetupTTB0 (void)
   blockEntry->AP        = AP_RW_NONE;
   blockEntry->SH        = SH_INNER_SHAREABLE;
   blockEntry->AF        = AF_ACCESSABLE;
-  blockEntry->NG        = NG_GLOBAL;
+  blockEntry->NG        = NG_NON_GLOBAL;
   blockEntry->RESV0     = 0;
   blockEntry->ADDR      = 0;
   blockEntry->RESV1     = 0;
@@ -423,23 +445,61 @@ static void PortSetupTTB1 (void)
 {
   /* Descriptors as integers. */
   uint64_t     invalidEntryValue = 0;
+  uint64_t     tableEntryValue   = 0;
+  uint64_t     blockEntryValue   = 0;
 
   /* Descriptors as structs. */
   INVENTRY_t  *invalidEntry      = NULL;
+  TBLENTRY_t  *tableEntry        = NULL;
+  BLKENTRY_t  *blockEntry        = NULL;
 
   /* Page tables. */
   uint64_t    *L0Table           = NULL;
+  uint64_t    *L1Table           = NULL;
 
   /* Misc Variables. */
+  uint64_t     curAddr           = 0;
   uint64_t     curL0Idx          = 0;
+  uint64_t     curL1Idx          = 0;
 
   /* Setup pointers. */
   invalidEntry = (INVENTRY_t *) &invalidEntryValue;
+  tableEntry   = (TBLENTRY_t *) &tableEntryValue;
+  blockEntry   = (BLKENTRY_t *) &blockEntryValue;
 
   /* Setup invalid entry. */
   invalidEntry->VALID   = 0;
   invalidEntry->IGNORED = 0;
 
+  /* Setup table entry. */
+  tableEntry->VALID     = IS_VALID;
+  tableEntry->TYPE      = TYPE_TABLE;
+  tableEntry->IGNORED0  = 0;
+  tableEntry->ADDR      = 0;
+  tableEntry->RESV      = 0;
+  tableEntry->IGNORED1  = 0;
+  tableEntry->PXN       = PXN_PERMIT_EXEC;
+  tableEntry->UXN       = 0;
+  tableEntry->AP        = AP_RW_NONE;
+  tableEntry->NS        = NS_SECURE;
+
+  /* Setup block entry (global, kernel-only). */
+  blockEntry->VALID     = IS_VALID;
+  blockEntry->TYPE      = TYPE_BLOCK;
+  blockEntry->ATTRIDX   = 0;
+  blockEntry->NS        = NS_SECURE;
+  blockEntry->AP        = AP_RW_NONE;
+  blockEntry->SH        = SH_INNER_SHAREABLE;
+  blockEntry->AF        = AF_ACCESSABLE;
+  blockEntry->NG        = NG_GLOBAL;
+  blockEntry->RESV0     = 0;
+  blockEntry->ADDR      = 0;
+  blockEntry->RESV1     = 0;
+  blockEntry->CONT      = CONT_ENABLE;
+  blockEntry->PXN       = PXN_PERMIT_EXEC;
+  blockEntry->XN        = 1;
+  blockEntry->IGNORED   = 0;
+
   /* Obtain L0 table. */
   L0Table = PortTTB1;
 
@@ -449,6 +509,28 @@ static void PortSetupTTB1 (void)
     L0Table[curL0Idx] = invalidEntryValue;
   }
 
+  /* Map every gigabyte of the physical address space with 1GB blocks. */
+  for (curAddr = 0; curAddr <= LAST_PHYSICAL_ADDR; curAddr += L2_SIZE)
+  {
+    /* Simplifying variables. */
+    curL0Idx = curAddr / L1_SIZE;
+    curL1Idx = (curAddr / L2_SIZE) % ENTRY_COUNT;
+
+    /* Obtain the L1 table of this 512GB slice. */
+    L1Table = PortTTB1L1[curL0Idx];
+
+    /* Beginning of a new L1 table? Link it into the L0 table. */
+    if (curL1Idx == 0)
+    {
+      tableEntry->ADDR = TO_TBL_ADDR(L1Table);
+      L0Table[DIRECT_L0_FIRST + curL0Idx] = tableEntryValue;
+    }
+
+    /* Initialize corresponding entry in L1 table. */
+    blockEntry->ADDR  = TO_BLK_ADDR(curAddr);
+    L1Table[curL1Idx] = blockEntryValue;
+  }
+
   /* Print table information. */
   KernelPrintFmt("TTB1 TABLE: %x\n", PortTTB1);
 }
@@ -548,7 +630,7 @@ static void PortSetupTCR (void)
   tcrPtr->SH0   = SH_INNER_SHAREABLE;
   tcrPtr->TG0   = TG_4KB;
   tcrPtr->T1SZ  = TSZ_16_BITS;
-  tcrPtr->A1    = A_TTBR1_DEFINES_ASID;
+  tcrPtr->A1    = A_TTBR0_DEFINES_ASID;
   tcrPtr->EPD1  = EPD_WALK_ON_TLB_MISS;
   tcrPtr->IRGN1 = IRGN_WB_RA_WA;
   tcrPtr->ORGN1 = ORGN_WB_RA_WA;
@@ -651,6 +733,95 @@ static void PortSetupSCTLRPost (void)
   ISB();
 }
 
+/*****************************************************************************
+ *                        PortTranslationRoot()
+ ****************************************************************************/
+
+static uint64_t *PortTranslationRoot (void *translationTable)
+{
+  /* NULL selects the kernel table (TTB1), anything else is a process L0. */
+  if (translationTable == NULL)
+  {
+    return PortTTB1;
+  }
+  else
+  {
+    return (uint64_t *) translationTable;
+  }
+}
+
+/*****************************************************************************
+ *                       PortTranslationEncode()
+ ****************************************************************************/
+
+static void PortTranslationEncode (PAGENTRY_t *pageEntry, uint64_t attributes)
+{
+  /* Simplifying variables. */
+  uint64_t isUser  = attributes & PORT_TRANSLATION_USER;
+  uint64_t isWrite = attributes & PORT_TRANSLATION_WRITE;
+  uint64_t isExec  = attributes & PORT_TRANSLATION_EXEC;
+
+  /* Access permissions. */
+  if (isUser)
+  {
+    pageEntry->AP = isWrite ? AP_RW_RW   : AP_RO_RO;
+  }
+  else
+  {
+    pageEntry->AP = isWrite ? AP_RW_NONE : AP_RO_NONE;
+  }
+
+  /* Execute permissions. */
+  pageEntry->PXN = (isExec && !isUser) ? PXN_PERMIT_EXEC : PXN_NOT_PERMIT_EXEC;
+  pageEntry->UXN = (isExec &&  isUser) ? UXN_PERMIT_EXEC : UXN_NOT_PERMIT_EXEC;
+}
+
+/*****************************************************************************
+ *                       PortTranslationDecode()
+ ****************************************************************************/
+
+static uint64_t PortTranslationDecode (PAGENTRY_t *pageEntry)
+{
+  /* Every valid mapping is readable. */
+  uint64_t attributes = PORT_TRANSLATION_READ;
+
+  /* Decode access permissions. */
+  if (pageEntry->AP == AP_RW_RW || pageEntry->AP == AP_RO_RO)
+  {
+    attributes |= PORT_TRANSLATION_USER;
+  }
+  if (pageEntry->AP == AP_RW_RW || pageEntry->AP == AP_RW_NONE)
+  {
+    attributes |= PORT_TRANSLATION_WRITE;
+  }
+
+  /* Decode execute permissions. */
+  if (pageEntry->PXN == PXN_PERMIT_EXEC || pageEntry->UXN == UXN_PERMIT_EXEC)
+  {
+    attributes |= PORT_TRANSLATION_EXEC;
+  }
+
+  /* Done. */
+  return attributes;
+}
+
+/*****************************************************************************
+ *                        PortTranslationFlush()
+ ****************************************************************************/
+
+static void PortTranslationFlush (void *virtualAddr)
+{
+  /* Make the descriptor update visible to the table walker. */
+  DSB(ishst);
+
+  /* Invalidate the VA for all ASIDs on all cores. */
+  TLBI_VA(vaae1is, ((uint64_t) virtualAddr) >> 12);
+
+  /* Halt pipeline until TLBI is completed. */
+  DSB(ish);
+  ISB();
+}
+
 /*****************************************************************************
  *                      PortTranslationInitialize()
  ****************************************************************************/
@@ -667,13 +838,96 @@ void PortTranslationInitialize (void)
   PortSetupTTBR1();
   PortSetupTCR();
   PortSetupSCTLRPost();
+
+  /* Rewrite GOT and data pointers so they target the direct map alias. */
+  _relocate((long) PORT_PHYS_TO_VIRT(ImageBase),
+            PORT_PHYS_TO_VIRT(_DYNAMIC), NULL, NULL);
+
+  /* Reach the UART through the direct map too. */
+  PortSerialRemap();
+}
+
+/*****************************************************************************
+ *                      PortTranslationTrampoline()
+ ****************************************************************************/
+
+/* x0: function to call, x1: offset to add to sp for the duration. */
+__asm__(
+  ".global PortTranslationTrampoline\n"
+  "PortTranslationTrampoline:\n"
+  "  stp  x29, x30, [sp, #-16]!\n"
+  "  mov  x29, sp\n"
+  "  add  sp, sp, x1\n"
+  "  blr  x0\n"
+  "  mov  sp, x29\n"
+  "  ldp  x29, x30, [sp], #16\n"
+  "  ret\n"
+);
+
+/*****************************************************************************
+ *                        PortTranslationEnter()
+ ****************************************************************************/
+
+void PortTranslationEnter (void (*function)(void))
+{
+  /* Current stack pointer. */
+  uint64_t stackAddr   = 0;
+  uint64_t stackOffset = 0;
+
+  /* Load stack pointer. */
+  __asm__ volatile("MOV %0, sp" : "=r"(stackAddr));
+
+  /* Move the stack into the direct map if it is still in the identity map. */
+  if (stackAddr < PORT_DIRECT_MAP_START)
+  {
+    stackOffset = PORT_DIRECT_MAP_START;
+  }
+
+  /* Call the direct map alias of the function. */
+  PortTranslationTrampoline(((uint64_t) function) | PORT_DIRECT_MAP_START,
+                            stackOffset);
+}
+
+/*****************************************************************************
+ *                        PortTranslationSwitch()
+ ****************************************************************************/
+
+void PortTranslationSwitch (void *translationTable, uint64_t asid)
+{
+  /* Register as integer & struct. */
+  uint64_t ttbr0Value   = 0;
+  TTBR_t  *ttbr0Ptr     = NULL;
+
+  /* Setup pointer. */
+  ttbr0Ptr = (TTBR_t *) &ttbr0Value;
+
+  /* NULL selects the boot identity map (reserved ASID 0). */
+  if (translationTable == NULL)
+  {
+    translationTable = PortTTB0;
+    asid             = 0;
+  }
+
+  /* Initialize new value, TLB entries are tagged so no flush is needed. */
+  ttbr0Ptr->RESV = 0;
+  ttbr0Ptr->ADDR = TO_TTB_ADDR(translationTable);
+  ttbr0Ptr->ASID = asid;
+
+  /* Store new value. */
+  MSR(TTBR0_EL1, ttbr0Value);
+
+  /* Halt pipeline until MSR is completed. */
+  ISB();
 }
 
 /*****************************************************************************
  *                        PortTranslationSet()
  ****************************************************************************/
 
-void *PortTranslationSet (void *virtualAddr, void *physicalAddr)
+void *PortTranslationSet (void     *translationTable,
+                          void     *virtualAddr,
+                          void     *physicalAddr,
+                          uint64_t  attributes)
 {
   /* Descriptors as integers. */
   uint64_t    invalidEntryValue   = 0;
@@ -715,8 +969,8 @@ void *PortTranslationSet (void *virtualAddr, void *physicalAddr)
   invalidEntry->VALID   = IS_INVALID;
   invalidEntry->IGNORED = 0;
 
-  /* Start from L0Table (PortTTB1). */
-  L0Table = PortTTB1;
+  /* Start from the L0Table of the requested translation table. */
+  L0Table = PortTranslationRoot(translationTable);
 
   /* Read current descriptor at L0Table[L0EntryNo]. */
   tableEntryValue = L0Table[L0EntryNo];
@@ -748,7 +1002,7 @@ void *PortTranslationSet (void *virtualAddr, void *physicalAddr)
     tableEntry->PXN            = PXN_PERMIT_EXEC;
     tableEntry->UXN            = 0;
     tableEntry->ADDR           = TO_TBL_ADDR(L1Table);
-    tableEntry->AP             = AP_RW_RW;
+    tableEntry->AP             = AP_RW_NONE;
     tableEntry->NS             = NS_SECURE;
 
     /* Store the new entry. */
@@ -790,7 +1044,7 @@ void *PortTranslationSet (void *virtualAddr, void *physicalAddr)
     tableEntry->PXN            = PXN_PERMIT_EXEC;
     tableEntry->UXN            = 0;
     tableEntry->ADDR           = TO_TBL_ADDR(L2Table);
-    tableEntry->AP             = AP_RW_RW;
+    tableEntry->AP             = AP_RW_NONE;
     tableEntry->NS             = NS_SECURE;
 
     /* Store the new entry. */
@@ -837,7 +1091,7 @@ void *PortTranslationSet (void *virtualAddr, void *physicalAddr)
     tableEntry->PXN            = PXN_PERMIT_EXEC;
     tableEntry->UXN            = 0;
     tableEntry->ADDR           = TO_TBL_ADDR(L3Table);
-    tableEntry->AP             = AP_RW_RW;
+    tableEntry->AP             = AP_RW_NONE;
     tableEntry->NS             = NS_SECURE;
 
     /* Store the new entry. */
@@ -866,17 +1120,18 @@ void *PortTranslationSet (void *virtualAddr, void *physicalAddr)
     pageEntry->TYPE            = TYPE_PAGE;
     pageEntry->ATTRIDX         = 0;
     pageEntry->NS              = NS_SECURE;
-    pageEntry->AP              = AP_RW_RW;
     pageEntry->SH              = SH_INNER_SHAREABLE;
     pageEntry->AF              = AF_ACCESSABLE;
-    pageEntry->NG              = NG_NON_GLOBAL;
+    pageEntry->NG              = translationTable == NULL ? NG_GLOBAL :
+                                                            NG_NON_GLOBAL;
     pageEntry->RESV0           = 0;
     pageEntry->CONT            = CONT_DISABLE;
-    pageEntry->PXN             = PXN_PERMIT_EXEC;
-    pageEntry->UXN             = 0;
     pageEntry->ADDR            = TO_PAG_ADDR(physicalAddr);
     pageEntry->IGNORED         = 0;
 
+    /* Setup access and execute permissions. */
+    PortTranslationEncode(pageEntry, attributes);
+
     /* Store the new entry. */
     L3Table[L3EntryNo]         = pageEntryValue;
 
@@ -899,7 +1154,9 @@ void *PortTranslationSet (void *virtualAddr, void *physicalAddr)
  *                          PortTranslationGet()
  ****************************************************************************/
 
-void *PortTranslationGet (void *virtualAddr)
+void *PortTranslationGet (void     *translationTable,
+                          void     *virtualAddr,
+                          uint64_t *attributes)
 {
   /* Descriptors as integers. */
   uint64_t    tableEntryValue   = 0;
@@ -934,8 +1191,8 @@ void *PortTranslationGet (void *virtualAddr)
   L1EntryNo = (((uint64_t) virtualAddr) >> 30) & 0x1FF;
   L0EntryNo = (((uint64_t) virtualAddr) >> 39) & 0x1FF;
 
-  /* Start from L0Table (PortTTB1). */
-  L0Table = PortTTB1;
+  /* Start from the L0Table of the requested translation table. */
+  L0Table = PortTranslationRoot(translationTable);
 
   /* Read current descriptor at L0Table[L0EntryNo]. */
   tableEntryValue = L0Table[L0EntryNo];
@@ -989,6 +1246,12 @@ void *PortTranslationGet (void *virtualAddr)
   /* Load the physical address of the mapped page. */
   physicalAddr = FROM_PAG_ADDR(pageEntry->ADDR);
 
+  /* Report the mapping attributes if requested. */
+  if (attributes != NULL)
+  {
+    *attributes = PortTranslationDecode(pageEntry);
+  }
+
   /* Done. */
   return physicalAddr;
 }
@@ -997,7 +1260,7 @@ void *PortTranslationGet (void *virtualAddr)
  *                          PortTranslationDel()
  ****************************************************************************/
 
-void *PortTranslationDel (void *virtualAddr)
+void *PortTranslationDel (void *translationTable, void *virtualAddr)
 {
   /* Descriptors as integers. */
   uint64_t    invalidEntryValue = 0;
@@ -1039,8 +1302,8 @@ void *PortTranslationDel (void *virtualAddr)
   invalidEntry->VALID   = IS_INVALID;
   invalidEntry->IGNORED = 0;
 
-  /* Start from L0Table (PortTTB1). */
-  L0Table = PortTTB1;
+  /* Start from the L0Table of the requested translation table. */
+  L0Table = PortTranslationRoot(translationTable);
 
   /* Read current descriptor at L0Table[L0EntryNo]. */
   tableEntryValue = L0Table[L0EntryNo];
@@ -1097,6 +1360,9 @@ void *PortTranslationDel (void *virtualAddr)
   /* Mark the descriptor in L3Table as invalid. */
   L3Table[L3EntryNo]    = invalidEntryValue;
 
+  /* Drop stale TLB entries for the page. */
+  PortTranslationFlush(virtualAddr);
+
   /* Decrease L3Table counter in L2Table. */
   tableEntryValue = L2Table[L2EntryNo];
   tableEntry->IGNORED0--;
@@ -1154,3 +1420,386 @@ void *PortTranslationDel (void *virtualAddr)
   /* Done. */
   return physicalAddr;
 }
+
+/*****************************************************************************
+ *                        PortTranslationLookup()
+ ****************************************************************************/
+
+static uint64_t *PortTranslationLookup (uint64_t *L0Table, void *virtualAddr)
+{
+  /* Descriptor as integer & struct. */
+  uint64_t    tableEntryValue = 0;
+  TBLENTRY_t *tableEntry      = NULL;
+
+  /* Current table and level. */
+  uint64_t   *curTable        = L0Table;
+  uint64_t    curShift        = 39;
+
+  /* Setup pointer. */
+  tableEntry = (TBLENTRY_t *) &tableEntryValue;
+
+  /* Walk L0, L1 and L2 tables. */
+  for (curShift = 39; curShift > 12; curShift -= 9)
+  {
+    /* Read the table descriptor. */
+    tableEntryValue = curTable[(((uint64_t) virtualAddr) >> curShift) & 0x1FF];
+
+    /* Next level table doesn't exist? */
+    if (tableEntry->VALID == IS_INVALID)
+    {
+      return NULL;
+    }
+
+    /* Descend. */
+    curTable = FROM_TBL_ADDR(tableEntry->ADDR);
+  }
+
+  /* Return pointer to the L3 descriptor. */
+  return &curTable[(((uint64_t) virtualAddr) >> 12) & 0x1FF];
+}
+
+/*****************************************************************************
+ *                        PortTranslationCreate()
+ ****************************************************************************/
+
+void *PortTranslationCreate (void)
+{
+  /* New L0 table. */
+  uint64_t *L0Table  = NULL;
+
+  /* Loop counter. */
+  uint64_t  curL0Idx = 0;
+
+  /* Allocate L0 table. */
+  L0Table = KernelMemoryPageAllocate();
+
+  /* Out of memory? */
+  if (L0Table == NULL)
+  {
+    return NULL;
+  }
+
+  /* The whole lower half belongs to the process. */
+  for (curL0Idx = 0; curL0Idx < ENTRY_COUNT; curL0Idx++)
+  {
+    L0Table[curL0Idx] = 0;
+  }
+
+  /* Done. */
+  return L0Table;
+}
+
+/*****************************************************************************
+ *                        PortTranslationDestroy()
+ ****************************************************************************/
+
+void PortTranslationDestroy (void  *translationTable,
+                             void (*pageVisit)(void *physicalAddr))
+{
+  /* Descriptors as integers. */
+  uint64_t    tableEntryValue = 0;
+  uint64_t    pageEntryValue  = 0;
+
+  /* Descriptors as structs. */
+  TBLENTRY_t *tableEntry      = NULL;
+  PAGENTRY_t *pageEntry       = NULL;
+
+  /* Table pointers. */
+  uint64_t   *L0Table         = NULL;
+  uint64_t   *L1Table         = NULL;
+  uint64_t   *L2Table         = NULL;
+  uint64_t   *L3Table         = NULL;
+
+  /* Loop counters. */
+  uint64_t    curL0Idx        = 0;
+  uint64_t    curL1Idx        = 0;
+  uint64_t    curL2Idx        = 0;
+  uint64_t    curL3Idx        = 0;
+
+  /* Setup pointers. */
+  tableEntry = (TBLENTRY_t *) &tableEntryValue;
+  pageEntry  = (PAGENTRY_t *) &pageEntryValue;
+
+  /* Obtain L0 table. */
+  L0Table = translationTable;
+
+  /* Loop over the L0 table. */
+  for (curL0Idx = 0; curL0Idx < ENTRY_COUNT; curL0Idx++)
+  {
+    tableEntryValue = L0Table[curL0Idx];
+    if (tableEntry->VALID == IS_INVALID)
+    {
+      continue;
+    }
+    L1Table = FROM_TBL_ADDR(tableEntry->ADDR);
+
+    /* Loop over L1 table. */
+    for (curL1Idx = 0; curL1Idx < ENTRY_COUNT; curL1Idx++)
+    {
+      tableEntryValue = L1Table[curL1Idx];
+      if (tableEntry->VALID == IS_INVALID)
+      {
+        continue;
+      }
+      L2Table = FROM_TBL_ADDR(tableEntry->ADDR);
+
+      /* Loop over L2 table. */
+      for (curL2Idx = 0; curL2Idx < ENTRY_COUNT; curL2Idx++)
+      {
+        tableEntryValue = L2Table[curL2Idx];
+        if (tableEntry->VALID == IS_INVALID)
+        {
+          continue;
+        }
+        L3Table = FROM_TBL_ADDR(tableEntry->ADDR);
+
+        /* Hand every mapped page back to the caller. */
+        for (curL3Idx = 0; curL3Idx < ENTRY_COUNT; curL3Idx++)
+        {
+          pageEntryValue = L3Table[curL3Idx];
+          if (pageEntry->VALID == IS_VALID)
+          {
+            pageVisit(FROM_PAG_ADDR(pageEntry->ADDR));
+          }
+        }
+
+        /* Free L3 table. */
+        KernelMemoryPageDeallocate(L3Table);
+      }
+
+      /* Free L2 table. */
+      KernelMemoryPageDeallocate(L2Table);
+    }
+
+    /* Free L1 table. */
+    KernelMemoryPageDeallocate(L1Table);
+  }
+
+  /* Free L0 table. */
+  KernelMemoryPageDeallocate(L0Table);
+
+  /* Flush TLB (the table may have been used under any ASID). */
+  DSB(ishst);
+  TLBI(vmalle1is);
+  DSB(ish);
+  ISB();
+}
+
+/*****************************************************************************
+ *                        PortTranslationProtect()
+ ****************************************************************************/
+
+void PortTranslationProtect (void     *translationTable,
+                             void     *virtualAddr,
+                             uint64_t  attributes)
+{
+  /* Descriptor as integer & struct. */
+  uint64_t    pageEntryValue = 0;
+  PAGENTRY_t *pageEntry      = NULL;
+
+  /* Pointer to the L3 descriptor. */
+  uint64_t   *pageEntryPtr   = NULL;
+
+  /* Setup pointer. */
+  pageEntry = (PAGENTRY_t *) &pageEntryValue;
+
+  /* Find the descriptor. */
+  pageEntryPtr = PortTranslationLookup(PortTranslationRoot(translationTable),
+                                       virtualAddr);
+
+  /* Page is not mapped? */
+  if (pageEntryPtr == NULL)
+  {
+    return;
+  }
+  pageEntryValue = *pageEntryPtr;
+  if (pageEntry->VALID == IS_INVALID)
+  {
+    return;
+  }
+
+  /* Update permissions. */
+  PortTranslationEncode(pageEntry, attributes);
+  *pageEntryPtr = pageEntryValue;
+
+  /* Drop stale TLB entries for the page. */
+  PortTranslationFlush(virtualAddr);
+}
+
+/*****************************************************************************
+ *                        PortTranslationReplace()
+ ****************************************************************************/
+
+void *PortTranslationReplace (void     *translationTable,
+                              void     *virtualAddr,
+                              void     *physicalAddr,
+                              uint64_t  attributes)
+{
+  /* Descriptor as integer & struct. */
+  uint64_t    pageEntryValue = 0;
+  PAGENTRY_t *pageEntry      = NULL;
+
+  /* Pointer to the L3 descriptor. */
+  uint64_t   *pageEntryPtr   = NULL;
+
+  /* The page mapped so far. */
+  void       *oldAddr        = NULL;
+
+  /* Setup pointer. */
+  pageEntry = (PAGENTRY_t *) &pageEntryValue;
+
+  /* Find the descriptor. */
+  pageEntryPtr = PortTranslationLookup(PortTranslationRoot(translationTable),
+                                       virtualAddr);
+
+  /* Page is not mapped? */
+  if (pageEntryPtr == NULL)
+  {
+    return NULL;
+  }
+  pageEntryValue = *pageEntryPtr;
+  if (pageEntry->VALID == IS_INVALID)
+  {
+    return NULL;
+  }
+  oldAddr = FROM_PAG_ADDR(pageEntry->ADDR);
+
+  /* Break: no CPU may keep using the old page once we return. */
+  *pageEntryPtr = 0;
+  PortTranslationFlush(virtualAddr);
+
+  /* Make: same descriptor (and table counters), new page and permissions. */
+  pageEntry->ADDR = TO_PAG_ADDR(physicalAddr);
+  PortTranslationEncode(pageEntry, attributes);
+  *pageEntryPtr = pageEntryValue;
+
+  /* Make the descriptor visible to the table walker. */
+  DSB(ishst);
+  ISB();
+
+  /* Done (the caller releases the old page). */
+  return oldAddr;
+}
+
+/*****************************************************************************
+ *                        PortTranslationShare()
+ ****************************************************************************/
+
+error_t PortTranslationShare (void     *dstTable,
+                              void     *srcTable,
+                              void     *startAddr,
+                              void     *endAddr,
+                              uint64_t  clearAttributes,
+                              void    (*pageVisit)(void *physicalAddr))
+{
+  /* Descriptors as integers. */
+  uint64_t    tableEntryValue = 0;
+  uint64_t    pageEntryValue  = 0;
+
+  /* Descriptors as structs. */
+  TBLENTRY_t *tableEntry      = NULL;
+  PAGENTRY_t *pageEntry       = NULL;
+
+  /* Table pointers. */
+  uint64_t   *L0Table         = NULL;
+  uint64_t   *L1Table         = NULL;
+  uint64_t   *L2Table         = NULL;
+  uint64_t   *L3Table         = NULL;
+
+  /* Mapping information. */
+  uint64_t    attributes      = 0;
+  void       *physicalAddr    = NULL;
+
+  /* Iteration state. */
+  uint64_t    curAddr         = (uint64_t) startAddr;
+  uint64_t    nextAddr        = 0;
+  uint64_t    needFlush       = 0;
+
+  /* Error code. */
+  error_t     err             = PORT_SUCCESS;
+
+  /* Setup pointers. */
+  tableEntry = (TBLENTRY_t *) &tableEntryValue;
+  pageEntry  = (PAGENTRY_t *) &pageEntryValue;
+
+  /* Obtain source L0 table. */
+  L0Table = PortTranslationRoot(srcTable);
+
+  /* Walk the source range, skipping unpopulated tables in one step. */
+  while (curAddr < (uint64_t) endAddr)
+  {
+    /* Read L0 descriptor. */
+    tableEntryValue = L0Table[(curAddr >> 39) & 0x1FF];
+    if (tableEntry->VALID == IS_INVALID)
+    {
+      nextAddr = (curAddr | (L1_SIZE - 1)) + 1;
+      if (nextAddr <= curAddr)
+      {
+        break;
+      }
+      curAddr = nextAddr;
+      continue;
+    }
+    L1Table = FROM_TBL_ADDR(tableEntry->ADDR);
+
+    /* Read L1 descriptor. */
+    tableEntryValue = L1Table[(curAddr >> 30) & 0x1FF];
+    if (tableEntry->VALID == IS_INVALID)
+    {
+      curAddr = (curAddr | (L2_SIZE - 1)) + 1;
+      continue;
+    }
+    L2Table = FROM_TBL_ADDR(tableEntry->ADDR);
+
+    /* Read L2 descriptor. */
+    tableEntryValue = L2Table[(curAddr >> 21) & 0x1FF];
+    if (tableEntry->VALID == IS_INVALID)
+    {
+      curAddr = (curAddr | (L3_SIZE - 1)) + 1;
+      continue;
+    }
+    L3Table = FROM_TBL_ADDR(tableEntry->ADDR);
+
+    /* Read L3 descriptor. */
+    pageEntryValue = L3Table[(curAddr >> 12) & 0x1FF];
+    if (pageEntry->VALID == IS_VALID)
+    {
+      /* Strip attributes from the source mapping if requested. */
+      attributes = PortTranslationDecode(pageEntry);
+      if (attributes & clearAttributes)
+      {
+        attributes &= ~clearAttributes;
+        PortTranslationEncode(pageEntry, attributes);
+        L3Table[(curAddr >> 12) & 0x1FF] = pageEntryValue;
+        needFlush = 1;
+      }
+
+      /* Install the same page into the destination. */
+      physicalAddr = FROM_PAG_ADDR(pageEntry->ADDR);
+      if (PortTranslationSet(dstTable, (void *) curAddr,
+                             physicalAddr, attributes) == NULL)
+      {
+        err = PORT_ERR_RESOURCE;
+        break;
+      }
+
+      /* Let the caller account for the new reference. */
+      pageVisit(physicalAddr);
+    }
+
+    /* Next page. */
+    curAddr += PAGE_SIZE;
+  }
+
+  /* Flush TLB once for all downgraded source mappings. */
+  if (needFlush)
+  {
+    DSB(ishst);
+    TLBI(vmalle1is);
+    DSB(ish);
+    ISB();
+  }
+
+  /* Done. */
+  return err;
+}
@@ -0,0 +1,69 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   simulator/cfg/config.h
+ * @brief  Simulator config header file.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                             SAFE GUARD
+ ****************************************************************************/
+
+#ifndef SIMULATOR_CONFIG_H
+#define SIMULATOR_CONFIG_H
+
+/*****************************************************************************
+ *                              DEFINES
+ ****************************************************************************/
+
+/* Default number of simulated CPUs (at most KERNEL_CONFIG_MAX_CPU_COUNT). */
+#define SIMULATOR_CONFIG_CPU_COUNT        4
+
+/* Default simulated run time (milliseconds of virtual time). */
+#define SIMULATOR_CONFIG_DURATION_MS      1000
+
+/* Virtual counter frequency (1 tick = 1 nanosecond). */
+#define SIMULATOR_CONFIG_TIMER_HZ         1000000000UL
+
+/* Longest compute step of a thread between two looks for interrupts
+ * (microseconds of virtual time, timer deadlines cut steps short). */
+#define SIMULATOR_CONFIG_IRQ_STEP_US      10
+
+/* Host stack of every simulated context (kernel and workload code). */
+#define SIMULATOR_CONFIG_STACK_SIZE       0x10000
+
+/* Task groups in a workload, threads over all groups. */
+#define SIMULATOR_CONFIG_MAX_GROUPS       16
+#define SIMULATOR_CONFIG_MAX_THREADS      1024
+
+/* Latency samples kept per task group (later ones are counted only). */
+#define SIMULATOR_CONFIG_GROUP_SAMPLES    0x40000
+
+/* Task group name maximum size. */
+#define SIMULATOR_CONFIG_NAME_MAX_SIZE    16
+
+/*****************************************************************************
+ *                            END OF HEADER
+ ****************************************************************************/
+
+#endif /* SIMULATOR_CONFIG_H */
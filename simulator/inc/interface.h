@@ -0,0 +1,107 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   simulator/inc/interface.h
+ * @brief  Simulator interface header file.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                             SAFE GUARD
+ ****************************************************************************/
+
+#ifndef SIMULATOR_INTERFACE_H
+#define SIMULATOR_INTERFACE_H
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Simulator config header. */
+#include "simulator/cfg/config.h"
+
+/*****************************************************************************
+ *                              DEFINES
+ ****************************************************************************/
+
+/* Error codes (uint64_t/int64_t come from <stdint.h> or the port). */
+#define SIMULATOR_SUCCESS         (0)
+#define SIMULATOR_ERR_PARAMETER   (-1)
+#define SIMULATOR_ERR_STALLED     (-2)
+
+/*****************************************************************************
+ *                              TYPEDEFS
+ ****************************************************************************/
+
+/* Task group: threads that compute, then sleep (or yield), in a loop. */
+typedef struct simulator_group_t
+{
+  char     groupName[SIMULATOR_CONFIG_NAME_MAX_SIZE];
+  uint64_t groupPriority;
+  uint64_t groupThreads;
+  uint64_t groupCompute;  /* Microseconds of work per loop. */
+  uint64_t groupSleep;    /* Microseconds asleep per loop (0 = yield). */
+  uint64_t groupAffinity; /* CPU mask (0 = every simulated CPU). */
+  uint64_t groupSamples;  /* Latency samples taken (some may be dropped). */
+} simulator_group_t;
+
+/* One simulated thread of a task group. */
+typedef struct simulator_thread_t
+{
+  uint64_t threadGroup;
+  uint64_t threadId;
+  uint64_t threadPhase;   /* Microseconds asleep before the first loop. */
+  uint64_t threadLoops;
+  uint64_t threadBusy;    /* Counter ticks of work done. */
+} simulator_thread_t;
+
+/*****************************************************************************
+ *                             EXTERNS
+ ****************************************************************************/
+
+/* Workload description (filled in before the run) and its results. */
+extern simulator_group_t  SimulatorGroups[SIMULATOR_CONFIG_MAX_GROUPS];
+extern uint64_t           SimulatorGroupCount;
+extern simulator_thread_t SimulatorThreads[SIMULATOR_CONFIG_MAX_THREADS];
+extern uint64_t           SimulatorThreadCount;
+
+/* Virtual time from the start of the run until every task stopped. */
+extern uint64_t           SimulatorElapsed;
+
+/* Wake-up latencies (counter ticks from ready to running) per group. */
+extern uint64_t SimulatorSamples[SIMULATOR_CONFIG_MAX_GROUPS]
+                                [SIMULATOR_CONFIG_GROUP_SAMPLES];
+
+/*****************************************************************************
+ *                          FUNCTION PROTOTYPES
+ ****************************************************************************/
+
+/* Workload API (runs the kernel scheduler on virtual CPUs). */
+int64_t SimulatorWorkloadRun (uint64_t cpuCount,
+                              uint64_t durationMs,
+                              uint64_t verbose);
+
+/*****************************************************************************
+ *                            END OF HEADER
+ ****************************************************************************/
+
+#endif /* SIMULATOR_INTERFACE_H */
@@ -0,0 +1,86 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   simulator/inc/internal.h
+ * @brief  Simulator internal header file.
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                             SAFE GUARD
+ ****************************************************************************/
+
+#ifndef SIMULATOR_INTERNAL_H
+#define SIMULATOR_INTERNAL_H
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Simulator interface header. */
+#include "simulator/inc/interface.h"
+
+/*****************************************************************************
+ *                              DEFINES
+ ****************************************************************************/
+
+/* Pending interrupts of a simulated CPU. */
+#define SIMULATOR_IRQ_TIMER       (1UL<<0)
+#define SIMULATOR_IRQ_WAKEUP      (1UL<<1)
+
+/* Timer of a simulated CPU not armed. */
+#define SIMULATOR_NO_DEADLINE     (~0UL)
+
+/*****************************************************************************
+ *                          FUNCTION PROTOTYPES
+ ****************************************************************************/
+
+/* Virtual machine: CPUs, virtual time and contexts (host side).
+ * Contexts 0..contextCount-1 are threads, the next ones boot CPUs. */
+int64_t  SimulatorMachineRun     (uint64_t   cpuCount,
+                                  uint64_t   contextCount,
+                                  void     (*entry)(uint64_t cpuId));
+void     SimulatorMachineStart   (uint64_t   cpuId,
+                                  void     (*entry)(uint64_t cpuId));
+void     SimulatorMachineStop    (void);
+uint64_t SimulatorMachineCpu     (void);
+uint64_t SimulatorMachineNow     (void);
+void     SimulatorMachineAdvance (uint64_t   ticks);
+uint64_t SimulatorMachineIdle    (void);
+uint64_t SimulatorMachineMask    (uint64_t   masked);
+uint64_t SimulatorMachineMasked  (void);
+void     SimulatorMachineTimer   (uint64_t   deadline);
+void     SimulatorMachineSend    (uint64_t   cpuId, uint64_t irqBits);
+void     SimulatorMachinePrepare (uint64_t   contextId,
+                                  void     (*entry)(void *arg),
+                                  void      *arg);
+void     SimulatorMachineSwitch  (uint64_t   prevId, uint64_t nextId);
+
+/* Port: takes the interrupts raised on the executing CPU (SIMULATOR_IRQ_*
+ * bits), as the GIC handler would. */
+void     SimulatorPortInterrupt  (uint64_t   pending);
+
+/*****************************************************************************
+ *                            END OF HEADER
+ ****************************************************************************/
+
+#endif /* SIMULATOR_INTERNAL_H */
@@ -0,0 +1,624 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   simulator/src/machine.c
+ * @brief  Simulator virtual machine (CPUs, virtual time, contexts).
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* ucontext routines are XSI. */
+#define _XOPEN_SOURCE 600
+
+/* Host includes. */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <ucontext.h>
+
+/* Kernel config header (CPU count). */
+#include "kernel/cfg/config.h"
+
+/* Simulator includes. */
+#include "simulator/inc/interface.h"
+#include "simulator/inc/internal.h"
+
+/*****************************************************************************
+ *                               MACROS
+ ****************************************************************************/
+
+/* Simplifying macros. */
+#define MAX_CPU          (KERNEL_CONFIG_MAX_CPU_COUNT)
+#define STACK_SIZE       (SIMULATOR_CONFIG_STACK_SIZE)
+#define NO_DEADLINE      (SIMULATOR_NO_DEADLINE)
+
+/* Longest compute step with interrupts unmasked (virtual counter ticks). */
+#define IRQ_STEP         (SIMULATOR_CONFIG_IRQ_STEP_US * \
+                          (SIMULATOR_CONFIG_TIMER_HZ / 1000000))
+
+/*****************************************************************************
+ *                              TYPEDEFS
+ ****************************************************************************/
+
+/* Simulated CPU. */
+typedef struct simulator_cpu_t
+{
+  uint64_t cpuStarted;  /* Running kernel code. */
+  uint64_t cpuAsleep;   /* In PortCpuIdle() waiting for an interrupt. */
+  uint64_t cpuClock;    /* Virtual counter of the CPU. */
+  uint64_t cpuDeadline; /* Timer compare value. */
+  uint64_t cpuPending;  /* SIMULATOR_IRQ_* raised and not taken yet. */
+  uint64_t cpuMasked;   /* IRQs masked (PSTATE.I). */
+  uint64_t cpuContext;  /* Context executing on the CPU. */
+} simulator_cpu_t;
+
+/* Host execution context (a simulated thread or a boot CPU). */
+typedef struct simulator_context_t
+{
+  ucontext_t   contextState;
+  void        *contextStack;
+  void       (*contextEntry)(void *arg);
+  void        *contextArg;
+  void       (*contextBoot)(uint64_t cpuId);
+} simulator_context_t;
+
+/*****************************************************************************
+ *                           STATIC VARIABLES
+ ****************************************************************************/
+
+/* Simulated CPUs, and the one being executed by the host. */
+static simulator_cpu_t SimulatorMachineCpus[MAX_CPU];
+static uint64_t        SimulatorMachineCpuCount = 0;
+static uint64_t        SimulatorMachineCurrent  = 0;
+
+/* Contexts, allocated on first use (indexed by context ID). */
+static simulator_context_t **SimulatorMachineContexts     = NULL;
+static uint64_t              SimulatorMachineContextCount = 0;
+
+/* Context holding the state of a thread (the idle thread of a CPU keeps
+ * the boot context of the CPU, anything else its own). */
+static uint64_t *SimulatorMachineHolder = NULL;
+
+/* Host context running the event loop. */
+static ucontext_t SimulatorMachineHost;
+
+/* Set by SimulatorMachineStop(). */
+static uint64_t SimulatorMachineStopped = 0;
+
+/*****************************************************************************
+ *                      SimulatorMachineContext()
+ ****************************************************************************/
+
+static simulator_context_t *SimulatorMachineContext (uint64_t contextId)
+{
+  /* Simplifying variables. */
+  simulator_context_t *context = SimulatorMachineContexts[contextId];
+
+  /* Allocate it with its stack (stacks are reused with the context ID). */
+  if (context == NULL)
+  {
+    context = calloc(1, sizeof(simulator_context_t));
+    if (context == NULL || (context->contextStack = malloc(STACK_SIZE)) == NULL)
+    {
+      fprintf(stderr, "SIMULATOR: out of host memory\n");
+      exit(EXIT_FAILURE);
+    }
+    SimulatorMachineContexts[contextId] = context;
+  }
+
+  /* Done. */
+  return context;
+}
+
+/*****************************************************************************
+ *                     SimulatorMachineTrampoline()
+ ****************************************************************************/
+
+static void SimulatorMachineTrampoline (int contextId)
+{
+  /* Simplifying variables. */
+  simulator_context_t *context = SimulatorMachineContexts[contextId];
+  uint64_t             cpuId   = 0;
+
+  /* Boot context of a CPU, or a thread. */
+  if (context->contextBoot != 0)
+  {
+    cpuId = (uint64_t) contextId - SimulatorMachineContextCount;
+    context->contextBoot(cpuId);
+  }
+  else
+  {
+    context->contextEntry(context->contextArg);
+  }
+
+  /* Kernel threads and CPUs never return. */
+  fprintf(stderr, "SIMULATOR: context %d returned\n", contextId);
+  exit(EXIT_FAILURE);
+}
+
+/*****************************************************************************
+ *                       SimulatorMachineBuild()
+ ****************************************************************************/
+
+static void SimulatorMachineBuild (uint64_t contextId)
+{
+  /* Simplifying variables. */
+  simulator_context_t *context = SimulatorMachineContext(contextId);
+
+  /* Fresh frame on the (reused) stack, starting in the trampoline. */
+  getcontext(&context->contextState);
+  context->contextState.uc_stack.ss_sp   = context->contextStack;
+  context->contextState.uc_stack.ss_size = STACK_SIZE;
+  context->contextState.uc_link          = NULL;
+  makecontext(&context->contextState,
+              (void (*)(void)) SimulatorMachineTrampoline, 1, (int) contextId);
+}
+
+/*****************************************************************************
+ *                       SimulatorMachineYield()
+ ****************************************************************************/
+
+static void SimulatorMachineYield (void)
+{
+  /* Simplifying variables. */
+  simulator_cpu_t *cpu = &SimulatorMachineCpus[SimulatorMachineCurrent];
+
+  /* Freeze this CPU, the event loop picks the next one to run. */
+  swapcontext(&SimulatorMachineContexts[cpu->cpuContext]->contextState,
+              &SimulatorMachineHost);
+}
+
+/*****************************************************************************
+ *                        SimulatorMachinePick()
+ ****************************************************************************/
+
+static uint64_t SimulatorMachinePick (void)
+{
+  /* Loop counter. */
+  uint64_t curCpu = 0;
+
+  /* Earliest CPU so far and when it runs. */
+  uint64_t bestCpu  = MAX_CPU;
+  uint64_t bestTime = NO_DEADLINE;
+  uint64_t cpuTime  = 0;
+
+  /* Run the CPU furthest behind in virtual time (so no CPU can see an
+   * event from the future), asleep ones when their timer fires. */
+  for (curCpu = 0; curCpu < SimulatorMachineCpuCount; curCpu++)
+  {
+    if (!SimulatorMachineCpus[curCpu].cpuStarted)
+    {
+      continue;
+    }
+    cpuTime = SimulatorMachineCpus[curCpu].cpuClock;
+    if (SimulatorMachineCpus[curCpu].cpuAsleep)
+    {
+      if (SimulatorMachineCpus[curCpu].cpuDeadline == NO_DEADLINE)
+      {
+        continue;
+      }
+      if (SimulatorMachineCpus[curCpu].cpuDeadline > cpuTime)
+      {
+        cpuTime = SimulatorMachineCpus[curCpu].cpuDeadline;
+      }
+    }
+    if (cpuTime < bestTime)
+    {
+      bestCpu  = curCpu;
+      bestTime = cpuTime;
+    }
+  }
+
+  /* An asleep CPU wakes up at its deadline. */
+  if (bestCpu != MAX_CPU)
+  {
+    SimulatorMachineCpus[bestCpu].cpuClock  = bestTime;
+    SimulatorMachineCpus[bestCpu].cpuAsleep = 0;
+  }
+
+  /* Done. */
+  return bestCpu;
+}
+
+/*****************************************************************************
+ *                        SimulatorMachineRun()
+ ****************************************************************************/
+
+int64_t SimulatorMachineRun (uint64_t   cpuCount,
+                             uint64_t   contextCount,
+                             void     (*entry)(uint64_t cpuId))
+{
+  /* Loop counter. */
+  uint64_t curContext = 0;
+
+  /* Next CPU to execute. */
+  uint64_t nextCpu    = 0;
+
+  /* Check parameters. */
+  if (cpuCount == 0 || cpuCount > MAX_CPU)
+  {
+    return SIMULATOR_ERR_PARAMETER;
+  }
+
+  /* Context table (threads first, then one boot context per CPU). */
+  SimulatorMachineCpuCount     = cpuCount;
+  SimulatorMachineContextCount = contextCount;
+  SimulatorMachineContexts = calloc(contextCount + MAX_CPU,
+                                    sizeof(simulator_context_t *));
+  SimulatorMachineHolder   = calloc(contextCount, sizeof(uint64_t));
+  if (SimulatorMachineContexts == NULL || SimulatorMachineHolder == NULL)
+  {
+    return SIMULATOR_ERR_PARAMETER;
+  }
+  for (curContext = 0; curContext < contextCount; curContext++)
+  {
+    SimulatorMachineHolder[curContext] = curContext;
+  }
+
+  /* Boot CPU 0 at time 0, it starts the others. */
+  SimulatorMachineStopped = 0;
+  SimulatorMachineCurrent = 0;
+  SimulatorMachineStart(0, entry);
+
+  /* Event loop: execute a CPU until it computes, sleeps or spins. */
+  while (!SimulatorMachineStopped)
+  {
+    nextCpu = SimulatorMachinePick();
+    if (nextCpu == MAX_CPU)
+    {
+      return SIMULATOR_ERR_STALLED;
+    }
+    SimulatorMachineCurrent = nextCpu;
+    swapcontext(&SimulatorMachineHost,
+                &SimulatorMachineContexts[SimulatorMachineCpus[nextCpu]
+                                          .cpuContext]->contextState);
+  }
+
+  /* Done. */
+  return SIMULATOR_SUCCESS;
+}
+
+/*****************************************************************************
+ *                       SimulatorMachineStart()
+ ****************************************************************************/
+
+void SimulatorMachineStart (uint64_t   cpuId,
+                            void     (*entry)(uint64_t cpuId))
+{
+  /* Simplifying variables. */
+  uint64_t         contextId = SimulatorMachineContextCount + cpuId;
+  simulator_cpu_t *cpu       = &SimulatorMachineCpus[cpuId];
+
+  /* Check parameters. */
+  if (cpuId >= SimulatorMachineCpuCount || cpu->cpuStarted)
+  {
+    return;
+  }
+
+  /* Power on at the time of the caller, in a boot context. */
+  SimulatorMachineBuild(contextId);
+  SimulatorMachineContexts[contextId]->contextBoot = entry;
+  cpu->cpuStarted  = 1;
+  cpu->cpuAsleep   = 0;
+  cpu->cpuClock    = SimulatorMachineCpus[SimulatorMachineCurrent].cpuClock;
+  cpu->cpuDeadline = NO_DEADLINE;
+  cpu->cpuPending  = 0;
+  cpu->cpuMasked   = 1;
+  cpu->cpuContext  = contextId;
+}
+
+/*****************************************************************************
+ *                        SimulatorMachineStop()
+ ****************************************************************************/
+
+void SimulatorMachineStop (void)
+{
+  /* Back to the event loop, for good. */
+  SimulatorMachineStopped = 1;
+  SimulatorMachineYield();
+}
+
+/*****************************************************************************
+ *                        SimulatorMachineCpu()
+ ****************************************************************************/
+
+uint64_t SimulatorMachineCpu (void)
+{
+  /* CPU being executed. */
+  return SimulatorMachineCurrent;
+}
+
+/*****************************************************************************
+ *                        SimulatorMachineNow()
+ ****************************************************************************/
+
+uint64_t SimulatorMachineNow (void)
+{
+  /* Virtual counter of the executing CPU. */
+  return SimulatorMachineCpus[SimulatorMachineCurrent].cpuClock;
+}
+
+/*****************************************************************************
+ *                        SimulatorMachineTake()
+ ****************************************************************************/
+
+static uint64_t SimulatorMachineTake (simulator_cpu_t *cpu)
+{
+  /* Simplifying variables. */
+  uint64_t pending = 0;
+
+  /* Take what is pending now, a fired timer is disarmed. */
+  pending         = cpu->cpuPending;
+  cpu->cpuPending = 0;
+  if (cpu->cpuDeadline <= cpu->cpuClock)
+  {
+    cpu->cpuDeadline = NO_DEADLINE;
+    pending         |= SIMULATOR_IRQ_TIMER;
+  }
+
+  /* Done. */
+  return pending;
+}
+
+/*****************************************************************************
+ *                       SimulatorMachineDeliver()
+ ****************************************************************************/
+
+static void SimulatorMachineDeliver (void)
+{
+  /* Simplifying variables. */
+  simulator_cpu_t *cpu = &SimulatorMachineCpus[SimulatorMachineCurrent];
+
+  /* Masked, or nothing raised and the timer not due? */
+  if (cpu->cpuMasked ||
+      (cpu->cpuPending == 0 && cpu->cpuDeadline > cpu->cpuClock))
+  {
+    return;
+  }
+
+  /* Interrupt the running code (it may be preempted in there). */
+  SimulatorPortInterrupt(SimulatorMachineTake(cpu));
+}
+
+/*****************************************************************************
+ *                      SimulatorMachineAdvance()
+ ****************************************************************************/
+
+void SimulatorMachineAdvance (uint64_t ticks)
+{
+  /* Simplifying variables. */
+  simulator_cpu_t *cpu  = &SimulatorMachineCpus[SimulatorMachineCurrent];
+  uint64_t         step = 0;
+
+  /* Masked: time passes in one go, interrupts stay pending. */
+  if (cpu->cpuMasked)
+  {
+    cpu->cpuClock += ticks;
+    SimulatorMachineYield();
+    return;
+  }
+
+  /* Unmasked: short steps, the last one ends at the timer deadline. */
+  while (ticks > 0)
+  {
+    step = ticks < IRQ_STEP ? ticks : IRQ_STEP;
+    if (cpu->cpuDeadline > cpu->cpuClock &&
+        cpu->cpuDeadline - cpu->cpuClock < step)
+    {
+      step = cpu->cpuDeadline - cpu->cpuClock;
+    }
+    cpu->cpuClock += step;
+    ticks         -= step;
+
+    /* Let the CPUs left behind catch up, then take what came meanwhile
+     * (preempted? The rest runs wherever the thread runs next). */
+    SimulatorMachineYield();
+    SimulatorMachineDeliver();
+    cpu = &SimulatorMachineCpus[SimulatorMachineCurrent];
+  }
+}
+
+/*****************************************************************************
+ *                        SimulatorMachineIdle()
+ ****************************************************************************/
+
+uint64_t SimulatorMachineIdle (void)
+{
+  /* Simplifying variables. */
+  simulator_cpu_t *cpu = &SimulatorMachineCpus[SimulatorMachineCurrent];
+
+  /* Sleep unless an interrupt is already pending (WFI falls through). */
+  if (cpu->cpuPending == 0 && cpu->cpuDeadline > cpu->cpuClock)
+  {
+    cpu->cpuAsleep = 1;
+    SimulatorMachineYield();
+  }
+
+  /* Take the interrupts that woke us up. */
+  return SimulatorMachineTake(cpu);
+}
+
+/*****************************************************************************
+ *                        SimulatorMachineMask()
+ ****************************************************************************/
+
+uint64_t SimulatorMachineMask (uint64_t masked)
+{
+  /* Simplifying variables. */
+  simulator_cpu_t *cpu      = &SimulatorMachineCpus[SimulatorMachineCurrent];
+  uint64_t         wasMasked = cpu->cpuMasked;
+
+  /* Unmasking lets pending interrupts in right away. */
+  cpu->cpuMasked = masked;
+  if (!masked)
+  {
+    SimulatorMachineDeliver();
+  }
+
+  /* Previous mask (for a restore). */
+  return wasMasked;
+}
+
+/*****************************************************************************
+ *                       SimulatorMachineMasked()
+ ****************************************************************************/
+
+uint64_t SimulatorMachineMasked (void)
+{
+  /* Mask of the executing CPU. */
+  return SimulatorMachineCpus[SimulatorMachineCurrent].cpuMasked;
+}
+
+/*****************************************************************************
+ *                        SimulatorMachineTimer()
+ ****************************************************************************/
+
+void SimulatorMachineTimer (uint64_t deadline)
+{
+  /* Compare value of the executing CPU. */
+  SimulatorMachineCpus[SimulatorMachineCurrent].cpuDeadline = deadline;
+}
+
+/*****************************************************************************
+ *                        SimulatorMachineSend()
+ ****************************************************************************/
+
+void SimulatorMachineSend (uint64_t cpuId, uint64_t irqBits)
+{
+  /* Simplifying variables. */
+  simulator_cpu_t *cpu = NULL;
+
+  /* CPUs never started drop it. */
+  if (cpuId >= SimulatorMachineCpuCount ||
+      !SimulatorMachineCpus[cpuId].cpuStarted)
+  {
+    return;
+  }
+  cpu = &SimulatorMachineCpus[cpuId];
+
+  /* Raise it, an asleep target wakes up now (it is not ahead of us). */
+  cpu->cpuPending |= irqBits;
+  if (cpu->cpuAsleep)
+  {
+    cpu->cpuAsleep = 0;
+    cpu->cpuClock  = SimulatorMachineNow();
+  }
+}
+
+/*****************************************************************************
+ *                       SimulatorMachinePrepare()
+ ****************************************************************************/
+
+void SimulatorMachinePrepare (uint64_t   contextId,
+                              void     (*entry)(void *arg),
+                              void      *arg)
+{
+  /* Simplifying variables. */
+  simulator_context_t *context = NULL;
+
+  /* Check parameters. */
+  if (contextId >= SimulatorMachineContextCount)
+  {
+    return;
+  }
+
+  /* First activation calls entry(arg) on the context stack. */
+  SimulatorMachineBuild(contextId);
+  context               = SimulatorMachineContexts[contextId];
+  context->contextEntry = entry;
+  context->contextArg   = arg;
+  context->contextBoot  = 0;
+
+  /* A reused ID no longer aliases an idle thread. */
+  SimulatorMachineHolder[contextId] = contextId;
+}
+
+/*****************************************************************************
+ *                       SimulatorMachineSwitch()
+ ****************************************************************************/
+
+void SimulatorMachineSwitch (uint64_t prevId, uint64_t nextId)
+{
+  /* Simplifying variables. */
+  simulator_cpu_t *cpu      = &SimulatorMachineCpus[SimulatorMachineCurrent];
+  uint64_t         prevSlot = cpu->cpuContext;
+  uint64_t         nextSlot = SimulatorMachineHolder[nextId];
+
+  /* Prev is saved where it runs now (the boot context for idle threads). */
+  SimulatorMachineHolder[prevId] = prevSlot;
+  cpu->cpuContext                = nextSlot;
+
+  /* STORE prev and RESTORE next. */
+  swapcontext(&SimulatorMachineContexts[prevSlot]->contextState,
+              &SimulatorMachineContexts[nextSlot]->contextState);
+}
+
+/*****************************************************************************
+ *                           KernelPrintFmt()
+ ****************************************************************************/
+
+void KernelPrintFmt (char *fmt, ...)
+{
+  /* Argument list. */
+  va_list args;
+
+  /* Same conversions as the kernel (all integers are 64-bit). */
+  va_start(args, fmt);
+  while (*fmt)
+  {
+    if (*fmt != '%')
+    {
+      putchar(*fmt++);
+      continue;
+    }
+    switch (*++fmt)
+    {
+      case 'c':
+        putchar((char) va_arg(args, uint64_t));
+        break;
+      case 's':
+        fputs(va_arg(args, char *), stdout);
+        break;
+      case 'u':
+      case 'd':
+        printf("%lu", (unsigned long) va_arg(args, uint64_t));
+        break;
+      case 'p':
+      case 'x':
+      case 'X':
+        printf("0x%016lX", (unsigned long) va_arg(args, uint64_t));
+        break;
+      case '%':
+        putchar('%');
+        break;
+      default:
+        putchar('?');
+        break;
+    }
+    fmt++;
+  }
+  va_end(args);
+}
@@ -0,0 +1,332 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   simulator/src/main.c
+ * @brief  Simulator entry point (workload loading and report).
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Host includes. */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Simulator includes. */
+#include "simulator/inc/interface.h"
+#include "simulator/inc/internal.h"
+
+/*****************************************************************************
+ *                               MACROS
+ ****************************************************************************/
+
+/* Simplifying macros. */
+#define MAX_GROUPS       (SIMULATOR_CONFIG_MAX_GROUPS)
+#define GROUP_SAMPLES    (SIMULATOR_CONFIG_GROUP_SAMPLES)
+#define TICKS_PER_US     (SIMULATOR_CONFIG_TIMER_HZ / 1000000.0)
+
+/*****************************************************************************
+ *                           STATIC VARIABLES
+ ****************************************************************************/
+
+/* Synthetic workload used without a workload file: periodic control
+ * loops, request handlers and CPU-bound batch jobs. */
+static const simulator_group_t SimulatorMainDefault[] =
+{
+  /* Name      Priority Threads Compute Sleep CPU mask Samples */
+  { "control", 40,      4,      50,     1000, 0,       0 },
+  { "server",  20,      8,      200,    500,  0,       0 },
+  { "batch",   10,      8,      5000,   0,    0,       0 },
+};
+
+/*****************************************************************************
+ *                         SimulatorMainUsage()
+ ****************************************************************************/
+
+static void SimulatorMainUsage (char *program)
+{
+  fprintf(stderr,
+          "usage: %s [-c cpus] [-d milliseconds] [-v] [workload-file]\n"
+          "workload-file lines (# starts a comment):\n"
+          "  name priority threads compute-us sleep-us [cpu-mask]\n"
+          "  (sleep-us 0 yields after every compute step)\n",
+          program);
+}
+
+/*****************************************************************************
+ *                          SimulatorMainLoad()
+ ****************************************************************************/
+
+static int SimulatorMainLoad (char *fileName)
+{
+  /* Local variables. */
+  FILE              *file   = NULL;
+  simulator_group_t *group  = NULL;
+  char               line[256];
+  unsigned long      fields[5];
+  int                count  = 0;
+  uint64_t           lineNo = 0;
+
+  /* Built-in workload? */
+  if (fileName == NULL)
+  {
+    SimulatorGroupCount = sizeof(SimulatorMainDefault) /
+                          sizeof(SimulatorMainDefault[0]);
+    memcpy(SimulatorGroups, SimulatorMainDefault, sizeof(SimulatorMainDefault));
+    return 0;
+  }
+
+  /* One task group per line. */
+  file = fopen(fileName, "r");
+  if (file == NULL)
+  {
+    fprintf(stderr, "SIMULATOR: cannot open %s\n", fileName);
+    return -1;
+  }
+  SimulatorGroupCount = 0;
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    lineNo++;
+    line[strcspn(line, "#\r\n")] = '\0';
+    if (line[strspn(line, " \t")] == '\0')
+    {
+      continue;
+    }
+    if (SimulatorGroupCount == MAX_GROUPS)
+    {
+      fprintf(stderr, "SIMULATOR: more than %d groups\n", MAX_GROUPS);
+      fclose(file);
+      return -1;
+    }
+    group     = &SimulatorGroups[SimulatorGroupCount];
+    fields[4] = 0;
+    count     = sscanf(line, "%15s %lu %lu %lu %lu %lx", group->groupName,
+                       &fields[0], &fields[1], &fields[2], &fields[3],
+                       &fields[4]);
+    if (count < 5)
+    {
+      fprintf(stderr, "SIMULATOR: %s:%lu: bad task group\n",
+              fileName, (unsigned long) lineNo);
+      fclose(file);
+      return -1;
+    }
+    group->groupPriority = fields[0];
+    group->groupThreads  = fields[1];
+    group->groupCompute  = fields[2];
+    group->groupSleep    = fields[3];
+    group->groupAffinity = fields[4];
+    SimulatorGroupCount++;
+  }
+
+  /* Done. */
+  fclose(file);
+  return 0;
+}
+
+/*****************************************************************************
+ *                         SimulatorMainCompare()
+ ****************************************************************************/
+
+static int SimulatorMainCompare (const void *a, const void *b)
+{
+  /* Ascending latencies. */
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+/*****************************************************************************
+ *                        SimulatorMainPercentile()
+ ****************************************************************************/
+
+static double SimulatorMainPercentile (uint64_t *samples,
+                                       uint64_t  count,
+                                       uint64_t  perMille)
+{
+  /* Nearest rank on sorted samples, in microseconds. */
+  uint64_t rank = (count * perMille + 999) / 1000;
+
+  /* No samples? */
+  if (count == 0)
+  {
+    return 0.0;
+  }
+  return samples[rank == 0 ? 0 : rank - 1] / TICKS_PER_US;
+}
+
+/*****************************************************************************
+ *                          SimulatorMainReport()
+ ****************************************************************************/
+
+static void SimulatorMainReport (uint64_t cpuCount)
+{
+  /* Loop counters. */
+  uint64_t curGroup  = 0;
+  uint64_t curThread = 0;
+
+  /* Local variables. */
+  simulator_group_t *group    = NULL;
+  double             window   = SimulatorElapsed / (TICKS_PER_US * 1e6);
+  double             capacity = (double) cpuCount * SimulatorElapsed;
+  double             busy     = 0.0;
+  double             sum      = 0.0;
+  double             squares  = 0.0;
+  double             allBusy  = 0.0;
+  double             allLoops = 0.0;
+  uint64_t           loops    = 0;
+  uint64_t           kept     = 0;
+
+  /* Header. */
+  printf("%-10s %4s %4s %9s %6s %6s %8s %8s %8s %8s\n",
+         "GROUP", "PRIO", "THR", "LOOPS/S", "CPU%", "FAIR",
+         "P50 us", "P99 us", "P99.9 us", "MAX us");
+
+  /* One line per task group. */
+  for (curGroup = 0; curGroup < SimulatorGroupCount; curGroup++)
+  {
+    /* Throughput and CPU time, Jain's index over the threads' CPU time. */
+    group   = &SimulatorGroups[curGroup];
+    loops   = 0;
+    sum     = 0.0;
+    squares = 0.0;
+    for (curThread = 0; curThread < SimulatorThreadCount; curThread++)
+    {
+      if (SimulatorThreads[curThread].threadGroup != curGroup)
+      {
+        continue;
+      }
+      busy     = (double) SimulatorThreads[curThread].threadBusy;
+      loops   += SimulatorThreads[curThread].threadLoops;
+      sum     += busy;
+      squares += busy * busy;
+    }
+    allBusy  += sum;
+    allLoops += loops;
+
+    /* Latency percentiles over the samples kept. */
+    kept = group->groupSamples < GROUP_SAMPLES ? group->groupSamples
+                                               : GROUP_SAMPLES;
+    qsort(SimulatorSamples[curGroup], kept, sizeof(uint64_t),
+          SimulatorMainCompare);
+
+    printf("%-10s %4lu %4lu %9.0f %6.1f %6.3f %8.1f %8.1f %8.1f %8.1f\n",
+           group->groupName,
+           (unsigned long) group->groupPriority,
+           (unsigned long) group->groupThreads,
+           loops / window,
+           100.0 * sum / capacity,
+           squares > 0.0 ? sum * sum / (group->groupThreads * squares) : 0.0,
+           SimulatorMainPercentile(SimulatorSamples[curGroup], kept, 500),
+           SimulatorMainPercentile(SimulatorSamples[curGroup], kept, 990),
+           SimulatorMainPercentile(SimulatorSamples[curGroup], kept, 999),
+           SimulatorMainPercentile(SimulatorSamples[curGroup], kept, 1000));
+  }
+
+  /* Totals. */
+  printf("%-10s %4s %4lu %9.0f %6.1f\n", "TOTAL", "",
+         (unsigned long) SimulatorThreadCount,
+         allLoops / window, 100.0 * allBusy / capacity);
+}
+
+/*****************************************************************************
+ *                                main()
+ ****************************************************************************/
+
+int main (int argc, char *argv[])
+{
+  /* Loop counter. */
+  int curArg = 0;
+
+  /* Run parameters. */
+  uint64_t cpuCount   = SIMULATOR_CONFIG_CPU_COUNT;
+  uint64_t durationMs = SIMULATOR_CONFIG_DURATION_MS;
+  uint64_t verbose    = 0;
+  char    *fileName   = NULL;
+
+  /* Local variables. */
+  clock_t  hostStart  = 0;
+  int64_t  ret        = 0;
+
+  /* Command line. */
+  for (curArg = 1; curArg < argc; curArg++)
+  {
+    if (strcmp(argv[curArg], "-c") == 0 && curArg + 1 < argc)
+    {
+      cpuCount = strtoul(argv[++curArg], NULL, 0);
+    }
+    else if (strcmp(argv[curArg], "-d") == 0 && curArg + 1 < argc)
+    {
+      durationMs = strtoul(argv[++curArg], NULL, 0);
+    }
+    else if (strcmp(argv[curArg], "-v") == 0)
+    {
+      verbose = 1;
+    }
+    else if (argv[curArg][0] != '-' && fileName == NULL)
+    {
+      fileName = argv[curArg];
+    }
+    else
+    {
+      SimulatorMainUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  /* Workload. */
+  if (SimulatorMainLoad(fileName) != 0)
+  {
+    return EXIT_FAILURE;
+  }
+
+  /* Run the kernel scheduler on virtual CPUs. */
+  printf("SIMULATOR: %lu CPUs, %lu ms, %s workload\n",
+         (unsigned long) cpuCount, (unsigned long) durationMs,
+         fileName == NULL ? "built-in" : fileName);
+  hostStart = clock();
+  ret = SimulatorWorkloadRun(cpuCount, durationMs, verbose);
+  if (ret == SIMULATOR_ERR_PARAMETER)
+  {
+    fprintf(stderr, "SIMULATOR: bad CPU count or task group\n");
+    SimulatorMainUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (ret == SIMULATOR_ERR_STALLED)
+  {
+    fprintf(stderr, "SIMULATOR: every CPU asleep with no timer armed\n");
+    return EXIT_FAILURE;
+  }
+
+  /* Results. */
+  SimulatorMainReport(cpuCount);
+  printf("SIMULATOR: %.1f virtual ms in %.0f host ms\n",
+         SimulatorElapsed / (TICKS_PER_US * 1000.0),
+         (clock() - hostStart) * 1000.0 / CLOCKS_PER_SEC);
+
+  /* Done. */
+  return EXIT_SUCCESS;
+}
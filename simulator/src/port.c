@@ -0,0 +1,479 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   simulator/src/port.c
+ * @brief  Simulator port layer (virtual CPUs under the real kernel).
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Port, kernel and simulator includes (no host headers here, the port
+ * defines its own integer types). */
+#include "port/inc/interface.h"
+#include "kernel/inc/interface.h"
+#include "kernel/inc/internal.h"
+#include "simulator/inc/internal.h"
+
+/*****************************************************************************
+ *                               MACROS
+ ****************************************************************************/
+
+/* Stack slots only need distinct addresses, nothing is mapped there. */
+#define STACK_SLOT_START        (0xFFFFC00000000000UL)
+#define STACK_SLOT_SIZE         (0x40000000UL)
+
+/*****************************************************************************
+ *                           STATIC VARIABLES
+ ****************************************************************************/
+
+/* Every "page" handed out for thread stacks (the host stack is used). */
+static uint8_t SimulatorPortPage[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+/*****************************************************************************
+ *                          PortCpuId()
+ ****************************************************************************/
+
+uint64_t PortCpuId (void)
+{
+  /* Simulated CPU being executed. */
+  return SimulatorMachineCpu();
+}
+
+/*****************************************************************************
+ *                          PortCpuIdle()
+ ****************************************************************************/
+
+void PortCpuIdle (void)
+{
+  /* Sleep in virtual time until an interrupt is pending, then take it. */
+  SimulatorPortInterrupt(SimulatorMachineIdle());
+}
+
+/*****************************************************************************
+ *                          PortCpuRelax()
+ ****************************************************************************/
+
+void PortCpuRelax (void)
+{
+  /* A spinning CPU lets the lock holder (on another CPU) go on. */
+  SimulatorMachineAdvance(1);
+}
+
+/*****************************************************************************
+ *                         PortCpuIrqSave()
+ ****************************************************************************/
+
+uint64_t PortCpuIrqSave (void)
+{
+  /* Mask, the old mask is the state. */
+  return SimulatorMachineMask(1);
+}
+
+/*****************************************************************************
+ *                        PortCpuIrqRestore()
+ ****************************************************************************/
+
+void PortCpuIrqRestore (uint64_t irqState)
+{
+  /* Back to the saved mask (pending interrupts are taken if unmasked). */
+  SimulatorMachineMask(irqState);
+}
+
+/*****************************************************************************
+ *                         PortCpuIrqEnable()
+ ****************************************************************************/
+
+void PortCpuIrqEnable (void)
+{
+  /* Unmask. */
+  SimulatorMachineMask(0);
+}
+
+/*****************************************************************************
+ *                        PortCpuIrqEnabled()
+ ****************************************************************************/
+
+uint64_t PortCpuIrqEnabled (void)
+{
+  /* Current mask of the CPU. */
+  return !SimulatorMachineMasked();
+}
+
+/*****************************************************************************
+ *                       SimulatorPortInterrupt()
+ ****************************************************************************/
+
+void SimulatorPortInterrupt (uint64_t pending)
+{
+  /* Handlers run masked, like after an exception entry. */
+  uint64_t irqState = SimulatorMachineMask(1);
+
+  /* Let the interrupts be taken, as the GIC would deliver them. */
+  KernelThreadInterruptEnter();
+  if (pending & SIMULATOR_IRQ_TIMER)
+  {
+    KernelTimerInterrupt();
+  }
+  if (pending & SIMULATOR_IRQ_WAKEUP)
+  {
+    KernelThreadWakeInterrupt();
+  }
+
+  /* Preempt the interrupted thread if needed, back to its mask (ERET). */
+  KernelThreadInterruptExit();
+  SimulatorMachineMask(irqState);
+}
+
+/*****************************************************************************
+ *                        PortAtomicFetchAdd32()
+ ****************************************************************************/
+
+uint32_t PortAtomicFetchAdd32 (uint32_t *atomicAddr, uint32_t value)
+{
+  /* Add, return the previous value. */
+  return __atomic_fetch_add(atomicAddr, value, __ATOMIC_ACQUIRE);
+}
+
+/*****************************************************************************
+ *                        PortAtomicFetchAdd64()
+ ****************************************************************************/
+
+uint64_t PortAtomicFetchAdd64 (uint64_t *atomicAddr, uint64_t value)
+{
+  /* Add, return the previous value. */
+  return __atomic_fetch_add(atomicAddr, value, __ATOMIC_ACQ_REL);
+}
+
+/*****************************************************************************
+ *                          PortAtomicSwap64()
+ ****************************************************************************/
+
+uint64_t PortAtomicSwap64 (uint64_t *atomicAddr, uint64_t value)
+{
+  /* Swap, return the previous value. */
+  return __atomic_exchange_n(atomicAddr, value, __ATOMIC_ACQ_REL);
+}
+
+/*****************************************************************************
+ *                          PortAtomicCas64()
+ ****************************************************************************/
+
+uint64_t PortAtomicCas64 (uint64_t *atomicAddr,
+                          uint64_t  expected,
+                          uint64_t  desired)
+{
+  /* Compare and swap, return the old value. */
+  __atomic_compare_exchange_n(atomicAddr, &expected, desired, 0,
+                              __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+  return expected;
+}
+
+/*****************************************************************************
+ *                        PortInterruptSend()
+ ****************************************************************************/
+
+void PortInterruptSend (uint64_t cpuId, uint64_t interruptId)
+{
+  /* The wake-up SGI is the only one the kernel sends. */
+  if (interruptId == PORT_INTERRUPT_WAKEUP)
+  {
+    SimulatorMachineSend(cpuId, SIMULATOR_IRQ_WAKEUP);
+  }
+}
+
+/*****************************************************************************
+ *                        PortTimerInitialize()
+ ****************************************************************************/
+
+void PortTimerInitialize (void)
+{
+  /* Disarmed until the kernel programs it. */
+  SimulatorMachineTimer(SIMULATOR_NO_DEADLINE);
+}
+
+/*****************************************************************************
+ *                           PortTimerNow()
+ ****************************************************************************/
+
+uint64_t PortTimerNow (void)
+{
+  /* Virtual counter of this CPU. */
+  return SimulatorMachineNow();
+}
+
+/*****************************************************************************
+ *                        PortTimerFrequency()
+ ****************************************************************************/
+
+uint64_t PortTimerFrequency (void)
+{
+  /* Virtual counter ticks per second. */
+  return SIMULATOR_CONFIG_TIMER_HZ;
+}
+
+/*****************************************************************************
+ *                           PortTimerSet()
+ ****************************************************************************/
+
+void PortTimerSet (uint64_t deadline)
+{
+  /* Fire once the virtual counter reaches the deadline. */
+  SimulatorMachineTimer(deadline);
+}
+
+/*****************************************************************************
+ *                          PortTimerCancel()
+ ****************************************************************************/
+
+void PortTimerCancel (void)
+{
+  /* Disarm. */
+  SimulatorMachineTimer(SIMULATOR_NO_DEADLINE);
+}
+
+/*****************************************************************************
+ *                         PortPsciInitialize()
+ ****************************************************************************/
+
+/* No firmware on the host. */
+uint64_t PortPsciConduit = PORT_CONDUIT_NONE;
+
+void PortPsciInitialize (void)
+{
+  /* Nothing to discover. */
+}
+
+/*****************************************************************************
+ *                          PortPsciVersion()
+ ****************************************************************************/
+
+uint64_t PortPsciVersion (void)
+{
+  /* No PSCI. */
+  return 0;
+}
+
+/*****************************************************************************
+ *                           PortPsciSmccc()
+ ****************************************************************************/
+
+uint64_t PortPsciSmccc (void)
+{
+  /* No SMCCC. */
+  return 0;
+}
+
+/*****************************************************************************
+ *                           PortPsciState()
+ ****************************************************************************/
+
+error_t PortPsciState (uint64_t  stateNo,
+                       uint64_t *exitLatencyUs,
+                       uint64_t *residencyUs)
+{
+  /* Only WFI (the virtual CPUs have no deeper states). */
+  if (stateNo != 0)
+  {
+    return PORT_ERR_RESOURCE;
+  }
+
+  /* Same figures as the hardware port. */
+  *exitLatencyUs = 1;
+  *residencyUs   = 1;
+  return PORT_SUCCESS;
+}
+
+/*****************************************************************************
+ *                            PortPsciIdle()
+ ****************************************************************************/
+
+void PortPsciIdle (uint64_t stateNo)
+{
+  /* Every state is WFI. */
+  (void) stateNo;
+  PortCpuIdle();
+}
+
+/*****************************************************************************
+ *                           PortPsciCpuOn()
+ ****************************************************************************/
+
+error_t PortPsciCpuOn (uint64_t  mpidr,
+                       void     *entryPhys,
+                       void     *contextPhys)
+{
+  /* Virtual CPUs are started by the machine. */
+  (void) mpidr;
+  (void) entryPhys;
+  (void) contextPhys;
+  return PORT_ERR_RESOURCE;
+}
+
+/*****************************************************************************
+ *                         PortPsciSystemOff()
+ ****************************************************************************/
+
+void PortPsciSystemOff (void)
+{
+  /* The machine stops when the driver thread is done. */
+}
+
+/*****************************************************************************
+ *                       PortTranslationSwitch()
+ ****************************************************************************/
+
+void PortTranslationSwitch (void *translationTable, uint64_t asid)
+{
+  /* One host address space. */
+  (void) translationTable;
+  (void) asid;
+}
+
+/*****************************************************************************
+ *                         PortTranslationSet()
+ ****************************************************************************/
+
+void *PortTranslationSet (void     *translationTable,
+                          void     *virtualAddr,
+                          void     *physicalAddr,
+                          uint64_t  attributes)
+{
+  /* Nothing is mapped (stack slots are never touched), report success. */
+  (void) translationTable;
+  (void) virtualAddr;
+  (void) attributes;
+  return physicalAddr;
+}
+
+/*****************************************************************************
+ *                         PortTranslationGet()
+ ****************************************************************************/
+
+void *PortTranslationGet (void     *translationTable,
+                          void     *virtualAddr,
+                          uint64_t *attributes)
+{
+  /* Nothing is mapped. */
+  (void) translationTable;
+  (void) virtualAddr;
+  (void) attributes;
+  return NULL;
+}
+
+/*****************************************************************************
+ *                         PortTranslationDel()
+ ****************************************************************************/
+
+void *PortTranslationDel (void *translationTable, void *virtualAddr)
+{
+  /* Nothing to unmap, so no page goes back to the allocator. */
+  (void) translationTable;
+  (void) virtualAddr;
+  return NULL;
+}
+
+/*****************************************************************************
+ *                         PortThreadAllocate()
+ ****************************************************************************/
+
+void PortThreadAllocate (uint64_t threadId)
+{
+  /* The host context is built by PortThreadPrepare(). */
+  (void) threadId;
+}
+
+/*****************************************************************************
+ *                        PortThreadDeallocate()
+ ****************************************************************************/
+
+void PortThreadDeallocate (uint64_t threadId)
+{
+  /* The host context is kept for the next thread with this ID. */
+  (void) threadId;
+}
+
+/*****************************************************************************
+ *                         PortThreadStackSlot()
+ ****************************************************************************/
+
+void *PortThreadStackSlot (uint64_t slotNo)
+{
+  /* Same layout as the real port. */
+  return (void *) (STACK_SLOT_START + slotNo * STACK_SLOT_SIZE);
+}
+
+/*****************************************************************************
+ *                         PortThreadPrepare()
+ ****************************************************************************/
+
+void PortThreadPrepare (uint64_t   threadId,
+                        void     (*entry)(void *arg),
+                        void      *arg,
+                        void      *stackTop)
+{
+  /* The thread runs on a host stack of its own. */
+  (void) stackTop;
+  SimulatorMachinePrepare(threadId, entry, arg);
+}
+
+/*****************************************************************************
+ *                          PortThreadAdopt()
+ ****************************************************************************/
+
+void PortThreadAdopt (uint64_t threadId)
+{
+  /* The host context of the CPU already runs, it has no FP state. */
+  (void) threadId;
+}
+
+/*****************************************************************************
+ *                          PortThreadSwitch()
+ ****************************************************************************/
+
+void PortThreadSwitch (uint64_t prevThreadId, uint64_t nextThreadId)
+{
+  /* STORE prev and RESTORE next (host contexts, same simulated CPU). */
+  SimulatorMachineSwitch(prevThreadId, nextThreadId);
+}
+
+/*****************************************************************************
+ *                      KernelMemoryPageAllocate()
+ ****************************************************************************/
+
+void *KernelMemoryPageAllocate (void)
+{
+  /* Stand-in for kernel/src/memory.c, only stacks ask for pages. */
+  return SimulatorPortPage;
+}
+
+/*****************************************************************************
+ *                     KernelMemoryPageDeallocate()
+ ****************************************************************************/
+
+void KernelMemoryPageDeallocate (void *pageBaseAddr)
+{
+  /* The shared page is never freed. */
+  (void) pageBaseAddr;
+}
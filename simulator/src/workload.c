@@ -0,0 +1,301 @@
+/***************************************************************************
+ *
+ *                   ARTOS Operating System.
+ *                 Copyright (C) 2020  ARMKit.
+ *
+ ***************************************************************************
+ * @file   simulator/src/workload.c
+ * @brief  Simulator workload (kernel threads driven by a task table).
+ ***************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*****************************************************************************
+ *                              INCLUDES
+ ****************************************************************************/
+
+/* Kernel includes. */
+#include "kernel/inc/interface.h"
+#include "kernel/inc/internal.h"
+
+/* Simulator includes. */
+#include "simulator/inc/interface.h"
+#include "simulator/inc/internal.h"
+
+/*****************************************************************************
+ *                               MACROS
+ ****************************************************************************/
+
+/* Simplifying macros. */
+#define MAX_CPU          (KERNEL_CONFIG_MAX_CPU_COUNT)
+#define MAX_PRIORITY     (KERNEL_CONFIG_MAX_PRIOIRTY)
+#define MAX_GROUPS       (SIMULATOR_CONFIG_MAX_GROUPS)
+#define MAX_THREADS      (SIMULATOR_CONFIG_MAX_THREADS)
+#define GROUP_SAMPLES    (SIMULATOR_CONFIG_GROUP_SAMPLES)
+
+/* The driver creates and joins the workload above every task group. */
+#define DRIVER_PRIORITY  (MAX_PRIORITY - 1)
+
+/*****************************************************************************
+ *                           GLOBAL VARIABLES
+ ****************************************************************************/
+
+/* Workload description and results. */
+simulator_group_t  SimulatorGroups[MAX_GROUPS];
+uint64_t           SimulatorGroupCount  = 0;
+simulator_thread_t SimulatorThreads[MAX_THREADS];
+uint64_t           SimulatorThreadCount = 0;
+uint64_t           SimulatorElapsed     = 0;
+
+/* Wake-up latencies per group. */
+uint64_t SimulatorSamples[MAX_GROUPS][GROUP_SAMPLES];
+
+/*****************************************************************************
+ *                           STATIC VARIABLES
+ ****************************************************************************/
+
+/* Run parameters. */
+static uint64_t SimulatorWorkloadCpus     = 0;
+static uint64_t SimulatorWorkloadDuration = 0;
+static uint64_t SimulatorWorkloadVerbose  = 0;
+
+/* Virtual time at which the run started and the task loops stop. */
+static uint64_t SimulatorWorkloadStart    = 0;
+static uint64_t SimulatorWorkloadEnd      = 0;
+
+/*****************************************************************************
+ *                       SimulatorWorkloadSample()
+ ****************************************************************************/
+
+static void SimulatorWorkloadSample (uint64_t groupNo, uint64_t latency)
+{
+  /* Simplifying variables. */
+  simulator_group_t *group = &SimulatorGroups[groupNo];
+
+  /* Keep it while there is room, count it anyway. */
+  if (group->groupSamples < GROUP_SAMPLES)
+  {
+    SimulatorSamples[groupNo][group->groupSamples] = latency;
+  }
+  group->groupSamples++;
+}
+
+/*****************************************************************************
+ *                        SimulatorWorkloadTask()
+ ****************************************************************************/
+
+static void SimulatorWorkloadTask (void *arg)
+{
+  /* Simplifying variables. */
+  simulator_thread_t *thread     = (simulator_thread_t *) arg;
+  simulator_group_t  *group      = &SimulatorGroups[thread->threadGroup];
+  uint64_t            ticksPerUs = PortTimerFrequency() / 1000000;
+  uint64_t            compute    = group->groupCompute * ticksPerUs;
+  uint64_t            readyAt    = 0;
+  uint64_t            now        = 0;
+
+  /* Spread the periodic threads of the group over one period. */
+  if (thread->threadPhase != 0)
+  {
+    KernelThreadSleep(thread->threadPhase);
+  }
+
+  /* Compute, then sleep or yield, until the end of the run. */
+  while (PortTimerNow() < SimulatorWorkloadEnd)
+  {
+    /* Work is virtual time spent on this CPU. */
+    SimulatorMachineAdvance(compute);
+    thread->threadBusy += compute;
+    thread->threadLoops++;
+
+    /* Runnable again at the end of the sleep, or right away. */
+    readyAt = PortTimerNow();
+    if (group->groupSleep == 0)
+    {
+      KernelThreadYield();
+    }
+    else
+    {
+      readyAt += group->groupSleep * ticksPerUs;
+      KernelThreadSleep(group->groupSleep);
+    }
+
+    /* Latency: runnable until running again. */
+    now = PortTimerNow();
+    SimulatorWorkloadSample(thread->threadGroup,
+                            now > readyAt ? now - readyAt : 0);
+  }
+}
+
+/*****************************************************************************
+ *                       SimulatorWorkloadDriver()
+ ****************************************************************************/
+
+static void SimulatorWorkloadDriver (void *arg)
+{
+  /* Loop counter. */
+  uint64_t curThread = 0;
+
+  /* Simplifying variables. */
+  uint64_t            allCpus = (~0UL) >> (64 - SimulatorWorkloadCpus);
+  uint64_t            cpuMask = 0;
+  simulator_thread_t *thread  = NULL;
+  simulator_group_t  *group   = NULL;
+
+  /* Unused. */
+  (void) arg;
+
+  /* Create the workload (nothing runs before the driver blocks). */
+  for (curThread = 0; curThread < SimulatorThreadCount; curThread++)
+  {
+    thread  = &SimulatorThreads[curThread];
+    group   = &SimulatorGroups[thread->threadGroup];
+    cpuMask = group->groupAffinity == 0 ? allCpus
+                                        : group->groupAffinity & allCpus;
+    if (KernelThreadCreate(SimulatorWorkloadTask, thread,
+                           group->groupPriority,
+                           &thread->threadId) != KERNEL_SUCCESS)
+    {
+      KernelPrintFmt("SIMULATOR: out of kernel threads\n");
+      SimulatorThreadCount = curThread;
+      break;
+    }
+    if (cpuMask != allCpus)
+    {
+      KernelThreadAffinity(thread->threadId, cpuMask);
+    }
+  }
+
+  /* Wait for every task to reach the end of the run. */
+  for (curThread = 0; curThread < SimulatorThreadCount; curThread++)
+  {
+    KernelThreadJoin(SimulatorThreads[curThread].threadId);
+  }
+  SimulatorElapsed = PortTimerNow() - SimulatorWorkloadStart;
+
+  /* Scheduler histograms and per-thread counters of the kernel. */
+  if (SimulatorWorkloadVerbose)
+  {
+    KernelThreadStatsDump();
+  }
+
+  /* Back to the host. */
+  SimulatorMachineStop();
+}
+
+/*****************************************************************************
+ *                      SimulatorWorkloadSecondary()
+ ****************************************************************************/
+
+static void SimulatorWorkloadSecondary (uint64_t cpuId)
+{
+  /* Same steps as a secondary CPU of the kernel. */
+  KernelTimerInitialize();
+  KernelThreadAdopt(cpuId);
+
+  /* Idle until there is work. */
+  KernelThreadIdle(NULL);
+}
+
+/*****************************************************************************
+ *                        SimulatorWorkloadBoot()
+ ****************************************************************************/
+
+static void SimulatorWorkloadBoot (uint64_t cpuId)
+{
+  /* Loop counter. */
+  uint64_t curCpu = 0;
+
+  /* Scheduler side of the kernel only (no memory, processes or IRQs). */
+  KernelRcuInitialize();
+  KernelThreadInitialize();
+  KernelTimerInitialize();
+
+  /* Power on the other CPUs (they run once this one waits). */
+  for (curCpu = cpuId + 1; curCpu < SimulatorWorkloadCpus; curCpu++)
+  {
+    SimulatorMachineStart(curCpu, SimulatorWorkloadSecondary);
+  }
+
+  /* Start the run. */
+  SimulatorWorkloadStart = PortTimerNow();
+  SimulatorWorkloadEnd   = SimulatorWorkloadStart + SimulatorWorkloadDuration;
+  if (KernelThreadCreate(SimulatorWorkloadDriver, NULL, DRIVER_PRIORITY,
+                         NULL) != KERNEL_SUCCESS)
+  {
+    KernelPrintFmt("SIMULATOR: no driver thread\n");
+    SimulatorMachineStop();
+  }
+
+  /* This context is the idle thread of the boot CPU. */
+  KernelThreadIdle(NULL);
+}
+
+/*****************************************************************************
+ *                         SimulatorWorkloadRun()
+ ****************************************************************************/
+
+int64_t SimulatorWorkloadRun (uint64_t cpuCount,
+                              uint64_t durationMs,
+                              uint64_t verbose)
+{
+  /* Loop counters. */
+  uint64_t curGroup  = 0;
+  uint64_t curThread = 0;
+
+  /* Simplifying variables. */
+  simulator_group_t  *group  = NULL;
+  simulator_thread_t *thread = NULL;
+
+  /* Check parameters. */
+  if (cpuCount == 0 || cpuCount > MAX_CPU || SimulatorGroupCount == 0 ||
+      SimulatorGroupCount > MAX_GROUPS)
+  {
+    return SIMULATOR_ERR_PARAMETER;
+  }
+
+  /* One table entry per thread, groups in order. */
+  SimulatorThreadCount = 0;
+  for (curGroup = 0; curGroup < SimulatorGroupCount; curGroup++)
+  {
+    group = &SimulatorGroups[curGroup];
+    if (group->groupPriority == 0 || group->groupPriority >= DRIVER_PRIORITY ||
+        group->groupThreads > MAX_THREADS - SimulatorThreadCount)
+    {
+      return SIMULATOR_ERR_PARAMETER;
+    }
+    group->groupSamples = 0;
+    for (curThread = 0; curThread < group->groupThreads; curThread++)
+    {
+      thread              = &SimulatorThreads[SimulatorThreadCount++];
+      thread->threadGroup = curGroup;
+      thread->threadId    = 0;
+      thread->threadPhase = group->groupSleep * curThread /
+                            group->groupThreads;
+      thread->threadLoops = 0;
+      thread->threadBusy  = 0;
+    }
+  }
+
+  /* Run the kernel on the virtual machine until the driver stops it. */
+  SimulatorWorkloadCpus     = cpuCount;
+  SimulatorWorkloadDuration = durationMs * (PortTimerFrequency() / 1000);
+  SimulatorWorkloadVerbose  = verbose;
+  return SimulatorMachineRun(cpuCount, PORT_THREAD_COUNT,
+                             SimulatorWorkloadBoot);
+}